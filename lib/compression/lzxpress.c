@@ -57,16 +57,148 @@
 ))
 #endif
 
+/*
+ * Matches are at most 0x1FFF bytes back and at least 3 bytes long.
+ *
+ * Instead of comparing against every offset in the window, the
+ * positions are kept in hash chains keyed on their first 3 bytes.
+ * A chain is walked from the most recent position, so the offsets
+ * grow and only a strictly longer match replaces the best one. If
+ * the whole chain is walked, that finds exactly the match the
+ * exhaustive search would find and the output does not change.
+ */
+#define LZXPRESS_MAX_OFFSET 0x1FFF
+#define LZXPRESS_WINDOW_SIZE 0x2000
+#define LZXPRESS_HASH_BITS 13
+#define LZXPRESS_NO_POS UINT32_MAX
+
+struct lzxpress_matcher {
+	/* most recent position for each hash */
+	uint32_t head[1 << LZXPRESS_HASH_BITS];
+	/* previous position with the same hash, indexed modulo window */
+	uint32_t prev[LZXPRESS_WINDOW_SIZE];
+	/* positions before this one are in the chains */
+	uint32_t next_pos;
+	uint32_t max_chain;
+};
+
+static const uint32_t lzxpress_level_max_chain[] = {
+	[1] = 4,
+	[2] = 8,
+	[3] = 16,
+	[4] = 32,
+	[5] = 64,
+	[6] = 128,
+	[7] = 256,
+	[8] = 1024,
+	[9] = UINT32_MAX,
+};
+
+static inline uint32_t lzxpress_hash(const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+	return (v * 0x9E3779B1) >> (32 - LZXPRESS_HASH_BITS);
+}
+
+static void lzxpress_matcher_init(struct lzxpress_matcher *m, int level)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(m->head); i++) {
+		m->head[i] = LZXPRESS_NO_POS;
+	}
+	m->next_pos = 0;
+	m->max_chain = lzxpress_level_max_chain[level];
+}
+
+/* add the positions up to 'end' to the chains */
+static void lzxpress_matcher_insert(struct lzxpress_matcher *m,
+				    const uint8_t *data,
+				    uint32_t size,
+				    uint32_t end)
+{
+	if (size < 3) {
+		return;
+	}
+	end = MIN(end, size - 2);
+
+	for (; m->next_pos < end; m->next_pos++) {
+		uint32_t h = lzxpress_hash(&data[m->next_pos]);
+
+		m->prev[m->next_pos % LZXPRESS_WINDOW_SIZE] = m->head[h];
+		m->head[h] = m->next_pos;
+	}
+}
+
+/*
+ * Find the longest match of at most max_len bytes for 'pos', the
+ * smallest offset wins a tie. Returns 2 if there is no match.
+ */
+static uint32_t lzxpress_find_match(struct lzxpress_matcher *m,
+				    const uint8_t *data,
+				    uint32_t pos,
+				    uint32_t max_len,
+				    uint32_t *best_offset)
+{
+	const uint8_t *str1 = &data[pos];
+	uint32_t best_len = 2;
+	uint32_t chain = m->max_chain;
+	uint32_t cand;
+
+	if (max_len < 3) {
+		return best_len;
+	}
+
+	cand = m->head[lzxpress_hash(str1)];
+
+	while ((cand != LZXPRESS_NO_POS) && (chain-- > 0)) {
+		uint32_t offset = pos - cand;
+		const uint8_t *str2 = &data[cand];
+		uint32_t len;
+
+		if (offset > LZXPRESS_MAX_OFFSET) {
+			break;
+		}
+
+		for (len = 0; (len < max_len) && (str1[len] == str2[len]); len++);
+
+		if (len > best_len) {
+			best_len = len;
+			*best_offset = offset;
+			if (len == max_len) {
+				break;
+			}
+		}
+
+		cand = m->prev[cand % LZXPRESS_WINDOW_SIZE];
+	}
+
+	return best_len;
+}
+
 ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			  uint32_t uncompressed_size,
 			  uint8_t *compressed,
 			  uint32_t max_compressed_size)
 {
+	return lzxpress_compress_level(uncompressed,
+				       uncompressed_size,
+				       compressed,
+				       max_compressed_size,
+				       LZXPRESS_LEVEL_MAX);
+}
+
+ssize_t lzxpress_compress_level(const uint8_t *uncompressed,
+				uint32_t uncompressed_size,
+				uint8_t *compressed,
+				uint32_t max_compressed_size,
+				int level)
+{
+	struct lzxpress_matcher *m = NULL;
 	uint32_t uncompressed_pos, compressed_pos, byte_left;
-	uint32_t max_offset, best_offset;
-	int32_t offset;
-	uint32_t max_len, len, best_len;
-	const uint8_t *str1, *str2;
+	uint32_t best_offset;
+	uint32_t max_len, best_len;
 	uint32_t indic;
 	uint8_t *indic_pos;
 	uint32_t indic_bit, nibble_index;
@@ -79,6 +211,16 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 		return 0;
 	}
 
+	if ((level < LZXPRESS_LEVEL_MIN) || (level > LZXPRESS_LEVEL_MAX)) {
+		return -1;
+	}
+
+	m = malloc(sizeof(*m));
+	if (m == NULL) {
+		return -1;
+	}
+	lzxpress_matcher_init(m, level);
+
 	uncompressed_pos = 0;
 	indic = 0;
 	*(uint32_t *)compressed = 0;
@@ -89,42 +231,19 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 	indic_bit = 0;
 	nibble_index = 0;
 
-	if (uncompressed_pos > XPRESS_BLOCK_SIZE)
-		return 0;
-
 	do {
-		bool found = false;
-
-		max_offset = uncompressed_pos;
-
-		str1 = &uncompressed[uncompressed_pos];
-
-		best_len = 2;
 		best_offset = 0;
 
-		max_offset = MIN(0x1FFF, max_offset);
+		/* maximum len we can encode into metadata */
+		max_len = MIN((255 + 15 + 7 + 3), byte_left);
 
 		/* search for the longest match in the window for the lookahead buffer */
-		for (offset = 1; (uint32_t)offset <= max_offset; offset++) {
-			str2 = &str1[-offset];
-
-			/* maximum len we can encode into metadata */
-			max_len = MIN((255 + 15 + 7 + 3), byte_left);
-
-			for (len = 0; (len < max_len) && (str1[len] == str2[len]); len++);
-
-			/*
-			 * We check if len is better than the value found before, including the
-			 * sequence of identical bytes
-			 */
-			if (len > best_len) {
-				found = true;
-				best_len = len;
-				best_offset = offset;
-			}
-		}
+		lzxpress_matcher_insert(m, uncompressed, uncompressed_size,
+					uncompressed_pos);
+		best_len = lzxpress_find_match(m, uncompressed, uncompressed_pos,
+					       max_len, &best_offset);
 
-		if (found) {
+		if (best_len > 2) {
 			metadata_size = 0;
 			dest = (uint16_t *)&compressed[compressed_pos];
 
@@ -230,6 +349,7 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 		compressed_pos += sizeof(uint32_t);
 	}
 
+	free(m);
 	return compressed_pos;
 }
 
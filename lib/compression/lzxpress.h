@@ -37,11 +37,24 @@
 
 #define XPRESS_BLOCK_SIZE 0x10000
 
+/*
+ * The level limits how many earlier positions are tried for a match.
+ * LZXPRESS_LEVEL_MAX tries all of them, lzxpress_compress() uses it.
+ */
+#define LZXPRESS_LEVEL_MIN 1
+#define LZXPRESS_LEVEL_MAX 9
+
 ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			  uint32_t uncompressed_size,
 			  uint8_t *compressed,
 			  uint32_t max_compressed_size);
 
+ssize_t lzxpress_compress_level(const uint8_t *uncompressed,
+				uint32_t uncompressed_size,
+				uint8_t *compressed,
+				uint32_t max_compressed_size,
+				int level);
+
 ssize_t lzxpress_decompress(const uint8_t *input,
 			    uint32_t input_size,
 			    uint8_t *output,
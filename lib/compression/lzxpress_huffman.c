@@ -0,0 +1,718 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   LZ77 + Huffman compression as described in [MS-XCA] 2.1 and 2.2
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Each block of up to 64k of output starts with a 256 byte table
+ * holding the 4 bit code lengths of the 512 symbols, the even symbol
+ * in the low nibble. Symbols 0-255 are literals, 256-511 are matches
+ * with the high bit of the offset in bits 4-7 and the length - 3 in
+ * bits 0-3, where 15 means the length follows as a byte, or as 255
+ * and a 16 bit value. The codes are canonical, assigned by length
+ * and then symbol value.
+ *
+ * The bit stream is read as 16 bit little endian words, most
+ * significant bit first, with two words of lookahead. The extra
+ * length bytes are taken from the input position after the words
+ * read so far, so the encoder reserves two words ahead of them.
+ *
+ * Symbol 256 with nothing left in the input marks the end of the
+ * stream, as it is also a valid match it is only written at the end
+ * of the last block.
+ */
+
+#include "replace.h"
+#include "lzxpress_huffman.h"
+#include "../lib/util/byteorder.h"
+#include "../lib/util/tsort.h"
+
+#define LZXHUFF_NUM_SYMBOLS 512
+#define LZXHUFF_TABLE_SIZE (LZXHUFF_NUM_SYMBOLS / 2)
+#define LZXHUFF_MAX_CODE_LEN 15
+#define LZXHUFF_DECODE_BITS LZXHUFF_MAX_CODE_LEN
+#define LZXHUFF_EOF_SYMBOL 256
+
+#define LZXHUFF_MIN_MATCH 3
+#define LZXHUFF_MAX_MATCH (0xFFFF + LZXHUFF_MIN_MATCH)
+#define LZXHUFF_MAX_OFFSET 0xFFFF
+#define LZXHUFF_WINDOW_SIZE 0x10000
+#define LZXHUFF_HASH_BITS 15
+#define LZXHUFF_NO_POS UINT32_MAX
+
+/* how many earlier positions are tried for a match */
+#define LZXHUFF_MAX_CHAIN 32
+
+struct lzxhuff_token {
+	/* the literal byte if offset is 0 */
+	uint32_t length;
+	uint32_t offset;
+};
+
+struct lzxhuff_compressor {
+	/* most recent position for each hash */
+	uint32_t head[1 << LZXHUFF_HASH_BITS];
+	/* previous position with the same hash, indexed modulo window */
+	uint32_t prev[LZXHUFF_WINDOW_SIZE];
+	/* positions before this one are in the chains */
+	uint32_t next_pos;
+
+	struct lzxhuff_token tokens[LZXPRESS_HUFFMAN_BLOCK_SIZE];
+	uint32_t freq[LZXHUFF_NUM_SYMBOLS];
+	uint8_t lengths[LZXHUFF_NUM_SYMBOLS];
+	uint16_t codes[LZXHUFF_NUM_SYMBOLS];
+};
+
+struct lzxhuff_writer {
+	uint8_t *dest;
+	uint32_t dest_size;
+	/* the reserved words the next two full words go to */
+	uint32_t slot1;
+	uint32_t slot2;
+	/* where the next word or extra length byte goes */
+	uint32_t pos;
+	uint32_t bits;
+	uint32_t free_bits;
+	bool overflow;
+};
+
+static inline uint32_t lzxhuff_hash(const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+	return (v * 0x9E3779B1) >> (32 - LZXHUFF_HASH_BITS);
+}
+
+/* add the positions up to 'end' to the chains */
+static void lzxhuff_insert(struct lzxhuff_compressor *c,
+			   const uint8_t *data,
+			   uint32_t size,
+			   uint32_t end)
+{
+	if (size < LZXHUFF_MIN_MATCH) {
+		return;
+	}
+	end = MIN(end, size - 2);
+
+	for (; c->next_pos < end; c->next_pos++) {
+		uint32_t h = lzxhuff_hash(&data[c->next_pos]);
+
+		c->prev[c->next_pos % LZXHUFF_WINDOW_SIZE] = c->head[h];
+		c->head[h] = c->next_pos;
+	}
+}
+
+/* longest match of at most max_len bytes, 0 if there is none */
+static uint32_t lzxhuff_find_match(struct lzxhuff_compressor *c,
+				   const uint8_t *data,
+				   uint32_t pos,
+				   uint32_t max_len,
+				   uint32_t *best_offset)
+{
+	const uint8_t *str1 = &data[pos];
+	uint32_t best_len = LZXHUFF_MIN_MATCH - 1;
+	uint32_t chain = LZXHUFF_MAX_CHAIN;
+	uint32_t cand;
+
+	if (max_len < LZXHUFF_MIN_MATCH) {
+		return 0;
+	}
+
+	cand = c->head[lzxhuff_hash(str1)];
+
+	while ((cand != LZXHUFF_NO_POS) && (chain-- > 0)) {
+		uint32_t offset = pos - cand;
+		const uint8_t *str2 = &data[cand];
+		uint32_t len;
+
+		if (offset > LZXHUFF_MAX_OFFSET) {
+			break;
+		}
+
+		/* cheap reject before the full compare */
+		if (str2[best_len] == str1[best_len]) {
+			for (len = 0;
+			     (len < max_len) && (str1[len] == str2[len]);
+			     len++);
+
+			if (len > best_len) {
+				best_len = len;
+				*best_offset = offset;
+				if (len == max_len) {
+					break;
+				}
+			}
+		}
+
+		cand = c->prev[cand % LZXHUFF_WINDOW_SIZE];
+	}
+
+	if (best_len < LZXHUFF_MIN_MATCH) {
+		return 0;
+	}
+	return best_len;
+}
+
+static uint32_t lzxhuff_high_bit(uint32_t v)
+{
+	uint32_t bit = 0;
+
+	while (v >>= 1) {
+		bit++;
+	}
+	return bit;
+}
+
+static uint32_t lzxhuff_match_symbol(const struct lzxhuff_token *t)
+{
+	return LZXHUFF_EOF_SYMBOL +
+		(lzxhuff_high_bit(t->offset) << 4) +
+		MIN(t->length - LZXHUFF_MIN_MATCH, 15);
+}
+
+/*
+ * Greedy parse of [start, end), matches may reach back into earlier
+ * blocks but stop at the end of this one.
+ */
+static uint32_t lzxhuff_tokenize(struct lzxhuff_compressor *c,
+				 const uint8_t *data,
+				 uint32_t size,
+				 uint32_t start,
+				 uint32_t end)
+{
+	uint32_t num_tokens = 0;
+	uint32_t pos = start;
+
+	while (pos < end) {
+		struct lzxhuff_token *t = &c->tokens[num_tokens++];
+		uint32_t max_len = MIN(end - pos, LZXHUFF_MAX_MATCH);
+		uint32_t offset = 0;
+		uint32_t len;
+
+		lzxhuff_insert(c, data, size, pos);
+		len = lzxhuff_find_match(c, data, pos, max_len, &offset);
+
+		if (len == 0) {
+			t->length = data[pos];
+			t->offset = 0;
+			c->freq[data[pos]]++;
+			pos++;
+			continue;
+		}
+
+		t->length = len;
+		t->offset = offset;
+		c->freq[lzxhuff_match_symbol(t)]++;
+		pos += len;
+	}
+
+	return num_tokens;
+}
+
+static int lzxhuff_leaf_cmp(const uint64_t *a, const uint64_t *b)
+{
+	if (*a == *b) {
+		return 0;
+	}
+	return (*a < *b) ? -1 : 1;
+}
+
+/*
+ * Huffman code lengths, built with the two queue method over the
+ * leaves sorted by frequency. Returns the longest code.
+ */
+static uint32_t lzxhuff_tree_lengths(const uint32_t *freq, uint8_t *lengths)
+{
+	/* frequency in the high bits, symbol in the low ones */
+	uint64_t leaves[LZXHUFF_NUM_SYMBOLS];
+	uint32_t weight[2 * LZXHUFF_NUM_SYMBOLS];
+	uint16_t parent[2 * LZXHUFF_NUM_SYMBOLS];
+	uint8_t depth[2 * LZXHUFF_NUM_SYMBOLS];
+	uint32_t num_leaves = 0;
+	uint32_t next_leaf, next_node, num_nodes;
+	uint32_t i, max_len = 0;
+
+	for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+		lengths[i] = 0;
+		if (freq[i] > 0) {
+			leaves[num_leaves++] = ((uint64_t)freq[i] << 16) | i;
+		}
+	}
+
+	TYPESAFE_QSORT(leaves, num_leaves, lzxhuff_leaf_cmp);
+
+	for (i = 0; i < num_leaves; i++) {
+		weight[i] = leaves[i] >> 16;
+	}
+
+	/*
+	 * The leaves are nodes [0, num_leaves), the inner nodes follow
+	 * in the order they are made, which is also by weight.
+	 */
+	next_leaf = 0;
+	next_node = num_leaves;
+	num_nodes = num_leaves;
+
+	while (num_nodes < 2 * num_leaves - 1) {
+		uint32_t pick[2];
+		uint32_t j;
+
+		for (j = 0; j < 2; j++) {
+			if ((next_leaf < num_leaves) &&
+			    ((next_node == num_nodes) ||
+			     (weight[next_leaf] <= weight[next_node]))) {
+				pick[j] = next_leaf++;
+			} else {
+				pick[j] = next_node++;
+			}
+		}
+
+		weight[num_nodes] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = num_nodes;
+		parent[pick[1]] = num_nodes;
+		num_nodes++;
+	}
+
+	depth[num_nodes - 1] = 0;
+	for (i = num_nodes - 1; i-- > 0;) {
+		depth[i] = depth[parent[i]] + 1;
+	}
+
+	for (i = 0; i < num_leaves; i++) {
+		lengths[leaves[i] & 0xFFFF] = depth[i];
+		max_len = MAX(max_len, depth[i]);
+	}
+
+	return max_len;
+}
+
+/*
+ * Length limited code lengths: the frequencies are flattened until
+ * the tree is shallow enough. The decoder needs a complete code, so
+ * a lone symbol gets a partner that is never used.
+ */
+static void lzxhuff_build_lengths(const uint32_t *freq_in, uint8_t *lengths)
+{
+	uint32_t freq[LZXHUFF_NUM_SYMBOLS];
+	uint32_t num_used = 0;
+	uint32_t i;
+
+	for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+		freq[i] = freq_in[i];
+		if (freq[i] > 0) {
+			num_used++;
+		}
+	}
+
+	if (num_used < 2) {
+		freq[(freq[0] > 0) ? 1 : 0] = 1;
+	}
+
+	while (lzxhuff_tree_lengths(freq, lengths) > LZXHUFF_MAX_CODE_LEN) {
+		for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+			if (freq[i] > 0) {
+				freq[i] = (freq[i] >> 1) | 1;
+			}
+		}
+	}
+}
+
+/* canonical codes, by length and then by symbol */
+static void lzxhuff_build_codes(const uint8_t *lengths, uint16_t *codes)
+{
+	uint32_t count[LZXHUFF_MAX_CODE_LEN + 1] = { 0 };
+	uint32_t next_code[LZXHUFF_MAX_CODE_LEN + 1];
+	uint32_t code = 0;
+	uint32_t i;
+
+	for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+		count[lengths[i]]++;
+	}
+	count[0] = 0;
+
+	for (i = 1; i <= LZXHUFF_MAX_CODE_LEN; i++) {
+		code = (code + count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+
+	for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+		if (lengths[i] != 0) {
+			codes[i] = next_code[lengths[i]]++;
+		}
+	}
+}
+
+static void lzxhuff_write_word(struct lzxhuff_writer *w,
+			       uint32_t pos, uint16_t v)
+{
+	if (pos + 2 > w->dest_size) {
+		w->overflow = true;
+		return;
+	}
+	SSVAL(w->dest, pos, v);
+}
+
+/* reserve the next word of the bit stream */
+static uint32_t lzxhuff_reserve_word(struct lzxhuff_writer *w)
+{
+	uint32_t pos = w->pos;
+
+	w->pos += 2;
+	return pos;
+}
+
+static void lzxhuff_write_bits(struct lzxhuff_writer *w,
+			       uint32_t num_bits, uint32_t v)
+{
+	if (num_bits == 0) {
+		return;
+	}
+
+	if (w->free_bits >= num_bits) {
+		w->bits = (w->bits << num_bits) | v;
+		w->free_bits -= num_bits;
+		return;
+	}
+
+	/* the word is only written when the next bits don't fit */
+	num_bits -= w->free_bits;
+	w->bits = (w->bits << w->free_bits) | (v >> num_bits);
+	lzxhuff_write_word(w, w->slot1, w->bits);
+
+	w->slot1 = w->slot2;
+	w->slot2 = lzxhuff_reserve_word(w);
+	w->bits = v & ((1 << num_bits) - 1);
+	w->free_bits = 16 - num_bits;
+}
+
+static void lzxhuff_write_byte(struct lzxhuff_writer *w, uint8_t v)
+{
+	if (w->pos + 1 > w->dest_size) {
+		w->overflow = true;
+		return;
+	}
+	w->dest[w->pos++] = v;
+}
+
+static void lzxhuff_write_block_start(struct lzxhuff_writer *w,
+				      const uint8_t *lengths)
+{
+	uint32_t i;
+
+	for (i = 0; i < LZXHUFF_TABLE_SIZE; i++) {
+		lzxhuff_write_byte(w, lengths[2 * i] |
+				      (lengths[2 * i + 1] << 4));
+	}
+
+	w->slot1 = lzxhuff_reserve_word(w);
+	w->slot2 = lzxhuff_reserve_word(w);
+	w->bits = 0;
+	w->free_bits = 16;
+}
+
+static void lzxhuff_write_block_end(struct lzxhuff_writer *w)
+{
+	lzxhuff_write_word(w, w->slot1, w->bits << w->free_bits);
+	lzxhuff_write_word(w, w->slot2, 0);
+}
+
+static void lzxhuff_write_symbol(struct lzxhuff_writer *w,
+				 const struct lzxhuff_compressor *c,
+				 uint32_t symbol)
+{
+	lzxhuff_write_bits(w, c->lengths[symbol], c->codes[symbol]);
+}
+
+static void lzxhuff_write_match(struct lzxhuff_writer *w,
+				const struct lzxhuff_compressor *c,
+				const struct lzxhuff_token *t)
+{
+	uint32_t len = t->length - LZXHUFF_MIN_MATCH;
+	uint32_t high_bit = lzxhuff_high_bit(t->offset);
+
+	lzxhuff_write_symbol(w, c, lzxhuff_match_symbol(t));
+
+	if (len >= 15) {
+		lzxhuff_write_byte(w, MIN(len - 15, 255));
+		if (len - 15 >= 255) {
+			lzxhuff_write_byte(w, len & 0xFF);
+			lzxhuff_write_byte(w, len >> 8);
+		}
+	}
+
+	lzxhuff_write_bits(w, high_bit, t->offset - (1 << high_bit));
+}
+
+ssize_t lzxpress_huffman_compress(const uint8_t *uncompressed,
+				  uint32_t uncompressed_size,
+				  uint8_t *compressed,
+				  uint32_t max_compressed_size)
+{
+	struct lzxhuff_compressor *c = NULL;
+	struct lzxhuff_writer w = {
+		.dest = compressed,
+		.dest_size = max_compressed_size,
+	};
+	uint32_t start, i;
+
+	if (uncompressed_size == 0) {
+		return 0;
+	}
+
+	c = malloc(sizeof(*c));
+	if (c == NULL) {
+		return -1;
+	}
+	for (i = 0; i < ARRAY_SIZE(c->head); i++) {
+		c->head[i] = LZXHUFF_NO_POS;
+	}
+	c->next_pos = 0;
+
+	for (start = 0;
+	     start < uncompressed_size;
+	     start += LZXPRESS_HUFFMAN_BLOCK_SIZE) {
+		uint32_t end = MIN(uncompressed_size,
+				   start + LZXPRESS_HUFFMAN_BLOCK_SIZE);
+		bool last = (end == uncompressed_size);
+		uint32_t num_tokens;
+
+		memset(c->freq, 0, sizeof(c->freq));
+		num_tokens = lzxhuff_tokenize(c, uncompressed,
+					      uncompressed_size, start, end);
+		if (last) {
+			c->freq[LZXHUFF_EOF_SYMBOL]++;
+		}
+
+		lzxhuff_build_lengths(c->freq, c->lengths);
+		lzxhuff_build_codes(c->lengths, c->codes);
+
+		lzxhuff_write_block_start(&w, c->lengths);
+
+		for (i = 0; i < num_tokens; i++) {
+			const struct lzxhuff_token *t = &c->tokens[i];
+
+			if (t->offset == 0) {
+				lzxhuff_write_symbol(&w, c, t->length);
+			} else {
+				lzxhuff_write_match(&w, c, t);
+			}
+		}
+
+		if (last) {
+			lzxhuff_write_symbol(&w, c, LZXHUFF_EOF_SYMBOL);
+		}
+
+		lzxhuff_write_block_end(&w);
+
+		if (w.overflow || w.pos > w.dest_size) {
+			free(c);
+			return -1;
+		}
+	}
+
+	free(c);
+	return w.pos;
+}
+
+struct lzxhuff_reader {
+	const uint8_t *src;
+	uint32_t src_size;
+	uint32_t pos;
+	/* the next bits, most significant first */
+	uint32_t bits;
+	/* how many bits beyond 16 are valid in 'bits' */
+	int32_t extra_bits;
+};
+
+static uint16_t lzxhuff_read_word(struct lzxhuff_reader *r)
+{
+	uint16_t v = 0;
+
+	/*
+	 * Reading past the end gives zero bits here, the caller checks
+	 * the position after each block: a complete stream never has
+	 * more lookahead than the encoder reserved.
+	 */
+	if (r->pos + 2 <= r->src_size) {
+		v = SVAL(r->src, r->pos);
+	}
+	r->pos += 2;
+	return v;
+}
+
+static void lzxhuff_consume_bits(struct lzxhuff_reader *r, uint32_t num_bits)
+{
+	if (num_bits == 0) {
+		return;
+	}
+	r->bits <<= num_bits;
+	r->extra_bits -= num_bits;
+	if (r->extra_bits < 0) {
+		r->bits |= (uint32_t)lzxhuff_read_word(r) << (-r->extra_bits);
+		r->extra_bits += 16;
+	}
+}
+
+static bool lzxhuff_read_byte(struct lzxhuff_reader *r, uint32_t *v)
+{
+	if (r->pos + 1 > r->src_size) {
+		return false;
+	}
+	*v = r->src[r->pos++];
+	return true;
+}
+
+/*
+ * Fill the decoding table: each code of length l covers 2^(15 - l)
+ * entries, in the order the canonical codes are assigned.
+ */
+static bool lzxhuff_build_decode_table(const uint8_t *table,
+				       uint8_t *lengths,
+				       uint16_t *decode)
+{
+	uint32_t entry = 0;
+	uint32_t len, i;
+
+	for (i = 0; i < LZXHUFF_TABLE_SIZE; i++) {
+		lengths[2 * i] = table[i] & 0xF;
+		lengths[2 * i + 1] = table[i] >> 4;
+	}
+
+	for (len = 1; len <= LZXHUFF_MAX_CODE_LEN; len++) {
+		for (i = 0; i < LZXHUFF_NUM_SYMBOLS; i++) {
+			uint32_t n, j;
+
+			if (lengths[i] != len) {
+				continue;
+			}
+
+			n = 1 << (LZXHUFF_DECODE_BITS - len);
+			if (entry + n > (1 << LZXHUFF_DECODE_BITS)) {
+				return false;
+			}
+			for (j = 0; j < n; j++) {
+				decode[entry++] = i;
+			}
+		}
+	}
+
+	return entry == (1 << LZXHUFF_DECODE_BITS);
+}
+
+ssize_t lzxpress_huffman_decompress(const uint8_t *compressed,
+				    uint32_t compressed_size,
+				    uint8_t *uncompressed,
+				    uint32_t uncompressed_size)
+{
+	struct lzxhuff_reader r = {
+		.src = compressed,
+		.src_size = compressed_size,
+	};
+	uint8_t lengths[LZXHUFF_NUM_SYMBOLS];
+	uint16_t *decode = NULL;
+	uint32_t out_pos = 0;
+
+	decode = malloc(sizeof(uint16_t) << LZXHUFF_DECODE_BITS);
+	if (decode == NULL) {
+		return -1;
+	}
+
+	while (out_pos < uncompressed_size) {
+		uint32_t block_end;
+
+		if (r.pos + LZXHUFF_TABLE_SIZE > r.src_size) {
+			goto fail;
+		}
+		if (!lzxhuff_build_decode_table(&r.src[r.pos], lengths,
+						decode)) {
+			goto fail;
+		}
+		r.pos += LZXHUFF_TABLE_SIZE;
+
+		r.bits = (uint32_t)lzxhuff_read_word(&r) << 16;
+		r.bits |= lzxhuff_read_word(&r);
+		r.extra_bits = 16;
+
+		block_end = out_pos + LZXPRESS_HUFFMAN_BLOCK_SIZE;
+
+		while ((out_pos < uncompressed_size) && (out_pos < block_end)) {
+			uint32_t symbol, len, offset_bits, offset;
+
+			symbol = decode[r.bits >> (32 - LZXHUFF_DECODE_BITS)];
+			lzxhuff_consume_bits(&r, lengths[symbol]);
+
+			if (symbol < 256) {
+				uncompressed[out_pos++] = symbol;
+				continue;
+			}
+
+			symbol -= 256;
+			len = symbol & 0xF;
+			offset_bits = symbol >> 4;
+
+			if (len == 15) {
+				if (!lzxhuff_read_byte(&r, &len)) {
+					goto fail;
+				}
+				if (len == 255) {
+					uint32_t lo, hi;
+
+					if (!lzxhuff_read_byte(&r, &lo) ||
+					    !lzxhuff_read_byte(&r, &hi)) {
+						goto fail;
+					}
+					len = lo | (hi << 8);
+					if (len < 15) {
+						goto fail;
+					}
+					len -= 15;
+				}
+				len += 15;
+			}
+			len += LZXHUFF_MIN_MATCH;
+
+			offset = 1 << offset_bits;
+			if (offset_bits > 0) {
+				offset += r.bits >> (32 - offset_bits);
+				lzxhuff_consume_bits(&r, offset_bits);
+			}
+
+			if ((offset > out_pos) ||
+			    (len > uncompressed_size - out_pos)) {
+				goto fail;
+			}
+
+			for (; len > 0; len--) {
+				uncompressed[out_pos] =
+					uncompressed[out_pos - offset];
+				out_pos++;
+			}
+		}
+
+		if (r.pos > r.src_size) {
+			/* the stream was truncated */
+			goto fail;
+		}
+	}
+
+	free(decode);
+	return out_pos;
+
+fail:
+	free(decode);
+	return -1;
+}
@@ -0,0 +1,48 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   LZ77 + Huffman compression as described in [MS-XCA] 2.1 and 2.2
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LZXPRESS_HUFFMAN_H
+#define _LZXPRESS_HUFFMAN_H
+
+/* every block of this much output starts with a new Huffman table */
+#define LZXPRESS_HUFFMAN_BLOCK_SIZE 0x10000
+
+/*
+ * An upper bound for the compressed size: a token takes less than two
+ * bytes per input byte, each block adds its table and up to two words
+ * of flushed bits, the last one also the end of stream symbol.
+ */
+#define LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(n) \
+	(2 * (n) + 264 * ((n) / LZXPRESS_HUFFMAN_BLOCK_SIZE + 1))
+
+ssize_t lzxpress_huffman_compress(const uint8_t *uncompressed,
+				  uint32_t uncompressed_size,
+				  uint8_t *compressed,
+				  uint32_t max_compressed_size);
+
+/*
+ * The format does not record the uncompressed size, exactly
+ * uncompressed_size bytes are decompressed.
+ */
+ssize_t lzxpress_huffman_decompress(const uint8_t *compressed,
+				    uint32_t compressed_size,
+				    uint8_t *uncompressed,
+				    uint32_t uncompressed_size);
+
+#endif /* _LZXPRESS_HUFFMAN_H */
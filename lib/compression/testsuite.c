@@ -23,6 +23,7 @@
 #include "torture/local/proto.h"
 #include "talloc.h"
 #include "lzxpress.h"
+#include "lzxpress_huffman.h"
 
 /*
   test lzxpress
@@ -64,12 +65,681 @@ static bool test_lzxpress(struct torture_context *test)
 	return true;
 }
 
+enum lzxpress_test_data {
+	LZXPRESS_TEXT,
+	LZXPRESS_RUNS,
+	LZXPRESS_RANDOM,
+};
+
+static const char *lzxpress_test_data_name[] = {
+	[LZXPRESS_TEXT] = "text",
+	[LZXPRESS_RUNS] = "runs",
+	[LZXPRESS_RANDOM] = "random",
+};
+
+/*
+  fill a buffer with reproducible data, the text looks a bit like the
+  attributes of a replicated object
+ */
+static void lzxpress_fill(uint8_t *buf, size_t size,
+			  enum lzxpress_test_data type)
+{
+	const char *words[] = {
+		"CN=", "Users,", "DC=", "samba,", "example,", "com;",
+		"objectClass=", "user;", "person;", "top;", "member=",
+		"whenChanged=", "20170704083000.0Z;", "sAMAccountName=",
+	};
+	uint32_t seed = 0x12345678;
+	size_t i = 0;
+
+	while (i < size) {
+		seed = seed * 1103515245 + 12345;
+
+		switch (type) {
+		case LZXPRESS_TEXT: {
+			const char *w = words[(seed >> 16) % ARRAY_SIZE(words)];
+
+			while (*w != '\0' && i < size) {
+				buf[i++] = *w++;
+			}
+			break;
+		}
+		case LZXPRESS_RUNS: {
+			size_t len = (seed >> 16) % 64;
+
+			while (len-- > 0 && i < size) {
+				buf[i++] = seed >> 24;
+			}
+			break;
+		}
+		case LZXPRESS_RANDOM:
+			buf[i++] = seed >> 16;
+			break;
+		}
+	}
+}
+
+/*
+  compress and decompress at all levels
+ */
+static bool test_lzxpress_round_trip(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	size_t sizes[] = { 1, 2, 3, 4, 5, 100, 8191, 8192, 8193, XPRESS_BLOCK_SIZE };
+	uint8_t *in, *out, *out2;
+	size_t i, j;
+	int level;
+
+	in = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	out = talloc_size(tmp_ctx, 2 * XPRESS_BLOCK_SIZE);
+	out2 = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "talloc failed");
+
+	for (i = 0; i < ARRAY_SIZE(lzxpress_test_data_name); i++) {
+		lzxpress_fill(in, XPRESS_BLOCK_SIZE, i);
+
+		for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+			for (level = LZXPRESS_LEVEL_MIN;
+			     level <= LZXPRESS_LEVEL_MAX;
+			     level++) {
+				ssize_t c_size, d_size;
+
+				c_size = lzxpress_compress_level(
+					in, sizes[j], out,
+					talloc_get_size(out), level);
+				torture_assert(test, c_size > 0,
+					       "lzxpress_compress_level failed");
+
+				d_size = lzxpress_decompress(
+					out, c_size, out2, sizes[j]);
+				torture_assert_int_equal(test, d_size, sizes[j],
+					"lzxpress_decompress size");
+				torture_assert_mem_equal(test, out2, in, d_size,
+					"lzxpress_decompress data");
+			}
+		}
+	}
+
+	torture_assert_int_equal(test,
+		lzxpress_compress_level(in, 100, out, talloc_get_size(out),
+					LZXPRESS_LEVEL_MAX + 1),
+		-1, "invalid level accepted");
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  lzxpress_compress() before it used hash chains, searching every
+  offset in the window. Kept as a reference for the output.
+ */
+static ssize_t lzxpress_compress_reference(const uint8_t *uncompressed,
+					   uint32_t uncompressed_size,
+					   uint8_t *compressed,
+					   uint32_t max_compressed_size)
+{
+	uint32_t uncompressed_pos, compressed_pos, byte_left;
+	uint32_t max_offset, best_offset;
+	int32_t offset;
+	uint32_t max_len, len, best_len;
+	const uint8_t *str1, *str2;
+	uint32_t indic;
+	uint8_t *indic_pos;
+	uint32_t indic_bit, nibble_index;
+
+	uint32_t metadata_size;
+	uint16_t metadata;
+	uint16_t *dest;
+
+	if (!uncompressed_size) {
+		return 0;
+	}
+
+	uncompressed_pos = 0;
+	indic = 0;
+	*(uint32_t *)compressed = 0;
+	compressed_pos = sizeof(uint32_t);
+	indic_pos = &compressed[0];
+
+	byte_left = uncompressed_size;
+	indic_bit = 0;
+	nibble_index = 0;
+
+	if (uncompressed_pos > XPRESS_BLOCK_SIZE)
+		return 0;
+
+	do {
+		bool found = false;
+
+		max_offset = uncompressed_pos;
+
+		str1 = &uncompressed[uncompressed_pos];
+
+		best_len = 2;
+		best_offset = 0;
+
+		max_offset = MIN(0x1FFF, max_offset);
+
+		/* search for the longest match in the window for the lookahead buffer */
+		for (offset = 1; (uint32_t)offset <= max_offset; offset++) {
+			str2 = &str1[-offset];
+
+			/* maximum len we can encode into metadata */
+			max_len = MIN((255 + 15 + 7 + 3), byte_left);
+
+			for (len = 0; (len < max_len) && (str1[len] == str2[len]); len++);
+
+			/*
+			 * We check if len is better than the value found before, including the
+			 * sequence of identical bytes
+			 */
+			if (len > best_len) {
+				found = true;
+				best_len = len;
+				best_offset = offset;
+			}
+		}
+
+		if (found) {
+			metadata_size = 0;
+			dest = (uint16_t *)&compressed[compressed_pos];
+
+			if (best_len < 10) {
+				/* Classical meta-data */
+				metadata = (uint16_t)(((best_offset - 1) << 3) | (best_len - 3));
+				SSVAL(dest, metadata_size / sizeof(uint16_t), metadata);
+				metadata_size += sizeof(uint16_t);
+			} else {
+				metadata = (uint16_t)(((best_offset - 1) << 3) | 7);
+				SSVAL(dest, metadata_size / sizeof(uint16_t), metadata);
+				metadata_size = sizeof(uint16_t);
+
+				if (best_len < (15 + 7 + 3)) {
+					/* Shared byte */
+					if (!nibble_index) {
+						compressed[compressed_pos + metadata_size] = (best_len - (3 + 7)) & 0xF;
+						metadata_size += sizeof(uint8_t);
+					} else {
+						compressed[nibble_index] &= 0xF;
+						compressed[nibble_index] |= (best_len - (3 + 7)) * 16;
+					}
+				} else if (best_len < (3 + 7 + 15 + 255)) {
+					/* Shared byte */
+					if (!nibble_index) {
+						compressed[compressed_pos + metadata_size] = 15;
+						metadata_size += sizeof(uint8_t);
+					} else {
+						compressed[nibble_index] &= 0xF;
+						compressed[nibble_index] |= (15 * 16);
+					}
+
+					/* Additional best_len */
+					compressed[compressed_pos + metadata_size] = (best_len - (3 + 7 + 15)) & 0xFF;
+					metadata_size += sizeof(uint8_t);
+				} else {
+					/* Shared byte */
+					if (!nibble_index) {
+						compressed[compressed_pos + metadata_size] |= 15;
+						metadata_size += sizeof(uint8_t);
+					} else {
+						compressed[nibble_index] |= 15 << 4;
+					}
+
+					/* Additional best_len */
+					compressed[compressed_pos + metadata_size] = 255;
+
+					metadata_size += sizeof(uint8_t);
+
+					compressed[compressed_pos + metadata_size] = (best_len - 3) & 0xFF;
+					compressed[compressed_pos + metadata_size + 1] = ((best_len - 3) >> 8) & 0xFF;
+					metadata_size += sizeof(uint16_t);
+				}
+			}
+
+			indic |= 1 << (32 - ((indic_bit % 32) + 1));
+
+			if (best_len > 9) {
+				if (nibble_index == 0) {
+					nibble_index = compressed_pos + sizeof(uint16_t);
+				} else {
+					nibble_index = 0;
+				}
+			}
+
+			compressed_pos += metadata_size;
+			uncompressed_pos += best_len;
+			byte_left -= best_len;
+		} else {
+			compressed[compressed_pos++] = uncompressed[uncompressed_pos++];
+			byte_left--;
+		}
+		indic_bit++;
+
+		if ((indic_bit - 1) % 32 > (indic_bit % 32)) {
+			SIVAL(indic_pos, 0, indic);
+			indic = 0;
+			indic_pos = &compressed[compressed_pos];
+			compressed_pos += sizeof(uint32_t);
+		}
+	} while (byte_left > 3);
+
+	do {
+		compressed[compressed_pos] = uncompressed[uncompressed_pos];
+		indic_bit++;
+
+		uncompressed_pos++;
+		compressed_pos++;
+                if (((indic_bit - 1) % 32) > (indic_bit % 32)){
+			SIVAL(indic_pos, 0, indic);
+			indic = 0;
+			indic_pos = &compressed[compressed_pos];
+			compressed_pos += sizeof(uint32_t);
+		}
+	} while (uncompressed_pos < uncompressed_size);
+
+	if ((indic_bit % 32) > 0) {
+		for (; (indic_bit % 32) != 0; indic_bit++)
+			indic |= 0 << (32 - ((indic_bit % 32) + 1));
+
+		*(uint32_t *)&compressed[compressed_pos] = 0;
+		SIVAL(indic_pos, 0, indic);
+		compressed_pos += sizeof(uint32_t);
+	}
+
+	return compressed_pos;
+}
+
+/*
+  lzxpress_compress() has to produce the same bytes as the exhaustive
+  search, also where the positions in the chains wrap around the
+  window
+ */
+static bool test_lzxpress_reference(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	size_t sizes[] = { 2, 3, 4, 5, 100,
+			   0x1FFE, 0x1FFF, 0x2000, 0x2001, 0x2002,
+			   0x3FFF, 0x4000, 0x4001, 0x6003, XPRESS_BLOCK_SIZE };
+	uint8_t *in, *out, *ref;
+	size_t i, j;
+
+	/* both read one byte past the input if a match ends it */
+	in = talloc_zero_size(tmp_ctx, XPRESS_BLOCK_SIZE + 1);
+	out = talloc_size(tmp_ctx, 2 * XPRESS_BLOCK_SIZE);
+	ref = talloc_size(tmp_ctx, 2 * XPRESS_BLOCK_SIZE);
+	torture_assert(test, in != NULL && out != NULL && ref != NULL,
+		       "talloc failed");
+
+	for (i = 0; i < ARRAY_SIZE(lzxpress_test_data_name); i++) {
+		lzxpress_fill(in, XPRESS_BLOCK_SIZE, i);
+
+		for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+			ssize_t c_size, r_size;
+
+			r_size = lzxpress_compress_reference(
+				in, sizes[j], ref, talloc_get_size(ref));
+			c_size = lzxpress_compress(
+				in, sizes[j], out, talloc_get_size(out));
+
+			torture_assert_int_equal(test, c_size, r_size,
+				talloc_asprintf(tmp_ctx,
+						"lzxpress_compress size, %s "
+						"%zu bytes",
+						lzxpress_test_data_name[i],
+						sizes[j]));
+			torture_assert_mem_equal(test, out, ref, c_size,
+				talloc_asprintf(tmp_ctx,
+						"lzxpress_compress data, %s "
+						"%zu bytes",
+						lzxpress_test_data_name[i],
+						sizes[j]));
+		}
+	}
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  compression throughput and ratio against the level
+ */
+static bool test_lzxpress_speed(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const int levels[] = { LZXPRESS_LEVEL_MIN, 5, LZXPRESS_LEVEL_MAX };
+	const size_t num_blocks = 64;
+	uint8_t *in, *out, *out2;
+	size_t i, j, b;
+
+	in = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	out = talloc_size(tmp_ctx, 2 * XPRESS_BLOCK_SIZE);
+	out2 = talloc_size(tmp_ctx, XPRESS_BLOCK_SIZE);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "talloc failed");
+
+	for (i = 0; i < ARRAY_SIZE(lzxpress_test_data_name); i++) {
+		lzxpress_fill(in, XPRESS_BLOCK_SIZE, i);
+
+		for (j = 0; j < ARRAY_SIZE(levels); j++) {
+			struct timeval tv = timeval_current();
+			double c_time, d_time;
+			ssize_t c_size = 0, d_size = 0;
+
+			for (b = 0; b < num_blocks; b++) {
+				c_size = lzxpress_compress_level(
+					in, XPRESS_BLOCK_SIZE, out,
+					talloc_get_size(out), levels[j]);
+			}
+			c_time = timeval_elapsed(&tv);
+			torture_assert(test, c_size > 0,
+				       "lzxpress_compress_level failed");
+
+			tv = timeval_current();
+			for (b = 0; b < num_blocks; b++) {
+				d_size = lzxpress_decompress(
+					out, c_size, out2, XPRESS_BLOCK_SIZE);
+			}
+			d_time = timeval_elapsed(&tv);
+			torture_assert_int_equal(test, d_size, XPRESS_BLOCK_SIZE,
+						 "lzxpress_decompress size");
+			torture_assert_mem_equal(test, out2, in, d_size,
+						 "lzxpress_decompress data");
+
+			torture_comment(test, "%-6s level %d: %5.1f%% of input, "
+					"compress %7.1f MB/s, "
+					"decompress %7.1f MB/s\n",
+					lzxpress_test_data_name[i], levels[j],
+					100.0 * c_size / XPRESS_BLOCK_SIZE,
+					num_blocks * XPRESS_BLOCK_SIZE / c_time / 1e6,
+					num_blocks * XPRESS_BLOCK_SIZE / d_time / 1e6);
+		}
+	}
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  a stream built by hand from [MS-XCA] 2.1: 'a' and the end of stream
+  symbol 256 have codes 0 and 10, symbol 263 is a match of length 10
+  at offset 1 with code 11
+ */
+static bool test_lzxpress_huffman(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const char *fixed_data = "aaaaaaaaaaa";
+	uint8_t fixed_in[256 + 4] = { 0 };
+	uint8_t *out, *out2;
+	ssize_t c_size, d_size;
+
+	fixed_in['a' / 2] = 0x10;	/* 'a' is odd, high nibble */
+	fixed_in[256 / 2] = 0x02;
+	fixed_in[263 / 2] = 0x20;
+	/* 0 11 10 and padding, the second word is unused */
+	fixed_in[256] = 0x00;
+	fixed_in[257] = 0x70;
+
+	out = talloc_size(tmp_ctx, strlen(fixed_data));
+	torture_assert(test, out != NULL, "talloc failed");
+
+	torture_comment(test, "lzxpress_huffman fixed decompression\n");
+	d_size = lzxpress_huffman_decompress(fixed_in, sizeof(fixed_in),
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, strlen(fixed_data),
+				 "fixed lzxpress_huffman_decompress size");
+	torture_assert_mem_equal(test, out, fixed_data, d_size,
+				 "fixed lzxpress_huffman_decompress data");
+
+	/* the match reaches back before the start of the output */
+	fixed_in[257] = 0xF0;
+	d_size = lzxpress_huffman_decompress(fixed_in, sizeof(fixed_in),
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, -1, "bad offset accepted");
+	fixed_in[257] = 0x70;
+
+	/* an incomplete code can't be decoded */
+	fixed_in[263 / 2] = 0x00;
+	d_size = lzxpress_huffman_decompress(fixed_in, sizeof(fixed_in),
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, -1, "incomplete code accepted");
+	fixed_in[263 / 2] = 0x20;
+
+	/* the second word of lookahead is missing */
+	d_size = lzxpress_huffman_decompress(fixed_in, sizeof(fixed_in) - 2,
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, -1, "truncated input accepted");
+
+	torture_comment(test, "lzxpress_huffman round trip of the vector\n");
+	out2 = talloc_size(tmp_ctx,
+		LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(strlen(fixed_data)));
+	torture_assert(test, out2 != NULL, "talloc failed");
+	c_size = lzxpress_huffman_compress((const uint8_t *)fixed_data,
+					   strlen(fixed_data),
+					   out2, talloc_get_size(out2));
+	torture_assert(test, c_size > 0, "lzxpress_huffman_compress failed");
+	d_size = lzxpress_huffman_decompress(out2, c_size,
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, strlen(fixed_data),
+				 "lzxpress_huffman_decompress size");
+	torture_assert_mem_equal(test, out, fixed_data, d_size,
+				 "lzxpress_huffman_decompress data");
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  the LZ77+Huffman example of [MS-XCA] section 3: the alphabet, where w,
+  x, y, z and the end of stream symbol get 4 bit codes, the other
+  letters 5 bit ones
+ */
+static bool test_lzxpress_huffman_example(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const char *fixed_data = "abcdefghijklmnopqrstuvwxyz";
+	const uint8_t fixed_bits[] = { 0xd8, 0x52, 0x3e, 0xd7, 0x94, 0x11,
+				       0x5b, 0xe9, 0x19, 0x5f, 0xf9, 0xd6,
+				       0x7c, 0xdf, 0x8d, 0x04, 0x00, 0x00,
+				       0x00, 0x00 };
+	uint8_t fixed_out[256 + sizeof(fixed_bits)] = { 0 };
+	uint8_t *out, *out2;
+	ssize_t c_size, d_size;
+	size_t i;
+
+	fixed_out['a' / 2] = 0x50;
+	for (i = 'b' / 2; i < 'v' / 2; i++) {
+		fixed_out[i] = 0x55;
+	}
+	fixed_out['v' / 2] = 0x45;
+	fixed_out['x' / 2] = 0x44;
+	fixed_out['z' / 2] = 0x04;
+	fixed_out[256 / 2] = 0x04;
+	memcpy(fixed_out + 256, fixed_bits, sizeof(fixed_bits));
+
+	out = talloc_size(tmp_ctx, strlen(fixed_data));
+	out2 = talloc_size(tmp_ctx,
+		LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(strlen(fixed_data)));
+	torture_assert(test, out != NULL && out2 != NULL, "talloc failed");
+
+	torture_comment(test, "lzxpress_huffman example decompression\n");
+	d_size = lzxpress_huffman_decompress(fixed_out, sizeof(fixed_out),
+					     out, strlen(fixed_data));
+	torture_assert_int_equal(test, d_size, strlen(fixed_data),
+				 "example lzxpress_huffman_decompress size");
+	torture_assert_mem_equal(test, out, fixed_data, d_size,
+				 "example lzxpress_huffman_decompress data");
+
+	torture_comment(test, "lzxpress_huffman example compression\n");
+	c_size = lzxpress_huffman_compress((const uint8_t *)fixed_data,
+					   strlen(fixed_data),
+					   out2, talloc_get_size(out2));
+	torture_assert_int_equal(test, c_size, sizeof(fixed_out),
+				 "example lzxpress_huffman_compress size");
+	torture_assert_mem_equal(test, out2, fixed_out, c_size,
+				 "example lzxpress_huffman_compress data");
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  compress and decompress, including several Huffman blocks
+ */
+static bool test_lzxpress_huffman_round_trip(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const size_t max_size = 3 * LZXPRESS_HUFFMAN_BLOCK_SIZE + 17;
+	size_t sizes[] = {
+		1, 2, 3, 4, 100, 8192, LZXPRESS_HUFFMAN_BLOCK_SIZE - 1,
+		LZXPRESS_HUFFMAN_BLOCK_SIZE, LZXPRESS_HUFFMAN_BLOCK_SIZE + 1,
+		max_size
+	};
+	uint8_t *in, *out, *out2;
+	size_t i, j;
+	ssize_t cut;
+
+	in = talloc_size(tmp_ctx, max_size);
+	out = talloc_size(tmp_ctx,
+			  LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(max_size));
+	out2 = talloc_size(tmp_ctx, max_size);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "talloc failed");
+
+	for (i = 0; i < ARRAY_SIZE(lzxpress_test_data_name); i++) {
+		lzxpress_fill(in, max_size, i);
+
+		for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+			ssize_t c_size, d_size;
+
+			c_size = lzxpress_huffman_compress(
+				in, sizes[j], out,
+				LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(sizes[j]));
+			torture_assert(test, c_size > 0,
+				       "lzxpress_huffman_compress failed");
+
+			d_size = lzxpress_huffman_decompress(
+				out, c_size, out2, sizes[j]);
+			torture_assert_int_equal(test, d_size, sizes[j],
+				"lzxpress_huffman_decompress size");
+			torture_assert_mem_equal(test, out2, in, d_size,
+				"lzxpress_huffman_decompress data");
+
+			/*
+			 * A cut stream either fails or still holds all
+			 * the data, only the end of stream symbol and
+			 * padding can go unnoticed.
+			 */
+			for (cut = 1; cut <= 4 && cut < c_size; cut++) {
+				d_size = lzxpress_huffman_decompress(
+					out, c_size - cut, out2, sizes[j]);
+				if (d_size == -1) {
+					continue;
+				}
+				torture_assert_int_equal(test, d_size,
+					sizes[j], "truncated size");
+				torture_assert_mem_equal(test, out2, in,
+					d_size, "truncated data");
+			}
+			d_size = lzxpress_huffman_decompress(
+				out, c_size / 2, out2, sizes[j]);
+			torture_assert_int_equal(test, d_size, -1,
+				"half of the stream accepted");
+		}
+	}
+
+	torture_assert_int_equal(test,
+		lzxpress_huffman_compress(in, max_size, out, 300), -1,
+		"lzxpress_huffman_compress ignored the output size");
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+/*
+  LZ77+Huffman against plain LZ77 at the default level
+ */
+static bool test_lzxpress_huffman_speed(struct torture_context *test)
+{
+	TALLOC_CTX *tmp_ctx = talloc_new(test);
+	const size_t num_blocks = 64;
+	const size_t size = XPRESS_BLOCK_SIZE;
+	uint8_t *in, *out, *out2;
+	size_t i, b;
+
+	in = talloc_size(tmp_ctx, size);
+	out = talloc_size(tmp_ctx, LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(size));
+	out2 = talloc_size(tmp_ctx, size);
+	torture_assert(test, in != NULL && out != NULL && out2 != NULL,
+		       "talloc failed");
+
+	for (i = 0; i < ARRAY_SIZE(lzxpress_test_data_name); i++) {
+		struct timeval tv;
+		double c_time, d_time;
+		ssize_t c_size = 0, d_size = 0, plain_size = 0;
+
+		lzxpress_fill(in, size, i);
+
+		tv = timeval_current();
+		for (b = 0; b < num_blocks; b++) {
+			c_size = lzxpress_huffman_compress(
+				in, size, out, talloc_get_size(out));
+		}
+		c_time = timeval_elapsed(&tv);
+		torture_assert(test, c_size > 0,
+			       "lzxpress_huffman_compress failed");
+
+		tv = timeval_current();
+		for (b = 0; b < num_blocks; b++) {
+			d_size = lzxpress_huffman_decompress(
+				out, c_size, out2, size);
+		}
+		d_time = timeval_elapsed(&tv);
+		torture_assert_int_equal(test, d_size, size,
+					 "lzxpress_huffman_decompress size");
+		torture_assert_mem_equal(test, out2, in, d_size,
+					 "lzxpress_huffman_decompress data");
+
+		plain_size = lzxpress_compress(in, size, out,
+					       talloc_get_size(out));
+		torture_assert(test, plain_size > 0,
+			       "lzxpress_compress failed");
+
+		torture_comment(test, "%-6s huffman: %5.1f%% of input "
+				"(plain %5.1f%%), "
+				"compress %7.1f MB/s, "
+				"decompress %7.1f MB/s\n",
+				lzxpress_test_data_name[i],
+				100.0 * c_size / size,
+				100.0 * plain_size / size,
+				num_blocks * size / c_time / 1e6,
+				num_blocks * size / d_time / 1e6);
+	}
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
 
 struct torture_suite *torture_local_compression(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "compression");
 
 	torture_suite_add_simple_test(suite, "lzxpress", test_lzxpress);
+	torture_suite_add_simple_test(suite, "lzxpress_round_trip",
+				      test_lzxpress_round_trip);
+	torture_suite_add_simple_test(suite, "lzxpress_reference",
+				      test_lzxpress_reference);
+	torture_suite_add_simple_test(suite, "lzxpress_speed",
+				      test_lzxpress_speed);
+	torture_suite_add_simple_test(suite, "lzxpress_huffman",
+				      test_lzxpress_huffman);
+	torture_suite_add_simple_test(suite, "lzxpress_huffman_example",
+				      test_lzxpress_huffman_example);
+	torture_suite_add_simple_test(suite, "lzxpress_huffman_round_trip",
+				      test_lzxpress_huffman_round_trip);
+	torture_suite_add_simple_test(suite, "lzxpress_huffman_speed",
+				      test_lzxpress_huffman_speed);
 
 	return suite;
 }
@@ -0,0 +1,137 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Word at a time scanning of ASCII runs, for the fast paths of the
+   character set conversion code
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SAMBA_CHARSET_ASCII_FAST_H_
+#define _SAMBA_CHARSET_ASCII_FAST_H_
+
+/*
+ * Nearly all names and strings we convert are ASCII, so the fast
+ * paths look at 8 bytes at once and only fall back to one character
+ * at a time at the first byte that needs it. The loads go through
+ * memcpy(), which compiles to a plain unaligned load where that is
+ * allowed.
+ */
+
+#define ASCII_FAST_HIGH_BITS 0x8080808080808080ULL
+#define ASCII_FAST_LOW_BITS 0x0101010101010101ULL
+
+/*
+ * The high byte of each UTF-16LE unit and the top bit of the low
+ * byte, in the byte order of a native 64 bit load.
+ */
+#ifdef WORDS_BIGENDIAN
+#define ASCII_FAST_UTF16LE_MASK 0x80FF80FF80FF80FFULL
+#else
+#define ASCII_FAST_UTF16LE_MASK 0xFF80FF80FF80FF80ULL
+#endif
+
+static inline uint64_t ascii_fast_load(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*
+ * The number of leading bytes of s below 0x80, at most len.
+ */
+static inline size_t ascii_fast_len(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+
+	while (len - i >= 8 &&
+	       (ascii_fast_load(&s[i]) & ASCII_FAST_HIGH_BITS) == 0) {
+		i += 8;
+	}
+	while (i < len && s[i] < 0x80) {
+		i++;
+	}
+	return i;
+}
+
+/*
+ * As ascii_fast_len(), but also stopping before the first NUL byte.
+ */
+static inline size_t ascii_fast_len_nonzero(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+
+	while (len - i >= 8) {
+		uint64_t v = ascii_fast_load(&s[i]);
+
+		/* a zero byte borrows into its high bit */
+		if (((v | (v - ASCII_FAST_LOW_BITS)) &
+		     ASCII_FAST_HIGH_BITS) != 0) {
+			break;
+		}
+		i += 8;
+	}
+	while (i < len && s[i] != 0 && s[i] < 0x80) {
+		i++;
+	}
+	return i;
+}
+
+/*
+ * The number of leading UTF-16LE units of s below 0x80, s is len
+ * bytes long.
+ */
+static inline size_t ascii_fast_utf16le_len(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+
+	while (len - i >= 8 &&
+	       (ascii_fast_load(&s[i]) & ASCII_FAST_UTF16LE_MASK) == 0) {
+		i += 8;
+	}
+	while (len - i >= 2 && s[i] < 0x80 && s[i+1] == 0) {
+		i += 2;
+	}
+	return i / 2;
+}
+
+/*
+ * Widen n ASCII bytes to UTF-16LE and narrow n ASCII UTF-16LE units
+ * back. There are no branches in the loops, so the compiler is free
+ * to vectorise them.
+ */
+static inline void ascii_fast_widen(const uint8_t *src, size_t n,
+				    uint8_t *dst)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		dst[2*i] = src[i];
+		dst[2*i+1] = 0;
+	}
+}
+
+static inline void ascii_fast_narrow(const uint8_t *src, size_t n,
+				     uint8_t *dst)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] = src[2*i];
+	}
+}
+
+#endif /* _SAMBA_CHARSET_ASCII_FAST_H_ */
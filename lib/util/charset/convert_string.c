@@ -23,6 +23,7 @@
 */
 #include "includes.h"
 #include "system/iconv.h"
+#include "ascii_fast.h"
 
 /**
  * @file
@@ -140,6 +141,17 @@ bool convert_string_error_handle(struct smb_iconv_handle *ic,
 		size_t retval = 0;
 
 		/* If all characters are ascii, fast path here. */
+		if (slen != (size_t)-1) {
+			size_t n = ascii_fast_len_nonzero(p, MIN(slen, dlen));
+
+			memcpy(q, p, n);
+			p += n;
+			q += n;
+			slen -= n;
+			dlen -= n;
+			retval += n;
+		}
+
 		while (slen && dlen) {
 			if ((lastp = *p) <= 0x7f) {
 				*q++ = *p++;
@@ -195,6 +207,16 @@ bool convert_string_error_handle(struct smb_iconv_handle *ic,
 			}
 			if (lastp != 0) goto slow_path;
 		} else {
+			size_t n = ascii_fast_utf16le_len(p,
+						MIN(slen / 2, dlen) * 2);
+
+			ascii_fast_narrow(p, n, q);
+			p += 2 * n;
+			q += n;
+			slen -= 2 * n;
+			dlen -= n;
+			retval += n;
+
 			while (slen >= 2 && dlen &&
 			       (*p <= 0x7f) && (p[1] == 0)) {
 				*q++ = *p;
@@ -239,6 +261,17 @@ bool convert_string_error_handle(struct smb_iconv_handle *ic,
 		unsigned char lastp = '\0';
 
 		/* If all characters are ascii, fast path here. */
+		if (slen != (size_t)-1) {
+			size_t n = ascii_fast_len_nonzero(p, MIN(slen, dlen / 2));
+
+			ascii_fast_widen(p, n, q);
+			p += n;
+			q += 2 * n;
+			slen -= n;
+			dlen -= 2 * n;
+			retval += 2 * n;
+		}
+
 		while (slen && (dlen >= 1)) {
 			if (dlen >=2 && (lastp = *p) <= 0x7F) {
 				*q++ = *p++;
@@ -23,6 +23,7 @@
 #include "system/iconv.h"
 #include "system/filesys.h"
 #include "charset_proto.h"
+#include "ascii_fast.h"
 
 #ifdef strcasecmp
 #undef strcasecmp
@@ -592,12 +593,14 @@ static size_t utf8_pull(void *cd, const char **inbuf, size_t *inbytesleft,
 
 	while (in_left >= 1 && out_left >= 2) {
 		if ((c[0] & 0x80) == 0) {
-			uc[0] = c[0];
-			uc[1] = 0;
-			c  += 1;
-			in_left  -= 1;
-			out_left -= 2;
-			uc += 2;
+			/* take the whole ASCII run at once */
+			size_t n = ascii_fast_len(c, MIN(in_left, out_left / 2));
+
+			ascii_fast_widen(c, n, uc);
+			c  += n;
+			in_left  -= n;
+			out_left -= 2 * n;
+			uc += 2 * n;
 			continue;
 		}
 
@@ -715,12 +718,15 @@ static size_t utf8_push(void *cd, const char **inbuf, size_t *inbytesleft,
 		unsigned int codepoint;
 
 		if (uc[1] == 0 && !(uc[0] & 0x80)) {
-			/* simplest case */
-			c[0] = uc[0];
-			in_left  -= 2;
-			out_left -= 1;
-			uc += 2;
-			c  += 1;
+			/* simplest case, take the whole ASCII run at once */
+			size_t n = ascii_fast_utf16le_len(
+				uc, MIN(in_left / 2, out_left) * 2);
+
+			ascii_fast_narrow(uc, n, c);
+			in_left  -= 2 * n;
+			out_left -= n;
+			uc += 2 * n;
+			c  += n;
 			continue;
 		}
 
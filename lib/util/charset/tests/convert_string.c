@@ -23,6 +23,8 @@
 #include "lib/util/charset/charset.h"
 #include "param/param.h"
 #include "lib/util/base64.h"
+#include "system/dir.h"
+#include "system/time.h"
 
 struct torture_suite *torture_local_convert_string_handle(TALLOC_CTX *mem_ctx);
 struct torture_suite *torture_local_string_case_handle(TALLOC_CTX *mem_ctx);
@@ -1701,6 +1703,280 @@ static bool test_plato_case(struct torture_context *tctx)
 	return true;
 }
 
+/*
+ * Build a string of mostly ASCII runs in both UTF-8 and UTF-16LE,
+ * with a few other BMP characters at random places.
+ */
+static void gen_ascii_runs(uint8_t *utf8, size_t *utf8_len,
+			   uint8_t *utf16, size_t *utf16_len,
+			   size_t num_chars, bool nul_term)
+{
+	size_t i, l8 = 0, l16 = 0;
+
+	for (i = 0; i < num_chars; i++) {
+		unsigned int c;
+
+		if (nul_term && i == num_chars - 1) {
+			c = 0;
+		} else if (random() % 40 != 0) {
+			c = 1 + random() % 0x7f;
+		} else {
+			/* not ASCII, but no surrogates */
+			c = 0x80 + random() % (0xd800 - 0x80);
+		}
+
+		if (c < 0x80) {
+			utf8[l8++] = c;
+		} else if (c < 0x800) {
+			utf8[l8++] = 0xc0 | (c >> 6);
+			utf8[l8++] = 0x80 | (c & 0x3f);
+		} else {
+			utf8[l8++] = 0xe0 | (c >> 12);
+			utf8[l8++] = 0x80 | ((c >> 6) & 0x3f);
+			utf8[l8++] = 0x80 | (c & 0x3f);
+		}
+		SSVAL(utf16, l16, c);
+		l16 += 2;
+	}
+
+	*utf8_len = l8;
+	*utf16_len = l16;
+}
+
+static bool check_fast_path(struct torture_context *tctx,
+			    struct smb_iconv_handle *ic,
+			    charset_t from, charset_t to,
+			    const uint8_t *src, size_t srclen,
+			    size_t destlen)
+{
+	uint8_t fast[2000], slow[2000];
+	size_t fast_len = 0, slow_len, i_len = srclen, o_len = destlen;
+	const char *inbuf = (const char *)src;
+	char *outbuf = (char *)slow;
+	int fast_errno, slow_errno;
+	bool fast_ret, slow_ret;
+	smb_iconv_t cd;
+
+	errno = 0;
+	fast_ret = convert_string_error_handle(ic, from, to, src, srclen,
+					       fast, destlen, &fast_len);
+	fast_errno = errno;
+
+	/* the slow path, as convert_string_internal() does it */
+	cd = get_conv_handle(ic, from, to);
+	torture_assert(tctx, cd != (smb_iconv_t)-1, "get_conv_handle failed");
+	errno = 0;
+	slow_ret = (smb_iconv(cd, &inbuf, &i_len, &outbuf, &o_len) != (size_t)-1);
+	slow_errno = errno;
+	slow_len = destlen - o_len;
+
+	torture_assert_int_equal(tctx, fast_ret, slow_ret,
+		talloc_asprintf(tctx, "return mismatch %s to %s, srclen %zu "
+				"destlen %zu", charset_name(ic, from),
+				charset_name(ic, to), srclen, destlen));
+	if (!slow_ret) {
+		torture_assert_int_equal(tctx, fast_errno, slow_errno,
+					 "errno mismatch");
+	}
+	torture_assert_int_equal(tctx, fast_len, slow_len,
+		talloc_asprintf(tctx, "converted size mismatch %s to %s, "
+				"srclen %zu destlen %zu", charset_name(ic, from),
+				charset_name(ic, to), srclen, destlen));
+	torture_assert_mem_equal(tctx, fast, slow, fast_len,
+				 "converted data mismatch");
+	return true;
+}
+
+/*
+ * The ASCII fast paths in convert_string_error_handle() and in the
+ * UTF-8 module must give the same results as going through
+ * smb_iconv() a character at a time, including at short output
+ * buffers and unaligned input.
+ */
+static bool test_ascii_fast_path_handle(struct torture_context *tctx)
+{
+	struct smb_iconv_handle *iconv_handle;
+	uint8_t utf8_buf[3 * 300 + 8], utf16_buf[2 * 300 + 8];
+	size_t utf8_len, utf16_len;
+	unsigned int i;
+
+	iconv_handle = get_iconv_testing_handle(tctx, "CP850", "UTF8",
+						lpcfg_parm_bool(tctx->lp_ctx, NULL, "iconv", "use_builtin_handlers", true));
+	torture_assert(tctx, iconv_handle, "getting iconv handle");
+
+	for (i = 0; i < 20000; i++) {
+		size_t align = random() % 8;
+		uint8_t *utf8 = utf8_buf + align;
+		uint8_t *utf16 = utf16_buf + align;
+		size_t num_chars = random() % 300;
+		bool nul_term = (num_chars > 0) && (random() % 2 == 0);
+		size_t destlen;
+
+		gen_ascii_runs(utf8, &utf8_len, utf16, &utf16_len,
+			       num_chars, nul_term);
+
+		/* mostly large enough, sometimes cut short */
+		destlen = (random() % 4 == 0) ?
+			random() % (2 * utf8_len + 1) : 2 * utf8_len + 16;
+
+		if (!check_fast_path(tctx, iconv_handle, CH_UTF16LE, CH_UNIX,
+				     utf16, utf16_len, destlen) ||
+		    !check_fast_path(tctx, iconv_handle, CH_UNIX, CH_UTF16LE,
+				     utf8, utf8_len, destlen) ||
+		    !check_fast_path(tctx, iconv_handle, CH_UNIX, CH_DOS,
+				     utf8, utf8_len, destlen) ||
+		    !check_fast_path(tctx, iconv_handle, CH_UTF16LE, CH_DOS,
+				     utf16, utf16_len, destlen)) {
+			torture_comment(tctx, "failed at iteration %u\n", i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Collect up to max_names paths below dir, relative to the top
+ * directory as in an SMB2 create request, as a corpus of the strings
+ * the file server converts most.
+ */
+static void collect_names(TALLOC_CTX *mem_ctx, const char *dir,
+			  size_t prefix_len,
+			  char ***names, size_t *num_names, size_t max_names)
+{
+	DIR *d;
+	struct dirent *de;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		return;
+	}
+
+	while ((*num_names < max_names) && ((de = readdir(d)) != NULL)) {
+		struct stat st;
+		char *path;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+
+		path = talloc_asprintf(mem_ctx, "%s/%s", dir, de->d_name);
+		if (path == NULL) {
+			break;
+		}
+
+		*names = talloc_realloc(mem_ctx, *names, char *,
+					*num_names + 1);
+		if (*names == NULL) {
+			break;
+		}
+		(*names)[(*num_names)++] = talloc_strdup(*names,
+							 path + prefix_len);
+
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			collect_names(mem_ctx, path, prefix_len,
+				      names, num_names, max_names);
+		}
+		TALLOC_FREE(path);
+	}
+
+	closedir(d);
+}
+
+/*
+ * Benchmark: convert the paths of a directory tree to UTF-16LE and
+ * back, through convert_string_handle() and directly through
+ * smb_iconv(). Only run when a tree is given with
+ * --option=torture:filename_corpus=DIR.
+ */
+static bool test_filename_speed_handle(struct torture_context *tctx)
+{
+	TALLOC_CTX *mem_ctx = NULL;
+	const char *dir = torture_setting_string(tctx, "filename_corpus", NULL);
+	struct smb_iconv_handle *iconv_handle;
+	char **names = NULL;
+	size_t num_names = 0, total = 0;
+	uint8_t utf16[2 * PATH_MAX], unix_name[PATH_MAX];
+	double fast_time, slow_time;
+	struct timeval tv;
+	unsigned int loop, loops = 20;
+	size_t i;
+	smb_iconv_t pull, push;
+
+	if (dir == NULL) {
+		torture_skip(tctx, "benchmark, set torture:filename_corpus "
+			     "to a directory tree to run it");
+	}
+
+	mem_ctx = talloc_new(tctx);
+	torture_assert(tctx, mem_ctx != NULL, "talloc_new failed");
+
+	iconv_handle = get_iconv_testing_handle(mem_ctx, "CP850", "UTF8",
+						lpcfg_parm_bool(tctx->lp_ctx, NULL, "iconv", "use_builtin_handlers", true));
+	torture_assert(tctx, iconv_handle, "getting iconv handle");
+
+	collect_names(mem_ctx, dir, strlen(dir) + 1, &names, &num_names, 50000);
+	if (num_names == 0) {
+		torture_skip(tctx, talloc_asprintf(tctx, "no file names found below %s",
+						   dir));
+	}
+	for (i = 0; i < num_names; i++) {
+		total += strlen(names[i]);
+	}
+	torture_comment(tctx, "%zu paths, %zu bytes, below %s\n",
+			num_names, total, dir);
+
+	tv = timeval_current();
+	for (loop = 0; loop < loops; loop++) {
+		for (i = 0; i < num_names; i++) {
+			size_t len = strlen(names[i]);
+			size_t utf16_len, unix_len;
+
+			torture_assert(tctx, convert_string_handle(iconv_handle,
+					CH_UNIX, CH_UTF16LE, names[i], len,
+					utf16, sizeof(utf16), &utf16_len),
+				       "convert to UTF16LE failed");
+			torture_assert(tctx, convert_string_handle(iconv_handle,
+					CH_UTF16LE, CH_UNIX, utf16, utf16_len,
+					unix_name, sizeof(unix_name), &unix_len),
+				       "convert from UTF16LE failed");
+			torture_assert_mem_equal(tctx, unix_name, names[i], len,
+						 "round trip mismatch");
+		}
+	}
+	fast_time = timeval_elapsed(&tv);
+
+	pull = get_conv_handle(iconv_handle, CH_UNIX, CH_UTF16LE);
+	push = get_conv_handle(iconv_handle, CH_UTF16LE, CH_UNIX);
+
+	tv = timeval_current();
+	for (loop = 0; loop < loops; loop++) {
+		for (i = 0; i < num_names; i++) {
+			const char *inbuf = names[i];
+			char *outbuf = (char *)utf16;
+			size_t i_len = strlen(names[i]);
+			size_t o_len = sizeof(utf16);
+
+			smb_iconv(pull, &inbuf, &i_len, &outbuf, &o_len);
+
+			inbuf = (const char *)utf16;
+			i_len = sizeof(utf16) - o_len;
+			outbuf = (char *)unix_name;
+			o_len = sizeof(unix_name);
+			smb_iconv(push, &inbuf, &i_len, &outbuf, &o_len);
+		}
+	}
+	slow_time = timeval_elapsed(&tv);
+
+	torture_comment(tctx, "convert_string_handle: %7.1f MB/s, "
+			"smb_iconv: %7.1f MB/s (input bytes, both ways)\n",
+			loops * total / fast_time / 1e6,
+			loops * total / slow_time / 1e6);
+
+	talloc_free(mem_ctx);
+	return true;
+}
+
 struct torture_suite *torture_local_convert_string_handle(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "convert_string_handle");
@@ -1713,6 +1989,8 @@ struct torture_suite *torture_local_convert_string_handle(TALLOC_CTX *mem_ctx)
 	torture_suite_add_simple_test(suite, "plato_cp850_utf8", test_plato_cp850_utf8_handle);
 	torture_suite_add_simple_test(suite, "plato_minus_1", test_plato_minus_1_handle);
 	torture_suite_add_simple_test(suite, "plato_latin_cp850_utf8", test_plato_latin_cp850_utf8_handle);
+	torture_suite_add_simple_test(suite, "ascii_fast_path", test_ascii_fast_path_handle);
+	torture_suite_add_simple_test(suite, "filename_speed", test_filename_speed_handle);
 	return suite;
 }
 
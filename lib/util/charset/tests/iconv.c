@@ -414,6 +414,42 @@ static bool test_random_5m(struct torture_context *tctx)
 }
 
 
+/*
+  long ASCII runs with the odd other character, to cover the word at
+  a time paths of the UTF-8 module against the system iconv
+*/
+static bool test_ascii_runs(struct torture_context *tctx)
+{
+	unsigned char inbuf[2 * 300 + 8];
+	unsigned int i;
+
+	if (iconv_untestable(tctx))
+		return true;
+
+	for (i=0;i<50000;i++) {
+		unsigned char *p = inbuf + random() % 8;
+		size_t size;
+		unsigned int c;
+
+		size = 2 * (random() % 300);
+		for (c=0;c<size;c+=2) {
+			if (random() % 30 != 0) {
+				p[c] = random() % 128;
+				p[c+1] = 0;
+			} else {
+				/* surrogates are covered above */
+				SSVAL(p, c, 0x80 + random() % (0xd800 - 0x80));
+			}
+		}
+		if (!test_buffer(tctx, p, size, "UTF-8")) {
+			printf("i=%d failed UTF-8\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
 static bool test_string2key(struct torture_context *tctx)
 {
 	uint16_t *buf;
@@ -479,6 +515,9 @@ struct torture_suite *torture_local_iconv(TALLOC_CTX *mem_ctx)
 	torture_suite_add_simple_test(suite, "5M random UTF-16LE sequences",
 				      test_random_5m);
 
+	torture_suite_add_simple_test(suite, "ASCII runs",
+				      test_ascii_runs);
+
 	torture_suite_add_simple_test(suite, "string2key",
 				      test_string2key);
 	return suite;
@@ -44,7 +44,10 @@ enum memcache_number {
 	SINGLETON_CACHE_TALLOC,	/* talloc */
 	SINGLETON_CACHE,
 	SMB1_SEARCH_OFFSET_MAP,
-	SHARE_MODE_LOCK_CACHE	/* talloc */
+	SHARE_MODE_LOCK_CACHE,	/* talloc */
+	IDMAP_SID2XID_CACHE,
+	WB_TOKEN_CACHE,
+	WB_PAM_AUTH_CACHE
 };
 
 /*
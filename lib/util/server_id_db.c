@@ -75,6 +75,44 @@ void server_id_db_reinit(struct server_id_db *db, struct server_id pid)
 	TALLOC_FREE(db->names);
 }
 
+/*
+ * Like server_id_db_reinit(), but register the names we had under the
+ * new pid. The entries of the old pid are left alone, they still belong
+ * to the process we were forked from.
+ */
+int server_id_db_reinit_names(struct server_id_db *db, struct server_id pid)
+{
+	char *names = db->names;
+	char *name = NULL;
+	int ret = 0;
+
+	db->pid = pid;
+	db->names = NULL;
+
+	while ((name = strv_next(names, name)) != NULL) {
+		ret = server_id_db_add(db, name);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	TALLOC_FREE(names);
+	return ret;
+}
+
+/*
+ * Remove our entries for all our names from the database, but remember
+ * the names for a later server_id_db_reinit_names() in a child
+ */
+void server_id_db_prune_all(struct server_id_db *db)
+{
+	char *name = NULL;
+
+	while ((name = strv_next(db->names, name)) != NULL) {
+		server_id_db_prune_name(db, name, db->pid);
+	}
+}
+
 struct server_id server_id_db_pid(struct server_id_db *db)
 {
 	return db->pid;
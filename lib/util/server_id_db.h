@@ -30,6 +30,8 @@ struct server_id_db *server_id_db_init(TALLOC_CTX *mem_ctx,
 				       const char *base_path,
 				       int hash_size, int tdb_flags);
 void server_id_db_reinit(struct server_id_db *db, struct server_id pid);
+int server_id_db_reinit_names(struct server_id_db *db, struct server_id pid);
+void server_id_db_prune_all(struct server_id_db *db);
 struct server_id server_id_db_pid(struct server_id_db *db);
 int server_id_db_add(struct server_id_db *db, const char *name);
 int server_id_db_remove(struct server_id_db *db, const char *name);
@@ -75,6 +75,12 @@ struct ndr_pull {
 	/* this is used to ensure we generate unique reference IDs
 	   between request and reply */
 	uint32_t ptr_count;
+
+	/*
+	 * Byte arrays, blobs and plain ASCII strings point into data
+	 * instead of being copied, see ndr_pull_set_no_copy()
+	 */
+	bool no_copy;
 };
 
 /* structure passed to functions that generate NDR formatted data */
@@ -98,6 +104,21 @@ struct ndr_push {
 
 	/* this is used to ensure we generate unique reference IDs */
 	uint32_t ptr_count;
+
+	/*
+	 * Byte arrays of at least iov_threshold bytes are referenced
+	 * instead of copied, see ndr_push_set_iov_threshold()
+	 */
+	uint32_t iov_threshold;
+	struct ndr_push_iov_ref *iov_refs;
+	uint32_t num_iov_refs;
+	uint32_t alloc_iov_refs;
+};
+
+struct ndr_push_iov_ref {
+	uint32_t offset;
+	uint32_t length;
+	const uint8_t *data;
 };
 
 /* structure passed to functions that print IDL structures */
@@ -234,7 +255,8 @@ enum ndr_err_code {
 
 enum ndr_compression_alg {
 	NDR_COMPRESSION_MSZIP	= 2,
-	NDR_COMPRESSION_XPRESS	= 3
+	NDR_COMPRESSION_XPRESS	= 3,
+	NDR_COMPRESSION_XPRESS_HUFF_RAW	= 4
 };
 
 /*
@@ -494,9 +516,14 @@ struct ndr_pull *ndr_pull_init_blob(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx);
 enum ndr_err_code ndr_pull_append(struct ndr_pull *ndr, DATA_BLOB *blob);
 enum ndr_err_code ndr_pull_pop(struct ndr_pull *ndr);
 enum ndr_err_code ndr_pull_advance(struct ndr_pull *ndr, uint32_t size);
+void ndr_pull_set_no_copy(struct ndr_pull *ndr, bool no_copy);
 struct ndr_push *ndr_push_init_ctx(TALLOC_CTX *mem_ctx);
 DATA_BLOB ndr_push_blob(struct ndr_push *ndr);
 enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_size);
+struct iovec;
+void ndr_push_set_iov_threshold(struct ndr_push *ndr, uint32_t threshold);
+enum ndr_err_code ndr_push_iov(struct ndr_push *ndr, TALLOC_CTX *mem_ctx,
+			       struct iovec **piov, int *pnum_iov);
 void ndr_print_debug_helper(struct ndr_print *ndr, const char *format, ...) PRINTF_ATTRIBUTE(2,3);
 void ndr_print_debugc_helper(struct ndr_print *ndr, const char *format, ...) PRINTF_ATTRIBUTE(2,3);
 void ndr_print_printf_helper(struct ndr_print *ndr, const char *format, ...) PRINTF_ATTRIBUTE(2,3);
@@ -557,6 +584,7 @@ uint32_t ndr_print_get_switch_value(struct ndr_print *ndr, const void *p);
 uint32_t ndr_pull_steal_switch_value(struct ndr_pull *ndr, const void *p);
 enum ndr_err_code ndr_pull_struct_blob(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, ndr_pull_flags_fn_t fn);
+enum ndr_err_code ndr_pull_struct_blob_all_nocopy(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_struct_blob_all_noalloc(const DATA_BLOB *blob,
 						   void *p, ndr_pull_flags_fn_t fn);
 enum ndr_err_code ndr_pull_union_blob(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, void *p, uint32_t level, ndr_pull_flags_fn_t fn);
@@ -620,6 +648,7 @@ enum ndr_err_code ndr_pull_generic_ptr(struct ndr_pull *ndr, uint32_t *v);
 enum ndr_err_code ndr_pull_ref_ptr(struct ndr_pull *ndr, uint32_t *v);
 enum ndr_err_code ndr_pull_bytes(struct ndr_pull *ndr, uint8_t *data, uint32_t n);
 enum ndr_err_code ndr_pull_array_uint8(struct ndr_pull *ndr, int ndr_flags, uint8_t *data, uint32_t n);
+enum ndr_err_code ndr_pull_array_uint8_ptr(struct ndr_pull *ndr, int ndr_flags, uint8_t **data, uint32_t size, uint32_t length);
 enum ndr_err_code ndr_push_align(struct ndr_push *ndr, size_t size);
 enum ndr_err_code ndr_pull_align(struct ndr_pull *ndr, size_t size);
 enum ndr_err_code ndr_push_union_align(struct ndr_push *ndr, size_t size);
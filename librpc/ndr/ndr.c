@@ -29,7 +29,9 @@
 
 #include "includes.h"
 #include "librpc/ndr/libndr.h"
+#include "system/filesys.h"
 #include "../lib/util/dlinklist.h"
+#include "lib/util/tsort.h"
 
 #define NDR_BASE_MARSHALL_SIZE 1024
 
@@ -86,6 +88,16 @@ _PUBLIC_ enum ndr_err_code ndr_pull_append(struct ndr_pull *ndr, DATA_BLOB *blob
 		return NDR_ERR_SUCCESS;
 	}
 
+	if (ndr->no_copy) {
+		/*
+		 * data_blob_append() may move the buffer
+		 * the pulled structures point into
+		 */
+		return ndr_pull_error(ndr, NDR_ERR_FLAGS,
+				      "ndr_pull_append() in no_copy mode: %s",
+				      __location__);
+	}
+
 	ndr_err = ndr_token_retrieve(&ndr->array_size_list, ndr, &append);
 	if (ndr_err == NDR_ERR_TOKEN) {
 		append = 0;
@@ -130,6 +142,10 @@ _PUBLIC_ enum ndr_err_code ndr_pull_pop(struct ndr_pull *ndr)
 	uint32_t skip = 0;
 	uint32_t append = 0;
 
+	if (ndr->no_copy) {
+		return ndr_pull_error(ndr, NDR_ERR_FLAGS,
+				      "%s", __location__);
+	}
 	if (ndr->relative_base_offset != 0) {
 		return ndr_pull_error(ndr, NDR_ERR_RELATIVE,
 				      "%s", __location__);
@@ -194,6 +210,17 @@ _PUBLIC_ enum ndr_err_code ndr_pull_advance(struct ndr_pull *ndr, uint32_t size)
 	return NDR_ERR_SUCCESS;
 }
 
+/*
+  let the pulled byte arrays, DATA_BLOBs and plain ASCII strings point
+  into the input buffer instead of copying them. The result must not
+  outlive the buffer and these members must not be modified or
+  talloc_free()d.
+*/
+_PUBLIC_ void ndr_pull_set_no_copy(struct ndr_pull *ndr, bool no_copy)
+{
+	ndr->no_copy = no_copy;
+}
+
 /*
   set the parse offset to 'ofs'
 */
@@ -229,10 +256,30 @@ _PUBLIC_ struct ndr_push *ndr_push_init_ctx(TALLOC_CTX *mem_ctx)
 	return ndr;
 }
 
+/*
+  copy the referenced byte arrays into the space reserved for them
+*/
+static void ndr_push_iov_flatten(struct ndr_push *ndr)
+{
+	uint32_t i;
+
+	for (i=0; i<ndr->num_iov_refs; i++) {
+		struct ndr_push_iov_ref *ref = &ndr->iov_refs[i];
+		memcpy(ndr->data + ref->offset, ref->data, ref->length);
+	}
+
+	TALLOC_FREE(ndr->iov_refs);
+	ndr->num_iov_refs = 0;
+	ndr->alloc_iov_refs = 0;
+}
+
 /* return a DATA_BLOB structure for the current ndr_push marshalled data */
 _PUBLIC_ DATA_BLOB ndr_push_blob(struct ndr_push *ndr)
 {
 	DATA_BLOB blob;
+
+	ndr_push_iov_flatten(ndr);
+
 	blob = data_blob_const(ndr->data, ndr->offset);
 	if (ndr->alloc_size > ndr->offset) {
 		ndr->data[ndr->offset] = 0;
@@ -247,6 +294,7 @@ _PUBLIC_ DATA_BLOB ndr_push_blob(struct ndr_push *ndr)
 _PUBLIC_ enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_size)
 {
 	uint32_t size = extra_size + ndr->offset;
+	uint32_t new_size;
 
 	if (size < ndr->offset) {
 		/* extra_size overflowed the offset */
@@ -269,7 +317,15 @@ _PUBLIC_ enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_
 		return NDR_ERR_SUCCESS;
 	}
 
-	ndr->alloc_size += NDR_BASE_MARSHALL_SIZE;
+	/*
+	 * Grow geometrically, a fixed increment makes pushing large
+	 * structures quadratic in the bytes copied by talloc_realloc()
+	 */
+	new_size = ndr->alloc_size + MAX(ndr->alloc_size, NDR_BASE_MARSHALL_SIZE);
+	if (new_size < ndr->alloc_size) {
+		new_size = UINT32_MAX;
+	}
+	ndr->alloc_size = new_size;
 	if (size+1 > ndr->alloc_size) {
 		ndr->alloc_size = size+1;
 	}
@@ -282,6 +338,96 @@ _PUBLIC_ enum ndr_err_code ndr_push_expand(struct ndr_push *ndr, uint32_t extra_
 	return NDR_ERR_SUCCESS;
 }
 
+/*
+  Byte arrays (uint8 arrays and DATA_BLOBs) of at least 'threshold'
+  bytes pushed from now on are not copied into the marshalling buffer,
+  only the space for them is reserved. ndr_push_iov() then returns the
+  marshalled data with these arrays referenced in place, ready for
+  writev(). The pushed structure must stay unchanged as long as the
+  ndr_push is in use. ndr_push_blob() still returns a complete buffer.
+  0 disables this, which is the default.
+*/
+_PUBLIC_ void ndr_push_set_iov_threshold(struct ndr_push *ndr,
+					 uint32_t threshold)
+{
+	ndr->iov_threshold = threshold;
+}
+
+static int ndr_push_iov_ref_cmp(const struct ndr_push_iov_ref *r1,
+				const struct ndr_push_iov_ref *r2)
+{
+	if (r1->offset == r2->offset) {
+		return 0;
+	}
+	return (r1->offset < r2->offset) ? -1 : 1;
+}
+
+/*
+  return the marshalled data as an array of iovecs: slices of
+  ndr->data between the referenced byte arrays, see
+  ndr_push_set_iov_threshold()
+*/
+_PUBLIC_ enum ndr_err_code ndr_push_iov(struct ndr_push *ndr,
+					TALLOC_CTX *mem_ctx,
+					struct iovec **piov, int *pnum_iov)
+{
+	struct iovec *iov;
+	uint32_t ofs = 0;
+	uint32_t i;
+	int num_iov = 0;
+
+	TYPESAFE_QSORT(ndr->iov_refs, ndr->num_iov_refs, ndr_push_iov_ref_cmp);
+
+	for (i=0; i<ndr->num_iov_refs; i++) {
+		struct ndr_push_iov_ref *ref = &ndr->iov_refs[i];
+
+		if ((ref->offset < ofs) ||
+		    (ref->offset + ref->length > ndr->offset)) {
+			/*
+			 * Someone moved the offset back and overwrote
+			 * the reserved space, play safe.
+			 */
+			ndr_push_iov_flatten(ndr);
+			break;
+		}
+		ofs = ref->offset + ref->length;
+	}
+
+	iov = talloc_array(mem_ctx, struct iovec, ndr->num_iov_refs * 2 + 1);
+	if (iov == NULL) {
+		return ndr_push_error(ndr, NDR_ERR_ALLOC,
+				      "Failed to allocate %u iovecs",
+				      ndr->num_iov_refs * 2 + 1);
+	}
+
+	ofs = 0;
+
+	for (i=0; i<ndr->num_iov_refs; i++) {
+		struct ndr_push_iov_ref *ref = &ndr->iov_refs[i];
+
+		if (ref->offset > ofs) {
+			iov[num_iov].iov_base = ndr->data + ofs;
+			iov[num_iov].iov_len = ref->offset - ofs;
+			num_iov += 1;
+		}
+		iov[num_iov].iov_base = discard_const_p(uint8_t, ref->data);
+		iov[num_iov].iov_len = ref->length;
+		num_iov += 1;
+
+		ofs = ref->offset + ref->length;
+	}
+
+	if (ndr->offset > ofs) {
+		iov[num_iov].iov_base = ndr->data + ofs;
+		iov[num_iov].iov_len = ndr->offset - ofs;
+		num_iov += 1;
+	}
+
+	*piov = iov;
+	*pnum_iov = num_iov;
+	return NDR_ERR_SUCCESS;
+}
+
 _PUBLIC_ void ndr_print_debugc_helper(struct ndr_print *ndr, const char *format, ...)
 {
 	va_list ap;
@@ -749,6 +895,7 @@ _PUBLIC_ enum ndr_err_code ndr_pull_subcontext_start(struct ndr_pull *ndr,
 		subndr->data		= ndr->data;
 		subndr->offset		= ndr->offset;
 		subndr->data_size	= ndr->data_size;
+		subndr->no_copy		= ndr->no_copy;
 
 		*_subndr = subndr;
 		return NDR_ERR_SUCCESS;
@@ -768,6 +915,7 @@ _PUBLIC_ enum ndr_err_code ndr_pull_subcontext_start(struct ndr_pull *ndr,
 	subndr->data = ndr->data + ndr->offset;
 	subndr->offset = 0;
 	subndr->data_size = r_content_size;
+	subndr->no_copy = ndr->no_copy;
 
 	if (force_le) {
 		ndr_set_flags(&ndr->flags, LIBNDR_FLAG_LITTLE_ENDIAN);
@@ -1146,13 +1294,17 @@ _PUBLIC_ enum ndr_err_code ndr_pull_struct_blob(const DATA_BLOB *blob, TALLOC_CT
 /*
   pull a struct from a blob using NDR - failing if all bytes are not consumed
 */
-_PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, 
-						    void *p, ndr_pull_flags_fn_t fn)
+static enum ndr_err_code ndr_pull_struct_blob_all_internal(const DATA_BLOB *blob,
+							   TALLOC_CTX *mem_ctx,
+							   void *p,
+							   ndr_pull_flags_fn_t fn,
+							   bool no_copy)
 {
 	struct ndr_pull *ndr;
 	uint32_t highest_ofs;
 	ndr = ndr_pull_init_blob(blob, mem_ctx);
 	NDR_ERR_HAVE_NO_MEMORY(ndr);
+	ndr_pull_set_no_copy(ndr, no_copy);
 	NDR_CHECK_FREE(fn(ndr, NDR_SCALARS|NDR_BUFFERS, p));
 	if (ndr->offset > ndr->relative_highest_offset) {
 		highest_ofs = ndr->offset;
@@ -1171,6 +1323,27 @@ _PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLO
 	return NDR_ERR_SUCCESS;
 }
 
+_PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all(const DATA_BLOB *blob, TALLOC_CTX *mem_ctx, 
+						    void *p, ndr_pull_flags_fn_t fn)
+{
+	return ndr_pull_struct_blob_all_internal(blob, mem_ctx, p, fn, false);
+}
+
+/*
+  pull a struct from a blob using NDR - failing if all bytes are not consumed
+
+  Byte arrays, DATA_BLOBs and plain ASCII strings point into the blob,
+  see ndr_pull_set_no_copy(). This is meant for read-only consumers
+  that are done with the structure before the blob goes away.
+*/
+_PUBLIC_ enum ndr_err_code ndr_pull_struct_blob_all_nocopy(const DATA_BLOB *blob,
+							   TALLOC_CTX *mem_ctx,
+							   void *p,
+							   ndr_pull_flags_fn_t fn)
+{
+	return ndr_pull_struct_blob_all_internal(blob, mem_ctx, p, fn, true);
+}
+
 /*
   pull a struct from a blob using NDR - failing if all bytes are not consumed
 
@@ -1662,6 +1835,9 @@ _PUBLIC_ enum ndr_err_code ndr_push_relative_ptr2_end(struct ndr_push *ndr, cons
 
 		clear_size = MIN(clear_size, len);
 
+		/* the referenced arrays would not move with the buffer */
+		ndr_push_iov_flatten(ndr);
+
 		/* now move the marshalled buffer to the end of the main buffer */
 		memmove(ndr->data + correct_offset, ndr->data + begin_offset, len);
 
@@ -465,6 +465,25 @@ _PUBLIC_ enum ndr_err_code ndr_pull_array_uint8(struct ndr_pull *ndr, int ndr_fl
 	return ndr_pull_bytes(ndr, data, n);
 }
 
+/*
+  pull an allocated uint8 array of 'size' elements, 'length' of them
+  are on the wire. In no_copy mode the array points into the input
+  buffer when all elements are on the wire.
+*/
+_PUBLIC_ enum ndr_err_code ndr_pull_array_uint8_ptr(struct ndr_pull *ndr, int ndr_flags, uint8_t **data, uint32_t size, uint32_t length)
+{
+	NDR_PULL_CHECK_FLAGS(ndr, ndr_flags);
+	if (ndr->no_copy && (ndr_flags & NDR_SCALARS) &&
+	    size > 0 && size == length) {
+		NDR_PULL_NEED_BYTES(ndr, length);
+		*data = ndr->data + ndr->offset;
+		ndr->offset += length;
+		return NDR_ERR_SUCCESS;
+	}
+	NDR_PULL_ALLOC_N(ndr, *data, size);
+	return ndr_pull_array_uint8(ndr, ndr_flags, *data, length);
+}
+
 /*
   push a int8_t
 */
@@ -725,6 +744,52 @@ _PUBLIC_ enum ndr_err_code ndr_push_bytes(struct ndr_push *ndr, const uint8_t *d
 	return NDR_ERR_SUCCESS;
 }
 
+/*
+  push bytes owned by the structure being pushed, they are only
+  referenced if the ndr_push is in iov mode
+*/
+static enum ndr_err_code ndr_push_bytes_ref(struct ndr_push *ndr,
+					    const uint8_t *data, uint32_t n)
+{
+	struct ndr_push_iov_ref *refs;
+
+	if ((ndr->iov_threshold == 0) || (n < ndr->iov_threshold) ||
+	    ndr->fixed_buf_size ||
+	    (ndr->flags & LIBNDR_FLAG_RELATIVE_REVERSE)) {
+		return ndr_push_bytes(ndr, data, n);
+	}
+
+	NDR_PUSH_NEED_BYTES(ndr, n);
+
+	if (ndr->num_iov_refs == ndr->alloc_iov_refs) {
+		/* grow geometrically, like ndr_push_expand() */
+		uint32_t new_alloc = MAX(ndr->alloc_iov_refs * 2, 16);
+
+		if (new_alloc < ndr->alloc_iov_refs) {
+			return ndr_push_error(ndr, NDR_ERR_ALLOC,
+					      "Too many referenced arrays");
+		}
+		refs = talloc_realloc(ndr, ndr->iov_refs,
+				      struct ndr_push_iov_ref, new_alloc);
+		if (refs == NULL) {
+			return ndr_push_error(ndr, NDR_ERR_ALLOC,
+					      "Failed to reference %u bytes",
+					      n);
+		}
+		ndr->iov_refs = refs;
+		ndr->alloc_iov_refs = new_alloc;
+	}
+	refs = ndr->iov_refs;
+
+	refs[ndr->num_iov_refs] = (struct ndr_push_iov_ref) {
+		.offset = ndr->offset, .length = n, .data = data,
+	};
+	ndr->num_iov_refs += 1;
+
+	ndr->offset += n;
+	return NDR_ERR_SUCCESS;
+}
+
 /*
   push some zero bytes
 */
@@ -745,7 +810,7 @@ _PUBLIC_ enum ndr_err_code ndr_push_array_uint8(struct ndr_push *ndr, int ndr_fl
 	if (!(ndr_flags & NDR_SCALARS)) {
 		return NDR_ERR_SUCCESS;
 	}
-	return ndr_push_bytes(ndr, data, n);
+	return ndr_push_bytes_ref(ndr, data, n);
 }
 
 /*
@@ -1285,7 +1350,7 @@ _PUBLIC_ enum ndr_err_code ndr_push_DATA_BLOB(struct ndr_push *ndr, int ndr_flag
 	} else {
 		NDR_CHECK(ndr_push_uint3264(ndr, NDR_SCALARS, blob.length));
 	}
-	NDR_CHECK(ndr_push_bytes(ndr, blob.data, blob.length));
+	NDR_CHECK(ndr_push_bytes_ref(ndr, blob.data, blob.length));
 	return NDR_ERR_SUCCESS;
 }
 
@@ -1320,7 +1385,11 @@ _PUBLIC_ enum ndr_err_code ndr_pull_DATA_BLOB(struct ndr_pull *ndr, int ndr_flag
 		NDR_CHECK(ndr_pull_uint3264(ndr, NDR_SCALARS, &length));
 	}
 	NDR_PULL_NEED_BYTES(ndr, length);
-	*blob = data_blob_talloc(ndr->current_mem_ctx, ndr->data+ndr->offset, length);
+	if (ndr->no_copy && length > 0) {
+		*blob = data_blob_const(ndr->data+ndr->offset, length);
+	} else {
+		*blob = data_blob_talloc(ndr->current_mem_ctx, ndr->data+ndr->offset, length);
+	}
 	ndr->offset += length;
 	return NDR_ERR_SUCCESS;
 }
@@ -22,6 +22,7 @@
 
 #include "includes.h"
 #include "../lib/compression/lzxpress.h"
+#include "../lib/compression/lzxpress_huffman.h"
 #include "librpc/ndr/libndr.h"
 #include "../librpc/ndr/ndr_compression.h"
 #include <zlib.h>
@@ -376,6 +377,82 @@ static enum ndr_err_code ndr_push_compression_xpress_chunk(struct ndr_push *ndrp
 	return NDR_ERR_SUCCESS;
 }
 
+/*
+  LZ77+Huffman has no chunk headers, the rest of the buffer is one
+  stream and the caller has to know the uncompressed size
+*/
+static enum ndr_err_code ndr_pull_compression_xpress_huff_raw(struct ndr_pull *ndrpull,
+							      struct ndr_push *ndrpush,
+							      ssize_t decompressed_len)
+{
+	DATA_BLOB comp;
+	DATA_BLOB plain;
+	uint32_t plain_offset;
+	ssize_t ret;
+
+	if (decompressed_len < 0 || decompressed_len > UINT32_MAX) {
+		return ndr_pull_error(ndrpull, NDR_ERR_COMPRESSION,
+				      "XPRESS_HUFF_RAW needs the uncompressed size, got %d (PULL)",
+				      (int)decompressed_len);
+	}
+
+	comp.data = ndrpull->data + ndrpull->offset;
+	comp.length = ndrpull->data_size - ndrpull->offset;
+
+	plain_offset = ndrpush->offset;
+	NDR_CHECK(ndr_push_zero(ndrpush, decompressed_len));
+	plain.data = ndrpush->data + plain_offset;
+	plain.length = decompressed_len;
+
+	DEBUG(9,("XPRESS_HUFF_RAW plain_size: %08X (%u) comp_size: %08X (%u)\n",
+		 (unsigned int)plain.length, (unsigned int)plain.length,
+		 (unsigned int)comp.length, (unsigned int)comp.length));
+
+	ret = lzxpress_huffman_decompress(comp.data,
+					  comp.length,
+					  plain.data,
+					  plain.length);
+	if (ret < 0) {
+		return ndr_pull_error(ndrpull, NDR_ERR_COMPRESSION,
+				      "XPRESS_HUFF_RAW lzxpress_huffman_decompress() returned %d\n",
+				      (int)ret);
+	}
+
+	NDR_CHECK(ndr_pull_advance(ndrpull, comp.length));
+	return NDR_ERR_SUCCESS;
+}
+
+static enum ndr_err_code ndr_push_compression_xpress_huff_raw(struct ndr_push *ndrpush,
+							      struct ndr_pull *ndrpull)
+{
+	DATA_BLOB comp;
+	DATA_BLOB plain;
+	uint32_t max_comp_size;
+	ssize_t ret;
+
+	plain.data = ndrpull->data;
+	plain.length = ndrpull->data_size;
+
+	max_comp_size = LZXPRESS_HUFFMAN_MAX_COMPRESSED_SIZE(plain.length);
+	NDR_CHECK(ndr_push_expand(ndrpush, max_comp_size));
+
+	comp.data = ndrpush->data + ndrpush->offset;
+	comp.length = max_comp_size;
+
+	ret = lzxpress_huffman_compress(plain.data,
+					plain.length,
+					comp.data,
+					comp.length);
+	if (ret < 0) {
+		return ndr_push_error(ndrpush, NDR_ERR_COMPRESSION,
+				      "XPRESS_HUFF_RAW lzxpress_huffman_compress() returned %d\n",
+				      (int)ret);
+	}
+
+	ndrpush->offset += ret;
+	return NDR_ERR_SUCCESS;
+}
+
 /*
   handle compressed subcontext buffers, which in midl land are user-marshalled, but
   we use magic in pidl to make them easier to cope with
@@ -408,6 +485,11 @@ enum ndr_err_code ndr_pull_compression_start(struct ndr_pull *subndr,
 		}
 		break;
 
+	case NDR_COMPRESSION_XPRESS_HUFF_RAW:
+		NDR_CHECK(ndr_pull_compression_xpress_huff_raw(subndr, ndrpush,
+							       decompressed_len));
+		break;
+
 	default:
 		return ndr_pull_error(subndr, NDR_ERR_COMPRESSION, "Bad compression algorithm %d (PULL)",
 				      compression_alg);
@@ -456,6 +538,7 @@ enum ndr_err_code ndr_push_compression_start(struct ndr_push *subndr,
 	switch (compression_alg) {
 	case NDR_COMPRESSION_MSZIP:
 	case NDR_COMPRESSION_XPRESS:
+	case NDR_COMPRESSION_XPRESS_HUFF_RAW:
 		break;
 	default:
 		return ndr_push_error(subndr, NDR_ERR_COMPRESSION,
@@ -504,6 +587,10 @@ enum ndr_err_code ndr_push_compression_end(struct ndr_push *subndr,
 		}
 		break;
 
+	case NDR_COMPRESSION_XPRESS_HUFF_RAW:
+		NDR_CHECK(ndr_push_compression_xpress_huff_raw(subndr, ndrpull));
+		break;
+
 	default:
 		return ndr_push_error(subndr, NDR_ERR_COMPRESSION, "Bad compression algorithm %d (PUSH)", 
 				      compression_alg);
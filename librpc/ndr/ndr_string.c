@@ -22,6 +22,39 @@
 #include "includes.h"
 #include "librpc/ndr/libndr.h"
 
+/*
+  In no_copy mode a NULL terminated 8 bit string can point into the
+  input buffer if converting it would not change it: raw strings
+  always, UTF8 and DOS strings if they are plain ASCII.
+*/
+static bool ndr_pull_string_ref(struct ndr_pull *ndr, bool convert,
+				charset_t chset, uint32_t length,
+				const char **s)
+{
+	const uint8_t *p = ndr->data + ndr->offset;
+	uint32_t i;
+
+	if (!ndr->no_copy || length == 0) {
+		return false;
+	}
+	if (convert && chset != CH_UTF8 && chset != CH_DOS) {
+		return false;
+	}
+	if (p[length-1] != '\0') {
+		return false;
+	}
+	if (convert) {
+		for (i = 0; i < length; i++) {
+			if (p[i] & 0x80) {
+				return false;
+			}
+		}
+	}
+
+	*s = (const char *)p;
+	return true;
+}
+
 /**
   pull a general string from the wire
 */
@@ -144,6 +177,10 @@ _PUBLIC_ enum ndr_err_code ndr_pull_string(struct ndr_pull *ndr, int ndr_flags,
 	if (conv_src_len == 0) {
 		as = talloc_strdup(ndr->current_mem_ctx, "");
 		converted_size = 0;
+	} else if (byte_mul == 1 &&
+		   ndr_pull_string_ref(ndr, do_convert, chset, conv_src_len,
+				       discard_const_p(const char *, &as))) {
+		converted_size = strlen(as) + 1;
 	} else {
 		if (!do_convert) {
 			as = talloc_strndup(ndr->current_mem_ctx,
@@ -590,6 +627,12 @@ _PUBLIC_ enum ndr_err_code ndr_pull_charset(struct ndr_pull *ndr, int ndr_flags,
 
 	NDR_PULL_NEED_BYTES(ndr, length*byte_mul);
 
+	if (byte_mul == 1 &&
+	    ndr_pull_string_ref(ndr, true, chset, length, var)) {
+		NDR_CHECK(ndr_pull_advance(ndr, length));
+		return NDR_ERR_SUCCESS;
+	}
+
 	if (!convert_string_talloc(ndr->current_mem_ctx, chset, CH_UNIX,
 				   ndr->data+ndr->offset, length*byte_mul,
 				   discard_const_p(void *, var),
@@ -621,6 +664,11 @@ _PUBLIC_ enum ndr_err_code ndr_pull_charset_to_null(struct ndr_pull *ndr, int nd
 
 	str_len = ndr_string_length(ndr->data+ndr->offset, byte_mul);
 	str_len = MIN(str_len, length);	/* overrun protection */
+	if (byte_mul == 1 && str_len < length &&
+	    ndr_pull_string_ref(ndr, true, chset, str_len + 1, var)) {
+		NDR_CHECK(ndr_pull_advance(ndr, length));
+		return NDR_ERR_SUCCESS;
+	}
 	if (!convert_string_talloc(ndr->current_mem_ctx, chset, CH_UNIX,
 				   ndr->data+ndr->offset, str_len*byte_mul,
 				   discard_const_p(void *, var),
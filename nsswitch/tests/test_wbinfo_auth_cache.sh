@@ -0,0 +1,84 @@
+#!/bin/sh
+# Test winbindd's cache of plaintext logons: a repeated logon is
+# answered without the DC, a wrong password is not, entries expire
+# after "winbindd:auth cache time" seconds and are dropped when the DC
+# refuses the account.
+#
+# The password is changed behind winbindd's back with samba-tool, twice
+# as the DC still accepts the previous password for NTLM logons. A
+# logon with the first password then only succeeds from the cache.
+if [ $# -lt 4 ]; then
+	echo Usage: $0 SERVER USERNAME PASSWORD CACHE_TIME
+	exit 1
+fi
+
+SERVER="$1"
+USERNAME="$2"
+PASSWORD="$3"
+CACHE_TIME="$4"
+shift 4
+
+wbinfo="$VALGRIND $BINDIR/wbinfo"
+samba_tool="$VALGRIND $BINDIR/samba-tool"
+
+TESTUSER=authcacheuser
+PASS1=Pa55w0rd.authcache1
+PASS2=Pa55w0rd.authcache2
+PASS3=Pa55w0rd.authcache3
+PASS4=Pa55w0rd.authcache4
+
+failed=0
+
+. `dirname $0`/../../testprogs/blackbox/subunit.sh
+
+st() {
+	$samba_tool "$@" -H ldap://$SERVER -U"$USERNAME%$PASSWORD"
+}
+
+domain=`$wbinfo --own-domain`
+sep=`$wbinfo --separator`
+
+# Plaintext only, "wbinfo -a" also tries challenge/response
+logon() {
+	$wbinfo --pam-logon="$domain$sep$TESTUSER%$1"
+}
+
+logon_fails() {
+	if logon "$1"; then
+		echo "logon with $1 succeeded"
+		return 1
+	fi
+	return 0
+}
+
+setpassword() {
+	st user setpassword $TESTUSER --newpassword="$1"
+}
+
+st user delete $TESTUSER >/dev/null 2>&1
+
+testit "create user" st user create $TESTUSER $PASS1 || failed=`expr $failed + 1`
+testit "logon" logon $PASS1 || failed=`expr $failed + 1`
+
+testit "change password at the DC" setpassword $PASS2 || failed=`expr $failed + 1`
+testit "change password at the DC again" setpassword $PASS3 || failed=`expr $failed + 1`
+testit "old password from the cache" logon $PASS1 || failed=`expr $failed + 1`
+
+testit "wrong password" logon_fails Wrong.Pa55word || failed=`expr $failed + 1`
+testit "wrong password keeps the entry" logon $PASS1 || failed=`expr $failed + 1`
+
+sleep `expr $CACHE_TIME + 1`
+
+testit "old password after expiry" logon_fails $PASS1 || failed=`expr $failed + 1`
+testit "new password" logon $PASS3 || failed=`expr $failed + 1`
+
+# setpassword enables the account, so disable it afterwards. The DC
+# refuses the next logon that reaches it, which drops the entry.
+testit "change password at the DC for disabling" setpassword $PASS4 || failed=`expr $failed + 1`
+testit "disable account" st user disable $TESTUSER || failed=`expr $failed + 1`
+testit "disabled account" logon_fails $PASS4 || failed=`expr $failed + 1`
+testit "cached password of a disabled account" logon_fails $PASS3 || failed=`expr $failed + 1`
+
+st user delete $TESTUSER
+
+exit $failed
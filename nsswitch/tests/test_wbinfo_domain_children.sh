@@ -0,0 +1,91 @@
+#!/bin/sh
+# Test that winbindd forks another domain child when all running ones
+# are busy, and that the extra child is shut down and reaped after
+# "winbindd:domain child idle timeout" seconds without a request.
+#
+# The environment needs "winbind max domain connections" > 1.
+if [ $# -lt 2 ]; then
+	echo Usage: $0 DOMAIN IDLE_TIMEOUT
+	exit 1
+fi
+
+DOMAIN="$1"
+IDLE_TIMEOUT="$2"
+
+wbinfo="$VALGRIND $BINDIR/wbinfo"
+smbcontrol="$VALGRIND $BINDIR/smbcontrol $CONFIGURATION"
+
+failed=0
+
+. `dirname $0`/../../testprogs/blackbox/subunit.sh
+
+# The pids of the running children of $DOMAIN
+domain_child_pids() {
+	$smbcontrol winbindd dump-domain-list "$DOMAIN" |
+		sed -n 's/^ *pid *: 0x[0-9a-f]* (\([0-9]*\))$/\1/p' |
+		grep -v '^0$'
+}
+
+num_domain_children() {
+	domain_child_pids | wc -l
+}
+
+testit "wbinfo -u" $wbinfo -u --domain="$DOMAIN" || failed=`expr $failed + 1`
+
+first_pids=`domain_child_pids`
+echo "children of $DOMAIN: $first_pids"
+
+# Keep the running children busy until winbindd starts another one.
+# Listing the users is always done by a domain child.
+spawn_extra_child() {
+	for round in 1 2 3 4 5 6 7 8 9 10; do
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16; do
+			$wbinfo -u --domain="$DOMAIN" >/dev/null 2>&1 &
+		done
+		wait
+		if [ `num_domain_children` -gt 1 ]; then
+			return 0
+		fi
+	done
+	echo "no second child for $DOMAIN was started"
+	return 1
+}
+
+testit "concurrent requests start another child" spawn_extra_child || failed=`expr $failed + 1`
+
+extra_pids=`domain_child_pids`
+for pid in $first_pids; do
+	extra_pids=`echo "$extra_pids" | grep -v "^$pid$"`
+done
+echo "extra children of $DOMAIN: $extra_pids"
+
+# The idle timer runs from the last request a child finished
+idle_child_gone() {
+	sleep `expr $IDLE_TIMEOUT + 2`
+
+	pids=`domain_child_pids`
+	for pid in $extra_pids; do
+		if echo "$pids" | grep -q "^$pid$"; then
+			echo "child $pid of $DOMAIN is still in use"
+			return 1
+		fi
+		if ps -o stat= -p $pid >/dev/null 2>&1; then
+			echo "child $pid of $DOMAIN was not reaped: `ps -o stat= -p $pid`"
+			return 1
+		fi
+	done
+
+	for pid in $first_pids; do
+		if ! echo "$pids" | grep -q "^$pid$"; then
+			echo "first child $pid of $DOMAIN was shut down"
+			return 1
+		fi
+	done
+	return 0
+}
+
+testit "idle child is shut down and reaped" idle_child_gone || failed=`expr $failed + 1`
+
+testit "wbinfo -u after shutdown" $wbinfo -u --domain="$DOMAIN" || failed=`expr $failed + 1`
+
+exit $failed
@@ -0,0 +1,110 @@
+#!/bin/sh
+# Test that concurrent sids-to-unix-ids requests for the same uncached
+# SIDs wait on a single lookup in winbindd, and that all of them get
+# the same answer.
+#
+# The counters come from "smbcontrol winbindd sids2xids-stats".
+
+wbinfo="$VALGRIND $BINDIR/wbinfo"
+net="$VALGRIND $BINDIR/net $CONFIGURATION"
+smbcontrol="$VALGRIND $BINDIR/smbcontrol $CONFIGURATION"
+
+NUM_CLIENTS=16
+
+failed=0
+
+. `dirname $0`/../../testprogs/blackbox/subunit.sh
+
+tmpdir=`mktemp -d ${PREFIX:-/tmp}/sids2xids.XXXXXX`
+trap "rm -rf $tmpdir" EXIT
+
+domain=`$wbinfo --own-domain`
+domsid=`$wbinfo --domain-info="$domain" | sed -n 's/^SID *: //p'`
+sids="$domsid-512,$domsid-513,S-1-5-32-545"
+num_sids=3
+
+# Print the value of counter $1 ("looked up", "batches", ...)
+sids2xids_stat() {
+	$smbcontrol winbindd sids2xids-stats |
+		sed -n "s/.* \([0-9]*\) $1.*/\1/p"
+}
+
+flush_caches() {
+	$net cache flush &&
+	$smbcontrol winbindd reload-config
+}
+
+concurrent_sids2xids() {
+	for i in `seq 1 $NUM_CLIENTS`; do
+		$wbinfo --sids-to-unix-ids="$sids" > $tmpdir/out.$i 2>&1 &
+	done
+	wait
+
+	for i in `seq 1 $NUM_CLIENTS`; do
+		if ! cmp -s $tmpdir/out.1 $tmpdir/out.$i; then
+			echo "client $i got a different answer:"
+			cat $tmpdir/out.1 $tmpdir/out.$i
+			return 1
+		fi
+	done
+	cat $tmpdir/out.1
+
+	if [ `wc -l < $tmpdir/out.1` -ne $num_sids ]; then
+		echo "expected $num_sids mappings"
+		return 1
+	fi
+	if grep -q -- "-> unmapped" $tmpdir/out.1; then
+		echo "unmapped SIDs"
+		return 1
+	fi
+	return 0
+}
+
+# One round with empty caches. Clients that start after the lookup
+# finished are answered from the idmap memory cache, so one batch with
+# $num_sids SIDs does not prove that anyone waited on a flight. Only
+# the "deduplicated" counter does.
+concurrent_round() {
+	flush_caches || return 1
+
+	looked_up=`sids2xids_stat "looked up"`
+	batches=`sids2xids_stat "batches"`
+	deduplicated=`sids2xids_stat "deduplicated"`
+
+	concurrent_sids2xids || return 1
+
+	new_looked_up=`sids2xids_stat "looked up"`
+	new_batches=`sids2xids_stat "batches"`
+	new_deduplicated=`sids2xids_stat "deduplicated"`
+	$smbcontrol winbindd sids2xids-stats
+
+	if [ `expr $new_batches - $batches` -ne 1 ]; then
+		echo "expected 1 batch, got `expr $new_batches - $batches`"
+		return 1
+	fi
+	if [ `expr $new_looked_up - $looked_up` -ne $num_sids ]; then
+		echo "expected $num_sids SIDs looked up, " \
+		     "got `expr $new_looked_up - $looked_up`"
+		return 1
+	fi
+	return 0
+}
+
+# Repeat until the clients overlapped at least once
+waited_on_flight() {
+	for round in 1 2 3 4 5 6 7 8 9 10; do
+		concurrent_round || return 1
+		if [ $new_deduplicated -gt $deduplicated ]; then
+			echo "round $round: `expr $new_deduplicated - $deduplicated` SIDs waited on a flight"
+			return 0
+		fi
+	done
+	echo "no client ever waited on another one's lookup"
+	return 1
+}
+
+testit "concurrent sids2xids wait on one lookup" waited_on_flight || failed=`expr $failed + 1`
+
+testit "flush caches again" flush_caches || failed=`expr $failed + 1`
+
+exit $failed
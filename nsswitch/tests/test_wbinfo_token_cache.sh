@@ -0,0 +1,84 @@
+#!/bin/sh
+# Test that winbindd's token cache does not hide group changes once
+# the user logs on again: get a token, change the groups, log on, and
+# get the token again.
+if [ $# -lt 3 ]; then
+	echo Usage: $0 SERVER USERNAME PASSWORD
+	exit 1
+fi
+
+SERVER="$1"
+USERNAME="$2"
+PASSWORD="$3"
+shift 3
+
+wbinfo="$VALGRIND $BINDIR/wbinfo"
+samba_tool="$VALGRIND $BINDIR/samba-tool"
+
+TESTUSER=tokencacheuser
+TESTPASS=Pa55w0rd.tokencache
+TESTGROUP=tokencachegroup
+
+failed=0
+
+. `dirname $0`/../../testprogs/blackbox/subunit.sh
+
+st() {
+	$samba_tool "$@" -H ldap://$SERVER -U"$USERNAME%$PASSWORD"
+}
+
+domain=`$wbinfo --own-domain`
+sep=`$wbinfo --separator`
+
+cleanup() {
+	st user delete $TESTUSER >/dev/null 2>&1
+	st group delete $TESTGROUP >/dev/null 2>&1
+}
+
+cleanup
+
+testit "create user" st user create $TESTUSER $TESTPASS || failed=`expr $failed + 1`
+testit "create group" st group add $TESTGROUP || failed=`expr $failed + 1`
+
+user_sid=`$wbinfo -n "$domain$sep$TESTUSER" | cut -d' ' -f1`
+group_sid=`$wbinfo -n "$domain$sep$TESTGROUP" | cut -d' ' -f1`
+echo "user $user_sid, group $group_sid"
+
+testit "logon" $wbinfo -a "$domain$sep$TESTUSER%$TESTPASS" || failed=`expr $failed + 1`
+
+# The second call is answered from the cache
+token_without_group() {
+	for i in 1 2; do
+		sids=`$wbinfo --user-sids=$user_sid` || return 1
+		if echo "$sids" | grep -q "^$group_sid$"; then
+			echo "$group_sid in the token too early"
+			return 1
+		fi
+	done
+	return 0
+}
+
+testit "token without the group" token_without_group || failed=`expr $failed + 1`
+
+testit "add to group" st group addmembers $TESTGROUP $TESTUSER || failed=`expr $failed + 1`
+
+# The new membership only reaches winbindd with the next logon
+sleep 1
+
+testit "logon again" $wbinfo -a "$domain$sep$TESTUSER%$TESTPASS" || failed=`expr $failed + 1`
+
+token_with_group() {
+	sids=`$wbinfo --user-sids=$user_sid` || return 1
+	if ! echo "$sids" | grep -q "^$group_sid$"; then
+		echo "$group_sid missing from the token:"
+		echo "$sids"
+		return 1
+	fi
+	return 0
+}
+
+testit "token with the group" token_with_group || failed=`expr $failed + 1`
+
+cleanup
+
+exit $failed
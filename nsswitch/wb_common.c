@@ -25,7 +25,11 @@
 
 #include "replace.h"
 #include "system/select.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/time.h"
 #include "winbind_client.h"
+#include "winbind_nss_cache.h"
 
 /* Global context */
 
@@ -41,6 +45,16 @@ static struct winbindd_context wb_global_ctx = {
 	.our_pid = 0
 };
 
+/* Mapping of winbindd's passwd and group cache, used with wb_global_ctx */
+
+static struct winbindd_nss_cache_map {
+	void *ptr;
+	size_t size;
+	time_t last_open;
+} wb_nss_cache_map;
+
+static void winbind_nss_cache_unmap(void);
+
 /* Free a response structure */
 
 void winbindd_free_response(struct winbindd_response *response)
@@ -94,6 +108,7 @@ __attribute__((destructor))
 static void winbind_destructor(void)
 {
 	winbind_close_sock(&wb_global_ctx);
+	winbind_nss_cache_unmap();
 }
 
 #define CONNECT_TIMEOUT 30
@@ -434,6 +449,266 @@ static int winbind_open_pipe_sock(struct winbindd_context *ctx,
 #endif /* HAVE_UNIXSOCKET */
 }
 
+#ifdef WINBINDD_NSS_CACHE_BARRIER
+
+static void winbind_nss_cache_unmap(void)
+{
+	if (wb_nss_cache_map.ptr != NULL) {
+		munmap(wb_nss_cache_map.ptr, wb_nss_cache_map.size);
+		wb_nss_cache_map.ptr = NULL;
+		wb_nss_cache_map.size = 0;
+	}
+}
+
+/*
+ * Map the cache file published by winbindd. Like the socket, it is
+ * only trusted if it is owned by root and nobody else can write it.
+ */
+
+static bool winbind_nss_cache_map(void)
+{
+	const struct winbindd_nss_cache_header *hdr;
+	char path[PATH_MAX];
+	struct stat st;
+	size_t size;
+	void *ptr;
+	int fd;
+	int ret;
+
+	ret = snprintf(path, sizeof(path), "%s/%s",
+		       winbindd_socket_dir(), WINBINDD_NSS_CACHE_NAME);
+	if ((ret == -1) || (ret >= sizeof(path))) {
+		return false;
+	}
+
+	fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+	if (fd == -1) {
+		return false;
+	}
+
+	ret = fstat(fd, &st);
+	if ((ret == -1) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_mode & (S_IWGRP|S_IWOTH)) != 0) ||
+	    !winbind_privileged_pipe_is_root(st.st_uid) ||
+	    (st.st_size < sizeof(struct winbindd_nss_cache_header))) {
+		close(fd);
+		return false;
+	}
+
+	size = st.st_size;
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		return false;
+	}
+
+	hdr = (const struct winbindd_nss_cache_header *)ptr;
+
+	if ((hdr->magic != WINBINDD_NSS_CACHE_MAGIC) ||
+	    (hdr->version != WINBINDD_NSS_CACHE_VERSION) ||
+	    (hdr->slot_size != WINBINDD_NSS_CACHE_SLOT_SIZE) ||
+	    (hdr->num_slots == 0) ||
+	    (size != sizeof(*hdr) +
+		     (size_t)hdr->num_slots * WINBINDD_NSS_CACHE_SLOT_SIZE)) {
+		munmap(ptr, size);
+		return false;
+	}
+
+	wb_nss_cache_map.ptr = ptr;
+	wb_nss_cache_map.size = size;
+	return true;
+}
+
+/*
+ * winbindd changes the file under our feet. The fields it changes are
+ * polled through a volatile access, everything else is copied between
+ * barriers and checked against the sequence number of the slot.
+ */
+
+static uint32_t winbind_nss_cache_read_u32(const uint32_t *p)
+{
+	return *(const volatile uint32_t *)p;
+}
+
+static const struct winbindd_nss_cache_header *winbind_nss_cache_get(void)
+{
+	const struct winbindd_nss_cache_header *hdr;
+	time_t now;
+
+	hdr = wb_nss_cache_map.ptr;
+	if ((hdr != NULL) && (winbind_nss_cache_read_u32(&hdr->valid) != 0)) {
+		return hdr;
+	}
+
+	/*
+	 * winbindd replaced the file or is not running. Don't look
+	 * for a new file more than once a second.
+	 */
+
+	now = time(NULL);
+	if (now == wb_nss_cache_map.last_open) {
+		return NULL;
+	}
+	wb_nss_cache_map.last_open = now;
+
+	winbind_nss_cache_unmap();
+	if (!winbind_nss_cache_map()) {
+		return NULL;
+	}
+
+	hdr = wb_nss_cache_map.ptr;
+	if (winbind_nss_cache_read_u32(&hdr->valid) == 0) {
+		return NULL;
+	}
+	return hdr;
+}
+
+/*
+ * Copy one slot out of the cache, returns false if the slot does not
+ * hold a current answer for the key or winbindd changed it meanwhile.
+ */
+
+static bool winbind_nss_cache_read_slot(const uint8_t *p,
+					int cmd, uint32_t hash,
+					const char *key, int key_len,
+					struct winbindd_response *response)
+{
+	const struct winbindd_nss_cache_slot *slot =
+		(const struct winbindd_nss_cache_slot *)p;
+	struct winbindd_nss_cache_slot copy;
+	void *extra = NULL;
+	uint32_t seqnum;
+	int tries;
+
+	for (tries = 0; tries < 3; tries++) {
+		seqnum = winbind_nss_cache_read_u32(&slot->seqnum);
+		WINBINDD_NSS_CACHE_BARRIER();
+
+		if ((seqnum & 1) != 0) {
+			continue;
+		}
+
+		memcpy(&copy, slot, sizeof(copy));
+
+		if ((copy.cmd != cmd) || (copy.hash != hash) ||
+		    (copy.key_len != key_len) ||
+		    (memcmp(copy.key, key, key_len) != 0)) {
+			WINBINDD_NSS_CACHE_BARRIER();
+			if (winbind_nss_cache_read_u32(&slot->seqnum) != seqnum) {
+				continue;
+			}
+			return false;
+		}
+
+		if ((copy.expires <= time(NULL)) ||
+		    (copy.extra_len > WINBINDD_NSS_CACHE_MAX_EXTRA)) {
+			return false;
+		}
+
+		if (copy.extra_len != 0) {
+			extra = malloc(copy.extra_len);
+			if (extra == NULL) {
+				return false;
+			}
+			memcpy(extra, slot + 1, copy.extra_len);
+		}
+
+		WINBINDD_NSS_CACHE_BARRIER();
+		if (winbind_nss_cache_read_u32(&slot->seqnum) == seqnum) {
+			break;
+		}
+		SAFE_FREE(extra);
+	}
+
+	if (tries == 3) {
+		return false;
+	}
+
+	ZERO_STRUCTP(response);
+	response->length = sizeof(struct winbindd_response) + copy.extra_len;
+	response->result = WINBINDD_OK;
+
+	switch (cmd) {
+	case WINBINDD_GETPWNAM:
+	case WINBINDD_GETPWUID:
+		response->data.pw = copy.data.pw;
+		break;
+	case WINBINDD_GETGRNAM:
+	case WINBINDD_GETGRGID:
+		response->data.gr = copy.data.gr;
+		break;
+	case WINBINDD_GETGROUPS:
+		response->data.num_entries = copy.num_entries;
+		break;
+	}
+	response->extra_data.data = extra;
+
+	return true;
+}
+
+/*
+ * Answer a request from winbindd's cache if possible. Misses and
+ * expired entries go to winbindd over the socket as before.
+ */
+
+static bool winbind_nss_cache_lookup(int req_type,
+				     const struct winbindd_request *request,
+				     struct winbindd_response *response)
+{
+	const struct winbindd_nss_cache_header *hdr;
+	const uint8_t *slots;
+	char key[FSTRING_LEN];
+	int key_len;
+	uint32_t hash;
+	uint32_t i;
+
+	if ((request == NULL) || (response == NULL) || winbind_env_set()) {
+		return false;
+	}
+
+	key_len = winbindd_nss_cache_key(req_type, request, key);
+	if (key_len == -1) {
+		return false;
+	}
+
+	hdr = winbind_nss_cache_get();
+	if (hdr == NULL) {
+		return false;
+	}
+
+	hash = winbindd_nss_cache_hash(req_type, key, key_len);
+	slots = (const uint8_t *)(hdr + 1);
+
+	for (i = 0; i < WINBINDD_NSS_CACHE_PROBES; i++) {
+		uint32_t idx = (hash + i) % hdr->num_slots;
+		const uint8_t *p = slots +
+			(size_t)idx * WINBINDD_NSS_CACHE_SLOT_SIZE;
+
+		if (winbind_nss_cache_read_slot(p, req_type, hash,
+						key, key_len, response)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#else
+
+static void winbind_nss_cache_unmap(void)
+{
+}
+
+static bool winbind_nss_cache_lookup(int req_type,
+				     const struct winbindd_request *request,
+				     struct winbindd_response *response)
+{
+	return false;
+}
+
+#endif /* WINBINDD_NSS_CACHE_BARRIER */
+
 /* Write data to winbindd socket */
 
 static int winbind_write_sock(struct winbindd_context *ctx, void *buffer,
@@ -723,6 +998,10 @@ NSS_STATUS winbindd_request_response(struct winbindd_context *ctx,
 
 	if (ctx == NULL) {
 		wb_ctx = &wb_global_ctx;
+
+		if (winbind_nss_cache_lookup(req_type, request, response)) {
+			return NSS_STATUS_SUCCESS;
+		}
 	}
 
 	status = winbindd_send_request(wb_ctx, req_type, 0, request);
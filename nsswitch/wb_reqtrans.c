@@ -169,7 +169,13 @@ struct tevent_req *wb_req_write_send(TALLOC_CTX *mem_ctx,
 		count = 2;
 	}
 
-	subreq = writev_send(state, ev, queue, fd, true, state->iov, count);
+	/*
+	 * A pipelined connection can have replies coming in while we
+	 * send, that's not the other end going away.
+	 */
+	subreq = writev_send(state, ev, queue, fd,
+			     (wb_req->wb_flags & WBFLAG_PIPELINED) == 0,
+			     state->iov, count);
 	if (tevent_req_nomem(subreq, req)) {
 		return tevent_req_post(req, ev);
 	}
@@ -207,6 +213,7 @@ ssize_t wb_req_write_recv(struct tevent_req *req, int *err)
 
 struct resp_read_state {
 	struct winbindd_response *wb_resp;
+	uint32_t request_id;
 	ssize_t ret;
 };
 
@@ -265,6 +272,7 @@ static void wb_resp_read_done(struct tevent_req *subreq)
 	}
 
 	state->wb_resp = (struct winbindd_response *)buf;
+	state->request_id = state->wb_resp->extra_data.request_id;
 
 	if (state->wb_resp->length > sizeof(struct winbindd_response)) {
 		state->wb_resp->extra_data.data =
@@ -288,17 +296,35 @@ ssize_t wb_resp_read_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
 	return state->ret;
 }
 
+ssize_t wb_resp_read_pipelined_recv(struct tevent_req *req,
+				    TALLOC_CTX *mem_ctx,
+				    struct winbindd_response **presp,
+				    uint32_t *request_id, int *err)
+{
+	struct resp_read_state *state = tevent_req_data(
+		req, struct resp_read_state);
+
+	if (tevent_req_is_unix_error(req, err)) {
+		return -1;
+	}
+	*request_id = state->request_id;
+	*presp = talloc_move(mem_ctx, &state->wb_resp);
+	return state->ret;
+}
+
 struct resp_write_state {
 	struct iovec iov[2];
+	struct winbindd_response hdr;
 	ssize_t ret;
 };
 
 static void wb_resp_write_done(struct tevent_req *subreq);
 
-struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
-				      struct tevent_context *ev,
-				      struct tevent_queue *queue, int fd,
-				      struct winbindd_response *wb_resp)
+static struct tevent_req *wb_resp_write_internal_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct tevent_queue *queue, int fd,
+	struct winbindd_response *wb_resp,
+	bool pipelined, uint32_t request_id)
 {
 	struct tevent_req *req, *subreq;
 	struct resp_write_state *state;
@@ -312,6 +338,17 @@ struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
 	state->iov[0].iov_base = (void *)wb_resp;
 	state->iov[0].iov_len = sizeof(struct winbindd_response);
 
+	if (pipelined) {
+		/*
+		 * The extra_data pointer means nothing to the client,
+		 * send the request_id in its place.
+		 */
+		state->hdr = *wb_resp;
+		state->hdr.extra_data.padding = 0;
+		state->hdr.extra_data.request_id = request_id;
+		state->iov[0].iov_base = (void *)&state->hdr;
+	}
+
 	if (wb_resp->length > sizeof(struct winbindd_response)) {
 		state->iov[1].iov_base = (void *)wb_resp->extra_data.data;
 		state->iov[1].iov_len =
@@ -319,7 +356,9 @@ struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
 		count = 2;
 	}
 
-	subreq = writev_send(state, ev, queue, fd, true, state->iov, count);
+	/* Pipelining clients send while we reply */
+	subreq = writev_send(state, ev, queue, fd, !pipelined,
+			     state->iov, count);
 	if (tevent_req_nomem(subreq, req)) {
 		return tevent_req_post(req, ev);
 	}
@@ -327,6 +366,24 @@ struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
 	return req;
 }
 
+struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
+				      struct tevent_context *ev,
+				      struct tevent_queue *queue, int fd,
+				      struct winbindd_response *wb_resp)
+{
+	return wb_resp_write_internal_send(mem_ctx, ev, queue, fd, wb_resp,
+					   false, 0);
+}
+
+struct tevent_req *wb_resp_write_pipelined_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct tevent_queue *queue, int fd,
+	struct winbindd_response *wb_resp, uint32_t request_id)
+{
+	return wb_resp_write_internal_send(mem_ctx, ev, queue, fd, wb_resp,
+					   true, request_id);
+}
+
 static void wb_resp_write_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
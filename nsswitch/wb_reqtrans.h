@@ -44,11 +44,19 @@ struct tevent_req *wb_resp_read_send(TALLOC_CTX *mem_ctx,
 				     struct tevent_context *ev, int fd);
 ssize_t wb_resp_read_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
 			  struct winbindd_response **presp, int *err);
+ssize_t wb_resp_read_pipelined_recv(struct tevent_req *req,
+				    TALLOC_CTX *mem_ctx,
+				    struct winbindd_response **presp,
+				    uint32_t *request_id, int *err);
 
 struct tevent_req *wb_resp_write_send(TALLOC_CTX *mem_ctx,
 				      struct tevent_context *ev,
 				      struct tevent_queue *queue, int fd,
 				      struct winbindd_response *wb_resp);
+struct tevent_req *wb_resp_write_pipelined_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct tevent_queue *queue, int fd,
+	struct winbindd_response *wb_resp, uint32_t request_id);
 ssize_t wb_resp_write_recv(struct tevent_req *req, int *err);
 
 struct tevent_req *wb_simple_trans_send(TALLOC_CTX *mem_ctx,
@@ -0,0 +1,121 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Layout of the passwd and group cache winbindd shares with its clients
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NSSWITCH_WINBIND_NSS_CACHE_H_
+#define _NSSWITCH_WINBIND_NSS_CACHE_H_
+
+/*
+ * The winbindd parent publishes its answers to getpwnam, getpwuid,
+ * getgrnam, getgrgid and getgroups requests in a file next to its
+ * public socket. The nss modules map it read-only and answer repeated
+ * lookups from it without a round trip over the socket.
+ *
+ * The file is a header followed by a hash table of fixed size slots.
+ * Only winbindd writes. The sequence number of a slot is odd while
+ * winbindd writes it, a reader that sees an odd or a changed
+ * sequence number around its copy of the slot throws the copy away.
+ */
+
+#define WINBINDD_NSS_CACHE_NAME "nsscache"
+#define WINBINDD_NSS_CACHE_MAGIC 0x434e4257 /* "WBNC" */
+#define WINBINDD_NSS_CACHE_VERSION 1
+#define WINBINDD_NSS_CACHE_SLOT_SIZE 4096
+#define WINBINDD_NSS_CACHE_PROBES 4
+
+#if defined(HAVE_MMAP) && defined(HAVE___SYNC_FETCH_AND_ADD)
+#define WINBINDD_NSS_CACHE_BARRIER() __sync_synchronize()
+#endif
+
+struct winbindd_nss_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	/* cleared when winbindd exits or replaces the file */
+	uint32_t valid;
+	uint32_t padding;
+};
+
+struct winbindd_nss_cache_slot {
+	uint32_t seqnum;
+	uint32_t cmd;		/* 0 for an unused slot */
+	uint64_t expires;
+	uint32_t hash;
+	uint32_t key_len;
+	uint32_t num_entries;
+	uint32_t extra_len;	/* extra data follows the slot */
+	char key[FSTRING_LEN];
+	union {
+		struct winbindd_pw pw;
+		struct winbindd_gr gr;
+	} data;
+};
+
+#define WINBINDD_NSS_CACHE_MAX_EXTRA \
+	(WINBINDD_NSS_CACHE_SLOT_SIZE - sizeof(struct winbindd_nss_cache_slot))
+
+/*
+ * Fill in the cache key of a request, returns the length of the key
+ * or -1 if answers to this request are not cached.
+ */
+static inline int winbindd_nss_cache_key(int cmd,
+					 const struct winbindd_request *request,
+					 char key[FSTRING_LEN])
+{
+	int len;
+
+	switch (cmd) {
+	case WINBINDD_GETPWNAM:
+	case WINBINDD_GETGROUPS:
+		len = snprintf(key, FSTRING_LEN, "%s", request->data.username);
+		break;
+	case WINBINDD_GETGRNAM:
+		len = snprintf(key, FSTRING_LEN, "%s", request->data.groupname);
+		break;
+	case WINBINDD_GETPWUID:
+		len = snprintf(key, FSTRING_LEN, "%u",
+			       (unsigned int)request->data.uid);
+		break;
+	case WINBINDD_GETGRGID:
+		len = snprintf(key, FSTRING_LEN, "%u",
+			       (unsigned int)request->data.gid);
+		break;
+	default:
+		return -1;
+	}
+
+	if ((len <= 0) || (len >= FSTRING_LEN)) {
+		return -1;
+	}
+	return len;
+}
+
+static inline uint32_t winbindd_nss_cache_hash(int cmd, const char *key,
+					       int key_len)
+{
+	uint32_t hash = 0x811c9dc5 ^ (uint32_t)cmd;
+	int i;
+
+	for (i = 0; i < key_len; i++) {
+		hash = (hash ^ (uint8_t)key[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+#endif /* _NSSWITCH_WINBIND_NSS_CACHE_H_ */
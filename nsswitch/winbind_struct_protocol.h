@@ -58,8 +58,10 @@ typedef char fstring[FSTRING_LEN];
  *     removed WINBINDD_SID_TO_GID
  *     removed WINBINDD_GID_TO_SID
  *     removed WINBINDD_UID_TO_SID
+ * 29: added WBFLAG_PIPELINED
+ *     replaced original_cmd by request_id
  */
-#define WINBIND_INTERFACE_VERSION 28
+#define WINBIND_INTERFACE_VERSION 29
 
 /* Have to deal with time_t being 4 or 8 bytes due to structure alignment.
    On a 64bit Linux box, we have to support a constant structure size
@@ -226,6 +228,12 @@ typedef struct winbindd_gr {
 /* Flag to tell winbind the NTLMv2 blob is too big for the struct and is in the
  * extra_data field */
 #define WBFLAG_BIG_NTLMV2_BLOB		0x00010000
+/*
+ * Generic flag: the client may send further requests before this one
+ * is answered. Replies can come in any order, they carry the
+ * request_id of the request in the extra_data field of the header.
+ */
+#define WBFLAG_PIPELINED		0x00020000
 
 #define WINBINDD_MAX_EXTRA_DATA (128*1024)
 
@@ -242,8 +250,7 @@ typedef struct winbindd_gr {
 struct winbindd_request {
 	uint32_t length;
 	enum winbindd_cmd cmd;   /* Winbindd command to execute */
-	enum winbindd_cmd original_cmd;   /* Original Winbindd command
-					     issued to parent process */
+	uint32_t request_id;     /* Matches the reply with WBFLAG_PIPELINED */
 	pid_t pid;               /* pid of calling process */
 	uint32_t wb_flags;       /* generic flags */
 	uint32_t flags;          /* flags relevant *only* to a given request */
@@ -508,6 +515,7 @@ struct winbindd_response {
 	union {
 		SMB_TIME_T padding;
 		void *data;
+		uint32_t request_id;	/* on the wire, with WBFLAG_PIPELINED */
 	} extra_data;
 };
 
@@ -80,6 +80,28 @@ sub has_fast_array($$)
 	return ($t->{NAME} eq "uint8") or ($t->{NAME} eq "string");
 }
 
+# Allocated uint8 arrays are pulled with ndr_pull_array_uint8_ptr(),
+# which lets them point into the input buffer in no_copy mode.
+sub ArrayPullByReference($$)
+{
+	my ($e,$l) = @_;
+
+	return 0 unless has_fast_array($e,$l);
+	return 0 unless ArrayDynamicallyAllocated($e,$l);
+	return 0 if is_charset_array($e,$l);
+	return 0 if $l->{IS_ZERO_TERMINATED};
+
+	my $nl = GetNextLevel($e,$l);
+	return 0 unless (getType($nl->{DATA_TYPE})->{NAME} eq "uint8");
+
+	# [ref] arrays may be allocated by the caller
+	my $pl = GetPrevLevel($e,$l);
+	return 0 if (defined($pl) and $pl->{TYPE} eq "POINTER" and
+		     $pl->{POINTER_TYPE} eq "ref");
+
+	return 1;
+}
+
 
 ####################################
 # pidl() is our basic output routine
@@ -461,7 +483,8 @@ sub ParseArrayPullHeader($$$$$$)
 		$self->defer("}");
 	}
 
-	if (ArrayDynamicallyAllocated($e,$l) and not is_charset_array($e,$l)) {
+	if (ArrayDynamicallyAllocated($e,$l) and not is_charset_array($e,$l)
+	    and not ArrayPullByReference($e,$l)) {
 		$self->AllocateArrayLevel($e,$l,$ndr,$var_name,$array_size);
 	}
 
@@ -1159,6 +1182,11 @@ sub ParseElementPullLevel
 				if ($l->{IS_ZERO_TERMINATED}) {
 					$self->CheckStringTerminator($ndr,$e,$l,$length);
 				}
+				if (ArrayPullByReference($e,$l)) {
+					my $size = "size_$e->{NAME}_$l->{LEVEL_INDEX}";
+					$self->pidl("NDR_CHECK(ndr_pull_array_uint8_ptr($ndr, $ndr_flags, ".get_pointer_to($var_name).", $size, $length));");
+					return;
+				}
 				$self->pidl("NDR_CHECK(ndr_pull_array_$nl->{DATA_TYPE}($ndr, $ndr_flags, $var_name, $length));");
 				return;
 			}
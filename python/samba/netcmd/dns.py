@@ -31,7 +31,7 @@ from samba.netcmd import (
     Option,
     SuperCommand,
     )
-from samba.dcerpc import dnsp, dnsserver
+from samba.dcerpc import dnsp, dnsserver, irpc
 
 
 def dns_connect(server, lp, creds):
@@ -1226,6 +1226,37 @@ class cmd_delete_record(Command):
         self.outf.write('Record deleted successfully\n')
 
 
+class cmd_cachestats(Command):
+    """Show the cache statistics of the local internal DNS server."""
+
+    synopsis = '%prog [options]'
+
+    takes_optiongroups = {
+        "sambaopts": options.SambaOptions,
+        "versionopts": options.VersionOptions,
+    }
+
+    def run(self, sambaopts=None, versionopts=None):
+        lp = sambaopts.get_loadparm()
+        try:
+            conn = irpc.irpc("irpc:dnssrv", lp_ctx=lp)
+            stats = conn.dnssrv_information(irpc.DNSSRV_INFO_CACHE_STATISTICS)
+        except RuntimeError, e:
+            raise CommandError('Failed to query the DNS server, is it '
+                               'running on this host?', e)
+
+        fields = [("records_entries", "Cached names"),
+                  ("records_hits", "Name hits"),
+                  ("records_misses", "Name misses"),
+                  ("forwarded_entries", "Cached forwarded answers"),
+                  ("forwarded_hits", "Forwarded hits"),
+                  ("forwarded_negative_hits", "Forwarded negative hits"),
+                  ("forwarded_misses", "Forwarded misses"),
+                  ("forwarded_shared", "Shared forwarder queries")]
+        for (field, description) in fields:
+            self.outf.write('%-28s: %d\n' % (description, getattr(stats, field)))
+
+
 class cmd_dns(SuperCommand):
     """Domain Name Service (DNS) management."""
 
@@ -1240,3 +1271,4 @@ class cmd_dns(SuperCommand):
     subcommands['add'] = cmd_add_record()
     subcommands['update'] = cmd_update_record()
     subcommands['delete'] = cmd_delete_record()
+    subcommands['cachestats'] = cmd_cachestats()
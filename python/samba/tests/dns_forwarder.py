@@ -603,4 +603,100 @@ class TestDnsForwarding(DNSTest):
         except socket.timeout:
             self.fail("DNS server is too slow (timeout %s)" % timeout)
 
+    def get_cache_stats(self):
+        "Helper returning the counters of samba-tool dns cachestats"
+        samba_tool = os.path.join(samba.source_tree_topdir(),
+                                  'bin/samba-tool')
+        out = subprocess.check_output([samba_tool, "dns", "cachestats",
+                                       "--configfile=%s" % self.lp.configfile])
+
+        stats = {}
+        for line in out.splitlines():
+            (description, value) = line.rsplit(":", 1)
+            stats[description.strip()] = int(value)
+        return stats
+
+    def send_forwarded_query(self, name):
+        "Helper sending a query the server has to forward"
+        p = self.make_name_packet(dns.DNS_OPCODE_QUERY)
+        q = self.make_name_question(name, dns.DNS_QTYPE_CNAME,
+                                    dns.DNS_QCLASS_IN)
+        self.finish_name_packet(p, [q])
+        p.operation |= dns.DNS_FLAG_RECURSION_DESIRED
+
+        ad = contact_real_server(server_ip, 53)
+        ad.settimeout(timeout or 5)
+        ad.send(ndr.ndr_pack(p), 0)
+        return ad
+
+    def recv_forwarded_answer(self, ad):
+        "Helper reading the answer to send_forwarded_query()"
+        try:
+            data = ad.recv(0xffff + 2, 0)
+        except socket.timeout:
+            self.fail("DNS server is too slow (timeout %s)" % timeout)
+        return ndr.ndr_unpack(dns.name_packet, data)
+
+    def test_cached_answer(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        s.send('ttl 900', 0)
+        name = "cached%d.dsfsdfs" % random.randint(0, 0xffffffff)
+
+        before = self.get_cache_stats()
+
+        data = self.recv_forwarded_answer(self.send_forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual('forwarder1', data.answers[0].rdata)
+
+        # the forwarder stops answering, the cache still does
+        s.send('timeout 1000000', 0)
+        data = self.recv_forwarded_answer(self.send_forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual('forwarder1', data.answers[0].rdata)
+        self.assertTrue(data.answers[0].ttl <= 900)
+
+        after = self.get_cache_stats()
+        self.assertEqual(after["Forwarded misses"],
+                         before["Forwarded misses"] + 1)
+        self.assertEqual(after["Forwarded hits"],
+                         before["Forwarded hits"] + 1)
+        self.assertTrue(after["Cached forwarded answers"] >= 1)
+
+    def test_uncacheable_answer(self):
+        # the toy server answers with a TTL of 0
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        name = "uncached%d.dsfsdfs" % random.randint(0, 0xffffffff)
+
+        before = self.get_cache_stats()
+
+        for i in range(2):
+            ad = self.send_forwarded_query(name)
+            data = self.recv_forwarded_answer(ad)
+            self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+            self.assertEqual('forwarder1', data.answers[0].rdata)
+
+        after = self.get_cache_stats()
+        self.assertEqual(after["Forwarded misses"],
+                         before["Forwarded misses"] + 2)
+        self.assertEqual(after["Forwarded hits"], before["Forwarded hits"])
+
+    def test_shared_forwarder_query(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        s.send('timeout 1', 0)
+        name = "shared%d.dsfsdfs" % random.randint(0, 0xffffffff)
+
+        before = self.get_cache_stats()
+
+        # the second query arrives while the first is still outstanding
+        ad1 = self.send_forwarded_query(name)
+        ad2 = self.send_forwarded_query(name)
+        for ad in (ad1, ad2):
+            data = self.recv_forwarded_answer(ad)
+            self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+            self.assertEqual('forwarder1', data.answers[0].rdata)
+
+        after = self.get_cache_stats()
+        self.assertEqual(after["Shared forwarder queries"],
+                         before["Shared forwarder queries"] + 1)
+
 TestProgram(module=__name__, opts=subunitopts)
@@ -35,6 +35,8 @@ def debug(msg):
         sys.stdout.flush()
 
 timeout = 0
+# answers with a TTL of 0 are not cached by the server we forward for
+ttl = 0
 
 
 def answer_question(data, question):
@@ -42,7 +44,7 @@ def answer_question(data, question):
     r.name = question.name
     r.rr_type = dns.DNS_QTYPE_CNAME
     r.rr_class = dns.DNS_QCLASS_IN
-    r.ttl = 900
+    r.ttl = ttl
     r.length = 0xffff
     r.rdata = SERVER_ID
     return r
@@ -81,6 +83,13 @@ class DnsHandler(SocketServer.BaseRequestHandler):
             debug("timing out at %s" % timeout)
             return
 
+        global ttl
+        m = re.match('^ttl\s+(\d+)$', data.strip())
+        if m:
+            ttl = int(m.group(1))
+            debug("answering with a TTL of %s" % ttl)
+            return
+
         t = Timer(timeout, self.really_handle, [data, socket])
         t.start()
 
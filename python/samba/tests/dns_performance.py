@@ -0,0 +1,205 @@
+# Unix SMB/CIFS implementation.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Query rate of the internal DNS server for names it is authoritative for.
+
+The first query for a name reads the records from the directory, repeated
+queries are answered from the DNS server's record cache. The update tests
+check that the cache never hides a change made through DNS or RPC.
+"""
+
+import sys
+import time
+import random
+import socket
+import samba.ndr as ndr
+from samba import credentials
+from samba.tests import TestCase
+from samba.dcerpc import dns, dnsp, dnsserver
+from samba.netcmd.dns import data_to_dns_record
+from samba.tests.subunitrun import SubunitOptions, TestProgram
+import samba.getopt as options
+import optparse
+
+parser = optparse.OptionParser("dns_performance.py <server name> <server ip> [options]")
+sambaopts = options.SambaOptions(parser)
+parser.add_option_group(sambaopts)
+parser.add_option("--timeout", type="int", dest="timeout", default=5,
+                  help="Specify timeout for DNS requests")
+parser.add_option("--queries", type="int", dest="queries", default=2000,
+                  help="Number of queries to send per test")
+
+credopts = options.CredentialsOptions(parser)
+parser.add_option_group(credopts)
+subunitopts = SubunitOptions(parser)
+parser.add_option_group(subunitopts)
+
+opts, args = parser.parse_args()
+
+if len(args) < 2:
+    parser.print_usage()
+    sys.exit(1)
+
+lp = sambaopts.get_loadparm()
+creds = credopts.get_credentials(lp)
+creds.set_krb_forwardable(credentials.NO_KRB_FORWARDABLE)
+
+server_name = args[0]
+server_ip = args[1]
+
+
+class DNSPerformanceTest(TestCase):
+
+    def setUp(self):
+        super(DNSPerformanceTest, self).setUp()
+        self.server = server_name
+        self.server_ip = server_ip
+        self.domain = creds.get_realm().lower()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, 0)
+        self.sock.settimeout(opts.timeout)
+        self.sock.connect((self.server_ip, 53))
+
+    def tearDown(self):
+        self.sock.close()
+        super(DNSPerformanceTest, self).tearDown()
+
+    def query(self, name, qtype):
+        p = dns.name_packet()
+        p.id = random.randint(0x0, 0xffff)
+        p.operation = dns.DNS_OPCODE_QUERY
+        q = dns.name_question()
+        q.name = name
+        q.question_type = qtype
+        q.question_class = dns.DNS_QCLASS_IN
+        p.qdcount = 1
+        p.questions = [q]
+        self.sock.send(ndr.ndr_pack(p), 0)
+        return ndr.ndr_unpack(dns.name_packet, self.sock.recv(4096, 0))
+
+    def rcode(self, packet):
+        return packet.operation & 0x000F
+
+    def time_queries(self, label, names, qtype, rcode):
+        start = time.time()
+        for i in range(opts.queries):
+            r = self.query(names[i % len(names)], qtype)
+            self.assertEquals(self.rcode(r), rcode)
+        elapsed = time.time() - start
+        print("%s: %d queries in %.3fs (%.0f/s)" %
+              (label, opts.queries, elapsed, opts.queries / elapsed))
+
+    def test_query_host_a(self):
+        name = "%s.%s" % (self.server, self.domain)
+        self.time_queries("A %s" % name, [name], dns.DNS_QTYPE_A,
+                          dns.DNS_RCODE_OK)
+
+    def test_query_srv(self):
+        names = ["_ldap._tcp.%s" % self.domain,
+                 "_kerberos._tcp.%s" % self.domain,
+                 "_ldap._tcp.dc._msdcs.%s" % self.domain,
+                 "_gc._tcp.%s" % self.domain]
+        self.time_queries("SRV", names, dns.DNS_QTYPE_SRV, dns.DNS_RCODE_OK)
+
+    def test_query_nxdomain(self):
+        names = ["nonexistent-%d.%s" % (i, self.domain) for i in range(16)]
+        self.time_queries("NXDOMAIN", names, dns.DNS_QTYPE_A,
+                          dns.DNS_RCODE_NXDOMAIN)
+
+    def txt_answers(self, name):
+        r = self.query(name, dns.DNS_QTYPE_TXT)
+        if self.rcode(r) != dns.DNS_RCODE_OK:
+            return None
+        return [a.rdata.txt.str for a in r.answers]
+
+    def test_update_visible(self):
+        "a DNS update must be visible to the very next query"
+        prefix = "perfupdate%d" % random.randint(0, 100000)
+        name = "%s.%s" % (prefix, self.domain)
+
+        # make sure the negative answer is cached first
+        self.assertIsNone(self.txt_answers(name))
+        self.assertIsNone(self.txt_answers(name))
+
+        p = dns.name_packet()
+        p.id = random.randint(0x0, 0xffff)
+        p.operation = dns.DNS_OPCODE_UPDATE
+        u = dns.name_question()
+        u.name = self.domain
+        u.question_type = dns.DNS_QTYPE_SOA
+        u.question_class = dns.DNS_QCLASS_IN
+        p.qdcount = 1
+        p.questions = [u]
+
+        def txt_rec(rr_class, ttl, text):
+            r = dns.res_rec()
+            r.name = name
+            r.rr_type = dns.DNS_QTYPE_TXT
+            r.rr_class = rr_class
+            r.ttl = ttl
+            r.length = 0xffff
+            rdata = dns.txt_record()
+            s_list = dnsp.string_list()
+            s_list.count = 1
+            s_list.str = [text]
+            rdata.txt = s_list
+            r.rdata = rdata
+            return r
+
+        p.nscount = 1
+        p.nsrecs = [txt_rec(dns.DNS_QCLASS_IN, 900, "cached?")]
+        self.sock.send(ndr.ndr_pack(p), 0)
+        r = ndr.ndr_unpack(dns.name_packet, self.sock.recv(4096, 0))
+        self.assertEquals(self.rcode(r), dns.DNS_RCODE_OK)
+
+        try:
+            self.assertEquals(self.txt_answers(name), [["cached?"]])
+        finally:
+            p.id = random.randint(0x0, 0xffff)
+            p.nsrecs = [txt_rec(dns.DNS_QCLASS_NONE, 0, "cached?")]
+            self.sock.send(ndr.ndr_pack(p), 0)
+            self.sock.recv(4096, 0)
+
+        self.assertIsNone(self.txt_answers(name))
+
+    def test_rpc_update_visible(self):
+        "a change made by another process must show up within a few seconds"
+        rpc_conn = dnsserver.dnsserver("ncacn_ip_tcp:%s[sign]" %
+                                       self.server_ip, lp, creds)
+        prefix = "perfrpc%d" % random.randint(0, 100000)
+        name = "%s.%s" % (prefix, self.domain)
+
+        self.assertIsNone(self.txt_answers(name))
+
+        rec = data_to_dns_record(dnsp.DNS_TYPE_TXT, '"cached?"')
+        buf = dnsserver.DNS_RPC_RECORD_BUF()
+        buf.rec = rec
+        rpc_conn.DnssrvUpdateRecord2(dnsserver.DNS_CLIENT_VERSION_LONGHORN,
+                                     0, self.server_ip, self.domain,
+                                     name, buf, None)
+        try:
+            start = time.time()
+            while self.txt_answers(name) is None:
+                self.assertTrue(time.time() - start < 5,
+                                "RPC update not visible over DNS")
+                time.sleep(0.1)
+            print("RPC update visible after %.2fs" % (time.time() - start))
+        finally:
+            rpc_conn.DnssrvUpdateRecord2(dnsserver.DNS_CLIENT_VERSION_LONGHORN,
+                                         0, self.server_ip, self.domain,
+                                         name, None, buf)
+
+
+TestProgram(module=__name__, opts=subunitopts)
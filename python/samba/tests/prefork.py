@@ -0,0 +1,72 @@
+# Unix SMB/CIFS implementation.
+#
+# Tests for the prefork process model
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Tests for the prefork process model, run against the preforkdc
+environment which starts samba with "prefork:children = 3"."""
+
+import ldb
+import samba.tests
+from samba.messaging import Messaging
+from samba.samdb import SamDB
+from samba.auth import system_session
+
+NUM_CHILDREN = 3
+
+
+class PreforkTests(samba.tests.TestCase):
+
+    def setUp(self):
+        super(PreforkTests, self).setUp()
+        self.lp = samba.tests.env_loadparm()
+        self.msg_ctx = Messaging(lp_ctx=self.lp)
+        self.server = samba.tests.env_get_var_value("SERVER")
+
+    def task_pids(self, name):
+        """The pids of the task processes registered under name,
+        connections register with a non-zero task_id"""
+        ids = self.msg_ctx.irpc_servers_byname(name)
+        return set(i.pid for i in ids if i.task_id == 0)
+
+    def test_workers_registered(self):
+        """every worker takes over the irpc names of its task"""
+        for name in ["ldap_server", "kdc_server"]:
+            pids = self.task_pids(name)
+            self.assertEqual(len(pids), NUM_CHILDREN,
+                             "%s is served by %s" % (name, pids))
+
+    def test_parallel_ldap(self):
+        """several LDAP connections at once are all served, by the
+        workers rather than the master"""
+        workers = self.task_pids("ldap_server")
+        conns = []
+        for i in range(NUM_CHILDREN * 3):
+            conns.append(SamDB(url="ldap://%s" % self.server,
+                               session_info=system_session(),
+                               credentials=self.get_credentials(),
+                               lp=self.lp))
+        for samdb in conns:
+            res = samdb.search(base=samdb.domain_dn(),
+                               scope=ldb.SCOPE_BASE,
+                               attrs=["objectGUID"])
+            self.assertEqual(len(res), 1)
+
+        ids = self.msg_ctx.irpc_servers_byname("ldap_server")
+        for i in ids:
+            if i.task_id != 0:
+                self.assertTrue(i.pid in workers,
+                                "connection served by %d" % i.pid)
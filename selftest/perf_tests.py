@@ -47,3 +47,11 @@ plantestsuite_loadlist("samba4.ldb.multi_connect.python(ad_dc_ntvfs)",
                                              "dsdb/tests/python/ad_dc_multi_bind.py"),
                         'tdb://$PREFIX_ABS/ad_dc_ntvfs/private/sam.ldb'
                         '$LOADLIST', '$LISTOPT'])
+
+plantestsuite_loadlist("samba.tests.dns_performance(fl2003dc:local)",
+                       "fl2003dc:local",
+                       [python, os.path.join(srcdir(),
+                                             "python/samba/tests/dns_performance.py"),
+                        '$SERVER', '$SERVER_IP', '-U"$USERNAME%$PASSWORD"',
+                        '--workgroup=$DOMAIN',
+                        '$LOADLIST', '$LISTOPT'])
@@ -317,6 +317,8 @@ sub setup_nt4_member($$$)
 	security = domain
 	dbwrap_tdb_mutexes:* = yes
 	${require_mutexes}
+	winbind max domain connections = 3
+	winbindd:domain child idle timeout = 5
 ";
 	my $ret = $self->provision($prefix,
 				   "LOCALNT4MEMBER3",
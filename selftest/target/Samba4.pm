@@ -1440,9 +1440,15 @@ sub provision_fl2000dc($$)
 	my ($self, $prefix) = @_;
 
 	print "PROVISIONING DC WITH FOREST LEVEL 2000...\n";
+	# The winbindd auth cache is off by default. It is enabled here
+	# for samba4.blackbox.wbinfo_auth_cache, so all other tests
+	# against fl2000dc run with a cache of plaintext logons as well.
+	# The time has to cover the password changes that test does over
+	# LDAP, tests.py passes the same value to it.
 	my $extra_conf_options = "
 	spnego:simulate_w2k=yes
 	ntlmssp_server:force_old_spnego=yes
+	winbindd:auth cache time = 60
 ";
 	my $ret = $self->provision($prefix,
 				   "domain controller",
@@ -1475,6 +1481,45 @@ sub provision_fl2000dc($$)
 	return $ret;
 }
 
+sub provision_preforkdc($$)
+{
+	my ($self, $prefix) = @_;
+
+	print "PROVISIONING DC WITH THE PREFORK PROCESS MODEL...\n";
+	my $extra_conf_options = "
+	prefork:children = 3
+";
+	my $ret = $self->provision($prefix,
+				   "domain controller",
+				   "preforkdc",
+				   "PREFORKDOMAIN",
+				   "preforkdomain.samba.example.com",
+				   "2008",
+				   "locDCpass9",
+				   undef,
+				   undef,
+				   $extra_conf_options,
+				   "",
+				   undef);
+	unless ($ret) {
+		return undef;
+	}
+
+	unless($self->add_wins_config("$prefix/private")) {
+		warn("Unable to add wins configuration");
+		return undef;
+	}
+	$ret->{DC_SERVER} = $ret->{SERVER};
+	$ret->{DC_SERVER_IP} = $ret->{SERVER_IP};
+	$ret->{DC_SERVER_IPV6} = $ret->{SERVER_IPV6};
+	$ret->{DC_NETBIOSNAME} = $ret->{NETBIOSNAME};
+	$ret->{DC_USERNAME} = $ret->{USERNAME};
+	$ret->{DC_PASSWORD} = $ret->{PASSWORD};
+	$ret->{DC_REALM} = $ret->{REALM};
+
+	return $ret;
+}
+
 sub provision_fl2003dc($$$)
 {
 	my ($self, $prefix, $dcvars) = @_;
@@ -2002,6 +2047,8 @@ sub setup_env($$$)
 		return $self->setup_ad_dc_ntvfs("$path/ad_dc_ntvfs");
 	} elsif ($envname eq "fl2000dc") {
 		return $self->setup_fl2000dc("$path/fl2000dc");
+	} elsif ($envname eq "preforkdc") {
+		return $self->setup_preforkdc("$path/preforkdc");
 	} elsif ($envname eq "fl2003dc") {
 		if (not defined($self->{vars}->{ad_dc})) {
 			$self->setup_ad_dc("$path/ad_dc");
@@ -2169,6 +2216,22 @@ sub setup_fl2000dc($$)
 	return $env;
 }
 
+sub setup_preforkdc($$)
+{
+	my ($self, $path) = @_;
+
+	my $env = $self->provision_preforkdc($path);
+	if (defined $env) {
+	        if (not defined($self->check_or_start($env, "prefork"))) {
+		        return undef;
+		}
+
+		$self->{vars}->{preforkdc} = $env;
+	}
+
+	return $env;
+}
+
 sub setup_fl2003dc($$$)
 {
 	my ($self, $path, $dc_vars) = @_;
@@ -342,6 +342,17 @@ struct pdb_search {
 	bool (*next_entry)(struct pdb_search *search,
 			   struct samr_displayentry *entry);
 	void (*search_end)(struct pdb_search *search);
+
+	/*
+	 * cache[] holds the entries [cache_start, num_entries), see
+	 * pdb_search_entries(). The search parameters are kept to be
+	 * able to restart a search that has been started with
+	 * pdb_search_users/groups/aliases.
+	 */
+	uint32_t cache_start;
+	bool restartable;
+	uint32_t acct_flags;
+	struct dom_sid sid;
 };
 
 struct pdb_domain_info {
@@ -418,6 +429,7 @@ enum pdb_policy_type {
  * Changed to 23, new idmap control functions
  * Changed to 24, removed uid_to_sid and gid_to_sid, replaced with id_to_sid
  * Leave at 24, add optional get_trusteddom_creds()
+ * Leave at 24, struct pdb_search only keeps a window of entries
  */
 
 #define PASSDB_INTERFACE_VERSION 24
@@ -26,6 +26,7 @@
 #include "system/glob.h"
 #include "util_tdb.h"
 #include "tdb_wrap/tdb_wrap.h"
+#include "../lib/util/memcache.h"
 
 #undef  DBGC_CLASS
 #define DBGC_CLASS DBGC_TDB
@@ -35,6 +36,16 @@
 static struct tdb_wrap *cache;
 static struct tdb_wrap *cache_notrans;
 
+/*
+ * In-memory tier in front of the two tdbs. It holds the parsed
+ * timeout and the payload of recently used entries. Both tdbs are
+ * opened with TDB_SEQNUM, the tier is only valid as long as their
+ * sequence numbers did not move behind our back.
+ */
+static struct memcache *gencache_ram;
+static int gencache_ram_seqnum = -1;
+static int gencache_ram_notrans_seqnum = -1;
+
 /**
  * @file gencache.c
  * @brief Generic, persistent and shared between processes cache mechanism
@@ -69,7 +80,7 @@ static bool gencache_init(void)
 	DEBUG(5, ("Opening cache file at %s\n", cache_fname));
 
 	cache = tdb_wrap_open(NULL, cache_fname, 0,
-			      TDB_DEFAULT|TDB_INCOMPATIBLE_HASH,
+			      TDB_DEFAULT|TDB_INCOMPATIBLE_HASH|TDB_SEQNUM,
 			      open_flags, 0644);
 	if (cache) {
 		int ret;
@@ -90,6 +101,7 @@ static bool gencache_init(void)
 			cache = tdb_wrap_open(NULL, cache_fname, 0,
 					      TDB_DEFAULT|
 					      TDB_INCOMPATIBLE_HASH|
+					      TDB_SEQNUM|
 					      TDB_CLEAR_IF_FIRST,
 					      open_flags, 0644);
 		}
@@ -98,7 +110,7 @@ static bool gencache_init(void)
 	if (!cache && (errno == EACCES)) {
 		open_flags = O_RDONLY;
 		cache = tdb_wrap_open(NULL, cache_fname, 0,
-				      TDB_DEFAULT|TDB_INCOMPATIBLE_HASH,
+				      TDB_DEFAULT|TDB_INCOMPATIBLE_HASH|TDB_SEQNUM,
 				      open_flags, 0644);
 		if (cache) {
 			DEBUG(5, ("gencache_init: Opening cache file %s read-only.\n", cache_fname));
@@ -123,6 +135,7 @@ static bool gencache_init(void)
 				      TDB_CLEAR_IF_FIRST|
 				      TDB_INCOMPATIBLE_HASH|
 				      TDB_NOSYNC|
+				      TDB_SEQNUM|
 				      TDB_MUTEX_LOCKING,
 				      open_flags, 0644);
 	if (cache_notrans == NULL) {
@@ -137,6 +150,153 @@ static bool gencache_init(void)
 	return true;
 }
 
+/*
+ * Make sure the in-memory tier only holds what the tdbs hold. Returns
+ * false if the tier is not in use.
+ */
+
+static bool gencache_ram_sync(void)
+{
+	int seqnum, notrans_seqnum;
+
+	if (gencache_ram == NULL) {
+		int size = lp_parm_int(-1, "gencache", "memory cache size",
+				       256 * 1024);
+		if (size <= 0) {
+			return false;
+		}
+		gencache_ram = memcache_init(NULL, size);
+		if (gencache_ram == NULL) {
+			return false;
+		}
+	}
+
+	seqnum = tdb_get_seqnum(cache->tdb);
+	notrans_seqnum = tdb_get_seqnum(cache_notrans->tdb);
+
+	if ((seqnum != gencache_ram_seqnum) ||
+	    (notrans_seqnum != gencache_ram_notrans_seqnum)) {
+		memcache_flush(gencache_ram, GENCACHE_RAM);
+		gencache_ram_seqnum = seqnum;
+		gencache_ram_notrans_seqnum = notrans_seqnum;
+	}
+
+	return true;
+}
+
+static void gencache_ram_store(TDB_DATA key, time_t timeout, DATA_BLOB blob)
+{
+	uint64_t t = timeout;
+	uint8_t *buf;
+
+	buf = talloc_array(talloc_tos(), uint8_t, sizeof(t) + blob.length);
+	if (buf == NULL) {
+		return;
+	}
+	memcpy(buf, &t, sizeof(t));
+	if (blob.length != 0) {
+		memcpy(buf + sizeof(t), blob.data, blob.length);
+	}
+
+	memcache_add(gencache_ram, GENCACHE_RAM,
+		     data_blob_const(key.dptr, key.dsize),
+		     data_blob_const(buf, talloc_get_size(buf)));
+	TALLOC_FREE(buf);
+}
+
+/*
+ * We just stored key in gencache_notrans, moving its sequence number
+ * by seqnum_delta. If nobody else wrote in the meantime, the rest of
+ * the tier stays valid.
+ */
+
+static void gencache_ram_wrote(TDB_DATA key, time_t timeout, DATA_BLOB blob,
+			       int seqnum_delta)
+{
+	int notrans_seqnum = tdb_get_seqnum(cache_notrans->tdb);
+
+	if (notrans_seqnum != gencache_ram_notrans_seqnum + seqnum_delta) {
+		/* The next gencache_ram_sync() flushes */
+		return;
+	}
+	gencache_ram_notrans_seqnum = notrans_seqnum;
+
+	gencache_ram_store(key, timeout, blob);
+}
+
+static int gencache_len_parser(TDB_DATA key, TDB_DATA data,
+			       void *private_data)
+{
+	size_t *len = private_data;
+	*len = data.dsize;
+	return 0;
+}
+
+/*
+ * Store into gencache_notrans such that we know how far the sequence
+ * number moves. tdb_storev() overwrites a record in place if the new
+ * data fits, otherwise it deletes the old record first, which counts
+ * as a change of its own. We can't see the room behind a record, so
+ * we delete a record that grows ourselves.
+ */
+
+static int gencache_notrans_storev(TDB_DATA key, const TDB_DATA *dbufs,
+				   int num_dbufs, int *seqnum_delta)
+{
+	size_t old_len = 0;
+	size_t new_len = 0;
+	int i, ret;
+
+	for (i=0; i<num_dbufs; i++) {
+		new_len += dbufs[i].dsize;
+	}
+
+	ret = tdb_chainlock(cache_notrans->tdb, key);
+	if (ret != 0) {
+		return -1;
+	}
+
+	*seqnum_delta = 1;
+
+	ret = tdb_parse_record(cache_notrans->tdb, key, gencache_len_parser,
+			       &old_len);
+	if ((ret == 0) && (new_len > old_len)) {
+		ret = tdb_delete(cache_notrans->tdb, key);
+		if (ret != 0) {
+			goto done;
+		}
+		*seqnum_delta = 2;
+	}
+
+	ret = tdb_storev(cache_notrans->tdb, key, dbufs, num_dbufs, 0);
+done:
+	tdb_chainunlock(cache_notrans->tdb, key);
+	return ret;
+}
+
+static bool gencache_ram_parse(TDB_DATA key,
+			       void (*parser)(time_t timeout, DATA_BLOB blob,
+					      void *private_data),
+			       void *private_data)
+{
+	DATA_BLOB val;
+	uint64_t t;
+
+	if (!memcache_lookup(gencache_ram, GENCACHE_RAM,
+			     data_blob_const(key.dptr, key.dsize), &val)) {
+		return false;
+	}
+	if (val.length < sizeof(t)) {
+		return false;
+	}
+	memcpy(&t, val.data, sizeof(t));
+
+	parser((time_t)t,
+	       data_blob_const(val.data + sizeof(t), val.length - sizeof(t)),
+	       private_data);
+	return true;
+}
+
 static TDB_DATA last_stabilize_key(void)
 {
 	TDB_DATA result;
@@ -281,6 +441,8 @@ bool gencache_set_data_blob(const char *keystr, const DATA_BLOB *blob,
 	time_t last_stabilize;
 	static int writecount;
 	TDB_DATA dbufs[2];
+	int seqnum_delta;
+	bool ram;
 
 	if (tdb_data_cmp(string_term_tdb_data(keystr),
 			 last_stabilize_key()) == 0) {
@@ -320,12 +482,19 @@ bool gencache_set_data_blob(const char *keystr, const DATA_BLOB *blob,
 		   (int)(timeout - time(NULL)), 
 		   timeout > time(NULL) ? "ahead" : "in the past"));
 
-	ret = tdb_storev(cache_notrans->tdb, string_term_tdb_data(keystr),
-			 dbufs, 2, 0);
+	ram = gencache_ram_sync();
+
+	ret = gencache_notrans_storev(string_term_tdb_data(keystr),
+				      dbufs, 2, &seqnum_delta);
 	if (ret != 0) {
 		return false;
 	}
 
+	if (ram) {
+		gencache_ram_wrote(string_term_tdb_data(keystr), timeout,
+				   *blob, seqnum_delta);
+	}
+
 	/*
 	 * Every 100 writes within a single process, stabilize the cache with
 	 * a transaction. This is done to prevent a single transaction to
@@ -442,6 +611,7 @@ struct gencache_parse_state {
 	void (*parser)(time_t timeout, DATA_BLOB blob, void *private_data);
 	void *private_data;
 	bool copy_to_notrans;
+	bool ram;
 };
 
 static int gencache_parse_fn(TDB_DATA key, TDB_DATA data, void *private_data)
@@ -465,7 +635,14 @@ static int gencache_parse_fn(TDB_DATA key, TDB_DATA data, void *private_data)
 	state->parser(t, blob, state->private_data);
 
 	if (state->copy_to_notrans) {
-		tdb_store(cache_notrans->tdb, key, data, 0);
+		int seqnum_delta;
+		int res = gencache_notrans_storev(key, &data, 1,
+						  &seqnum_delta);
+		if ((res == 0) && state->ram) {
+			gencache_ram_wrote(key, t, blob, seqnum_delta);
+		}
+	} else if (state->ram) {
+		gencache_ram_store(key, t, blob);
 	}
 
 	return 0;
@@ -493,6 +670,11 @@ bool gencache_parse(const char *keystr,
 	state.parser = parser;
 	state.private_data = private_data;
 	state.copy_to_notrans = false;
+	state.ram = gencache_ram_sync();
+
+	if (state.ram && gencache_ram_parse(key, parser, private_data)) {
+		return true;
+	}
 
 	ret = tdb_chainlock(cache_notrans->tdb, key);
 	if (ret != 0) {
@@ -21,6 +21,95 @@
 #include "idmap_cache.h"
 #include "../libcli/security/security.h"
 #include "../librpc/gen_ndr/idmap.h"
+#include "../lib/util/memcache.h"
+#include "../librpc/gen_ndr/ndr_security.h"
+
+/*
+ * Optional in-memory layer in front of the SID2XID gencache entries,
+ * saving the key formatting, the tdb lookup and the parsing for hot
+ * SIDs. Entries are used for at most IDMAP_CACHE_RAM_TIME seconds so
+ * that deletions by other processes are seen soon.
+ */
+
+#define IDMAP_CACHE_RAM_TIME 60
+
+static struct memcache *idmap_cache_ram;
+
+struct idmap_cache_ram_entry {
+	struct unixid id;
+	time_t timeout;
+	time_t valid_until;
+};
+
+void idmap_cache_ram_init(size_t max_size)
+{
+	TALLOC_FREE(idmap_cache_ram);
+	if (max_size == 0) {
+		return;
+	}
+	idmap_cache_ram = memcache_init(NULL, max_size);
+}
+
+void idmap_cache_ram_flush(void)
+{
+	if (idmap_cache_ram == NULL) {
+		return;
+	}
+	memcache_flush(idmap_cache_ram, IDMAP_SID2XID_CACHE);
+}
+
+static DATA_BLOB idmap_cache_ram_key(const struct dom_sid *sid)
+{
+	return data_blob_const(sid, ndr_size_dom_sid(sid, 0));
+}
+
+static bool idmap_cache_ram_find(const struct dom_sid *sid,
+				 struct unixid *id, bool *expired)
+{
+	struct idmap_cache_ram_entry e;
+	DATA_BLOB value;
+	time_t now;
+
+	if (idmap_cache_ram == NULL) {
+		return false;
+	}
+	if (!memcache_lookup(idmap_cache_ram, IDMAP_SID2XID_CACHE,
+			     idmap_cache_ram_key(sid), &value)) {
+		return false;
+	}
+	if (value.length != sizeof(e)) {
+		return false;
+	}
+	memcpy(&e, value.data, sizeof(e));
+
+	now = time(NULL);
+	if (e.valid_until <= now) {
+		return false;
+	}
+
+	*id = e.id;
+	*expired = (e.timeout <= now);
+	return true;
+}
+
+static void idmap_cache_ram_store(const struct dom_sid *sid,
+				  const struct unixid *id, time_t timeout)
+{
+	struct idmap_cache_ram_entry e;
+
+	if (idmap_cache_ram == NULL) {
+		return;
+	}
+
+	ZERO_STRUCT(e);
+	e.id = *id;
+	e.timeout = timeout;
+	e.valid_until = MIN(timeout, time(NULL) + IDMAP_CACHE_RAM_TIME);
+
+	memcache_add(idmap_cache_ram, IDMAP_SID2XID_CACHE,
+		     idmap_cache_ram_key(sid),
+		     data_blob_const(&e, sizeof(e)));
+}
 
 /**
  * Find a sid2xid mapping
@@ -43,6 +132,10 @@ bool idmap_cache_find_sid2unixid(const struct dom_sid *sid, struct unixid *id,
 	bool ret;
 	struct unixid tmp_id;
 
+	if (idmap_cache_ram_find(sid, id, expired)) {
+		return true;
+	}
+
 	key = talloc_asprintf(talloc_tos(), "IDMAP/SID2XID/%s",
 			      sid_to_fstring(sidstr, sid));
 	if (key == NULL) {
@@ -120,6 +213,7 @@ bool idmap_cache_find_sid2unixid(const struct dom_sid *sid, struct unixid *id,
 
 		*id = tmp_id;
 		*expired = (timeout <= time(NULL));
+		idmap_cache_ram_store(sid, id, timeout);
 	} else {
 		DEBUG(0, ("FAILED to parse value for key [%s] (value=[%s]): "
 			  "colon missing after id=[%llu]\n",
@@ -312,6 +406,7 @@ void idmap_cache_set_sid2unixid(const struct dom_sid *sid, struct unixid *unix_i
 			? lp_idmap_negative_cache_time()
 			: lp_idmap_cache_time();
 		gencache_set(key, value, now + timeout);
+		idmap_cache_ram_store(sid, unix_id, now + timeout);
 	}
 	if (unix_id->id != -1) {
 		if (is_null_sid(sid)) {
@@ -368,6 +463,8 @@ static bool idmap_cache_del_xid(char t, int xid)
 	time_t timeout;
 	bool ret = true;
 
+	idmap_cache_ram_flush();
+
 	if (!gencache_get(key, mem_ctx, &sid_str, &timeout)) {
 		DEBUG(3, ("no entry: %s\n", key));
 		ret = false;
@@ -414,6 +511,7 @@ bool idmap_cache_del_sid(const struct dom_sid *sid)
 	const char *sid_key;
 
 	if (!idmap_cache_find_sid2unixid(sid, &id, &expired)) {
+		idmap_cache_ram_flush();
 		ret = false;
 		goto done;
 	}
@@ -441,6 +539,7 @@ bool idmap_cache_del_sid(const struct dom_sid *sid)
 	}
 	/* If the mapping was symmetric, then this should fail */
 	gencache_del(sid_key);
+	idmap_cache_ram_flush();
 done:
 	talloc_free(mem_ctx);
 	return ret;
@@ -38,4 +38,7 @@ bool idmap_cache_del_gid(gid_t gid);
 bool idmap_cache_del_both(uid_t uid);
 bool idmap_cache_del_sid(const struct dom_sid *sid);
 
+void idmap_cache_ram_init(size_t max_size);
+void idmap_cache_ram_flush(void);
+
 #endif /* _LIB_IDMAP_CACHE_H_ */
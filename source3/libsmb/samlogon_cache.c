@@ -276,6 +276,41 @@ struct netr_SamInfo3 *netsamlogon_cache_get(TALLOC_CTX *mem_ctx, const struct do
 	return info3;
 }
 
+static int netsamlogon_cache_timestamp_parser(TDB_DATA key, TDB_DATA data,
+					      void *private_data)
+{
+	time_t *timestamp = private_data;
+
+	/* The entry starts with its NDR time_t, a 32-bit little endian */
+	if (data.dsize < 4) {
+		return -1;
+	}
+	*timestamp = (time_t)IVAL(data.dptr, 0);
+	return 0;
+}
+
+/***********************************************************************
+ When the entry for a SID was stored, without unmarshalling the info3
+***********************************************************************/
+
+bool netsamlogon_cache_timestamp(const struct dom_sid *sid,
+				 time_t *timestamp)
+{
+	char keystr[DOM_SID_STR_BUFLEN];
+	int ret;
+
+	if (!netsamlogon_cache_init()) {
+		DBG_WARNING("Cannot open %s\n", NETSAMLOGON_TDB);
+		return false;
+	}
+
+	dom_sid_string_buf(sid, keystr, sizeof(keystr));
+
+	ret = tdb_parse_record(netsamlogon_tdb, string_term_tdb_data(keystr),
+			       netsamlogon_cache_timestamp_parser, timestamp);
+	return (ret == 0);
+}
+
 bool netsamlogon_cache_have(const struct dom_sid *sid)
 {
 	char keystr[DOM_SID_STR_BUFLEN];
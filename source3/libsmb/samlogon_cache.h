@@ -37,5 +37,7 @@ bool netsamlogon_cache_store(const char *username,
 struct netr_SamInfo3 *netsamlogon_cache_get(TALLOC_CTX *mem_ctx,
 					    const struct dom_sid *user_sid);
 bool netsamlogon_cache_have(const struct dom_sid *sid);
+bool netsamlogon_cache_timestamp(const struct dom_sid *sid,
+				 time_t *timestamp);
 
 #endif
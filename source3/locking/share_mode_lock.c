@@ -703,7 +703,11 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 	blob.data = value.dptr;
 	blob.length = value.dsize;
 
-	ndr_err = ndr_pull_struct_blob_all(
+	/*
+	 * d is freed before we return, so the strings can point
+	 * into the record
+	 */
+	ndr_err = ndr_pull_struct_blob_all_nocopy(
 		&blob, d, d, (ndr_pull_flags_fn_t)ndr_pull_share_mode_data);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
 		DEBUG(1, ("ndr_pull_share_mode_lock failed\n"));
@@ -1924,6 +1924,10 @@ struct pdb_search *pdb_search_init(TALLOC_CTX *mem_ctx,
 	result->cache_size = 0;
 	result->search_ended = False;
 	result->search_end = NULL;
+	result->cache_start = 0;
+	result->restartable = false;
+	result->acct_flags = 0;
+	ZERO_STRUCT(result->sid);
 
 	/* Segfault appropriately if not initialized */
 	result->next_entry = NULL;
@@ -1979,7 +1983,8 @@ static bool next_entry_groups(struct pdb_search *s,
 
 	sid_peek_rid(&map->sid, &rid);
 
-	fill_displayentry(s, rid, 0, map->nt_name, NULL, map->comment, entry);
+	fill_displayentry(talloc_tos(), rid, 0, map->nt_name, NULL,
+			  map->comment, entry);
 
 	state->current_group += 1;
 	return True;
@@ -2032,43 +2037,210 @@ static bool pdb_default_search_aliases(struct pdb_methods *methods,
 	return pdb_search_grouptype(methods, search, sid, SID_NAME_ALIAS);
 }
 
+/*
+ * A search only keeps a window of the entries the backend has returned:
+ * cache[] holds the entries [cache_start, num_entries). Clients page
+ * through an enumeration from front to back, so everything before the
+ * start index of a request is dropped and the memory used by a SAMR
+ * handle does not grow with the size of the domain. A request behind
+ * the window starts the search again.
+ */
+
+static bool pdb_search_start(struct pdb_search *search)
+{
+	struct pdb_methods *pdb = pdb_get_methods();
+
+	if (pdb == NULL) {
+		return false;
+	}
+
+	switch (search->type) {
+	case PDB_USER_SEARCH:
+		return pdb->search_users(pdb, search, search->acct_flags);
+	case PDB_GROUP_SEARCH:
+		return pdb->search_groups(pdb, search);
+	case PDB_ALIAS_SEARCH:
+		return pdb->search_aliases(pdb, search, &search->sid);
+	}
+
+	return false;
+}
+
+static bool pdb_search_restart(struct pdb_search *search)
+{
+	DEBUG(10, ("pdb_search_restart: restarting search at index %u\n",
+		   (unsigned int)search->cache_start));
+
+	if ((!search->search_ended) && (search->search_end != NULL)) {
+		search->search_end(search);
+	}
+
+	TALLOC_FREE(search->cache);
+	search->cache_size = 0;
+	search->cache_start = 0;
+	search->num_entries = 0;
+	search->search_ended = false;
+	search->private_data = NULL;
+	search->next_entry = NULL;
+	search->search_end = NULL;
+
+	if (!pdb_search_start(search)) {
+		DEBUG(1, ("pdb_search_restart: could not restart search\n"));
+		search->search_ended = true;
+		return false;
+	}
+
+	return true;
+}
+
+static bool pdb_search_copy_entry(TALLOC_CTX *mem_ctx,
+				  struct samr_displayentry *dst,
+				  const struct samr_displayentry *src)
+{
+	*dst = *src;
+
+	dst->account_name = talloc_strdup(
+		mem_ctx, src->account_name ? src->account_name : "");
+	dst->fullname = talloc_strdup(
+		mem_ctx, src->fullname ? src->fullname : "");
+	dst->description = talloc_strdup(
+		mem_ctx, src->description ? src->description : "");
+
+	return ((dst->account_name != NULL) && (dst->fullname != NULL) &&
+		(dst->description != NULL));
+}
+
+static bool pdb_search_add_entry(struct pdb_search *search,
+				 const struct samr_displayentry *entry)
+{
+	uint32_t num_cached = search->num_entries - search->cache_start;
+
+	if ((ssize_t)num_cached == search->cache_size) {
+		ssize_t new_size = MAX(search->cache_size * 2, 64);
+		struct samr_displayentry *tmp;
+
+		tmp = talloc_realloc(search, search->cache,
+				     struct samr_displayentry, new_size);
+		if (tmp == NULL) {
+			return false;
+		}
+		search->cache = tmp;
+		search->cache_size = new_size;
+	}
+
+	return pdb_search_copy_entry(search->cache,
+				     &search->cache[num_cached], entry);
+}
+
+/*
+ * Forget the cached entries before start_idx
+ */
+
+static bool pdb_search_trim(struct pdb_search *search, uint32_t start_idx)
+{
+	struct samr_displayentry *cache;
+	uint32_t num_cached, num_drop, i;
+
+	if (!search->restartable || (start_idx <= search->cache_start)) {
+		return true;
+	}
+
+	num_cached = 0;
+	if (search->num_entries > search->cache_start) {
+		num_cached = search->num_entries - search->cache_start;
+	}
+	num_drop = MIN(start_idx - search->cache_start, num_cached);
+
+	if (num_drop == num_cached) {
+		TALLOC_FREE(search->cache);
+		search->cache_size = 0;
+		search->cache_start = start_idx;
+		return true;
+	}
+
+	/*
+	 * Copy the remaining entries, so that the strings of the
+	 * dropped ones go away with the old array.
+	 */
+	cache = talloc_array(search, struct samr_displayentry,
+			     num_cached - num_drop);
+	if (cache == NULL) {
+		return false;
+	}
+	for (i=0; i<num_cached - num_drop; i++) {
+		if (!pdb_search_copy_entry(cache, &cache[i],
+					   &search->cache[num_drop + i])) {
+			TALLOC_FREE(cache);
+			return false;
+		}
+	}
+
+	TALLOC_FREE(search->cache);
+	search->cache = cache;
+	search->cache_size = num_cached - num_drop;
+	search->cache_start = start_idx;
+	return true;
+}
+
 static struct samr_displayentry *pdb_search_getentry(struct pdb_search *search,
 						     uint32_t idx)
 {
+	if (idx < search->cache_start) {
+		return NULL;
+	}
+
 	if (idx < search->num_entries)
-		return &search->cache[idx];
+		return &search->cache[idx - search->cache_start];
 
 	if (search->search_ended)
 		return NULL;
 
 	while (idx >= search->num_entries) {
+		TALLOC_CTX *frame = talloc_stackframe();
 		struct samr_displayentry entry;
+		bool ok;
 
-		if (!search->next_entry(search, &entry)) {
-			search->search_end(search);
+		ok = search->next_entry(search, &entry);
+		if (!ok) {
+			TALLOC_FREE(frame);
+			if (search->search_end != NULL) {
+				search->search_end(search);
+			}
 			search->search_ended = True;
 			break;
 		}
 
-		ADD_TO_LARGE_ARRAY(search, struct samr_displayentry,
-				   entry, &search->cache, &search->num_entries,
-				   &search->cache_size);
+		/*
+		 * Entries before the window are only counted
+		 */
+		if (search->num_entries >= search->cache_start) {
+			ok = pdb_search_add_entry(search, &entry);
+		}
+		TALLOC_FREE(frame);
+
+		if (!ok) {
+			DEBUG(0, ("pdb_search_add_entry failed\n"));
+			break;
+		}
+		search->num_entries += 1;
 	}
 
-	return (search->num_entries > idx) ? &search->cache[idx] : NULL;
+	return (search->num_entries > idx) ?
+		&search->cache[idx - search->cache_start] : NULL;
 }
 
 struct pdb_search *pdb_search_users(TALLOC_CTX *mem_ctx, uint32_t acct_flags)
 {
-	struct pdb_methods *pdb = pdb_get_methods();
 	struct pdb_search *result;
 
 	result = pdb_search_init(mem_ctx, PDB_USER_SEARCH);
 	if (result == NULL) {
 		return NULL;
 	}
+	result->acct_flags = acct_flags;
+	result->restartable = true;
 
-	if (!pdb->search_users(pdb, result, acct_flags)) {
+	if (!pdb_search_start(result)) {
 		TALLOC_FREE(result);
 		return NULL;
 	}
@@ -2077,15 +2249,15 @@ struct pdb_search *pdb_search_users(TALLOC_CTX *mem_ctx, uint32_t acct_flags)
 
 struct pdb_search *pdb_search_groups(TALLOC_CTX *mem_ctx)
 {
-	struct pdb_methods *pdb = pdb_get_methods();
 	struct pdb_search *result;
 
 	result = pdb_search_init(mem_ctx, PDB_GROUP_SEARCH);
 	if (result == NULL) {
 		 return NULL;
 	}
+	result->restartable = true;
 
-	if (!pdb->search_groups(pdb, result)) {
+	if (!pdb_search_start(result)) {
 		TALLOC_FREE(result);
 		return NULL;
 	}
@@ -2094,17 +2266,16 @@ struct pdb_search *pdb_search_groups(TALLOC_CTX *mem_ctx)
 
 struct pdb_search *pdb_search_aliases(TALLOC_CTX *mem_ctx, const struct dom_sid *sid)
 {
-	struct pdb_methods *pdb = pdb_get_methods();
 	struct pdb_search *result;
 
-	if (pdb == NULL) return NULL;
-
 	result = pdb_search_init(mem_ctx, PDB_ALIAS_SEARCH);
 	if (result == NULL) {
 		return NULL;
 	}
+	sid_copy(&result->sid, sid);
+	result->restartable = true;
 
-	if (!pdb->search_aliases(pdb, result, sid)) {
+	if (!pdb_search_start(result)) {
 		TALLOC_FREE(result);
 		return NULL;
 	}
@@ -2118,6 +2289,24 @@ uint32_t pdb_search_entries(struct pdb_search *search,
 	struct samr_displayentry *end_entry;
 	uint32_t end_idx = start_idx+max_entries-1;
 
+	*result = NULL;
+
+	if ((start_idx < search->cache_start) &&
+	    !pdb_search_restart(search)) {
+		return 0;
+	}
+
+	/*
+	 * count_sam_users() and friends ask for the entry at
+	 * 0xffffffff only to run the search to the end. This drops
+	 * the whole window, so counting keeps no entries. A client
+	 * paging from the start afterwards restarts the search once.
+	 */
+
+	if (!pdb_search_trim(search, start_idx)) {
+		return 0;
+	}
+
 	/* The first entry needs to be searched after the last. Otherwise the
 	 * first entry might have moved due to a realloc during the search for
 	 * the last entry. */
@@ -4389,7 +4389,7 @@ static bool ldapsam_search_next_entry(struct pdb_search *search,
 		return false;
 	}
 
-	result = state->ldap2displayentry(state, search,
+	result = state->ldap2displayentry(state, talloc_tos(),
 					  state->connection->ldap_struct,
 					  state->current_entry, entry);
 
@@ -1870,35 +1870,68 @@ static NTSTATUS pdb_samba_dsdb_get_seq_num(struct pdb_methods *m,
 
 struct pdb_samba_dsdb_search_state {
 	uint32_t acct_flags;
-	struct samr_displayentry *entries;
-	uint32_t num_entries;
-	ssize_t array_size;
+	struct ldb_result *res;
 	uint32_t current;
 };
 
+/*
+ * The ldb messages are converted one by one as the search is walked
+ * and released right away, pdb_search_entries() keeps what it needs.
+ */
+
 static bool pdb_samba_dsdb_next_entry(struct pdb_search *search,
 			       struct samr_displayentry *entry)
 {
 	struct pdb_samba_dsdb_search_state *state = talloc_get_type_abort(
 		search->private_data, struct pdb_samba_dsdb_search_state);
 
-	if (state->current == state->num_entries) {
-		return false;
-	}
+	while (state->current < state->res->count) {
+		struct ldb_message *msg = state->res->msgs[state->current];
+		struct dom_sid *sid;
+		const char *str;
 
-	entry->idx = state->entries[state->current].idx;
-	entry->rid = state->entries[state->current].rid;
-	entry->acct_flags = state->entries[state->current].acct_flags;
+		entry->idx = state->current;
+		state->current += 1;
 
-	entry->account_name = talloc_strdup(
-		search, state->entries[state->current].account_name);
-	entry->fullname = talloc_strdup(
-		search, state->entries[state->current].fullname);
-	entry->description = talloc_strdup(
-		search, state->entries[state->current].description);
+		sid = samdb_result_dom_sid(talloc_tos(), msg, "objectSid");
+		if (!sid) {
+			DEBUG(10, ("Could not pull SID\n"));
+			return false;
+		}
+		sid_peek_rid(sid, &entry->rid);
+
+		entry->acct_flags = samdb_result_acct_flags(
+			msg, "userAccountControl");
+		if ((state->acct_flags != 0) &&
+		    ((state->acct_flags & entry->acct_flags) == 0)) {
+			TALLOC_FREE(msg);
+			state->res->msgs[state->current - 1] = NULL;
+			continue;
+		}
 
-	state->current += 1;
-	return true;
+		str = ldb_msg_find_attr_as_string(msg, "samAccountName", NULL);
+		if (str == NULL) {
+			return false;
+		}
+		entry->account_name = talloc_strdup(talloc_tos(), str);
+		str = ldb_msg_find_attr_as_string(msg, "displayName", "");
+		entry->fullname = talloc_strdup(talloc_tos(), str);
+		str = ldb_msg_find_attr_as_string(msg, "description", "");
+		entry->description = talloc_strdup(talloc_tos(), str);
+
+		TALLOC_FREE(msg);
+		state->res->msgs[state->current - 1] = NULL;
+
+		if ((entry->account_name == NULL) ||
+		    (entry->fullname == NULL) ||
+		    (entry->description == NULL)) {
+			DEBUG(10, ("talloc failed\n"));
+			return false;
+		}
+		return true;
+	}
+
+	return false;
 }
 
 static void pdb_samba_dsdb_search_end(struct pdb_search *search)
@@ -1925,7 +1958,7 @@ static bool pdb_samba_dsdb_search_filter(struct pdb_methods *m,
 	const char * attrs[] = { "objectSid", "sAMAccountName", "displayName",
 				 "userAccountControl", "description", NULL };
 	struct ldb_result *res;
-	int i, rc, num_users;
+	int rc;
 
 	va_list ap;
 	char *expression = NULL;
@@ -1958,51 +1991,7 @@ static bool pdb_samba_dsdb_search_filter(struct pdb_methods *m,
 		return false;
 	}
 
-	num_users = res->count;
-
-	sstate->entries = talloc_array(sstate, struct samr_displayentry,
-				       num_users);
-	if (sstate->entries == NULL) {
-		talloc_free(tmp_ctx);
-		DEBUG(10, ("talloc failed\n"));
-		return false;
-	}
-
-	sstate->num_entries = 0;
-
-	for (i=0; i<num_users; i++) {
-		struct samr_displayentry *e;
-		struct dom_sid *sid;
-
-		e = &sstate->entries[sstate->num_entries];
-
-		e->idx = sstate->num_entries;
-		sid = samdb_result_dom_sid(tmp_ctx, res->msgs[i], "objectSid");
-		if (!sid) {
-			talloc_free(tmp_ctx);
-			DEBUG(10, ("Could not pull SID\n"));
-			return false;
-		}
-		sid_peek_rid(sid, &e->rid);
-
-		e->acct_flags = samdb_result_acct_flags(res->msgs[i], "userAccountControl");
-		e->account_name = ldb_msg_find_attr_as_string(
-			res->msgs[i], "samAccountName", NULL);
-		if (e->account_name == NULL) {
-			talloc_free(tmp_ctx);
-			return false;
-		}
-		e->fullname = ldb_msg_find_attr_as_string(
-                        res->msgs[i], "displayName", "");
-		e->description = ldb_msg_find_attr_as_string(
-                        res->msgs[i], "description", "");
-
-		sstate->num_entries += 1;
-		if (sstate->num_entries >= num_users) {
-			break;
-		}
-	}
-	talloc_steal(sstate->entries, res->msgs);
+	sstate->res = talloc_steal(sstate, res);
 	search->private_data = talloc_steal(search, sstate);
 	search->next_entry = pdb_samba_dsdb_next_entry;
 	search->search_end = pdb_samba_dsdb_search_end;
@@ -2016,9 +2005,23 @@ static bool pdb_samba_dsdb_search_users(struct pdb_methods *m,
 				 uint32_t acct_flags)
 {
 	struct pdb_samba_dsdb_search_state *sstate;
+	uint32_t type_flags = ACB_NORMAL|ACB_DOMTRUST|ACB_WSTRUST|ACB_SVRTRUST;
 	bool ret;
 
-	ret = pdb_samba_dsdb_search_filter(m, search, &sstate, "(objectclass=user)");
+	if ((acct_flags != 0) && ((acct_flags & ~type_flags) == 0)) {
+		/*
+		 * Only account types are asked for, let ldb filter on
+		 * the userAccountControl bits (bitwise OR match).
+		 */
+		ret = pdb_samba_dsdb_search_filter(
+			m, search, &sstate,
+			"(&(objectclass=user)"
+			"(userAccountControl:1.2.840.113556.1.4.804:=%u))",
+			(unsigned int)ds_acb2uf(acct_flags));
+	} else {
+		ret = pdb_samba_dsdb_search_filter(m, search, &sstate,
+						   "(objectclass=user)");
+	}
 	if (!ret) {
 		return false;
 	}
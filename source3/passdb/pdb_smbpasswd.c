@@ -1575,11 +1575,11 @@ static bool smbpasswd_search_next_entry(struct pdb_search *search,
 	entry->acct_flags = state->entries[state->current].acct_flags;
 
 	entry->account_name = talloc_strdup(
-		search, state->entries[state->current].account_name);
+		talloc_tos(), state->entries[state->current].account_name);
 	entry->fullname = talloc_strdup(
-		search, state->entries[state->current].fullname);
+		talloc_tos(), state->entries[state->current].fullname);
 	entry->description = talloc_strdup(
-		search, state->entries[state->current].description);
+		talloc_tos(), state->entries[state->current].description);
 
 	if ((entry->account_name == NULL) || (entry->fullname == NULL)
 	    || (entry->description == NULL)) {
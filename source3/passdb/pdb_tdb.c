@@ -30,6 +30,7 @@
 #include "../libcli/security/security.h"
 #include "util_tdb.h"
 #include "passdb/pdb_tdb.h"
+#include "lib/util/binsearch.h"
 
 #if 0 /* when made a module use this */
 
@@ -60,6 +61,8 @@ static int tdbsam_debug_level = DBGC_ALL;
 static struct db_context *db_sam;
 static char *tdbsam_filename;
 static bool map_builtin;
+static bool use_memory_index;
+static bool db_sam_in_transaction;
 
 struct tdbsam_convert_state {
 	int32_t from;
@@ -292,7 +295,7 @@ static bool tdbsam_convert_backup(const char *dbname, struct db_context **pp_db)
 	/* re-open the converted TDB */
 
 	orig_db = db_open(NULL, dbname, 0,
-			  TDB_DEFAULT, O_CREAT|O_RDWR, 0600,
+			  TDB_DEFAULT|TDB_SEQNUM, O_CREAT|O_RDWR, 0600,
 			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	if (orig_db == NULL) {
 		DEBUG(0, ("tdbsam_convert_backup: Failed to re-open "
@@ -449,7 +452,8 @@ static bool tdbsam_open( const char *name )
 
 	/* Try to open tdb passwd.  Create a new one if necessary */
 
-	db_sam = db_open(NULL, name, 0, TDB_DEFAULT, O_CREAT|O_RDWR, 0600,
+	db_sam = db_open(NULL, name, 0, TDB_DEFAULT|TDB_SEQNUM,
+			 O_CREAT|O_RDWR, 0600,
 			 DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	if (db_sam == NULL) {
 		DEBUG(0, ("tdbsam_open: Failed to open/create TDB passwd "
@@ -560,6 +564,294 @@ static bool tdbsam_open( const char *name )
 	return true;
 }
 
+/*********************************************************************
+ In-memory index of the user records.
+
+ With "tdbsam:memory index = yes" lookups and enumeration are answered
+ from a copy of all USER_ records, sorted by rid and by name. The copy
+ is tagged with the tdb sequence number and rebuilt when anyone has
+ changed passdb.tdb, so a lookup only has to read the sequence number
+ instead of locking the tdb and fetching up to two records.
+*********************************************************************/
+
+struct tdbsam_index_entry {
+	uint32_t rid;
+	uint32_t acct_ctrl;
+	const char *name;	/* lower case, as in the USER_ key */
+	const char *username;
+	const char *fullname;
+	const char *description;
+	DATA_BLOB buf;		/* packed SAMU_BUFFER_LATEST record */
+};
+
+struct tdbsam_index {
+	int seqnum;
+	unsigned refcount;
+	bool failed;
+	struct tdbsam_index_entry *entries;	/* sorted by rid */
+	struct tdbsam_index_entry **by_name;	/* sorted by name */
+	size_t num_entries;
+	size_t array_size;
+};
+
+static struct tdbsam_index *tdbsam_index;
+
+static void tdbsam_index_unref(struct tdbsam_index **pindex)
+{
+	struct tdbsam_index *index = *pindex;
+
+	*pindex = NULL;
+
+	if (index == NULL) {
+		return;
+	}
+	index->refcount -= 1;
+	if (index->refcount == 0) {
+		TALLOC_FREE(index);
+	}
+}
+
+static int tdbsam_index_collect(struct db_record *rec, void *private_data)
+{
+	struct tdbsam_index *index = talloc_get_type_abort(
+		private_data, struct tdbsam_index);
+	struct tdbsam_index_entry *entry;
+	struct samu *user;
+	TDB_DATA key, value;
+	const char *str;
+
+	key = dbwrap_record_get_key(rec);
+
+	if ((key.dsize <= USERPREFIX_LEN)
+	    || (strncmp((char *)key.dptr, USERPREFIX, USERPREFIX_LEN) != 0)) {
+		return 0;
+	}
+
+	value = dbwrap_record_get_value(rec);
+	if (value.dsize == 0) {
+		return 0;
+	}
+
+	user = samu_new(talloc_tos());
+	if (user == NULL) {
+		goto nomem;
+	}
+
+	if (!init_samu_from_buffer(user, SAMU_BUFFER_LATEST,
+				   value.dptr, value.dsize)) {
+		DEBUG(0, ("tdbsam_index_collect: Bad struct samu entry for "
+			  "key %.*s\n", (int)key.dsize, (char *)key.dptr));
+		TALLOC_FREE(user);
+		return 0;
+	}
+
+	if (index->num_entries == index->array_size) {
+		size_t new_size = MAX(index->array_size * 2, 64);
+		struct tdbsam_index_entry *tmp;
+
+		tmp = talloc_realloc(index, index->entries,
+				     struct tdbsam_index_entry, new_size);
+		if (tmp == NULL) {
+			goto nomem;
+		}
+		index->entries = tmp;
+		index->array_size = new_size;
+	}
+
+	entry = &index->entries[index->num_entries];
+
+	entry->rid = pdb_get_user_rid(user);
+	entry->acct_ctrl = pdb_get_acct_ctrl(user);
+	entry->name = talloc_strndup(index->entries,
+				     (char *)key.dptr + USERPREFIX_LEN,
+				     key.dsize - USERPREFIX_LEN);
+	entry->username = talloc_strdup(index->entries,
+					pdb_get_username(user));
+	str = pdb_get_fullname(user);
+	entry->fullname = talloc_strdup(index->entries, str ? str : "");
+	str = pdb_get_acct_desc(user);
+	entry->description = talloc_strdup(index->entries, str ? str : "");
+	entry->buf = data_blob_talloc(index->entries, value.dptr, value.dsize);
+
+	TALLOC_FREE(user);
+
+	if ((entry->name == NULL) || (entry->username == NULL)
+	    || (entry->fullname == NULL) || (entry->description == NULL)
+	    || (entry->buf.data == NULL)) {
+		goto nomem;
+	}
+
+	index->num_entries += 1;
+	return 0;
+
+nomem:
+	DEBUG(0, ("tdbsam_index_collect: talloc failed\n"));
+	TALLOC_FREE(user);
+	index->failed = true;
+	return -1;
+}
+
+static int tdbsam_rid_cmp(uint32_t rid1, uint32_t rid2)
+{
+	if (rid1 == rid2) {
+		return 0;
+	}
+	return (rid1 < rid2) ? -1 : 1;
+}
+
+static int tdbsam_index_rid_cmp(const struct tdbsam_index_entry *e1,
+				const struct tdbsam_index_entry *e2)
+{
+	return tdbsam_rid_cmp(e1->rid, e2->rid);
+}
+
+static int tdbsam_index_name_cmp(struct tdbsam_index_entry * const *e1,
+				 struct tdbsam_index_entry * const *e2)
+{
+	return strcmp((*e1)->name, (*e2)->name);
+}
+
+/*********************************************************************
+ Return the index for the current contents of passdb.tdb, rebuilding
+ it if necessary. NULL means the caller has to use the tdb directly.
+*********************************************************************/
+
+static struct tdbsam_index *tdbsam_get_index(void)
+{
+	struct tdbsam_index *index;
+	NTSTATUS status;
+	size_t i;
+	int seqnum;
+
+	/*
+	 * Inside a transaction the sequence number already counts our
+	 * own uncommitted changes.
+	 */
+	if (!use_memory_index || db_sam_in_transaction) {
+		return NULL;
+	}
+
+	seqnum = dbwrap_get_seqnum(db_sam);
+
+	if ((tdbsam_index != NULL) && (tdbsam_index->seqnum == seqnum)) {
+		return tdbsam_index;
+	}
+
+	tdbsam_index_unref(&tdbsam_index);
+
+	index = talloc_zero(NULL, struct tdbsam_index);
+	if (index == NULL) {
+		return NULL;
+	}
+	index->seqnum = seqnum;
+	index->refcount = 1;
+
+	status = dbwrap_traverse_read(db_sam, tdbsam_index_collect, index,
+				      NULL);
+	if (!NT_STATUS_IS_OK(status) || index->failed) {
+		DEBUG(1, ("tdbsam_get_index: traverse failed: %s\n",
+			  nt_errstr(status)));
+		TALLOC_FREE(index);
+		return NULL;
+	}
+
+	if (dbwrap_get_seqnum(db_sam) != seqnum) {
+		/*
+		 * Somebody wrote to the tdb while we were copying it, we
+		 * might have an inconsistent picture. Try again next time.
+		 */
+		DEBUG(10, ("tdbsam_get_index: passdb changed during "
+			   "traverse\n"));
+		TALLOC_FREE(index);
+		return NULL;
+	}
+
+	TYPESAFE_QSORT(index->entries, index->num_entries,
+		       tdbsam_index_rid_cmp);
+
+	index->by_name = talloc_array(index, struct tdbsam_index_entry *,
+				      index->num_entries);
+	if (index->by_name == NULL) {
+		TALLOC_FREE(index);
+		return NULL;
+	}
+	for (i=0; i<index->num_entries; i++) {
+		index->by_name[i] = &index->entries[i];
+	}
+	TYPESAFE_QSORT(index->by_name, index->num_entries,
+		       tdbsam_index_name_cmp);
+
+	DEBUG(10, ("tdbsam_get_index: indexed %zu users at seqnum %d\n",
+		   index->num_entries, seqnum));
+
+	tdbsam_index = index;
+	return tdbsam_index;
+}
+
+/*
+ * All writes to db_sam go through these, so that tdbsam_get_index()
+ * knows when not to trust the sequence number.
+ */
+
+static int tdbsam_transaction_start(void)
+{
+	int ret = dbwrap_transaction_start(db_sam);
+	db_sam_in_transaction = (ret == 0);
+	return ret;
+}
+
+static int tdbsam_transaction_commit(void)
+{
+	db_sam_in_transaction = false;
+	return dbwrap_transaction_commit(db_sam);
+}
+
+static int tdbsam_transaction_cancel(void)
+{
+	db_sam_in_transaction = false;
+	return dbwrap_transaction_cancel(db_sam);
+}
+
+static NTSTATUS tdbsam_index_get_user(struct tdbsam_index_entry *entry,
+				      struct samu *user)
+{
+	if (!init_samu_from_buffer(user, SAMU_BUFFER_LATEST,
+				   entry->buf.data, entry->buf.length)) {
+		DEBUG(0,("tdbsam_index_get_user: Bad struct samu entry in "
+			 "index!\n"));
+		return NT_STATUS_NO_MEMORY;
+	}
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS tdbsam_index_getsampwnam(struct tdbsam_index *index,
+					 struct samu *user, const char *name)
+{
+	struct tdbsam_index_entry *entry = NULL;
+
+	BINARY_ARRAY_SEARCH_P(index->by_name, index->num_entries, name, name,
+			      strcmp, entry);
+	if (entry == NULL) {
+		return NT_STATUS_NO_SUCH_USER;
+	}
+
+	return tdbsam_index_get_user(entry, user);
+}
+
+static NTSTATUS tdbsam_index_getsampwrid(struct tdbsam_index *index,
+					 struct samu *user, uint32_t rid)
+{
+	struct tdbsam_index_entry *entry = NULL;
+
+	BINARY_ARRAY_SEARCH(index->entries, index->num_entries, rid, rid,
+			    tdbsam_rid_cmp, entry);
+	if (entry == NULL) {
+		return NT_STATUS_NO_SUCH_USER;
+	}
+
+	return tdbsam_index_get_user(entry, user);
+}
+
 /******************************************************************
  Lookup a name in the SAM TDB
 ******************************************************************/
@@ -571,6 +863,7 @@ static NTSTATUS tdbsam_getsampwnam (struct pdb_methods *my_methods,
 	fstring 	keystr;
 	fstring		name;
 	NTSTATUS status;
+	struct tdbsam_index *index;
 
 	if ( !user ) {
 		DEBUG(0,("pdb_getsampwnam: struct samu is NULL.\n"));
@@ -593,6 +886,11 @@ static NTSTATUS tdbsam_getsampwnam (struct pdb_methods *my_methods,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
+	index = tdbsam_get_index();
+	if (index != NULL) {
+		return tdbsam_index_getsampwnam(index, user, name);
+	}
+
 	/* get the record */
 
 	status = dbwrap_fetch_bystring(db_sam, talloc_tos(), keystr, &data);
@@ -634,6 +932,7 @@ static NTSTATUS tdbsam_getsampwrid (struct pdb_methods *my_methods,
 	TDB_DATA 		data;
 	fstring 		keystr;
 	fstring			name;
+	struct tdbsam_index	*index;
 
 	if ( !user ) {
 		DEBUG(0,("pdb_getsampwrid: struct samu is NULL.\n"));
@@ -651,6 +950,11 @@ static NTSTATUS tdbsam_getsampwrid (struct pdb_methods *my_methods,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
+	index = tdbsam_get_index();
+	if (index != NULL) {
+		return tdbsam_index_getsampwrid(index, user, rid);
+	}
+
 	/* get the record */
 
 	nt_status = dbwrap_fetch_bystring(db_sam, talloc_tos(), keystr, &data);
@@ -741,7 +1045,7 @@ static NTSTATUS tdbsam_delete_sam_account(struct pdb_methods *my_methods,
 
 	/* it's outaa here!  8^) */
 
-	if (dbwrap_transaction_start(db_sam) != 0) {
+	if (tdbsam_transaction_start() != 0) {
 		DEBUG(0, ("Could not start transaction\n"));
 		return NT_STATUS_UNSUCCESSFUL;
 	}
@@ -766,7 +1070,7 @@ static NTSTATUS tdbsam_delete_sam_account(struct pdb_methods *my_methods,
 		goto cancel;
 	}
 
-	if (dbwrap_transaction_commit(db_sam) != 0) {
+	if (tdbsam_transaction_commit() != 0) {
 		DEBUG(0, ("Could not commit transaction\n"));
 		return NT_STATUS_INTERNAL_DB_CORRUPTION;
 	}
@@ -774,7 +1078,7 @@ static NTSTATUS tdbsam_delete_sam_account(struct pdb_methods *my_methods,
 	return NT_STATUS_OK;
 
  cancel:
-	if (dbwrap_transaction_cancel(db_sam) != 0) {
+	if (tdbsam_transaction_cancel() != 0) {
 		smb_panic("transaction_cancel failed");
 	}
 
@@ -891,7 +1195,7 @@ static bool tdb_update_sam(struct pdb_methods *my_methods, struct samu* newpwd,
 		return False;
 	}
 
-	if (dbwrap_transaction_start(db_sam) != 0) {
+	if (tdbsam_transaction_start() != 0) {
 		DEBUG(0, ("Could not start transaction\n"));
 		return false;
 	}
@@ -950,7 +1254,7 @@ static bool tdb_update_sam(struct pdb_methods *my_methods, struct samu* newpwd,
 		}
 	}
 
-	if (dbwrap_transaction_commit(db_sam) != 0) {
+	if (tdbsam_transaction_commit() != 0) {
 		DEBUG(0, ("Could not commit transaction\n"));
 		return false;
 	}
@@ -958,7 +1262,7 @@ static bool tdb_update_sam(struct pdb_methods *my_methods, struct samu* newpwd,
 	return true;
 
  cancel:
-	if (dbwrap_transaction_cancel(db_sam) != 0) {
+	if (tdbsam_transaction_cancel() != 0) {
 		smb_panic("transaction_cancel failed");
 	}
 	return false;
@@ -1038,7 +1342,7 @@ static NTSTATUS tdbsam_rename_sam_account(struct pdb_methods *my_methods,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
-	if (dbwrap_transaction_start(db_sam) != 0) {
+	if (tdbsam_transaction_start() != 0) {
 		DEBUG(0, ("Could not start transaction\n"));
 		TALLOC_FREE(new_acct);
 		return NT_STATUS_ACCESS_DENIED;
@@ -1102,7 +1406,7 @@ static NTSTATUS tdbsam_rename_sam_account(struct pdb_methods *my_methods,
 
 	tdb_delete_samacct_only( old_acct );
 
-	if (dbwrap_transaction_commit(db_sam) != 0) {
+	if (tdbsam_transaction_commit() != 0) {
 		/*
 		 * Ok, we're screwed. We've changed the posix account, but
 		 * could not adapt passdb.tdb. Shall we change the posix
@@ -1117,7 +1421,7 @@ static NTSTATUS tdbsam_rename_sam_account(struct pdb_methods *my_methods,
 	return NT_STATUS_OK;
 
  cancel:
-	if (dbwrap_transaction_cancel(db_sam) != 0) {
+	if (tdbsam_transaction_cancel() != 0) {
 		smb_panic("transaction_cancel failed");
 	}
 
@@ -1161,6 +1465,8 @@ struct tdbsam_search_state {
 	struct pdb_methods *methods;
 	uint32_t acct_flags;
 
+	struct tdbsam_index *index;
+
 	uint32_t *rids;
 	uint32_t num_rids;
 	ssize_t array_size;
@@ -1197,6 +1503,50 @@ static void tdbsam_search_end(struct pdb_search *search)
 	TALLOC_FREE(state);
 }
 
+static int tdbsam_search_state_destructor(struct tdbsam_search_state *state)
+{
+	tdbsam_index_unref(&state->index);
+	return 0;
+}
+
+/*
+ * Enumerate from the index: it is already sorted by rid and has the
+ * display information at hand, no need to unpack the records.
+ */
+
+static bool tdbsam_index_search_next_entry(struct pdb_search *search,
+					   struct samr_displayentry *entry)
+{
+	struct tdbsam_search_state *state = talloc_get_type_abort(
+		search->private_data, struct tdbsam_search_state);
+	struct tdbsam_index *index = state->index;
+	struct tdbsam_index_entry *e;
+
+	while (state->current < index->num_entries) {
+		e = &index->entries[state->current++];
+
+		if ((state->acct_flags != 0) &&
+		    ((state->acct_flags & e->acct_ctrl) == 0)) {
+			continue;
+		}
+
+		entry->acct_flags = e->acct_ctrl;
+		entry->rid = e->rid;
+		entry->account_name = talloc_strdup(talloc_tos(), e->username);
+		entry->fullname = talloc_strdup(talloc_tos(), e->fullname);
+		entry->description = talloc_strdup(talloc_tos(), e->description);
+
+		if ((entry->account_name == NULL) || (entry->fullname == NULL)
+		    || (entry->description == NULL)) {
+			DEBUG(0, ("talloc_strdup failed\n"));
+			return false;
+		}
+		return true;
+	}
+
+	return false;
+}
+
 static bool tdbsam_search_next_entry(struct pdb_search *search,
 				     struct samr_displayentry *entry)
 {
@@ -1244,9 +1594,9 @@ static bool tdbsam_search_next_entry(struct pdb_search *search,
 
 	entry->acct_flags = pdb_get_acct_ctrl(user);
 	entry->rid = rid;
-	entry->account_name = talloc_strdup(search, pdb_get_username(user));
-	entry->fullname = talloc_strdup(search, pdb_get_fullname(user));
-	entry->description = talloc_strdup(search, pdb_get_acct_desc(user));
+	entry->account_name = talloc_strdup(talloc_tos(), pdb_get_username(user));
+	entry->fullname = talloc_strdup(talloc_tos(), pdb_get_fullname(user));
+	entry->description = talloc_strdup(talloc_tos(), pdb_get_acct_desc(user));
 
 	TALLOC_FREE(user);
 
@@ -1279,11 +1629,24 @@ static bool tdbsam_search_users(struct pdb_methods *methods,
 	state->acct_flags = acct_flags;
 	state->methods = methods;
 
+	search->private_data = state;
+	search->search_end = tdbsam_search_end;
+
+	state->index = tdbsam_get_index();
+	if (state->index != NULL) {
+		/*
+		 * Keep this generation of the index alive for the
+		 * lifetime of the search, even if the tdb changes.
+		 */
+		state->index->refcount += 1;
+		talloc_set_destructor(state, tdbsam_search_state_destructor);
+		search->next_entry = tdbsam_index_search_next_entry;
+		return true;
+	}
+
 	dbwrap_traverse_read(db_sam, tdbsam_collect_rids, state, NULL);
 
-	search->private_data = state;
 	search->next_entry = tdbsam_search_next_entry;
-	search->search_end = tdbsam_search_end;
 
 	return true;
 }
@@ -1324,6 +1687,7 @@ static NTSTATUS pdb_init_tdbsam(struct pdb_methods **pdb_method, const char *loc
 	(*pdb_method)->is_responsible_for_builtin =
 					tdbsam_is_responsible_for_builtin;
 	map_builtin = lp_parm_bool(-1, "tdbsam", "map builtin", true);
+	use_memory_index = lp_parm_bool(-1, "tdbsam", "memory index", false);
 
 	/* save the path for later */
 
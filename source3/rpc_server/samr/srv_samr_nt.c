@@ -1361,6 +1361,10 @@ NTSTATUS _samr_QueryDisplayInfo(struct pipes_struct *p,
 	 * of the second point , that's really important.
 	 *
 	 * JFM, 12/20/2001
+	 *
+	 * The copy is now only a window around the requested index, see
+	 * pdb_search_entries(). Paging forward walks the same search,
+	 * only a request behind the window runs the search again.
 	 */
 
 	if ((r->in.level < 1) || (r->in.level > 5)) {
@@ -103,6 +103,7 @@ plantestsuite("samba3.smbtorture_s3.plain(%s).%s" % (env, t), env, [os.path.join
 local_tests = [
     "LOCAL-SUBSTITUTE",
     "LOCAL-GENCACHE",
+    "LOCAL-IDMAP-CACHE",
     "LOCAL-TALLOC-DICT",
     "LOCAL-BASE64",
     "LOCAL-RBTREE",
@@ -116,6 +117,8 @@ local_tests = [
     "LOCAL-CONVERT-STRING",
     "LOCAL-CONV-AUTH-INFO",
     "LOCAL-IDMAP-TDB-COMMON",
+    "LOCAL-PDB-TDB-INDEX",
+    "LOCAL-PDB-SEARCH-WINDOW",
     "LOCAL-MESSAGING-READ1",
     "LOCAL-MESSAGING-READ2",
     "LOCAL-MESSAGING-READ3",
@@ -155,11 +158,18 @@ plantestsuite("samba3.blackbox.smbclient_auth.plain (%s) ipv6" % env, env, [os.p
 for env in ["nt4_member", "ad_member"]:
     plantestsuite("samba3.blackbox.net_cred_change.(%s:local)" % env, "%s:local" % env, [os.path.join(samba3srcdir, "script/tests/test_net_cred_change.sh"), configuration])
 
+# nt4_member runs with "winbind max domain connections = 3" and
+# "winbindd:domain child idle timeout = 5"
+env = "nt4_member"
+plantestsuite("samba3.wbinfo_domain_children.(%s:local)" % env, "%s:local" % env, [os.path.join(srcdir(), "nsswitch/tests/test_wbinfo_domain_children.sh"), '$DOMAIN', '5'])
+
 env = "ad_member"
 t = "--krb5auth=$DOMAIN/$DC_USERNAME%$DC_PASSWORD"
 plantestsuite("samba3.wbinfo_simple.(%s:local).%s" % (env, t), "%s:local" % env, [os.path.join(srcdir(), "nsswitch/tests/test_wbinfo_simple.sh"), t])
-t = "WBCLIENT-MULTI-PING"
-plantestsuite("samba3.smbtorture_s3.%s" % t, env, [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//foo/bar', '""', '""', smbtorture3, ""])
+plantestsuite("samba3.wbinfo_sids2xids_flights.(%s:local)" % env, "%s:local" % env, [os.path.join(srcdir(), "nsswitch/tests/test_wbinfo_sids2xids_flights.sh")])
+for t in ["WBCLIENT-MULTI-PING", "WBCLIENT-PIPELINED-PING",
+          "WBCLIENT-PIPELINED-LIMIT"]:
+    plantestsuite("samba3.smbtorture_s3.%s" % t, env, [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//foo/bar', '""', '""', smbtorture3, ""])
 plantestsuite("samba3.substitutions", env, [os.path.join(samba3srcdir, "script/tests/test_substitutions.sh"), "$SERVER", "alice", "Secret007", "$PREFIX"])
 
 plantestsuite("samba3.ntlm_auth.krb5 with old ccache(ktest:local)", "ktest:local", [os.path.join(samba3srcdir, "script/tests/test_ntlm_auth_krb5.sh"), valgrindify(python), samba3srcdir, ntlm_auth3, '$PREFIX/ktest/krb5_ccache-2', '$SERVER', configuration])
@@ -28,6 +28,7 @@
 #include "winbindd/winbindd_proto.h"
 #include "dbwrap/dbwrap.h"
 #include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
 #include "../libcli/security/dom_sid.h"
 
 #define HWM_GROUP  "GROUP HWM"
@@ -79,7 +80,7 @@ static bool open_db(struct idmap_tdb_common_context *ctx)
 		return false;
 	}
 
-	ctx->db = db_open(ctx, db_path, 0, TDB_DEFAULT,
+	ctx->db = db_open(ctx, db_path, 0, TDB_DEFAULT|TDB_SEQNUM,
 			  O_RDWR | O_CREAT, 0600,
 			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 
@@ -965,6 +966,151 @@ out:
 	return retval;
 }
 
+static bool snapshot_marker(struct idmap_tdb_common_context *ctx)
+{
+	NTSTATUS status;
+
+	/* a reload would lose this */
+	status = dbwrap_store_bystring(ctx->snapshot, "snapshot marker",
+				       string_term_tdb_data("1"), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: storing marker failed!\n"));
+		return false;
+	}
+	return true;
+}
+
+static bool test_snapshot1(TALLOC_CTX *memctx, struct idmap_domain *dom)
+{
+	struct idmap_tdb_common_context *ctx =
+		talloc_get_type_abort(dom->private_data,
+				      struct idmap_tdb_common_context);
+	NTSTATUS status;
+	struct id_map map, test_map;
+	struct dom_sid testsid;
+	bool retval = false;
+
+	ctx->use_snapshot = true;
+
+	ZERO_STRUCT(map);
+	map.sid = dom_sid_parse_talloc(memctx, DOM_SID6 "-100");
+
+	/* not there yet, but the lookup loads the snapshot */
+	status = idmap_tdb_common_sid_to_unixid(dom, &map);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_NONE_MAPPED)) {
+		DEBUG(0, ("test_snapshot1: found unmapped sid!\n"));
+		goto done;
+	}
+	if (ctx->snapshot == NULL) {
+		DEBUG(0, ("test_snapshot1: no snapshot loaded!\n"));
+		goto done;
+	}
+	if (!snapshot_marker(ctx)) {
+		goto done;
+	}
+
+	map.xid.type = ID_TYPE_UID;
+	status = idmap_tdb_common_get_new_id(dom, &map.xid);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: get_new_id failed!\n"));
+		goto done;
+	}
+	status = idmap_tdb_common_set_mapping(dom, &map);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: set_mapping failed!\n"));
+		goto done;
+	}
+
+	/* our own writes are copied to the snapshot */
+	ZERO_STRUCT(test_map);
+	test_map.sid = map.sid;
+	status = idmap_tdb_common_sid_to_unixid(dom, &test_map);
+	if (!NT_STATUS_IS_OK(status) ||
+	    (test_map.xid.type != ID_TYPE_UID) ||
+	    (test_map.xid.id != map.xid.id)) {
+		DEBUG(0, ("test_snapshot1: new mapping not found!\n"));
+		goto done;
+	}
+	ZERO_STRUCT(test_map);
+	test_map.sid = &testsid;
+	test_map.xid = map.xid;
+	status = idmap_tdb_common_unixid_to_sid(dom, &test_map);
+	if (!NT_STATUS_IS_OK(status) || !dom_sid_equal(map.sid, &testsid)) {
+		DEBUG(0, ("test_snapshot1: reverse mapping not found!\n"));
+		goto done;
+	}
+	if (!dbwrap_exists(ctx->snapshot,
+			   string_term_tdb_data("snapshot marker"))) {
+		DEBUG(0, ("test_snapshot1: snapshot reloaded after "
+			  "a local write!\n"));
+		goto done;
+	}
+	if (ctx->snapshot_seqnum != dbwrap_get_seqnum(ctx->db)) {
+		DEBUG(0, ("test_snapshot1: snapshot seqnum not updated!\n"));
+		goto done;
+	}
+
+	/* somebody else's write */
+	status = dbwrap_store_bystring(ctx->db, "SID S-1-5-21-1-2-3-100",
+				       string_term_tdb_data("UID 99999"), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: storing behind the snapshot "
+			  "failed!\n"));
+		goto done;
+	}
+
+	ZERO_STRUCT(test_map);
+	test_map.sid = map.sid;
+	status = idmap_tdb_common_sid_to_unixid(dom, &test_map);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: mapping lost on reload!\n"));
+		goto done;
+	}
+	if (dbwrap_exists(ctx->snapshot,
+			  string_term_tdb_data("snapshot marker"))) {
+		DEBUG(0, ("test_snapshot1: snapshot not reloaded after "
+			  "an external write!\n"));
+		goto done;
+	}
+	if (!dbwrap_exists(ctx->snapshot,
+			   string_term_tdb_data("SID S-1-5-21-1-2-3-100"))) {
+		DEBUG(0, ("test_snapshot1: external write not in the "
+			  "snapshot!\n"));
+		goto done;
+	}
+	status = dbwrap_delete_bystring(ctx->db, "SID S-1-5-21-1-2-3-100");
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: deleting test record failed!\n"));
+		goto done;
+	}
+
+	/* no writes, no reload */
+	ZERO_STRUCT(test_map);
+	test_map.sid = map.sid;
+	status = idmap_tdb_common_sid_to_unixid(dom, &test_map);
+	if (!NT_STATUS_IS_OK(status) || !snapshot_marker(ctx)) {
+		goto done;
+	}
+	status = idmap_tdb_common_sid_to_unixid(dom, &test_map);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_snapshot1: mapping lost!\n"));
+		goto done;
+	}
+	if (!dbwrap_exists(ctx->snapshot,
+			   string_term_tdb_data("snapshot marker"))) {
+		DEBUG(0, ("test_snapshot1: snapshot reloaded needlessly!\n"));
+		goto done;
+	}
+
+	DEBUG(0, ("test_snapshot1: PASSED!\n"));
+	retval = true;
+
+done:
+	ctx->use_snapshot = false;
+	TALLOC_FREE(ctx->snapshot);
+	return retval;
+}
+
 #define CHECKRESULT(r) if(!r) {return r;}
 
 bool run_idmap_tdb_common_test(int dummy)
@@ -1023,6 +1169,10 @@ bool run_idmap_tdb_common_test(int dummy)
 	result = test_unixids2sids3(memctx, dom);
 	CHECKRESULT(result);
 
+	/* test lookups from the in-memory snapshot */
+	result = test_snapshot1(memctx, dom);
+	CHECKRESULT(result);
+
 	/* test filling up the range */
 	result = test_getnewid2(memctx, dom);
 	CHECKRESULT(result);
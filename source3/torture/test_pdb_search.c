@@ -0,0 +1,194 @@
+/*
+   Unix SMB/CIFS implementation.
+   Test paging through a passdb search
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "torture/proto.h"
+#include "passdb.h"
+#include "../librpc/gen_ndr/samr.h"
+#include "../libcli/security/security.h"
+
+#define NUM_USERS 100
+#define PAGE_SIZE 7
+#define FIRST_RID 5000
+
+static bool add_users(void)
+{
+	int i;
+
+	for (i=0; i<NUM_USERS; i++) {
+		struct samu *user;
+		char name[32];
+		NTSTATUS status;
+
+		user = samu_new(talloc_tos());
+		if (user == NULL) {
+			d_fprintf(stderr, "samu_new failed\n");
+			return false;
+		}
+		snprintf(name, sizeof(name), "pdbsearch%d", i);
+
+		pdb_set_username(user, name, PDB_SET);
+		pdb_set_acct_ctrl(user, ACB_NORMAL, PDB_SET);
+		if (!pdb_set_user_sid_from_rid(user, FIRST_RID + i, PDB_SET) ||
+		    !pdb_set_group_sid_from_rid(user, DOMAIN_RID_USERS,
+						PDB_SET)) {
+			d_fprintf(stderr, "setting the sids failed\n");
+			TALLOC_FREE(user);
+			return false;
+		}
+
+		status = pdb_add_sam_account(user);
+		TALLOC_FREE(user);
+		if (!NT_STATUS_IS_OK(status)) {
+			d_fprintf(stderr, "pdb_add_sam_account(%s) failed: "
+				  "%s\n", name, nt_errstr(status));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static uint32_t num_cached(const struct pdb_search *search)
+{
+	if (search->num_entries <= search->cache_start) {
+		return 0;
+	}
+	return search->num_entries - search->cache_start;
+}
+
+/*
+ * Count the users like count_sam_users() does for QueryDomainInfo,
+ * then page through them like QueryDisplayInfo. Neither may keep more
+ * than a page of entries.
+ */
+
+bool run_local_pdb_search_window(int dummy)
+{
+	struct pdb_search *search = NULL;
+	struct samr_displayentry *entries;
+	bool seen[NUM_USERS] = { false, };
+	char *path, *backend;
+	uint32_t i, idx, num;
+	bool ret = false;
+
+	path = talloc_asprintf(talloc_tos(), "%s/pdb_search_test.tdb",
+			       lp_private_dir());
+	backend = talloc_asprintf(talloc_tos(), "tdbsam:%s", path);
+	if ((path == NULL) || (backend == NULL)) {
+		d_fprintf(stderr, "talloc_asprintf failed\n");
+		return false;
+	}
+	unlink(path);
+
+	lp_set_cmdline("passdb backend", backend);
+
+	if (!initialize_password_db(true, NULL)) {
+		d_fprintf(stderr, "initialize_password_db(%s) failed\n",
+			  backend);
+		goto fail;
+	}
+
+	if (!add_users()) {
+		goto fail;
+	}
+
+	search = pdb_search_users(talloc_tos(), ACB_NORMAL);
+	if (search == NULL) {
+		d_fprintf(stderr, "pdb_search_users failed\n");
+		goto fail;
+	}
+
+	pdb_search_entries(search, 0xffffffff, 1, &entries);
+	if (search->num_entries != NUM_USERS) {
+		d_fprintf(stderr, "counted %u users, expected %d\n",
+			  (unsigned)search->num_entries, NUM_USERS);
+		goto fail;
+	}
+	if (!search->search_ended) {
+		d_fprintf(stderr, "counting did not end the search\n");
+		goto fail;
+	}
+	if ((num_cached(search) != 0) || (search->cache != NULL)) {
+		d_fprintf(stderr, "counting kept %u entries\n",
+			  (unsigned)num_cached(search));
+		goto fail;
+	}
+
+	idx = 0;
+	while (idx < NUM_USERS) {
+		num = pdb_search_entries(search, idx, PAGE_SIZE, &entries);
+		if (num != MIN(PAGE_SIZE, NUM_USERS - idx)) {
+			d_fprintf(stderr, "got %u entries at %u\n",
+				  (unsigned)num, (unsigned)idx);
+			goto fail;
+		}
+
+		if (num_cached(search) > PAGE_SIZE) {
+			d_fprintf(stderr, "%u entries cached at %u\n",
+				  (unsigned)num_cached(search),
+				  (unsigned)idx);
+			goto fail;
+		}
+
+		for (i=0; i<num; i++) {
+			uint32_t rid = entries[i].rid;
+
+			if ((rid < FIRST_RID) ||
+			    (rid >= FIRST_RID + NUM_USERS) ||
+			    seen[rid - FIRST_RID]) {
+				d_fprintf(stderr, "unexpected rid %u at %u\n",
+					  (unsigned)rid, (unsigned)(idx + i));
+				goto fail;
+			}
+			seen[rid - FIRST_RID] = true;
+		}
+		idx += num;
+	}
+
+	num = pdb_search_entries(search, idx, PAGE_SIZE, &entries);
+	if (num != 0) {
+		d_fprintf(stderr, "got %u entries past the end\n",
+			  (unsigned)num);
+		goto fail;
+	}
+
+	/* going back restarts the search and finds the same entries */
+	num = pdb_search_entries(search, 0, PAGE_SIZE, &entries);
+	if (num != PAGE_SIZE) {
+		d_fprintf(stderr, "got %u entries after going back\n",
+			  (unsigned)num);
+		goto fail;
+	}
+	for (i=0; i<num; i++) {
+		uint32_t rid = entries[i].rid;
+
+		if ((rid < FIRST_RID) || (rid >= FIRST_RID + NUM_USERS)) {
+			d_fprintf(stderr, "unexpected rid %u after going "
+				  "back\n", (unsigned)rid);
+			goto fail;
+		}
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(search);
+	unlink(path);
+	return ret;
+}
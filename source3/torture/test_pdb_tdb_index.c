@@ -0,0 +1,233 @@
+/*
+   Unix SMB/CIFS implementation.
+   Test the in-memory index of tdbsam
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "torture/proto.h"
+#include "passdb.h"
+#include "../librpc/gen_ndr/samr.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+#include "../libcli/security/security.h"
+
+#define TEST_USER "pdbindexuser"
+#define TEST_RID 4321
+
+static bool check_fullname(struct pdb_methods *pdb, const char *expected)
+{
+	struct samu *user;
+	struct dom_sid sid;
+	NTSTATUS status;
+	const char *fullname;
+	bool ok = false;
+
+	user = samu_new(talloc_tos());
+	if (user == NULL) {
+		d_fprintf(stderr, "samu_new failed\n");
+		return false;
+	}
+
+	status = pdb->getsampwnam(pdb, user, TEST_USER);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "getsampwnam failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+	fullname = pdb_get_fullname(user);
+	if (strcmp(fullname, expected) != 0) {
+		d_fprintf(stderr, "getsampwnam returned \"%s\", "
+			  "expected \"%s\"\n", fullname, expected);
+		goto fail;
+	}
+	TALLOC_FREE(user);
+
+	user = samu_new(talloc_tos());
+	if (user == NULL) {
+		d_fprintf(stderr, "samu_new failed\n");
+		return false;
+	}
+
+	sid_compose(&sid, get_global_sam_sid(), TEST_RID);
+
+	status = pdb->getsampwsid(pdb, user, &sid);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "getsampwsid failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+	fullname = pdb_get_fullname(user);
+	if (strcmp(fullname, expected) != 0) {
+		d_fprintf(stderr, "getsampwsid returned \"%s\", "
+			  "expected \"%s\"\n", fullname, expected);
+		goto fail;
+	}
+
+	ok = true;
+fail:
+	TALLOC_FREE(user);
+	return ok;
+}
+
+/*
+ * Change the full name through another handle on passdb.tdb, as
+ * another process would
+ */
+
+static bool set_fullname_behind_back(const char *path, const char *fullname)
+{
+	struct db_context *db;
+	struct samu *user;
+	TDB_DATA data;
+	uint8_t *buf = NULL;
+	uint32_t len;
+	NTSTATUS status;
+	bool ok = false;
+
+	db = db_open(talloc_tos(), path, 0, TDB_DEFAULT|TDB_SEQNUM, O_RDWR,
+		     0600, DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		d_fprintf(stderr, "db_open(%s) failed\n", path);
+		return false;
+	}
+
+	user = samu_new(db);
+	if (user == NULL) {
+		d_fprintf(stderr, "samu_new failed\n");
+		goto fail;
+	}
+
+	status = dbwrap_fetch_bystring(db, db, "USER_" TEST_USER, &data);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "fetching the user failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+	if (!init_samu_from_buffer(user, SAMU_BUFFER_LATEST,
+				   data.dptr, data.dsize)) {
+		d_fprintf(stderr, "init_samu_from_buffer failed\n");
+		goto fail;
+	}
+
+	pdb_set_fullname(user, fullname, PDB_CHANGED);
+	pdb_set_group_sid_from_rid(user, DOMAIN_RID_USERS, PDB_SET);
+
+	len = init_buffer_from_samu(&buf, user, false);
+	if (len == (uint32_t)-1) {
+		d_fprintf(stderr, "init_buffer_from_samu failed\n");
+		goto fail;
+	}
+
+	status = dbwrap_store_bystring(db, "USER_" TEST_USER,
+				       make_tdb_data(buf, len), TDB_MODIFY);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "storing the user failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+
+	ok = true;
+fail:
+	SAFE_FREE(buf);
+	TALLOC_FREE(db);
+	return ok;
+}
+
+bool run_local_pdb_tdb_index(int dummy)
+{
+	struct pdb_methods *pdb = NULL;
+	struct samu *user = NULL;
+	char *path, *backend;
+	NTSTATUS status;
+	bool ret = false;
+
+	path = talloc_asprintf(talloc_tos(), "%s/pdb_index_test.tdb",
+			       lp_private_dir());
+	backend = talloc_asprintf(talloc_tos(), "tdbsam:%s", path);
+	if ((path == NULL) || (backend == NULL)) {
+		d_fprintf(stderr, "talloc_asprintf failed\n");
+		return false;
+	}
+	unlink(path);
+
+	lp_set_cmdline("tdbsam:memory index", "yes");
+
+	status = make_pdb_method_name(&pdb, backend);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "make_pdb_method_name(%s) failed: %s\n",
+			  backend, nt_errstr(status));
+		goto fail;
+	}
+
+	user = samu_new(talloc_tos());
+	if (user == NULL) {
+		d_fprintf(stderr, "samu_new failed\n");
+		goto fail;
+	}
+	pdb_set_username(user, TEST_USER, PDB_SET);
+	pdb_set_fullname(user, "Before", PDB_SET);
+	pdb_set_acct_ctrl(user, ACB_NORMAL, PDB_SET);
+	if (!pdb_set_user_sid_from_rid(user, TEST_RID, PDB_SET)) {
+		d_fprintf(stderr, "pdb_set_user_sid_from_rid failed\n");
+		goto fail;
+	}
+	if (!pdb_set_group_sid_from_rid(user, DOMAIN_RID_USERS, PDB_SET)) {
+		d_fprintf(stderr, "pdb_set_group_sid_from_rid failed\n");
+		goto fail;
+	}
+
+	status = pdb->add_sam_account(pdb, user);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "add_sam_account failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+
+	/* builds the index */
+	if (!check_fullname(pdb, "Before")) {
+		goto fail;
+	}
+
+	if (!set_fullname_behind_back(path, "After")) {
+		goto fail;
+	}
+
+	/* the seqnum moved, the index must be rebuilt */
+	if (!check_fullname(pdb, "After")) {
+		goto fail;
+	}
+
+	/* and again through our own update path */
+	pdb_set_fullname(user, "Updated", PDB_CHANGED);
+	status = pdb->update_sam_account(pdb, user);
+	if (!NT_STATUS_IS_OK(status)) {
+		d_fprintf(stderr, "update_sam_account failed: %s\n",
+			  nt_errstr(status));
+		goto fail;
+	}
+	if (!check_fullname(pdb, "Updated")) {
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(user);
+	TALLOC_FREE(pdb);
+	unlink(path);
+	return ret;
+}
@@ -43,6 +43,9 @@
 #include "../libcli/smb/smbXcli_base.h"
 #include "lib/util/sys_rw_data.h"
 #include "lib/util/base64.h"
+#include "../librpc/gen_ndr/idmap.h"
+#include "idmap_cache.h"
+#include "tdb_wrap/tdb_wrap.h"
 
 extern char *optarg;
 extern int optind;
@@ -9702,6 +9705,55 @@ static void parse_fn(time_t timeout, DATA_BLOB blob, void *private_data)
 	return;
 }
 
+/*
+ * Remove a record from gencache_notrans.tdb without moving its
+ * sequence number. Only the in-memory tier can answer afterwards.
+ */
+
+static bool gencache_remove_unseen(const char *keystr)
+{
+	struct tdb_wrap *w;
+	char *fname;
+	int ret;
+
+	fname = lock_path("gencache_notrans.tdb");
+	if (fname == NULL) {
+		return false;
+	}
+	/* Returns the handle gencache already has open */
+	w = tdb_wrap_open(talloc_tos(), fname, 0, TDB_DEFAULT, O_RDWR, 0644);
+	TALLOC_FREE(fname);
+	if (w == NULL) {
+		return false;
+	}
+
+	tdb_remove_flags(w->tdb, TDB_SEQNUM);
+	ret = tdb_delete(w->tdb, string_term_tdb_data(keystr));
+	tdb_add_flags(w->tdb, TDB_SEQNUM);
+
+	TALLOC_FREE(w);
+	return (ret == 0);
+}
+
+static bool gencache_check_val(const char *keystr, const char *expected)
+{
+	char *val;
+	bool ok;
+
+	if (!gencache_get(keystr, talloc_tos(), &val, NULL)) {
+		d_printf("%s: gencache_get(%s) failed\n", __location__,
+			 keystr);
+		return false;
+	}
+	ok = (strcmp(val, expected) == 0);
+	if (!ok) {
+		d_printf("%s: gencache_get(%s) returned %s, expected %s\n",
+			 __location__, keystr, val, expected);
+	}
+	TALLOC_FREE(val);
+	return ok;
+}
+
 static bool run_local_gencache(int dummy)
 {
 	char *val;
@@ -9820,9 +9872,307 @@ static bool run_local_gencache(int dummy)
 		return false;
 	}
 
+	/*
+	 * A change by another process must be visible even though
+	 * "foo" sits in our in-memory tier
+	 */
+
+	tm = time(NULL) + 1000;
+
+	if (!gencache_set("foo", "bar", tm) ||
+	    !gencache_get("foo", talloc_tos(), &val, NULL)) {
+		d_printf("%s: gencache_set/get failed\n", __location__);
+		return false;
+	}
+	TALLOC_FREE(val);
+
+	{
+		pid_t child;
+		int status;
+
+		child = fork();
+		if (child == -1) {
+			d_printf("%s: fork failed\n", __location__);
+			return false;
+		}
+		if (child == 0) {
+			_exit(gencache_set("foo", "baz", tm) ? 0 : 1);
+		}
+		if ((waitpid(child, &status, 0) != child) ||
+		    !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			d_printf("%s: child failed\n", __location__);
+			return false;
+		}
+	}
+
+	if (!gencache_get("foo", talloc_tos(), &val, NULL)) {
+		d_printf("%s: gencache_get() failed\n", __location__);
+		return false;
+	}
+	if (strcmp(val, "baz") != 0) {
+		d_printf("%s: gencache_get() returned %s, expected baz\n",
+			 __location__, val);
+		TALLOC_FREE(val);
+		return false;
+	}
+	TALLOC_FREE(val);
+
+	if (!gencache_del("foo")) {
+		d_printf("%s: gencache_del() failed\n", __location__);
+		return false;
+	}
+
+	/*
+	 * Our own deletes and sets must not flush the tier, also when
+	 * they change the size of a record. "b" is removed from the
+	 * tdb behind the tier's back, so it can only come from memory.
+	 */
+
+	if (!gencache_set("a", "aaaa", tm) ||
+	    !gencache_set("b", "bbbb", tm) ||
+	    !gencache_check_val("b", "bbbb")) {
+		return false;
+	}
+	if (!gencache_remove_unseen("b")) {
+		d_printf("%s: removing b failed\n", __location__);
+		return false;
+	}
+
+	if (!gencache_del("a")) {
+		d_printf("%s: gencache_del() failed\n", __location__);
+		return false;
+	}
+	if (!gencache_check_val("b", "bbbb")) {
+		d_printf("%s: gencache_del flushed the memory tier\n",
+			 __location__);
+		return false;
+	}
+
+	if (!gencache_set("a", "a much longer value", tm)) {
+		d_printf("%s: gencache_set() failed\n", __location__);
+		return false;
+	}
+	if (!gencache_check_val("b", "bbbb")) {
+		d_printf("%s: growing a record flushed the memory tier\n",
+			 __location__);
+		return false;
+	}
+	if (!gencache_check_val("a", "a much longer value")) {
+		return false;
+	}
+
+	gencache_del("a");
+	gencache_del("b");
+
 	return True;
 }
 
+static void gencache_perf_parser(time_t timeout, DATA_BLOB blob,
+				 void *private_data)
+{
+	size_t *found = private_data;
+	*found += blob.length;
+}
+
+static double gencache_perf_run(int num_keys, int num_loops)
+{
+	struct timeval start;
+	size_t found = 0;
+	int i, j;
+
+	start = timeval_current();
+
+	for (i=0; i<num_loops; i++) {
+		for (j=0; j<num_keys; j++) {
+			char key[64];
+
+			snprintf(key, sizeof(key),
+				 "IDMAP/SID2XID/S-1-5-21-1-2-3-%d", j);
+			gencache_parse(key, gencache_perf_parser, &found);
+		}
+	}
+
+	return timeval_elapsed(&start);
+}
+
+/*
+ * Hit rate of gencache_parse with and without the in-memory tier
+ */
+
+static bool run_local_gencache_perf(int dummy)
+{
+	const int num_keys = 1000;
+	const int num_loops = 100;
+	time_t tm = time(NULL) + 3600;
+	double t_tdb, t_ram;
+	int i;
+
+	/*
+	 * The tier is set up on first use, so this has to happen
+	 * before we touch gencache
+	 */
+	lp_set_cmdline("gencache:memory cache size", "0");
+
+	for (i=0; i<num_keys; i++) {
+		char key[64];
+
+		snprintf(key, sizeof(key), "IDMAP/SID2XID/S-1-5-21-1-2-3-%d",
+			 i);
+		if (!gencache_set(key, "3000000:U", tm)) {
+			d_printf("%s: gencache_set() failed\n", __location__);
+			return false;
+		}
+	}
+
+	t_tdb = gencache_perf_run(num_keys, num_loops);
+
+	lp_set_cmdline("gencache:memory cache size", "1048576");
+	t_ram = gencache_perf_run(num_keys, num_loops);
+
+	printf("gencache_parse: %.0f/s from the tdbs, %.0f/s with the "
+	       "memory cache\n",
+	       num_keys * num_loops / t_tdb, num_keys * num_loops / t_ram);
+
+	for (i=0; i<num_keys; i++) {
+		char key[64];
+
+		snprintf(key, sizeof(key), "IDMAP/SID2XID/S-1-5-21-1-2-3-%d",
+			 i);
+		gencache_del(key);
+	}
+
+	return true;
+}
+
+static bool idmap_cache_check(const struct dom_sid *sid,
+			      const struct unixid *expected)
+{
+	struct unixid id;
+	bool expired;
+
+	if (!idmap_cache_find_sid2unixid(sid, &id, &expired)) {
+		if (expected == NULL) {
+			return true;
+		}
+		d_printf("%s not found\n", sid_string_dbg(sid));
+		return false;
+	}
+	if (expected == NULL) {
+		d_printf("%s unexpectedly found as %u:%d\n",
+			 sid_string_dbg(sid), (unsigned)id.id, (int)id.type);
+		return false;
+	}
+	if ((id.id != expected->id) || (id.type != expected->type) ||
+	    expired) {
+		d_printf("%s found as %u:%d%s, expected %u:%d\n",
+			 sid_string_dbg(sid), (unsigned)id.id, (int)id.type,
+			 expired ? " (expired)" : "",
+			 (unsigned)expected->id, (int)expected->type);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Check the memory tier in front of the SID2XID gencache entries:
+ * idmap_cache_set_sid2unixid has to update it, deleting a mapping has
+ * to empty it. Removing the gencache record behind its back shows
+ * which tier answered.
+ */
+
+static bool run_local_idmap_cache(int dummy)
+{
+	const char *sidstr = "S-1-5-21-1234-5678-9012-1000";
+	const char *key = "IDMAP/SID2XID/S-1-5-21-1234-5678-9012-1000";
+	struct dom_sid sid;
+	struct unixid uid = { .id = 3000000, .type = ID_TYPE_UID };
+	struct unixid gid = { .id = 3000001, .type = ID_TYPE_GID };
+	struct unixid neg = { .id = UINT32_MAX, .type = ID_TYPE_NOT_SPECIFIED };
+	bool ret = false;
+
+	if (!string_to_sid(&sid, sidstr)) {
+		d_printf("string_to_sid failed\n");
+		return false;
+	}
+
+	idmap_cache_ram_init(64*1024);
+
+	idmap_cache_set_sid2unixid(&sid, &uid);
+	if (!idmap_cache_check(&sid, &uid)) {
+		goto done;
+	}
+
+	/* Without the gencache record only the memory tier can answer */
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, &uid)) {
+		d_printf("memory tier not filled by set_sid2unixid\n");
+		goto done;
+	}
+
+	/* A new mapping must replace the one in memory */
+	idmap_cache_set_sid2unixid(&sid, &gid);
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, &gid)) {
+		d_printf("memory tier not updated by set_sid2unixid\n");
+		goto done;
+	}
+
+	idmap_cache_set_sid2unixid(&sid, &neg);
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, &neg)) {
+		d_printf("negative mapping not in the memory tier\n");
+		goto done;
+	}
+
+	/* A gencache hit is put into the memory tier as well */
+	idmap_cache_ram_flush();
+	if (!gencache_set(key, "3000001:G", time(NULL) + 60)) {
+		d_printf("gencache_set failed\n");
+		goto done;
+	}
+	if (!idmap_cache_check(&sid, &gid)) {
+		goto done;
+	}
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, &gid)) {
+		d_printf("memory tier not filled by a gencache hit\n");
+		goto done;
+	}
+
+	idmap_cache_set_sid2unixid(&sid, &uid);
+	if (!idmap_cache_del_sid(&sid)) {
+		d_printf("idmap_cache_del_sid failed\n");
+		goto done;
+	}
+	if (!idmap_cache_check(&sid, NULL)) {
+		d_printf("memory tier not emptied by idmap_cache_del_sid\n");
+		goto done;
+	}
+
+	idmap_cache_set_sid2unixid(&sid, &uid);
+	idmap_cache_ram_flush();
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, NULL)) {
+		d_printf("memory tier not emptied by idmap_cache_ram_flush\n");
+		goto done;
+	}
+
+	/* Without the memory tier gencache is the only one */
+	idmap_cache_ram_init(0);
+	idmap_cache_set_sid2unixid(&sid, &uid);
+	gencache_del(key);
+	if (!idmap_cache_check(&sid, NULL)) {
+		d_printf("disabled memory tier answered\n");
+		goto done;
+	}
+
+	ret = true;
+done:
+	idmap_cache_ram_init(0);
+	idmap_cache_del_sid(&sid);
+	return ret;
+}
+
 static bool rbt_testval(struct db_context *db, const char *key,
 			const char *value)
 {
@@ -10555,7 +10905,7 @@ static void wbclient_done(struct tevent_req *req)
 	d_printf("wb_trans_recv %d returned %s\n", *i, wbcErrorString(wbc_err));
 }
 
-static bool run_wbclient_multi_ping(int dummy)
+static bool wbclient_multi_ping(bool pipelined)
 {
 	struct tevent_context *ev;
 	struct wb_context **wb_ctx;
@@ -10585,6 +10935,7 @@ static bool run_wbclient_multi_ping(int dummy)
 		if (wb_ctx[i] == NULL) {
 			goto fail;
 		}
+		wb_context_set_pipelined(wb_ctx[i], pipelined);
 		for (j=0; j<torture_numops; j++) {
 			struct tevent_req *req;
 			req = wb_trans_send(ev, ev, wb_ctx[i],
@@ -10608,6 +10959,151 @@ static bool run_wbclient_multi_ping(int dummy)
 	return result;
 }
 
+static bool run_wbclient_multi_ping(int dummy)
+{
+	return wbclient_multi_ping(false);
+}
+
+/*
+ * Same as WBCLIENT-MULTI-PING, but every wb_context sends all its
+ * requests over one connection without waiting for replies.
+ */
+
+static bool run_wbclient_pipelined_ping(int dummy)
+{
+	return wbclient_multi_ping(true);
+}
+
+struct wbclient_pipelined_limit_state {
+	int num_done;
+	int num_failed;
+	int first_ping;
+	int first_slow;
+};
+
+struct wbclient_pipelined_limit_req {
+	struct wbclient_pipelined_limit_state *state;
+	bool slow;
+};
+
+static void wbclient_pipelined_limit_done(struct tevent_req *req)
+{
+	struct wbclient_pipelined_limit_req *r =
+		(struct wbclient_pipelined_limit_req *)
+		tevent_req_callback_data_void(req);
+	struct wbclient_pipelined_limit_state *state = r->state;
+	struct winbindd_response *wb_resp;
+	wbcErr wbc_err;
+
+	wbc_err = wb_trans_recv(req, req, &wb_resp);
+	TALLOC_FREE(req);
+
+	state->num_done += 1;
+	/* The name lookups are expected to fail */
+	if (!r->slow && !WBC_ERROR_IS_OK(wbc_err)) {
+		d_printf("request %d returned %s\n", state->num_done,
+			 wbcErrorString(wbc_err));
+		state->num_failed += 1;
+	}
+	if (r->slow && (state->first_slow == 0)) {
+		state->first_slow = state->num_done;
+	}
+	if (!r->slow && (state->first_ping == 0)) {
+		state->first_ping = state->num_done;
+	}
+}
+
+/*
+ * Flood one pipelined connection: "winbindd:max pipelined requests"
+ * lookups of a name nobody answers for, which wait for the broadcast
+ * timeout, followed by pings. winbindd must not read the pings before
+ * one of the slow requests is done, so no ping may be answered first.
+ */
+
+static bool run_wbclient_pipelined_limit(int dummy)
+{
+	struct tevent_context *ev;
+	struct wb_context *wb_ctx;
+	struct winbindd_request slow_req, ping_req;
+	struct wbclient_pipelined_limit_state state = { .num_done = 0 };
+	struct wbclient_pipelined_limit_req *reqs;
+	int max_pipelined, num_reqs, i;
+	bool result = false;
+
+	BlockSignals(True, SIGPIPE);
+
+	max_pipelined = lp_parm_int(-1, "winbindd", "max pipelined requests",
+				    8);
+	num_reqs = max_pipelined * 4;
+
+	ev = tevent_context_init(talloc_tos());
+	if (ev == NULL) {
+		goto fail;
+	}
+
+	wb_ctx = wb_context_init(ev, NULL);
+	if (wb_ctx == NULL) {
+		goto fail;
+	}
+	wb_context_set_pipelined(wb_ctx, true);
+
+	reqs = talloc_array(ev, struct wbclient_pipelined_limit_req,
+			    num_reqs);
+	if (reqs == NULL) {
+		goto fail;
+	}
+
+	ZERO_STRUCT(slow_req);
+	slow_req.cmd = WINBINDD_WINS_BYNAME;
+	fstrcpy(slow_req.data.winsreq, "NOSUCHNAME");
+
+	ZERO_STRUCT(ping_req);
+	ping_req.cmd = WINBINDD_PING;
+
+	d_printf("max pipelined requests=%d, sending %d\n", max_pipelined,
+		 num_reqs);
+
+	for (i=0; i<num_reqs; i++) {
+		struct tevent_req *req;
+
+		reqs[i] = (struct wbclient_pipelined_limit_req) {
+			.state = &state, .slow = (i < max_pipelined)
+		};
+		req = wb_trans_send(ev, ev, wb_ctx, false,
+				    reqs[i].slow ? &slow_req : &ping_req);
+		if (req == NULL) {
+			goto fail;
+		}
+		tevent_req_set_callback(req, wbclient_pipelined_limit_done,
+					&reqs[i]);
+	}
+
+	while (state.num_done < num_reqs) {
+		if (tevent_loop_once(ev) != 0) {
+			d_printf("tevent_loop_once failed\n");
+			goto fail;
+		}
+	}
+
+	d_printf("first slow reply %d, first ping reply %d\n",
+		 state.first_slow, state.first_ping);
+
+	if (state.num_failed != 0) {
+		d_printf("%d requests failed\n", state.num_failed);
+		goto fail;
+	}
+	if (state.first_ping < state.first_slow) {
+		d_printf("a ping was read beyond the limit of %d\n",
+			 max_pipelined);
+		goto fail;
+	}
+
+	result = true;
+ fail:
+	TALLOC_FREE(ev);
+	return result;
+}
+
 static void getaddrinfo_finished(struct tevent_req *req)
 {
 	char *name = (char *)tevent_req_callback_data_void(req);
@@ -11226,6 +11722,8 @@ static struct {
 	{ "PIDHIGH", run_pidhigh },
 	{ "LOCAL-SUBSTITUTE", run_local_substitute, 0},
 	{ "LOCAL-GENCACHE", run_local_gencache, 0},
+	{ "LOCAL-GENCACHE-PERF", run_local_gencache_perf, 0},
+	{ "LOCAL-IDMAP-CACHE", run_local_idmap_cache, 0},
 	{ "LOCAL-TALLOC-DICT", run_local_talloc_dict, 0},
 	{ "LOCAL-DBWRAP-WATCH1", run_dbwrap_watch1, 0 },
 	{ "LOCAL-MESSAGING-READ1", run_messaging_read1, 0 },
@@ -11241,6 +11739,8 @@ static struct {
 	{ "LOCAL-MEMCACHE", run_local_memcache, 0},
 	{ "LOCAL-STREAM-NAME", run_local_stream_name, 0},
 	{ "WBCLIENT-MULTI-PING", run_wbclient_multi_ping, 0},
+	{ "WBCLIENT-PIPELINED-PING", run_wbclient_pipelined_ping, 0},
+	{ "WBCLIENT-PIPELINED-LIMIT", run_wbclient_pipelined_limit, 0},
 	{ "LOCAL-string_to_sid", run_local_string_to_sid, 0},
 	{ "LOCAL-sid_to_string", run_local_sid_to_string, 0},
 	{ "LOCAL-binary_to_sid", run_local_binary_to_sid, 0},
@@ -11250,6 +11750,8 @@ static struct {
 	{ "LOCAL-CONV-AUTH-INFO", run_local_conv_auth_info, 0},
 	{ "LOCAL-hex_encode_buf", run_local_hex_encode_buf, 0},
 	{ "LOCAL-IDMAP-TDB-COMMON", run_idmap_tdb_common_test, 0},
+	{ "LOCAL-PDB-TDB-INDEX", run_local_pdb_tdb_index, 0},
+	{ "LOCAL-PDB-SEARCH-WINDOW", run_local_pdb_search_window, 0},
 	{ "LOCAL-remove_duplicate_addrs2", run_local_remove_duplicate_addrs2, 0},
 	{ "local-tdb-opener", run_local_tdb_opener, 0 },
 	{ "local-tdb-writer", run_local_tdb_writer, 0 },
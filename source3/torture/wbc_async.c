@@ -27,7 +27,9 @@
 #include <talloc.h>
 #include <tevent.h>
 #include "lib/async_req/async_sock.h"
+#include "lib/util/dlinklist.h"
 #include "nsswitch/winbind_struct_protocol.h"
+#include "nsswitch/wb_reqtrans.h"
 #include "nsswitch/libwbclient/wbclient.h"
 #include "wbc_async.h"
 
@@ -88,12 +90,26 @@ struct wbc_debug_ops {
 	void *context;
 };
 
+struct wb_trans_state;
+
 struct wb_context {
 	struct tevent_queue *queue;
 	int fd;
 	bool is_priv;
 	const char *dir;
 	struct wbc_debug_ops debug_ops;
+
+	/*
+	 * With "pipelined" set and a winbindd that knows about
+	 * WBFLAG_PIPELINED, the queue only serializes connecting and
+	 * sending. Requests sent wait in "pending" for their reply,
+	 * which "reader" matches by request_id.
+	 */
+	bool pipelined;
+	int interface_version;
+	uint32_t next_request_id;
+	struct wb_trans_state *pending;
+	struct tevent_req *reader;
 };
 
 static int make_nonstd_fd(int fd)
@@ -203,6 +219,7 @@ struct wb_context *wb_context_init(TALLOC_CTX *mem_ctx, const char* dir)
 	}
 	result->fd = -1;
 	result->is_priv = false;
+	result->interface_version = -1;
 
 	if (dir != NULL) {
 		result->dir = talloc_strdup(result, dir);
@@ -216,6 +233,11 @@ struct wb_context *wb_context_init(TALLOC_CTX *mem_ctx, const char* dir)
 	return result;
 }
 
+void wb_context_set_pipelined(struct wb_context *wb_ctx, bool pipelined)
+{
+	wb_ctx->pipelined = pipelined;
+}
+
 struct wb_connect_state {
 	int dummy;
 };
@@ -427,6 +449,8 @@ static void wb_open_pipe_ping_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->wb_ctx->interface_version = wb_resp->data.interface_version;
+
 	if (!state->need_priv) {
 		tevent_req_done(req);
 		return;
@@ -496,11 +520,15 @@ static wbcErr wb_open_pipe_recv(struct tevent_req *req)
 
 struct wb_trans_state {
 	struct wb_trans_state *prev, *next;
+	struct tevent_req *req;
 	struct wb_context *wb_ctx;
 	struct tevent_context *ev;
 	struct winbindd_request *wb_req;
 	struct winbindd_response *wb_resp;
 	bool need_priv;
+	struct tevent_queue_entry *queue_entry;
+	uint32_t request_id;
+	bool is_pending;
 };
 
 static bool closed_fd(int fd)
@@ -530,7 +558,202 @@ static bool closed_fd(int fd)
 static void wb_trans_trigger(struct tevent_req *req, void *private_data);
 static void wb_trans_connect_done(struct tevent_req *subreq);
 static void wb_trans_done(struct tevent_req *subreq);
+static void wb_trans_written(struct tevent_req *subreq);
 static void wb_trans_retry_wait_done(struct tevent_req *subreq);
+static bool wb_trans_retry(struct tevent_req *req,
+			   struct wb_trans_state *state,
+			   wbcErr wbc_err);
+static void wb_context_read_done(struct tevent_req *subreq);
+
+static void wb_trans_cleanup(struct tevent_req *req,
+			     enum tevent_req_state req_state)
+{
+	struct wb_trans_state *state = tevent_req_data(
+		req, struct wb_trans_state);
+
+	if (state->is_pending) {
+		DLIST_REMOVE(state->wb_ctx->pending, state);
+		state->is_pending = false;
+	}
+	TALLOC_FREE(state->queue_entry);
+}
+
+static bool wb_trans_queue(struct tevent_req *req)
+{
+	struct wb_trans_state *state = tevent_req_data(
+		req, struct wb_trans_state);
+
+	if (!state->wb_ctx->pipelined) {
+		return tevent_queue_add(state->wb_ctx->queue, state->ev, req,
+					wb_trans_trigger, NULL);
+	}
+
+	/*
+	 * We leave the queue as soon as our request is sent, so we
+	 * need the entry
+	 */
+	state->queue_entry = tevent_queue_add_entry(
+		state->wb_ctx->queue, state->ev, req, wb_trans_trigger, NULL);
+	return (state->queue_entry != NULL);
+}
+
+/*
+ * The connection is gone. Everybody waiting for a reply on it has to
+ * start over.
+ */
+
+static void wb_context_disconnect(struct wb_context *wb_ctx, wbcErr wbc_err)
+{
+	struct wb_trans_state *pending = wb_ctx->pending;
+	struct wb_trans_state *state;
+
+	TALLOC_FREE(wb_ctx->reader);
+
+	if (wb_ctx->fd != -1) {
+		close(wb_ctx->fd);
+		wb_ctx->fd = -1;
+	}
+
+	wb_ctx->pending = NULL;
+
+	while ((state = pending) != NULL) {
+		DLIST_REMOVE(pending, state);
+		state->is_pending = false;
+		wb_trans_retry(state->req, state, wbc_err);
+	}
+}
+
+static void wb_context_read_next(struct wb_context *wb_ctx,
+				 struct tevent_context *ev)
+{
+	if ((wb_ctx->reader != NULL) || (wb_ctx->pending == NULL)) {
+		return;
+	}
+
+	wb_ctx->reader = wb_resp_read_send(wb_ctx, ev, wb_ctx->fd);
+	if (wb_ctx->reader == NULL) {
+		wb_context_disconnect(wb_ctx, WBC_ERR_NO_MEMORY);
+		return;
+	}
+	tevent_req_set_callback(wb_ctx->reader, wb_context_read_done, wb_ctx);
+}
+
+static void wb_context_read_done(struct tevent_req *subreq)
+{
+	struct wb_context *wb_ctx = tevent_req_callback_data(
+		subreq, struct wb_context);
+	struct winbindd_response *wb_resp;
+	struct wb_trans_state *state;
+	uint32_t request_id;
+	ssize_t ret;
+	int err;
+
+	ret = wb_resp_read_pipelined_recv(subreq, wb_ctx, &wb_resp,
+					  &request_id, &err);
+	TALLOC_FREE(subreq);
+	wb_ctx->reader = NULL;
+
+	if (ret == -1) {
+		wb_context_disconnect(wb_ctx, map_wbc_err_from_errno(err));
+		return;
+	}
+
+	for (state = wb_ctx->pending; state != NULL; state = state->next) {
+		if (state->request_id == request_id) {
+			break;
+		}
+	}
+	if (state == NULL) {
+		wbcDebug(wb_ctx, WBC_DEBUG_ERROR,
+			 "Got reply for unknown request %u\n",
+			 (unsigned)request_id);
+		TALLOC_FREE(wb_resp);
+		wb_context_disconnect(wb_ctx, WBC_ERR_UNKNOWN_FAILURE);
+		return;
+	}
+
+	DLIST_REMOVE(wb_ctx->pending, state);
+	state->is_pending = false;
+	state->wb_resp = talloc_move(state, &wb_resp);
+
+	wb_context_read_next(wb_ctx, state->ev);
+
+	tevent_req_done(state->req);
+}
+
+static void wb_trans_send_request(struct tevent_req *req)
+{
+	struct wb_trans_state *state = tevent_req_data(
+		req, struct wb_trans_state);
+	struct wb_context *wb_ctx = state->wb_ctx;
+	struct winbindd_request *wb_req;
+	struct tevent_req *subreq;
+
+	state->wb_req->pid = getpid();
+
+	if (!wb_ctx->pipelined || (wb_ctx->interface_version < 29)) {
+		subreq = wb_simple_trans_send(state, state->ev, NULL,
+					      wb_ctx->fd, state->wb_req);
+		if (tevent_req_nomem(subreq, req)) {
+			return;
+		}
+		tevent_req_set_callback(subreq, wb_trans_done, req);
+		return;
+	}
+
+	wb_ctx->next_request_id += 1;
+	if (wb_ctx->next_request_id == 0) {
+		wb_ctx->next_request_id = 1;
+	}
+
+	state->request_id = wb_ctx->next_request_id;
+
+	/*
+	 * Callers may send one request struct several times, tag a
+	 * private copy.
+	 */
+	wb_req = talloc_memdup(state, state->wb_req, sizeof(*wb_req));
+	if (tevent_req_nomem(wb_req, req)) {
+		return;
+	}
+	wb_req->length = sizeof(struct winbindd_request);
+	wb_req->wb_flags |= WBFLAG_PIPELINED;
+	wb_req->request_id = state->request_id;
+
+	subreq = wb_req_write_send(state, state->ev, NULL, wb_ctx->fd,
+				   wb_req);
+	if (tevent_req_nomem(subreq, req)) {
+		TALLOC_FREE(wb_req);
+		return;
+	}
+	talloc_steal(subreq, wb_req);
+	tevent_req_set_callback(subreq, wb_trans_written, req);
+}
+
+static void wb_trans_written(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct wb_trans_state *state = tevent_req_data(
+		req, struct wb_trans_state);
+	ssize_t ret;
+	int err;
+
+	ret = wb_req_write_recv(subreq, &err);
+	TALLOC_FREE(subreq);
+	if ((ret == -1)
+	    && wb_trans_retry(req, state, map_wbc_err_from_errno(err))) {
+		return;
+	}
+
+	DLIST_ADD_END(state->wb_ctx->pending, state);
+	state->is_pending = true;
+
+	/* Let the next request go */
+	TALLOC_FREE(state->queue_entry);
+
+	wb_context_read_next(state->wb_ctx, state->ev);
+}
 
 struct tevent_req *wb_trans_send(TALLOC_CTX *mem_ctx,
 				 struct tevent_context *ev,
@@ -544,13 +767,15 @@ struct tevent_req *wb_trans_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->req = req;
 	state->wb_ctx = wb_ctx;
 	state->ev = ev;
 	state->wb_req = wb_req;
 	state->need_priv = need_priv;
 
-	if (!tevent_queue_add(wb_ctx->queue, ev, req, wb_trans_trigger,
-			      NULL)) {
+	tevent_req_set_cleanup_fn(req, wb_trans_cleanup);
+
+	if (!wb_trans_queue(req)) {
 		tevent_req_oom(req);
 		return tevent_req_post(req, ev);
 	}
@@ -563,13 +788,21 @@ static void wb_trans_trigger(struct tevent_req *req, void *private_data)
 		req, struct wb_trans_state);
 	struct tevent_req *subreq;
 
-	if ((state->wb_ctx->fd != -1) && closed_fd(state->wb_ctx->fd)) {
+	/*
+	 * With replies outstanding the reader notices a closed
+	 * connection, and a reply in flight would look like one.
+	 */
+	if ((state->wb_ctx->fd != -1) && (state->wb_ctx->reader == NULL) &&
+	    closed_fd(state->wb_ctx->fd)) {
 		close(state->wb_ctx->fd);
 		state->wb_ctx->fd = -1;
 	}
 
 	if ((state->wb_ctx->fd == -1)
 	    || (state->need_priv && !state->wb_ctx->is_priv)) {
+		/* Replies on the old connection will not come */
+		wb_context_disconnect(state->wb_ctx, WBC_ERR_UNKNOWN_FAILURE);
+
 		subreq = wb_open_pipe_send(state, state->ev, state->wb_ctx,
 					   state->need_priv);
 		if (tevent_req_nomem(subreq, req)) {
@@ -579,14 +812,7 @@ static void wb_trans_trigger(struct tevent_req *req, void *private_data)
 		return;
 	}
 
-	state->wb_req->pid = getpid();
-
-	subreq = wb_simple_trans_send(state, state->ev, NULL,
-				      state->wb_ctx->fd, state->wb_req);
-	if (tevent_req_nomem(subreq, req)) {
-		return;
-	}
-	tevent_req_set_callback(subreq, wb_trans_done, req);
+	wb_trans_send_request(req);
 }
 
 static bool wb_trans_retry(struct tevent_req *req,
@@ -612,6 +838,15 @@ static bool wb_trans_retry(struct tevent_req *req,
 	 * The transfer as such failed, retry after one second
 	 */
 
+	if (state->wb_ctx->pipelined) {
+		/*
+		 * Others wait for replies on this connection. We
+		 * queue up again to reconnect.
+		 */
+		TALLOC_FREE(state->queue_entry);
+		wb_context_disconnect(state->wb_ctx, wbc_err);
+	}
+
 	if (state->wb_ctx->fd != -1) {
 		close(state->wb_ctx->fd);
 		state->wb_ctx->fd = -1;
@@ -641,6 +876,13 @@ static void wb_trans_retry_wait_done(struct tevent_req *subreq)
 		return;
 	}
 
+	if (state->wb_ctx->pipelined) {
+		if (!wb_trans_queue(req)) {
+			tevent_req_oom(req);
+		}
+		return;
+	}
+
 	subreq = wb_open_pipe_send(state, state->ev, state->wb_ctx,
 				   state->need_priv);
 	if (tevent_req_nomem(subreq, req)) {
@@ -664,12 +906,7 @@ static void wb_trans_connect_done(struct tevent_req *subreq)
 		return;
 	}
 
-	subreq = wb_simple_trans_send(state, state->ev, NULL,
-				      state->wb_ctx->fd, state->wb_req);
-	if (tevent_req_nomem(subreq, req)) {
-		return;
-	}
-	tevent_req_set_callback(subreq, wb_trans_done, req);
+	wb_trans_send_request(req);
 }
 
 static void wb_trans_done(struct tevent_req *subreq)
@@ -47,6 +47,7 @@ struct tevent_req *wb_trans_send(TALLOC_CTX *mem_ctx,
 wbcErr wb_trans_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
 		     struct winbindd_response **presponse);
 struct wb_context *wb_context_init(TALLOC_CTX *mem_ctx, const char* dir);
+void wb_context_set_pipelined(struct wb_context *wb_ctx, bool pipelined);
 int wbcSetDebug(struct wb_context *wb_ctx,
 		void (*debug)(void *context,
 			      enum wbcDebugLevel level,
@@ -1267,6 +1267,37 @@ static bool do_winbind_dump_domain_list(struct tevent_context *ev_ctx,
 	return num_replies;
 }
 
+static bool do_winbind_sids2xids_stats(struct tevent_context *ev_ctx,
+				       struct messaging_context *msg_ctx,
+				       const struct server_id pid,
+				       const int argc, const char **argv)
+{
+	if (argc != 1) {
+		fprintf(stderr, "Usage: smbcontrol winbindd sids2xids-stats\n");
+		return false;
+	}
+
+	messaging_register(msg_ctx, NULL, MSG_WINBIND_SIDS2XIDS_STATS,
+			   print_pid_string_cb);
+
+	if (!send_message(msg_ctx, pid, MSG_WINBIND_SIDS2XIDS_STATS,
+			  NULL, 0)) {
+		return false;
+	}
+
+	wait_replies(ev_ctx, msg_ctx, procid_to_pid(&pid) == 0);
+
+	/* No replies were received within the timeout period */
+
+	if (num_replies == 0) {
+		printf("No replies received\n");
+	}
+
+	messaging_deregister(msg_ctx, MSG_WINBIND_SIDS2XIDS_STATS, NULL);
+
+	return num_replies;
+}
+
 static void winbind_validate_cache_cb(struct messaging_context *msg,
 				      void *private_data,
 				      uint32_t msg_type,
@@ -1445,6 +1476,8 @@ static const struct {
 	{ "validate-cache" , do_winbind_validate_cache,
 	  "Validate winbind's credential cache" },
 	{ "dump-domain-list", do_winbind_dump_domain_list, "Dump winbind domain list"},
+	{ "sids2xids-stats", do_winbind_sids2xids_stats,
+	  "Show how winbind resolved SIDs to unix ids" },
 	{ "notify-cleanup", do_notify_cleanup },
 	{ "num-children", do_num_children,
 	  "Print number of smbd child processes" },
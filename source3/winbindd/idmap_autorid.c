@@ -170,6 +170,9 @@ static NTSTATUS idmap_autorid_id_to_sid(struct autorid_global_config *cfg,
 					struct idmap_domain *dom,
 					struct id_map *map)
 {
+	struct idmap_tdb_common_context *common =
+		talloc_get_type_abort(dom->private_data,
+				      struct idmap_tdb_common_context);
 	uint32_t range_number;
 	uint32_t domain_range_index;
 	uint32_t normalized_id;
@@ -207,7 +210,8 @@ static NTSTATUS idmap_autorid_id_to_sid(struct autorid_global_config *cfg,
 		return NT_STATUS_NO_MEMORY;
 	}
 
-	status = dbwrap_fetch_bystring(autorid_db, talloc_tos(), keystr, &data);
+	status = dbwrap_fetch_bystring(idmap_tdb_common_read_db(common),
+				       talloc_tos(), keystr, &data);
 	TALLOC_FREE(keystr);
 
 	if (!NT_STATUS_IS_OK(status)) {
@@ -512,8 +516,8 @@ static NTSTATUS idmap_autorid_sid_to_id_alloc(
 	alloc_ctx.dom = dom;
 	alloc_ctx.map = map;
 
-	ret = dbwrap_trans_do(ctx->db, idmap_autorid_sid_to_id_alloc_action,
-			      &alloc_ctx);
+	ret = idmap_tdb_common_trans_do(
+		ctx, idmap_autorid_sid_to_id_alloc_action, &alloc_ctx);
 	if (!NT_STATUS_IS_OK(ret)) {
 		DEBUG(1, ("Failed to create a new mapping in alloc range: %s\n",
 			  nt_errstr(ret)));
@@ -579,8 +583,8 @@ static NTSTATUS idmap_autorid_sid_to_id(struct idmap_tdb_common_context *common,
 
 	range.domain_range_index = rid / (global->rangesize);
 
-	ret = idmap_autorid_getrange(autorid_db, range.domsid,
-				     range.domain_range_index,
+	ret = idmap_autorid_getrange(idmap_tdb_common_read_db(common),
+				     range.domsid, range.domain_range_index,
 				     &range.rangenum, &range.low_id);
 	if (NT_STATUS_IS_OK(ret)) {
 		return idmap_autorid_sid_to_id_rid(
@@ -628,7 +632,8 @@ static NTSTATUS idmap_autorid_sid_to_id(struct idmap_tdb_common_context *common,
 	if (range.domain_range_index != 0) {
 		uint32_t zero_rangenum, zero_low_id;
 
-		ret = idmap_autorid_getrange(autorid_db, range.domsid, 0,
+		ret = idmap_autorid_getrange(idmap_tdb_common_read_db(common),
+					     range.domsid, 0,
 					     &zero_rangenum, &zero_low_id);
 		if (NT_STATUS_IS_OK(ret)) {
 			goto allocate;
@@ -859,6 +864,9 @@ static NTSTATUS idmap_autorid_initialize(struct idmap_domain *dom)
 	ignore_builtin = lp_parm_bool(-1, "idmap config *",
 				      "ignore builtin", false);
 
+	commonconfig->use_snapshot = lp_parm_bool(-1, "idmap config *",
+						  "memory snapshot", false);
+
 	/* fill the TDB common configuration */
 
 	commonconfig->max_id = config->rangesize - 1
@@ -320,7 +320,8 @@ static NTSTATUS idmap_tdb_open_db(struct idmap_domain *dom)
 	DEBUG(10,("Opening tdbfile %s\n", tdbfile ));
 
 	/* Open idmap repository */
-	db = db_open(mem_ctx, tdbfile, 0, TDB_DEFAULT, O_RDWR | O_CREAT, 0644,
+	db = db_open(mem_ctx, tdbfile, 0, TDB_DEFAULT|TDB_SEQNUM,
+		     O_RDWR | O_CREAT, 0644,
 		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	if (!db) {
 		DEBUG(0, ("Unable to open idmap database\n"));
@@ -383,6 +384,7 @@ static NTSTATUS idmap_tdb_db_init(struct idmap_domain *dom)
 {
 	NTSTATUS ret;
 	struct idmap_tdb_common_context *ctx;
+	char *config_option;
 
 	DEBUG(10, ("idmap_tdb_db_init called for domain '%s'\n", dom->name));
 
@@ -410,6 +412,16 @@ static NTSTATUS idmap_tdb_db_init(struct idmap_domain *dom)
 	ctx->hwmkey_uid = HWM_USER;
 	ctx->hwmkey_gid = HWM_GROUP;
 
+	config_option = talloc_asprintf(ctx, "idmap config %s", dom->name);
+	if (config_option == NULL) {
+		DEBUG(0, ("Out of memory!\n"));
+		ret = NT_STATUS_NO_MEMORY;
+		goto failed;
+	}
+	ctx->use_snapshot = lp_parm_bool(-1, config_option, "memory snapshot",
+					 false);
+	TALLOC_FREE(config_option);
+
 	ctx->rw_ops->get_new_id = idmap_tdb_common_get_new_id;
 	ctx->rw_ops->set_mapping = idmap_tdb_common_set_mapping;
 
@@ -113,7 +113,8 @@ static NTSTATUS idmap_tdb2_open_db(struct idmap_domain *dom)
 	NT_STATUS_HAVE_NO_MEMORY(db_path);
 
 	/* Open idmap repository */
-	ctx->db = db_open(ctx, db_path, 0, TDB_DEFAULT, O_RDWR|O_CREAT, 0644,
+	ctx->db = db_open(ctx, db_path, 0, TDB_DEFAULT|TDB_SEQNUM,
+			  O_RDWR|O_CREAT, 0644,
 			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	TALLOC_FREE(db_path);
 
@@ -131,6 +132,7 @@ static NTSTATUS idmap_tdb2_open_db(struct idmap_domain *dom)
  */
 
 struct idmap_tdb2_set_mapping_context {
+	struct idmap_tdb_common_context *ctx;
 	const char *ksidstr;
 	const char *kidstr;
 };
@@ -161,6 +163,7 @@ static NTSTATUS idmap_tdb2_set_mapping_action(struct db_context *db,
 		DEBUG(0, ("Error storing SID -> ID: %s\n", nt_errstr(ret)));
 		goto done;
 	}
+	idmap_tdb_common_written(state->ctx, state->ksidstr);
 
 	ret = dbwrap_store_bystring(db, state->kidstr,
 				    string_term_tdb_data(state->ksidstr),
@@ -171,6 +174,7 @@ static NTSTATUS idmap_tdb2_set_mapping_action(struct db_context *db,
 		dbwrap_delete_bystring(db, state->ksidstr);
 		goto done;
 	}
+	idmap_tdb_common_written(state->ctx, state->kidstr);
 
 	DEBUG(10,("Stored %s <-> %s\n", state->ksidstr, state->kidstr));
 
@@ -229,11 +233,12 @@ static NTSTATUS idmap_tdb2_set_mapping(struct idmap_domain *dom, const struct id
 		goto done;
 	}
 
+	state.ctx = commonctx;
 	state.ksidstr = ksidstr;
 	state.kidstr = kidstr;
 
-	ret = dbwrap_trans_do(commonctx->db, idmap_tdb2_set_mapping_action,
-			      &state);
+	ret = idmap_tdb_common_trans_do(commonctx,
+					idmap_tdb2_set_mapping_action, &state);
 
 done:
 	talloc_free(ksidstr);
@@ -371,7 +376,8 @@ static NTSTATUS idmap_tdb2_id_to_sid(struct idmap_domain *dom, struct id_map *ma
 	DEBUG(10,("Fetching record %s\n", keystr));
 
 	/* Check if the mapping exists */
-	status = dbwrap_fetch_bystring(commonctx->db, keystr, keystr, &data);
+	status = dbwrap_fetch_bystring(idmap_tdb_common_read_db(commonctx),
+				       keystr, keystr, &data);
 
 	if (!NT_STATUS_IS_OK(status)) {
 		char *sidstr;
@@ -394,12 +400,13 @@ static NTSTATUS idmap_tdb2_id_to_sid(struct idmap_domain *dom, struct id_map *ma
 			goto done;
 		}
 
+		store_state.ctx = commonctx;
 		store_state.ksidstr = sidstr;
 		store_state.kidstr = keystr;
 
-		ret = dbwrap_trans_do(commonctx->db,
-				      idmap_tdb2_set_mapping_action,
-				      &store_state);
+		ret = idmap_tdb_common_trans_do(commonctx,
+						idmap_tdb2_set_mapping_action,
+						&store_state);
 		goto done;
 	}
 
@@ -451,7 +458,8 @@ static NTSTATUS idmap_tdb2_sid_to_id(struct idmap_domain *dom, struct id_map *ma
 	DEBUG(10,("Fetching record %s\n", keystr));
 
 	/* Check if sid is present in database */
-	ret = dbwrap_fetch_bystring(commonctx->db, tmp_ctx, keystr, &data);
+	ret = dbwrap_fetch_bystring(idmap_tdb_common_read_db(commonctx),
+				    tmp_ctx, keystr, &data);
 	if (!NT_STATUS_IS_OK(ret)) {
 		char *idstr;
 		struct idmap_tdb2_set_mapping_context store_state;
@@ -485,12 +493,13 @@ static NTSTATUS idmap_tdb2_sid_to_id(struct idmap_domain *dom, struct id_map *ma
 			goto done;
 		}
 
+		store_state.ctx = commonctx;
 		store_state.ksidstr = keystr;
 		store_state.kidstr = idstr;
 
-		ret = dbwrap_trans_do(commonctx->db,
-				      idmap_tdb2_set_mapping_action,
-				      &store_state);
+		ret = idmap_tdb_common_trans_do(commonctx,
+						idmap_tdb2_set_mapping_action,
+						&store_state);
 		goto done;
 	}
 
@@ -563,6 +572,8 @@ static NTSTATUS idmap_tdb2_db_init(struct idmap_domain *dom)
 		goto failed;
 	}
 	ctx->script = lp_parm_const_string(-1, config_option, "script", NULL);
+	commonctx->use_snapshot = lp_parm_bool(-1, config_option,
+					       "memory snapshot", false);
 	talloc_free(config_option);
 
 	idmap_script = lp_parm_const_string(-1, "idmap", "script", NULL);
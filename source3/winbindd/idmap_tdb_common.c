@@ -33,6 +33,7 @@
 #include "includes.h"
 #include "idmap_tdb_common.h"
 #include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_rbt.h"
 #include "util_tdb.h"
 #include "idmap_rw.h"
 #include "../libcli/security/dom_sid.h"
@@ -40,7 +41,201 @@
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_IDMAP
 
+static int idmap_tdb_common_snapshot_copy(struct db_record *rec,
+					  void *private_data)
+{
+	struct db_context *snapshot = talloc_get_type_abort(
+		private_data, struct db_context);
+	NTSTATUS status;
+
+	status = dbwrap_store(snapshot, dbwrap_record_get_key(rec),
+			      dbwrap_record_get_value(rec), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		return -1;
+	}
+	return 0;
+}
+
+struct db_context *idmap_tdb_common_read_db(
+	struct idmap_tdb_common_context *ctx)
+{
+	struct db_context *snapshot;
+	NTSTATUS status;
+	int seqnum, count;
+
+	if (!ctx->use_snapshot || ctx->in_transaction) {
+		return ctx->db;
+	}
+
+	seqnum = dbwrap_get_seqnum(ctx->db);
+
+	if ((ctx->snapshot != NULL) && (seqnum == ctx->snapshot_seqnum)) {
+		return ctx->snapshot;
+	}
+
+	TALLOC_FREE(ctx->snapshot);
+
+	snapshot = db_open_rbt(ctx);
+	if (snapshot == NULL) {
+		return ctx->db;
+	}
+
+	status = dbwrap_traverse_read(ctx->db, idmap_tdb_common_snapshot_copy,
+				      snapshot, &count);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Loading snapshot failed: %s\n",
+			    nt_errstr(status));
+		TALLOC_FREE(snapshot);
+		return ctx->db;
+	}
+
+	if (dbwrap_get_seqnum(ctx->db) != seqnum) {
+		/* Somebody wrote while we were copying, try next time */
+		TALLOC_FREE(snapshot);
+		return ctx->db;
+	}
+
+	DBG_DEBUG("Loaded %d records at seqnum %d\n", count, seqnum);
+
+	ctx->snapshot = snapshot;
+	ctx->snapshot_seqnum = seqnum;
+
+	return ctx->snapshot;
+}
+
+void idmap_tdb_common_written(struct idmap_tdb_common_context *ctx,
+			      const char *key)
+{
+	bool ok;
+
+	if (ctx->snapshot == NULL) {
+		return;
+	}
+
+	ok = add_string_to_array(ctx, key, &ctx->written_keys,
+				 &ctx->num_written_keys);
+	if (!ok) {
+		/* The seqnum check will not match, we reload */
+		DBG_WARNING("add_string_to_array failed\n");
+	}
+}
+
+struct idmap_tdb_common_trans_state {
+	struct idmap_tdb_common_context *ctx;
+	NTSTATUS (*action)(struct db_context *db, void *private_data);
+	void *private_data;
+	bool snapshot_current;
+	int seqnum_start;
+	int seqnum_end;
+};
+
+static NTSTATUS idmap_tdb_common_trans_action(struct db_context *db,
+					      void *private_data)
+{
+	struct idmap_tdb_common_trans_state *state = private_data;
+	struct idmap_tdb_common_context *ctx = state->ctx;
+	NTSTATUS status;
+
+	/*
+	 * Sample the seqnum under the lock, so nobody else can write
+	 * between our check and our own writes
+	 */
+	state->seqnum_start = dbwrap_get_seqnum(db);
+	state->snapshot_current =
+		(ctx->snapshot != NULL) &&
+		(state->seqnum_start == ctx->snapshot_seqnum);
+
+	status = state->action(db, state->private_data);
+
+	state->seqnum_end = dbwrap_get_seqnum(db);
+
+	return status;
+}
+
+/*
+ * Copy the records written by the transaction in state to the
+ * snapshot. If anything else changed db, leave the snapshot stale, the
+ * next idmap_tdb_common_read_db() reloads it.
+ */
+static void idmap_tdb_common_snapshot_update(
+	struct idmap_tdb_common_context *ctx,
+	const struct idmap_tdb_common_trans_state *state)
+{
+	size_t i;
+	NTSTATUS status;
+
+	if (!state->snapshot_current) {
+		return;
+	}
+	if ((dbwrap_get_seqnum(ctx->db) != state->seqnum_end) ||
+	    ((size_t)(state->seqnum_end - state->seqnum_start) !=
+	     ctx->num_written_keys)) {
+		DBG_DEBUG("Unnoted changes in seqnum %d..%d, "
+			  "%zu records noted\n", state->seqnum_start,
+			  state->seqnum_end, ctx->num_written_keys);
+		return;
+	}
+
+	for (i=0; i<ctx->num_written_keys; i++) {
+		const char *key = ctx->written_keys[i];
+		TDB_DATA value;
+
+		status = dbwrap_fetch_bystring(ctx->db, talloc_tos(), key,
+					       &value);
+		if (NT_STATUS_IS_OK(status)) {
+			status = dbwrap_store_bystring(ctx->snapshot, key,
+						       value, 0);
+			TALLOC_FREE(value.dptr);
+		} else if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+			status = dbwrap_purge_bystring(ctx->snapshot, key);
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_WARNING("Updating %s in the snapshot failed: %s\n",
+				    key, nt_errstr(status));
+			TALLOC_FREE(ctx->snapshot);
+			return;
+		}
+	}
+
+	if (dbwrap_get_seqnum(ctx->db) != state->seqnum_end) {
+		/* Somebody wrote while we were copying, reload */
+		return;
+	}
+
+	ctx->snapshot_seqnum = state->seqnum_end;
+}
+
+NTSTATUS idmap_tdb_common_trans_do(struct idmap_tdb_common_context *ctx,
+				   NTSTATUS (*action)(struct db_context *db,
+						      void *private_data),
+				   void *private_data)
+{
+	struct idmap_tdb_common_trans_state state = {
+		.ctx = ctx, .action = action, .private_data = private_data,
+	};
+	NTSTATUS status;
+
+	if (ctx->in_transaction) {
+		return dbwrap_trans_do(ctx->db, action, private_data);
+	}
+
+	ctx->in_transaction = true;
+	status = dbwrap_trans_do(ctx->db, idmap_tdb_common_trans_action,
+				 &state);
+	ctx->in_transaction = false;
+
+	if (NT_STATUS_IS_OK(status)) {
+		idmap_tdb_common_snapshot_update(ctx, &state);
+	}
+
+	TALLOC_FREE(ctx->written_keys);
+	ctx->num_written_keys = 0;
+
+	return status;
+}
+
 struct idmap_tdb_common_allocate_id_context {
+	struct idmap_tdb_common_context *ctx;
 	const char *hwmkey;
 	const char *hwmtype;
 	uint32_t high_hwm;
@@ -77,6 +272,7 @@ static NTSTATUS idmap_tdb_common_allocate_id_action(struct db_context *db,
 			  state->hwmtype));
 		goto done;
 	}
+	idmap_tdb_common_written(state->ctx, state->hwmkey);
 
 	/* recheck it is in the range */
 	if (hwm > state->high_hwm) {
@@ -125,13 +321,14 @@ static NTSTATUS idmap_tdb_common_allocate_id(struct idmap_domain *dom,
 		return NT_STATUS_INVALID_PARAMETER;
 	}
 
+	state.ctx = ctx;
 	state.hwm = hwm;
 	state.high_hwm = ctx->max_id;
 	state.hwmtype = hwmtype;
 	state.hwmkey = hwmkey;
 
-	status = dbwrap_trans_do(ctx->db, idmap_tdb_common_allocate_id_action,
-				 &state);
+	status = idmap_tdb_common_trans_do(
+		ctx, idmap_tdb_common_allocate_id_action, &state);
 
 	if (NT_STATUS_IS_OK(status)) {
 		xid->id = state.hwm;
@@ -171,6 +368,7 @@ NTSTATUS idmap_tdb_common_get_new_id(struct idmap_domain * dom,
  */
 
 struct idmap_tdb_common_set_mapping_context {
+	struct idmap_tdb_common_context *ctx;
 	const char *ksidstr;
 	const char *kidstr;
 };
@@ -201,6 +399,7 @@ static NTSTATUS idmap_tdb_common_set_mapping_action(struct db_context *db,
 		DEBUG(0, ("Error storing SID -> ID: %s\n", nt_errstr(ret)));
 		goto done;
 	}
+	idmap_tdb_common_written(state->ctx, state->ksidstr);
 
 	ret = dbwrap_store_bystring(db, state->kidstr,
 				    string_term_tdb_data(state->ksidstr),
@@ -211,6 +410,7 @@ static NTSTATUS idmap_tdb_common_set_mapping_action(struct db_context *db,
 		dbwrap_delete_bystring(db, state->ksidstr);
 		goto done;
 	}
+	idmap_tdb_common_written(state->ctx, state->kidstr);
 
 	DEBUG(10, ("Stored %s <-> %s\n", state->ksidstr, state->kidstr));
 
@@ -269,11 +469,12 @@ NTSTATUS idmap_tdb_common_set_mapping(struct idmap_domain * dom,
 		goto done;
 	}
 
+	state.ctx = ctx;
 	state.ksidstr = ksidstr;
 	state.kidstr = kidstr;
 
-	ret = dbwrap_trans_do(ctx->db, idmap_tdb_common_set_mapping_action,
-			      &state);
+	ret = idmap_tdb_common_trans_do(
+		ctx, idmap_tdb_common_set_mapping_action, &state);
 
       done:
 	talloc_free(ksidstr);
@@ -422,7 +623,8 @@ NTSTATUS idmap_tdb_common_unixid_to_sid(struct idmap_domain * dom,
 	DEBUG(10, ("Fetching record %s\n", keystr));
 
 	/* Check if the mapping exists */
-	ret = dbwrap_fetch_bystring(ctx->db, keystr, keystr, &data);
+	ret = dbwrap_fetch_bystring(idmap_tdb_common_read_db(ctx), keystr,
+				    keystr, &data);
 
 	if (!NT_STATUS_IS_OK(ret)) {
 		DEBUG(10, ("Record %s not found\n", keystr));
@@ -484,7 +686,8 @@ NTSTATUS idmap_tdb_common_sid_to_unixid(struct idmap_domain * dom,
 	DEBUG(10, ("Fetching record %s\n", keystr));
 
 	/* Check if sid is present in database */
-	ret = dbwrap_fetch_bystring(ctx->db, tmp_ctx, keystr, &data);
+	ret = dbwrap_fetch_bystring(idmap_tdb_common_read_db(ctx), tmp_ctx,
+				    keystr, &data);
 	if (!NT_STATUS_IS_OK(ret)) {
 		DEBUG(10, ("Record %s not found\n", keystr));
 		ret = NT_STATUS_NONE_MAPPED;
@@ -652,9 +855,8 @@ NTSTATUS idmap_tdb_common_sids_to_unixids(struct idmap_domain * dom,
 	      NT_STATUS_EQUAL(ret, NT_STATUS_NONE_MAPPED)) &&
 	     !dom->read_only) {
 		state.allocate_unmapped = true;
-		ret = dbwrap_trans_do(ctx->db,
-				      idmap_tdb_common_sids_to_unixids_action,
-				      &state);
+		ret = idmap_tdb_common_trans_do(
+			ctx, idmap_tdb_common_sids_to_unixids_action, &state);
 	}
 
 	return ret;
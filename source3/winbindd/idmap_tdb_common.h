@@ -69,8 +69,47 @@ struct idmap_tdb_common_context {
 	NTSTATUS(*sid_to_unixid_fn) (struct idmap_domain *dom,
 				     struct id_map * map);
 	void *private_data;
+
+	/*
+	 * With "idmap config <domain> : memory snapshot = yes"
+	 * lookups read a copy of db kept in memory. Writes go to db
+	 * through idmap_tdb_common_trans_do(), which copies the
+	 * records written to the snapshot after the commit. The copy
+	 * is reloaded when the sequence number of db moves for any
+	 * other reason, e.g. a write by another process.
+	 */
+	bool use_snapshot;
+	bool in_transaction;
+	struct db_context *snapshot;
+	int snapshot_seqnum;
+	const char **written_keys;
+	size_t num_written_keys;
 };
 
+/*
+ * Return the database lookups should read from: the snapshot if it is
+ * enabled and current, db otherwise.
+ */
+struct db_context *idmap_tdb_common_read_db(
+	struct idmap_tdb_common_context *ctx);
+
+/*
+ * Run action in a transaction on ctx->db, reading ctx->db directly
+ * meanwhile. If only the records passed to idmap_tdb_common_written()
+ * changed, the snapshot is updated in place after the commit.
+ * Nested calls just join the running transaction.
+ */
+NTSTATUS idmap_tdb_common_trans_do(struct idmap_tdb_common_context *ctx,
+				   NTSTATUS (*action)(struct db_context *db,
+						      void *private_data),
+				   void *private_data);
+
+/*
+ * Note a record stored or deleted under idmap_tdb_common_trans_do()
+ */
+void idmap_tdb_common_written(struct idmap_tdb_common_context *ctx,
+			      const char *key);
+
 /**
  * Allocate a new unix-ID.
  * For now this is for the default idmap domain only.
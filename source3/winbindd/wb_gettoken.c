@@ -22,6 +22,43 @@
 #include "librpc/gen_ndr/ndr_winbind_c.h"
 #include "../libcli/security/security.h"
 #include "passdb/machine_sid.h"
+#include "libsmb/samlogon_cache.h"
+#include "../lib/util/memcache.h"
+#include "lib/util/dlinklist.h"
+
+/*
+ * The parent winbindd remembers the SIDs of recently built tokens.
+ * An entry is only used while the sequence numbers of the domains it
+ * was built from, as recorded in winbindd_cache.tdb, are unchanged
+ * and it is younger than "winbindd:token cache time". Entries in the
+ * last quarter of their lifetime are returned and rebuilt in the
+ * background, so a logon storm does not wait for the DCs.
+ *
+ * The user's groups come from the netsamlogon cache. A logon stores
+ * the groups the DC just returned there, whichever process did it, so
+ * an entry is dropped once the user's netsamlogon cache record is no
+ * older than the entry.
+ */
+
+struct wb_gettoken_cache_key {
+	struct dom_sid usersid;
+	bool expand_local_aliases;
+};
+
+struct wb_gettoken_cache_entry {
+	time_t fetched;
+	uint32_t seqnums[3];
+	uint32_t num_sids;
+	/* followed by num_sids struct dom_sid */
+};
+
+struct wb_gettoken_refresh {
+	struct wb_gettoken_refresh *prev, *next;
+	struct wb_gettoken_cache_key key;
+};
+
+static struct memcache *wb_gettoken_cache;
+static struct wb_gettoken_refresh *wb_gettoken_refreshes;
 
 struct wb_gettoken_state {
 	struct tevent_context *ev;
@@ -29,6 +66,9 @@ struct wb_gettoken_state {
 	bool expand_local_aliases;
 	uint32_t num_sids;
 	struct dom_sid *sids;
+
+	bool cacheable;
+	uint32_t seqnums[3];
 };
 
 static NTSTATUS wb_add_rids_to_sids(TALLOC_CTX *mem_ctx,
@@ -40,14 +80,199 @@ static NTSTATUS wb_add_rids_to_sids(TALLOC_CTX *mem_ctx,
 static void wb_gettoken_gotuser(struct tevent_req *subreq);
 static void wb_gettoken_gotlocalgroups(struct tevent_req *subreq);
 static void wb_gettoken_gotbuiltins(struct tevent_req *subreq);
+static void wb_gettoken_refresh(struct tevent_context *ev,
+				const struct dom_sid *sid,
+				bool expand_local_aliases);
 
-struct tevent_req *wb_gettoken_send(TALLOC_CTX *mem_ctx,
-				    struct tevent_context *ev,
-				    const struct dom_sid *sid,
-				    bool expand_local_aliases)
+static int wb_gettoken_cache_time(void)
+{
+	return lp_parm_int(-1, "winbindd", "token cache time",
+			   lp_winbind_cache_time());
+}
+
+static bool wb_gettoken_domain_seqnum(const struct dom_sid *domain_sid,
+				      uint32_t *seqnum)
+{
+	struct winbindd_domain *domain;
+	uint32_t last_seq_check;
+
+	domain = find_domain_from_sid_noinit(domain_sid);
+	if (domain == NULL) {
+		return false;
+	}
+	if (!wcache_fetch_seqnum(domain->name, seqnum, &last_seq_check)) {
+		return false;
+	}
+	return (*seqnum != DOM_SEQUENCE_NONE);
+}
+
+/*
+ * The sequence numbers of all domains that contribute to the token
+ */
+
+static bool wb_gettoken_seqnums(const struct dom_sid *usersid,
+				bool expand_local_aliases,
+				uint32_t seqnums[3])
+{
+	struct dom_sid domain_sid;
+	uint32_t rid;
+
+	sid_copy(&domain_sid, usersid);
+	if (!sid_split_rid(&domain_sid, &rid)) {
+		return false;
+	}
+	if (!wb_gettoken_domain_seqnum(&domain_sid, &seqnums[0])) {
+		return false;
+	}
+
+	seqnums[1] = seqnums[2] = 0;
+
+	if (!expand_local_aliases) {
+		return true;
+	}
+
+	return wb_gettoken_domain_seqnum(get_global_sam_sid(), &seqnums[1]) &&
+		wb_gettoken_domain_seqnum(&global_sid_Builtin, &seqnums[2]);
+}
+
+static DATA_BLOB wb_gettoken_cache_key(struct wb_gettoken_cache_key *key,
+				       const struct dom_sid *sid,
+				       bool expand_local_aliases)
+{
+	ZERO_STRUCTP(key);
+	sid_copy(&key->usersid, sid);
+	key->expand_local_aliases = expand_local_aliases;
+	return data_blob_const(key, sizeof(*key));
+}
+
+static bool wb_gettoken_cache_fetch(struct wb_gettoken_state *state,
+				    bool *refresh)
+{
+	struct wb_gettoken_cache_key key;
+	struct wb_gettoken_cache_entry entry;
+	DATA_BLOB val;
+	time_t now, logon_time;
+	int cache_time;
+
+	if (wb_gettoken_cache == NULL) {
+		return false;
+	}
+	if (!memcache_lookup(wb_gettoken_cache, WB_TOKEN_CACHE,
+			     wb_gettoken_cache_key(
+				     &key, &state->usersid,
+				     state->expand_local_aliases),
+			     &val)) {
+		return false;
+	}
+	if (val.length < sizeof(entry)) {
+		return false;
+	}
+	memcpy(&entry, val.data, sizeof(entry));
+
+	if (val.length != sizeof(entry) + entry.num_sids *
+	    sizeof(struct dom_sid)) {
+		return false;
+	}
+
+	now = time(NULL);
+	cache_time = wb_gettoken_cache_time();
+
+	if ((entry.fetched > now) || (now - entry.fetched >= cache_time)) {
+		return false;
+	}
+	if (memcmp(entry.seqnums, state->seqnums,
+		   sizeof(state->seqnums)) != 0) {
+		DBG_DEBUG("sequence number changed for %s\n",
+			  sid_string_dbg(&state->usersid));
+		return false;
+	}
+	if (!netsamlogon_cache_timestamp(&state->usersid, &logon_time) ||
+	    (logon_time >= entry.fetched)) {
+		DBG_DEBUG("netsamlogon cache changed for %s\n",
+			  sid_string_dbg(&state->usersid));
+		memcache_delete(wb_gettoken_cache, WB_TOKEN_CACHE,
+				data_blob_const(&key, sizeof(key)));
+		return false;
+	}
+
+	state->sids = talloc_memdup(state, val.data + sizeof(entry),
+				    entry.num_sids * sizeof(struct dom_sid));
+	if ((state->sids == NULL) && (entry.num_sids != 0)) {
+		return false;
+	}
+	state->num_sids = entry.num_sids;
+
+	*refresh = (now - entry.fetched >= cache_time - cache_time/4);
+
+	return true;
+}
+
+static void wb_gettoken_cache_store(struct wb_gettoken_state *state)
+{
+	struct wb_gettoken_cache_key key;
+	struct wb_gettoken_cache_entry entry = {
+		.fetched = time(NULL), .num_sids = state->num_sids
+	};
+	size_t sids_len = state->num_sids * sizeof(struct dom_sid);
+	uint8_t *buf;
+
+	if (!state->cacheable) {
+		return;
+	}
+
+	if (wb_gettoken_cache == NULL) {
+		int size = lp_parm_int(-1, "winbindd", "token cache size",
+				       1024 * 1024);
+		if (size <= 0) {
+			return;
+		}
+		wb_gettoken_cache = memcache_init(NULL, size);
+		if (wb_gettoken_cache == NULL) {
+			return;
+		}
+	}
+
+	memcpy(entry.seqnums, state->seqnums, sizeof(entry.seqnums));
+
+	buf = talloc_array(state, uint8_t, sizeof(entry) + sids_len);
+	if (buf == NULL) {
+		return;
+	}
+	memcpy(buf, &entry, sizeof(entry));
+	if (sids_len != 0) {
+		memcpy(buf + sizeof(entry), state->sids, sids_len);
+	}
+
+	memcache_add(wb_gettoken_cache, WB_TOKEN_CACHE,
+		     wb_gettoken_cache_key(&key, &state->usersid,
+					   state->expand_local_aliases),
+		     data_blob_const(buf, talloc_get_size(buf)));
+	TALLOC_FREE(buf);
+}
+
+void wb_gettoken_flush_cache(void)
+{
+	if (wb_gettoken_cache != NULL) {
+		memcache_flush(wb_gettoken_cache, WB_TOKEN_CACHE);
+	}
+}
+
+static void wb_gettoken_done(struct tevent_req *req)
+{
+	struct wb_gettoken_state *state = tevent_req_data(
+		req, struct wb_gettoken_state);
+
+	wb_gettoken_cache_store(state);
+	tevent_req_done(req);
+}
+
+static struct tevent_req *wb_gettoken_send_internal(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	const struct dom_sid *sid, bool expand_local_aliases, bool use_cache)
 {
 	struct tevent_req *req, *subreq;
 	struct wb_gettoken_state *state;
+	bool refresh = false;
 
 	req = tevent_req_create(mem_ctx, &state, struct wb_gettoken_state);
 	if (req == NULL) {
@@ -57,6 +282,27 @@ struct tevent_req *wb_gettoken_send(TALLOC_CTX *mem_ctx,
 	state->ev = ev;
 	state->expand_local_aliases = expand_local_aliases;
 
+	/*
+	 * Take the sequence numbers before asking the DCs, a change
+	 * while we are busy just makes our result stale.
+	 */
+	state->cacheable = (wb_gettoken_cache_time() > 0) &&
+		wb_gettoken_seqnums(&state->usersid, expand_local_aliases,
+				    state->seqnums);
+
+	if (use_cache && state->cacheable &&
+	    wb_gettoken_cache_fetch(state, &refresh)) {
+		DBG_DEBUG("%s from the token cache%s\n",
+			  sid_string_dbg(&state->usersid),
+			  refresh ? ", refreshing" : "");
+		if (refresh) {
+			wb_gettoken_refresh(ev, &state->usersid,
+					    expand_local_aliases);
+		}
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
 	subreq = wb_queryuser_send(state, ev, &state->usersid);
 	if (tevent_req_nomem(subreq, req)) {
 		return tevent_req_post(req, ev);
@@ -65,6 +311,69 @@ struct tevent_req *wb_gettoken_send(TALLOC_CTX *mem_ctx,
 	return req;
 }
 
+struct tevent_req *wb_gettoken_send(TALLOC_CTX *mem_ctx,
+				    struct tevent_context *ev,
+				    const struct dom_sid *sid,
+				    bool expand_local_aliases)
+{
+	return wb_gettoken_send_internal(mem_ctx, ev, sid,
+					 expand_local_aliases, true);
+}
+
+static void wb_gettoken_refresh_done(struct tevent_req *subreq);
+
+/*
+ * Rebuild a token in the background, nobody waits for the result
+ * except the cache
+ */
+
+static void wb_gettoken_refresh(struct tevent_context *ev,
+				const struct dom_sid *sid,
+				bool expand_local_aliases)
+{
+	struct wb_gettoken_refresh *r;
+	struct tevent_req *subreq;
+
+	for (r = wb_gettoken_refreshes; r != NULL; r = r->next) {
+		if (dom_sid_equal(&r->key.usersid, sid) &&
+		    (r->key.expand_local_aliases == expand_local_aliases)) {
+			return;
+		}
+	}
+
+	r = talloc_zero(NULL, struct wb_gettoken_refresh);
+	if (r == NULL) {
+		return;
+	}
+	wb_gettoken_cache_key(&r->key, sid, expand_local_aliases);
+
+	subreq = wb_gettoken_send_internal(r, ev, &r->key.usersid,
+					   expand_local_aliases, false);
+	if (subreq == NULL) {
+		TALLOC_FREE(r);
+		return;
+	}
+	tevent_req_set_callback(subreq, wb_gettoken_refresh_done, r);
+
+	DLIST_ADD(wb_gettoken_refreshes, r);
+}
+
+static void wb_gettoken_refresh_done(struct tevent_req *subreq)
+{
+	struct wb_gettoken_refresh *r = tevent_req_callback_data(
+		subreq, struct wb_gettoken_refresh);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(subreq, &status)) {
+		DBG_DEBUG("refreshing the token of %s failed: %s\n",
+			  sid_string_dbg(&r->key.usersid), nt_errstr(status));
+	}
+	TALLOC_FREE(subreq);
+
+	DLIST_REMOVE(wb_gettoken_refreshes, r);
+	TALLOC_FREE(r);
+}
+
 static void wb_gettoken_gotuser(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
@@ -111,7 +420,7 @@ static void wb_gettoken_gotuser(struct tevent_req *subreq)
 	}
 
 	if (!state->expand_local_aliases) {
-		tevent_req_done(req);
+		wb_gettoken_done(req);
 		return;
 	}
 
@@ -194,7 +503,7 @@ static void wb_gettoken_gotbuiltins(struct tevent_req *subreq)
 	if (tevent_req_nterror(req, status)) {
 		return;
 	}
-	tevent_req_done(req);
+	wb_gettoken_done(req);
 }
 
 NTSTATUS wb_gettoken_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
@@ -25,14 +25,64 @@
 #include "librpc/gen_ndr/ndr_winbind_c.h"
 #include "librpc/gen_ndr/ndr_netlogon.h"
 #include "lsa.h"
+#include "../librpc/gen_ndr/ndr_security.h"
+#include "util_tdb.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_rbt.h"
+
+/*
+ * SIDs that are not in the idmap cache are resolved in "flights": a
+ * lookupsids followed by a Sids2UnixIDs call per domain. A flight is
+ * not owned by the request that started it. Every SID of a running
+ * flight is registered in wb_sids2xids_inflight, and any request for
+ * the same SID waits for that flight instead of starting its own.
+ */
+
+struct wb_sids2xids_flight {
+	struct dom_sid *sids;
+	uint32_t num_sids;
+	struct wb_sids2xids_wait *waiters;
+};
+
+/* The SIDs one request waits for in one flight */
+
+struct wb_sids2xids_wait {
+	struct wb_sids2xids_wait *prev, *next;
+	struct wb_sids2xids_wait *req_next;
+	struct wb_sids2xids_flight *flight;
+	struct tevent_req *req;
+	uint32_t num;
+	uint32_t *req_idx;
+	uint32_t *flight_idx;
+};
+
+struct wb_sids2xids_inflight_rec {
+	struct wb_sids2xids_flight *flight;
+	uint32_t idx;
+};
+
+static struct db_context *wb_sids2xids_inflight;
+
+static struct {
+	uint64_t sids;
+	uint64_t cached;
+	uint64_t deduplicated;
+	uint64_t looked_up;
+	uint64_t flights;
+} wb_sids2xids_stats;
 
 struct wb_sids2xids_state {
 	struct tevent_context *ev;
 
-	struct dom_sid *sids;
 	uint32_t num_sids;
+	struct unixid *xids;
 
-	struct id_map *cached;
+	struct wb_sids2xids_wait *waits;
+	uint32_t num_pending;
+};
+
+struct wb_sids2xids_lookup_state {
+	struct tevent_context *ev;
 
 	struct dom_sid *non_cached;
 	uint32_t num_non_cached;
@@ -58,11 +108,175 @@ struct wb_sids2xids_state {
 	struct wbint_TransIDArray ids;
 };
 
-
-static bool wb_sids2xids_in_cache(struct dom_sid *sid, struct id_map *map);
+static bool wb_sids2xids_in_cache(struct dom_sid *sid, struct unixid *xid);
+static struct tevent_req *wb_sids2xids_lookup_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct dom_sid *sids, uint32_t num_sids);
+static NTSTATUS wb_sids2xids_lookup_recv(struct tevent_req *req,
+					 struct unixid xids[],
+					 uint32_t num_xids);
 static void wb_sids2xids_lookupsids_done(struct tevent_req *subreq);
 static void wb_sids2xids_done(struct tevent_req *subreq);
 static void wb_sids2xids_gotdc(struct tevent_req *subreq);
+static void wb_sids2xids_flight_done(struct tevent_req *subreq);
+
+static TDB_DATA wb_sids2xids_key(const struct dom_sid *sid)
+{
+	return make_tdb_data((const uint8_t *)sid, ndr_size_dom_sid(sid, 0));
+}
+
+static void wb_sids2xids_inflight_parser(TDB_DATA key, TDB_DATA data,
+					 void *private_data)
+{
+	struct wb_sids2xids_inflight_rec *rec = private_data;
+
+	if (data.dsize == sizeof(*rec)) {
+		memcpy(rec, data.dptr, sizeof(*rec));
+	}
+}
+
+static bool wb_sids2xids_inflight_find(const struct dom_sid *sid,
+				       struct wb_sids2xids_inflight_rec *rec)
+{
+	NTSTATUS status;
+
+	if (wb_sids2xids_inflight == NULL) {
+		return false;
+	}
+
+	*rec = (struct wb_sids2xids_inflight_rec) { .flight = NULL };
+
+	status = dbwrap_parse_record(wb_sids2xids_inflight,
+				     wb_sids2xids_key(sid),
+				     wb_sids2xids_inflight_parser, rec);
+	return NT_STATUS_IS_OK(status) && (rec->flight != NULL);
+}
+
+static void wb_sids2xids_flight_unregister(struct wb_sids2xids_flight *flight)
+{
+	uint32_t i;
+
+	for (i=0; i<flight->num_sids; i++) {
+		dbwrap_delete(wb_sids2xids_inflight,
+			      wb_sids2xids_key(&flight->sids[i]));
+	}
+	flight->num_sids = 0;
+}
+
+static int wb_sids2xids_flight_destructor(struct wb_sids2xids_flight *flight)
+{
+	struct wb_sids2xids_wait *w;
+
+	wb_sids2xids_flight_unregister(flight);
+
+	while ((w = flight->waiters) != NULL) {
+		DLIST_REMOVE(flight->waiters, w);
+		w->flight = NULL;
+	}
+
+	return 0;
+}
+
+static struct wb_sids2xids_flight *wb_sids2xids_flight_create(
+	uint32_t max_sids)
+{
+	struct wb_sids2xids_flight *flight;
+
+	if (wb_sids2xids_inflight == NULL) {
+		wb_sids2xids_inflight = db_open_rbt(NULL);
+		if (wb_sids2xids_inflight == NULL) {
+			return NULL;
+		}
+	}
+
+	flight = talloc_zero(NULL, struct wb_sids2xids_flight);
+	if (flight == NULL) {
+		return NULL;
+	}
+	flight->sids = talloc_array(flight, struct dom_sid, max_sids);
+	if (flight->sids == NULL) {
+		TALLOC_FREE(flight);
+		return NULL;
+	}
+	talloc_set_destructor(flight, wb_sids2xids_flight_destructor);
+
+	return flight;
+}
+
+static bool wb_sids2xids_flight_add(struct wb_sids2xids_flight *flight,
+				    const struct dom_sid *sid,
+				    uint32_t *pidx)
+{
+	struct wb_sids2xids_inflight_rec rec = {
+		.flight = flight, .idx = flight->num_sids
+	};
+	NTSTATUS status;
+
+	sid_copy(&flight->sids[rec.idx], sid);
+
+	status = dbwrap_store(wb_sids2xids_inflight, wb_sids2xids_key(sid),
+			      make_tdb_data((uint8_t *)&rec, sizeof(rec)), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	flight->num_sids += 1;
+	*pidx = rec.idx;
+	return true;
+}
+
+static int wb_sids2xids_wait_destructor(struct wb_sids2xids_wait *w)
+{
+	if (w->flight != NULL) {
+		DLIST_REMOVE(w->flight->waiters, w);
+		w->flight = NULL;
+	}
+	return 0;
+}
+
+/* Note that the request waits for SID flight_idx of the flight */
+
+static bool wb_sids2xids_wait_for(struct tevent_req *req,
+				  struct wb_sids2xids_flight *flight,
+				  uint32_t req_idx, uint32_t flight_idx)
+{
+	struct wb_sids2xids_state *state = tevent_req_data(
+		req, struct wb_sids2xids_state);
+	struct wb_sids2xids_wait *w;
+
+	for (w = state->waits; w != NULL; w = w->req_next) {
+		if (w->flight == flight) {
+			break;
+		}
+	}
+
+	if (w == NULL) {
+		w = talloc_zero(state, struct wb_sids2xids_wait);
+		if (w == NULL) {
+			return false;
+		}
+		w->flight = flight;
+		w->req = req;
+		DLIST_ADD(flight->waiters, w);
+		talloc_set_destructor(w, wb_sids2xids_wait_destructor);
+
+		w->req_next = state->waits;
+		state->waits = w;
+		state->num_pending += 1;
+	}
+
+	w->req_idx = talloc_realloc(w, w->req_idx, uint32_t, w->num + 1);
+	w->flight_idx = talloc_realloc(w, w->flight_idx, uint32_t,
+				       w->num + 1);
+	if ((w->req_idx == NULL) || (w->flight_idx == NULL)) {
+		return false;
+	}
+	w->req_idx[w->num] = req_idx;
+	w->flight_idx[w->num] = flight_idx;
+	w->num += 1;
+
+	return true;
+}
 
 struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 				     struct tevent_context *ev,
@@ -71,6 +285,7 @@ struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 {
 	struct tevent_req *req, *subreq;
 	struct wb_sids2xids_state *state;
+	struct wb_sids2xids_flight *flight = NULL;
 	uint32_t i;
 
 	req = tevent_req_create(mem_ctx, &state,
@@ -83,47 +298,194 @@ struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 
 	state->num_sids = num_sids;
 
-	state->sids = talloc_zero_array(state, struct dom_sid, num_sids);
-	if (tevent_req_nomem(state->sids, req)) {
+	state->xids = talloc_array(state, struct unixid, num_sids);
+	if (tevent_req_nomem(state->xids, req)) {
 		return tevent_req_post(req, ev);
 	}
 
-	for (i = 0; i < num_sids; i++) {
-		sid_copy(&state->sids[i], &sids[i]);
+	wb_sids2xids_stats.sids += num_sids;
+
+	/*
+	 * Answer what we can from the cache. For the rest, wait for a
+	 * flight already resolving the SID, or put it into a new one.
+	 */
+	for (i=0; i<state->num_sids; i++) {
+		struct dom_sid sid;
+		struct wb_sids2xids_inflight_rec rec;
+		uint32_t flight_idx;
+
+		sid_copy(&sid, &sids[i]);
+
+		DEBUG(10, ("SID %d: %s\n", (int)i, sid_string_dbg(&sid)));
+
+		state->xids[i] = (struct unixid) {
+			.id = UINT32_MAX, .type = ID_TYPE_NOT_SPECIFIED
+		};
+
+		if (wb_sids2xids_in_cache(&sid, &state->xids[i])) {
+			wb_sids2xids_stats.cached += 1;
+			continue;
+		}
+
+		if (wb_sids2xids_inflight_find(&sid, &rec)) {
+			if (rec.flight != flight) {
+				wb_sids2xids_stats.deduplicated += 1;
+			}
+			if (!wb_sids2xids_wait_for(req, rec.flight, i,
+						   rec.idx)) {
+				TALLOC_FREE(flight);
+				tevent_req_oom(req);
+				return tevent_req_post(req, ev);
+			}
+			continue;
+		}
+
+		if (flight == NULL) {
+			flight = wb_sids2xids_flight_create(num_sids);
+			if (tevent_req_nomem(flight, req)) {
+				return tevent_req_post(req, ev);
+			}
+		}
+
+		if (!wb_sids2xids_flight_add(flight, &sid, &flight_idx) ||
+		    !wb_sids2xids_wait_for(req, flight, i, flight_idx)) {
+			TALLOC_FREE(flight);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
 	}
 
-	state->cached = talloc_zero_array(state, struct id_map, num_sids);
-	if (tevent_req_nomem(state->cached, req)) {
-		return tevent_req_post(req, ev);
+	if (flight != NULL) {
+		wb_sids2xids_stats.looked_up += flight->num_sids;
+		wb_sids2xids_stats.flights += 1;
+
+		subreq = wb_sids2xids_lookup_send(flight, ev, flight->sids,
+						  flight->num_sids);
+		if (subreq == NULL) {
+			TALLOC_FREE(flight);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, wb_sids2xids_flight_done,
+					flight);
 	}
 
-	state->non_cached = talloc_array(state, struct dom_sid, num_sids);
-	if (tevent_req_nomem(state->non_cached, req)) {
+	if (state->num_pending == 0) {
+		tevent_req_done(req);
 		return tevent_req_post(req, ev);
 	}
 
 	/*
-	 * Extract those sids that can not be resolved from cache
-	 * into a separate list to be handed to id mapping, keeping
-	 * the same index.
+	 * A flight finishes all its waiters in one go, don't let
+	 * their callbacks run while it walks the list.
 	 */
-	for (i=0; i<state->num_sids; i++) {
+	tevent_req_defer_callback(req, ev);
 
-		DEBUG(10, ("SID %d: %s\n", (int)i,
-			   sid_string_dbg(&state->sids[i])));
+	return req;
+}
 
-		if (wb_sids2xids_in_cache(&state->sids[i], &state->cached[i])) {
-			continue;
-		}
-		sid_copy(&state->non_cached[state->num_non_cached],
-			 &state->sids[i]);
-		state->num_non_cached += 1;
+static void wb_sids2xids_wait_done(struct wb_sids2xids_wait *w,
+				   NTSTATUS status,
+				   const struct unixid *xids)
+{
+	struct tevent_req *req = w->req;
+	struct wb_sids2xids_state *state = tevent_req_data(
+		req, struct wb_sids2xids_state);
+	uint32_t i;
+
+	if (!tevent_req_is_in_progress(req)) {
+		return;
+	}
+
+	if (tevent_req_nterror(req, status)) {
+		return;
+	}
+
+	for (i=0; i<w->num; i++) {
+		state->xids[w->req_idx[i]] = xids[w->flight_idx[i]];
 	}
 
-	if (state->num_non_cached == 0) {
+	state->num_pending -= 1;
+	if (state->num_pending == 0) {
 		tevent_req_done(req);
-		return tevent_req_post(req, ev);
 	}
+}
+
+static void wb_sids2xids_flight_done(struct tevent_req *subreq)
+{
+	struct wb_sids2xids_flight *flight = tevent_req_callback_data(
+		subreq, struct wb_sids2xids_flight);
+	struct wb_sids2xids_wait *w;
+	struct unixid *xids;
+	NTSTATUS status;
+	uint32_t i;
+
+	xids = talloc_array(flight, struct unixid, flight->num_sids);
+	if (xids == NULL) {
+		status = NT_STATUS_NO_MEMORY;
+	} else {
+		status = wb_sids2xids_lookup_recv(subreq, xids,
+						  flight->num_sids);
+	}
+	TALLOC_FREE(subreq);
+
+	if (NT_STATUS_IS_OK(status)) {
+		for (i=0; i<flight->num_sids; i++) {
+			idmap_cache_set_sid2unixid(&flight->sids[i], &xids[i]);
+		}
+	}
+
+	/* From now on new requests look into the cache again */
+	wb_sids2xids_flight_unregister(flight);
+
+	while ((w = flight->waiters) != NULL) {
+		DLIST_REMOVE(flight->waiters, w);
+		w->flight = NULL;
+		wb_sids2xids_wait_done(w, status, xids);
+	}
+
+	TALLOC_FREE(flight);
+}
+
+char *wb_sids2xids_stats_string(TALLOC_CTX *mem_ctx)
+{
+	return talloc_asprintf(
+		mem_ctx, "sids2xids: %llu SIDs, %llu from cache, "
+		"%llu deduplicated, %llu looked up in %llu batches",
+		(unsigned long long)wb_sids2xids_stats.sids,
+		(unsigned long long)wb_sids2xids_stats.cached,
+		(unsigned long long)wb_sids2xids_stats.deduplicated,
+		(unsigned long long)wb_sids2xids_stats.looked_up,
+		(unsigned long long)wb_sids2xids_stats.flights);
+}
+
+void wb_sids2xids_dump_stats(void)
+{
+	char *s = wb_sids2xids_stats_string(talloc_tos());
+
+	if (s == NULL) {
+		return;
+	}
+	DEBUG(0, ("\t%s\n", s));
+	TALLOC_FREE(s);
+}
+
+static struct tevent_req *wb_sids2xids_lookup_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct dom_sid *sids, uint32_t num_sids)
+{
+	struct tevent_req *req, *subreq;
+	struct wb_sids2xids_lookup_state *state;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct wb_sids2xids_lookup_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	state->ev = ev;
+	state->non_cached = sids;
+	state->num_non_cached = num_sids;
 
 	subreq = wb_lookupsids_send(state, ev, state->non_cached,
 				    state->num_non_cached);
@@ -134,7 +496,7 @@ struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 	return req;
 }
 
-static bool wb_sids2xids_in_cache(struct dom_sid *sid, struct id_map *map)
+static bool wb_sids2xids_in_cache(struct dom_sid *sid, struct unixid *xid)
 {
 	struct unixid id;
 	bool expired;
@@ -146,9 +508,7 @@ static bool wb_sids2xids_in_cache(struct dom_sid *sid, struct id_map *map)
 		if (expired && is_domain_online(find_our_domain())) {
 			return false;
 		}
-		map->sid = sid;
-		map->xid = id;
-		map->status = ID_MAPPED;
+		*xid = id;
 		return true;
 	}
 	return false;
@@ -163,8 +523,8 @@ static void wb_sids2xids_lookupsids_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
-	struct wb_sids2xids_state *state = tevent_req_data(
-		req, struct wb_sids2xids_state);
+	struct wb_sids2xids_lookup_state *state = tevent_req_data(
+		req, struct wb_sids2xids_lookup_state);
 	struct lsa_RefDomainList *domains = NULL;
 	struct lsa_TransNameArray *names = NULL;
 	struct winbindd_child *child;
@@ -261,8 +621,8 @@ static void wb_sids2xids_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
-	struct wb_sids2xids_state *state = tevent_req_data(
-		req, struct wb_sids2xids_state);
+	struct wb_sids2xids_lookup_state *state = tevent_req_data(
+		req, struct wb_sids2xids_lookup_state);
 	NTSTATUS status, result;
 	struct winbindd_child *child;
 
@@ -354,8 +714,8 @@ static void wb_sids2xids_gotdc(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
-	struct wb_sids2xids_state *state = tevent_req_data(
-		req, struct wb_sids2xids_state);
+	struct wb_sids2xids_lookup_state *state = tevent_req_data(
+		req, struct wb_sids2xids_lookup_state);
 	struct winbindd_child *child = idmap_child();
 	struct netr_DsRGetDCNameInfo *dcinfo;
 	NTSTATUS status;
@@ -388,13 +748,37 @@ static void wb_sids2xids_gotdc(struct tevent_req *subreq)
 	tevent_req_set_callback(subreq, wb_sids2xids_done, req);
 }
 
+static NTSTATUS wb_sids2xids_lookup_recv(struct tevent_req *req,
+					 struct unixid xids[],
+					 uint32_t num_xids)
+{
+	struct wb_sids2xids_lookup_state *state = tevent_req_data(
+		req, struct wb_sids2xids_lookup_state);
+	NTSTATUS status;
+	uint32_t i;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		return status;
+	}
+
+	if (num_xids != state->num_non_cached) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	for (i=0; i<num_xids; i++) {
+		xids[i] = state->ids.ids[i].xid;
+	}
+
+	return NT_STATUS_OK;
+}
+
 NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 			   struct unixid xids[], uint32_t num_xids)
 {
 	struct wb_sids2xids_state *state = tevent_req_data(
 		req, struct wb_sids2xids_state);
 	NTSTATUS status;
-	uint32_t i, num_non_cached;
+	uint32_t i;
 
 	if (tevent_req_is_nterror(req, &status)) {
 		DEBUG(5, ("wb_sids_to_xids failed: %s\n", nt_errstr(status)));
@@ -407,26 +791,8 @@ NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 		return NT_STATUS_INTERNAL_ERROR;
 	}
 
-	num_non_cached = 0;
-
 	for (i=0; i<state->num_sids; i++) {
-		struct unixid xid;
-
-		xid.id = UINT32_MAX;
-
-		if (state->cached[i].sid != NULL) {
-			xid = state->cached[i].xid;
-		} else {
-			xid = state->ids.ids[num_non_cached].xid;
-
-			idmap_cache_set_sid2unixid(
-				&state->non_cached[num_non_cached],
-				&xid);
-
-			num_non_cached += 1;
-		}
-
-		xids[i] = xid;
+		xids[i] = state->xids[i];
 	}
 
 	return NT_STATUS_OK;
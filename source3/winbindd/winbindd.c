@@ -33,6 +33,7 @@
 #include "secrets.h"
 #include "rpc_client/cli_netlogon.h"
 #include "idmap.h"
+#include "idmap_cache.h"
 #include "lib/addrchange.h"
 #include "serverid.h"
 #include "auth.h"
@@ -182,6 +183,8 @@ static void winbindd_status(void)
 				     client_is_idle(tmp) ? "idle" : "active"));
 		}
 	}
+
+	wb_sids2xids_dump_stats();
 }
 
 /* Flush client cache */
@@ -192,6 +195,10 @@ static void flush_caches(void)
            otherwise cached access denied errors due to restrict anonymous
            hang around until the sequence number changes. */
 
+	winbindd_nss_cache_flush();
+	idmap_cache_ram_flush();
+	wb_gettoken_flush_cache();
+
 	if (!wcache_invalidate_cache()) {
 		DEBUG(0, ("invalidating the cache failed; revalidate the cache\n"));
 		if (!winbindd_cache_validate_and_initialize()) {
@@ -215,6 +222,10 @@ static void flush_caches_noinit(void)
 	 * are many domains..
 	 */
 
+	winbindd_nss_cache_flush();
+	idmap_cache_ram_flush();
+	wb_gettoken_flush_cache();
+
 	if (!wcache_invalidate_cache_noinit()) {
 		DEBUG(0, ("invalidating the cache failed; revalidate the cache\n"));
 		if (!winbindd_cache_validate_and_initialize()) {
@@ -239,6 +250,8 @@ static void terminate(bool is_parent)
 			unlink(path);
 			SAFE_FREE(path);
 		}
+
+		winbindd_nss_cache_shutdown();
 	}
 
 	idmap_close();
@@ -504,6 +517,26 @@ static void msg_shutdown(struct messaging_context *msg,
 }
 
 
+static void winbind_msg_sids2xids_stats(struct messaging_context *msg_ctx,
+					void *private_data,
+					uint32_t msg_type,
+					struct server_id server_id,
+					DATA_BLOB *data)
+{
+	char *s = wb_sids2xids_stats_string(talloc_tos());
+
+	if (s == NULL) {
+		return;
+	}
+	s = talloc_asprintf_append(s, "\n");
+	if (s == NULL) {
+		return;
+	}
+	messaging_send_buf(msg_ctx, server_id, MSG_WINBIND_SIDS2XIDS_STATS,
+			   (const uint8_t *)s, strlen(s) + 1);
+	TALLOC_FREE(s);
+}
+
 static void winbind_msg_validate_cache(struct messaging_context *msg_ctx,
 				       void *private_data,
 				       uint32_t msg_type,
@@ -705,7 +738,8 @@ static void process_request(struct winbindd_cli_state *state)
 	state->cmd_name = "unknown request";
 	state->recv_fn = NULL;
 	/* client is newest */
-	winbindd_promote_client(state);
+	winbindd_promote_client((state->pipelined_conn != NULL) ?
+				state->pipelined_conn : state);
 
 	/* Process command */
 
@@ -799,6 +833,7 @@ static void wb_request_done(struct tevent_req *req)
 		request_error(state);
 		return;
 	}
+	winbindd_nss_cache_store(state->request, state->response);
 	request_ok(state);
 }
 
@@ -816,12 +851,33 @@ static void request_finished(struct winbindd_cli_state *state);
 
 static void winbind_client_request_read(struct tevent_req *req);
 static void winbind_client_response_written(struct tevent_req *req);
+static void winbind_client_pipelined_written(struct tevent_req *req);
 static void winbind_client_activity(struct tevent_req *req);
 
 static void request_finished(struct winbindd_cli_state *state)
 {
+	struct winbindd_cli_state *conn = state->pipelined_conn;
 	struct tevent_req *req;
 
+	if (conn != NULL) {
+		/*
+		 * The connection keeps reading requests, we just
+		 * queue our reply behind the others.
+		 */
+		TALLOC_FREE(state->request);
+
+		req = wb_resp_write_pipelined_send(
+			state, winbind_event_context(), conn->out_queue,
+			conn->sock, state->response, state->request_id);
+		if (req == NULL) {
+			remove_client(conn);
+			return;
+		}
+		tevent_req_set_callback(req, winbind_client_pipelined_written,
+					state);
+		return;
+	}
+
 	/* free client socket monitoring request */
 	TALLOC_FREE(state->io_req);
 
@@ -878,6 +934,150 @@ static void winbind_client_response_written(struct tevent_req *req)
 	state->io_req = req;
 }
 
+static void winbind_client_pipelined_written(struct tevent_req *req)
+{
+	struct winbindd_cli_state *state = tevent_req_callback_data(
+		req, struct winbindd_cli_state);
+	struct winbindd_cli_state *conn = state->pipelined_conn;
+	ssize_t ret;
+	int err;
+
+	ret = wb_resp_write_recv(req, &err);
+	TALLOC_FREE(req);
+	if (ret == -1) {
+		DEBUG(2, ("Could not write response[%d:%s] to client: %s\n",
+			  (int)state->pid, state->cmd_name, strerror(err)));
+		remove_client(conn);
+		return;
+	}
+
+	DEBUG(10,("winbind_client_pipelined_written[%d:%s]: delivered "
+		  "response %"PRIu32" to client\n", (int)state->pid,
+		  state->cmd_name, state->request_id));
+
+	TALLOC_FREE(state);
+}
+
+/*
+ * A connection only has "winbindd:max pipelined requests" requests in
+ * flight. When they are all busy we stop reading from it, a freed slot
+ * starts the next read.
+ */
+
+static int winbind_client_max_pipelined(void)
+{
+	return MAX(lp_parm_int(-1, "winbindd", "max pipelined requests", 8), 1);
+}
+
+static bool winbind_client_read_next(struct winbindd_cli_state *conn)
+{
+	struct tevent_req *req;
+
+	req = wb_req_read_send(conn, winbind_event_context(), conn->sock,
+			       WINBINDD_MAX_EXTRA_DATA);
+	if (req == NULL) {
+		return false;
+	}
+	tevent_req_set_callback(req, winbind_client_request_read, conn);
+	conn->io_req = req;
+	return true;
+}
+
+static int winbind_client_pipelined_destructor(
+	struct winbindd_cli_state *state)
+{
+	struct winbindd_cli_state *conn = state->pipelined_conn;
+
+	conn->num_pipelined -= 1;
+
+	/*
+	 * Not reading means we were at the limit. A dead connection
+	 * has no socket anymore.
+	 */
+	if ((conn->io_req == NULL) && (conn->sock != -1)) {
+		DEBUG(10, ("winbind_client_pipelined_destructor[%d]: "
+			   "%"PRIu32" requests in flight, reading again\n",
+			   (int)conn->pid, conn->num_pipelined));
+		if (!winbind_client_read_next(conn)) {
+			/*
+			 * We're in the middle of a talloc_free, leave
+			 * the connection to remove_timed_out_clients()
+			 */
+			DEBUG(0, ("winbind_client_pipelined_destructor[%d]: "
+				  "wb_req_read_send failed\n",
+				  (int)conn->pid));
+		}
+	}
+	return 0;
+}
+
+/*
+ * Hand a WBFLAG_PIPELINED request to its own state and go on reading
+ * from the connection, unless it has the maximum number of requests
+ * in flight
+ */
+
+static void winbind_client_pipelined_request(struct winbindd_cli_state *conn)
+{
+	struct winbindd_cli_state *state;
+
+	state = talloc_zero(conn, struct winbindd_cli_state);
+	if (state == NULL) {
+		remove_client(conn);
+		return;
+	}
+	/* Remember who asked us. */
+	conn->pid = conn->request->pid;
+
+	state->sock = conn->sock;
+	state->pid = conn->pid;
+	state->last_access = conn->last_access;
+	state->privileged = conn->privileged;
+	state->pipelined_conn = conn;
+	state->request = talloc_move(state, &conn->request);
+	state->request_id = state->request->request_id;
+
+	conn->num_pipelined += 1;
+	talloc_set_destructor(state, winbind_client_pipelined_destructor);
+
+	if (conn->num_pipelined >= winbind_client_max_pipelined()) {
+		DEBUG(10, ("winbind_client_pipelined_request[%d]: "
+			   "%"PRIu32" requests in flight, not reading\n",
+			   (int)conn->pid, conn->num_pipelined));
+	} else if (!winbind_client_read_next(conn)) {
+		remove_client(conn);
+		return;
+	}
+
+	switch (state->request->cmd) {
+	case WINBINDD_SETPWENT:
+	case WINBINDD_GETPWENT:
+	case WINBINDD_ENDPWENT:
+	case WINBINDD_SETGRENT:
+	case WINBINDD_GETGRENT:
+	case WINBINDD_ENDGRENT:
+		/*
+		 * Enumerations keep their position in the connection,
+		 * they can't be answered out of order.
+		 */
+		state->mem_ctx = talloc_named(state, 0, "winbind request");
+		state->response = talloc_zero(state->mem_ctx,
+					      struct winbindd_response);
+		if (state->response == NULL) {
+			remove_client(conn);
+			return;
+		}
+		state->response->result = WINBINDD_PENDING;
+		state->response->length = sizeof(struct winbindd_response);
+		request_error(state);
+		return;
+	default:
+		break;
+	}
+
+	process_request(state);
+}
+
 void request_error(struct winbindd_cli_state *state)
 {
 	SMB_ASSERT(state->response->result == WINBINDD_PENDING);
@@ -976,6 +1176,11 @@ static void winbind_client_request_read(struct tevent_req *req)
 		return;
 	}
 
+	if (state->request->wb_flags & WBFLAG_PIPELINED) {
+		winbind_client_pipelined_request(state);
+		return;
+	}
+
 	req = wait_for_read_send(state, winbind_event_context(), state->sock,
 				 true);
 	if (req == NULL) {
@@ -1035,6 +1240,11 @@ static void remove_client(struct winbindd_cli_state *state)
 		return;
 	}
 
+	if (state->pipelined_conn != NULL) {
+		/* The connection takes its pipelined requests with it */
+		state = state->pipelined_conn;
+	}
+
 	/*
 	 * We need to remove a pending wb_req_read_*
 	 * or wb_resp_write_* request before closing the
@@ -1081,6 +1291,7 @@ static void remove_client(struct winbindd_cli_state *state)
 static bool client_is_idle(struct winbindd_cli_state *state) {
   return (state->request == NULL &&
 	  state->response == NULL &&
+	  state->num_pipelined == 0 &&
 	  !state->pwent_state && !state->grent_state);
 }
 
@@ -1383,6 +1594,10 @@ static void winbindd_register_handlers(struct messaging_context *msg_ctx,
 			   MSG_WINBIND_DUMP_DOMAIN_LIST,
 			   winbind_msg_dump_domain_list);
 
+	messaging_register(msg_ctx, NULL,
+			   MSG_WINBIND_SIDS2XIDS_STATS,
+			   winbind_msg_sids2xids_stats);
+
 	messaging_register(msg_ctx, NULL,
 			   MSG_WINBIND_IP_DROPPED,
 			   winbind_msg_ip_dropped_parent);
@@ -1539,6 +1754,7 @@ int main(int argc, const char **argv)
 	TALLOC_CTX *frame;
 	NTSTATUS status;
 	bool ok;
+	int idmap_cache_size;
 
 	/*
 	 * Do this before any other talloc operation
@@ -1814,6 +2030,17 @@ int main(int argc, const char **argv)
 		exit_daemon("Winbindd failed to setup listeners", EPIPE);
 	}
 
+	idmap_cache_size = lp_parm_int(-1, "winbindd",
+				       "idmap memory cache size",
+				       4 * 1024 * 1024);
+	/* 0 or less disables it */
+	idmap_cache_ram_init(MAX(idmap_cache_size, 0));
+
+	if (!winbindd_nss_cache_init()) {
+		DEBUG(0, ("Could not set up the nss cache, "
+			  "all lookups go through the socket\n"));
+	}
+
 	irpc_add_name(winbind_imessaging_context(), "winbind_server");
 
 	TALLOC_FREE(frame);
@@ -71,6 +71,14 @@ struct winbindd_cli_state {
 
 	struct getpwent_state *pwent_state; /* State for getpwent() */
 	struct getgrent_state *grent_state; /* State for getgrent() */
+
+	/*
+	 * A WBFLAG_PIPELINED request is handled in its own state, a
+	 * talloc child of the connection that sent it.
+	 */
+	struct winbindd_cli_state *pipelined_conn;
+	uint32_t request_id;
+	uint32_t num_pipelined;
 };
 
 struct getpwent_state {
@@ -141,8 +149,17 @@ struct winbindd_child {
 
 	struct tevent_timer *lockout_policy_event;
 	struct tevent_timer *machine_password_change_event;
+	struct tevent_timer *idle_event;
 
 	const struct winbindd_child_dispatch_table *table;
+
+	/* Request statistics, maintained by the parent */
+	struct timeval request_start;	/* zero while no request runs */
+	uint64_t num_requests;
+	uint64_t num_failed;
+	uint64_t total_usec;
+	uint64_t avg_usec;		/* moving average */
+	uint64_t max_usec;
 };
 
 /* Structures to hold per domain information */
@@ -429,8 +429,8 @@ static int wcache_seqnum_parser(TDB_DATA key, TDB_DATA data,
 	return 0;
 }
 
-static bool wcache_fetch_seqnum(const char *domain_name, uint32_t *seqnum,
-				uint32_t *last_seq_check)
+bool wcache_fetch_seqnum(const char *domain_name, uint32_t *seqnum,
+			 uint32_t *last_seq_check)
 {
 	struct wcache_seqnum_state state = {
 		.seqnum = seqnum, .last_seq_check = last_seq_check
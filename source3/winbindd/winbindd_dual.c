@@ -184,6 +184,9 @@ static void wb_child_request_trigger(struct tevent_req *req,
 	state->subreq = subreq;
 	tevent_req_set_callback(subreq, wb_child_request_done, req);
 	tevent_req_set_endtime(req, state->ev, timeval_current_ofs(300, 0));
+
+	state->child->request_start = timeval_current();
+	TALLOC_FREE(state->child->idle_event);
 }
 
 static void wb_child_request_done(struct tevent_req *subreq)
@@ -219,6 +222,9 @@ int wb_child_request_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
 	return 0;
 }
 
+static void winbindd_child_account(struct winbindd_child *child,
+				   bool ok);
+
 static void wb_child_request_cleanup(struct tevent_req *req,
 				     enum tevent_req_state req_state)
 {
@@ -232,6 +238,8 @@ static void wb_child_request_cleanup(struct tevent_req *req,
 
 	TALLOC_FREE(state->subreq);
 
+	winbindd_child_account(state->child, req_state == TEVENT_REQ_DONE);
+
 	if (req_state == TEVENT_REQ_DONE) {
 		/* transmitted request and got response */
 		return;
@@ -253,28 +261,149 @@ static bool winbindd_child_busy(struct winbindd_child *child)
 	return tevent_queue_length(child->queue) > 0;
 }
 
-static struct winbindd_child *find_idle_child(struct winbindd_domain *domain)
+/*
+ * Domain children beyond "winbindd:min domain connections" are shut
+ * down after "winbindd:domain child idle timeout" seconds without a
+ * request, they are forked again when the load needs them.
+ */
+
+static void winbindd_child_idle_handler(struct tevent_context *ev,
+					struct tevent_timer *te,
+					struct timeval now,
+					void *private_data)
 {
-	int i;
+	struct winbindd_child *child =
+		(struct winbindd_child *)private_data;
 
-	for (i=0; i<lp_winbind_max_domain_connections(); i++) {
-		if (!winbindd_child_busy(&domain->children[i])) {
-			return &domain->children[i];
-		}
+	child->idle_event = NULL;
+
+	if (winbindd_child_busy(child) || (child->sock == -1)) {
+		return;
 	}
 
-	return NULL;
+	DEBUG(5, ("Shutting down idle child %u of domain %s\n",
+		  (unsigned int)child->pid, child->domain->name));
+
+	close(child->sock);
+	child->sock = -1;
+	child->pid = 0;
+	DLIST_REMOVE(winbindd_children, child);
+}
+
+static void winbindd_child_arm_idle(struct winbindd_child *child)
+{
+	struct winbindd_domain *domain = child->domain;
+	int min_children, idle_timeout;
+
+	if ((domain == NULL) || (child->sock == -1) ||
+	    (child < domain->children) ||
+	    (child >= domain->children + lp_winbind_max_domain_connections())) {
+		return;
+	}
+
+	min_children = lp_parm_int(-1, "winbindd", "min domain connections", 1);
+	idle_timeout = lp_parm_int(-1, "winbindd",
+				   "domain child idle timeout", 300);
+	if ((child - domain->children < MAX(min_children, 1)) ||
+	    (idle_timeout <= 0)) {
+		return;
+	}
+
+	TALLOC_FREE(child->idle_event);
+	child->idle_event = tevent_add_timer(
+		winbind_event_context(), domain->children,
+		timeval_current_ofs(idle_timeout, 0),
+		winbindd_child_idle_handler, child);
+}
+
+/* Account a finished request to the child that served it */
+
+static void winbindd_child_account(struct winbindd_child *child, bool ok)
+{
+	struct timeval now = timeval_current();
+	uint64_t usec;
+
+	if (timeval_is_zero(&child->request_start)) {
+		return;
+	}
+
+	usec = usec_time_diff(&now, &child->request_start);
+	child->request_start = timeval_zero();
+
+	child->num_requests += 1;
+	if (!ok) {
+		child->num_failed += 1;
+	}
+	child->total_usec += usec;
+	child->max_usec = MAX(child->max_usec, usec);
+	if (child->num_requests == 1) {
+		child->avg_usec = usec;
+	} else {
+		child->avg_usec = (child->avg_usec * 7 + usec) / 8;
+	}
+
+	winbindd_child_arm_idle(child);
+}
+
+/*
+ * How long a new request is expected to wait for this child: the
+ * number of queued requests first, then the child's average latency
+ * plus how long its current request has been running.
+ */
+
+static uint64_t winbindd_child_expected_usec(struct winbindd_child *child,
+					     const struct timeval *now)
+{
+	uint64_t usec = child->avg_usec;
+
+	if (!timeval_is_zero(&child->request_start)) {
+		usec += usec_time_diff(now, &child->request_start);
+	}
+	return usec;
 }
 
 struct winbindd_child *choose_domain_child(struct winbindd_domain *domain)
 {
-	struct winbindd_child *result;
+	struct winbindd_child *result = NULL;
+	struct winbindd_child *unstarted = NULL;
+	struct timeval now = timeval_current();
+	size_t result_len = 0;
+	uint64_t result_usec = 0;
+	int i;
+
+	/*
+	 * Pick the running child with the fewest outstanding requests,
+	 * the faster one of two equally loaded children. Only start
+	 * another child if all running ones are busy.
+	 */
+
+	for (i=0; i<lp_winbind_max_domain_connections(); i++) {
+		struct winbindd_child *child = &domain->children[i];
+		size_t len = tevent_queue_length(child->queue);
+		uint64_t usec;
+
+		if ((child->sock == -1) && (len == 0)) {
+			if (unstarted == NULL) {
+				unstarted = child;
+			}
+			continue;
+		}
+
+		usec = winbindd_child_expected_usec(child, &now);
+
+		if ((result == NULL) || (len < result_len) ||
+		    ((len == result_len) && (usec < result_usec))) {
+			result = child;
+			result_len = len;
+			result_usec = usec;
+		}
+	}
 
-	result = find_idle_child(domain);
-	if (result != NULL) {
-		return result;
+	if ((result == NULL) || ((result_len > 0) && (unstarted != NULL))) {
+		result = unstarted;
 	}
-	return &domain->children[rand() % lp_winbind_max_domain_connections()];
+
+	return result;
 }
 
 struct dcerpc_binding_handle *dom_child_handle(struct winbindd_domain *domain)
@@ -1259,6 +1388,8 @@ NTSTATUS winbindd_reinit_after_fork(const struct winbindd_child *myself,
 
 	close_conns_after_fork();
 
+	winbindd_nss_cache_close_after_fork();
+
 	if (!override_logfile && logfilename) {
 		lp_set_logfile(logfilename);
 		reopen_logs();
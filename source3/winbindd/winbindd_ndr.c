@@ -48,6 +48,13 @@ void ndr_print_winbindd_child(struct ndr_print *ndr,
 	/* struct fd_event event; */
 	ndr_print_ptr(ndr, "lockout_policy_event", r->lockout_policy_event);
 	ndr_print_ptr(ndr, "table", r->table);
+	ndr_print_uint32(ndr, "queue_length",
+			 r->queue != NULL ? tevent_queue_length(r->queue) : 0);
+	ndr_print_hyper(ndr, "num_requests", r->num_requests);
+	ndr_print_hyper(ndr, "num_failed", r->num_failed);
+	ndr_print_hyper(ndr, "avg_usec", r->avg_usec);
+	ndr_print_hyper(ndr, "max_usec", r->max_usec);
+	ndr_print_hyper(ndr, "total_usec", r->total_usec);
 	ndr->depth--;
 }
 
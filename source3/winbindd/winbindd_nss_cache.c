@@ -0,0 +1,411 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Winbind daemon - passwd and group cache shared with the nss modules
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every getpwnam(), getgrgid() or initgroups() through libnss_winbind
+ * is a round trip to the winbindd parent, even when the answer comes
+ * straight from winbindd_cache.tdb. We publish the answers in a file
+ * in the public socket directory that the nss modules map read-only,
+ * see nsswitch/winbind_nss_cache.h for the layout.
+ *
+ * Answers are kept for "winbind cache time" seconds and the whole
+ * table is cleared when the winbindd caches are flushed. A passwd or
+ * group entry is also filed under its uid or gid and name, so a
+ * getpwnam() answers a later getpwuid() for the same user.
+ */
+
+#include "includes.h"
+#include "winbindd.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "nsswitch/winbind_nss_cache.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_WINBIND
+
+#define WINBINDD_NSS_CACHE_DEFAULT_SIZE 4096
+
+#ifdef WINBINDD_NSS_CACHE_BARRIER
+
+static struct winbindd_nss_cache {
+	struct winbindd_nss_cache_header *hdr;
+	uint8_t *slots;
+	size_t size;
+	char *path;
+} *nss_cache;
+
+static char *winbindd_nss_cache_path(TALLOC_CTX *mem_ctx)
+{
+	return talloc_asprintf(mem_ctx, "%s/%s",
+			       lp_winbindd_socket_directory(),
+			       WINBINDD_NSS_CACHE_NAME);
+}
+
+/*
+ * Readers still mapping the file of an earlier winbindd need to know
+ * that it is not maintained anymore.
+ */
+
+static void winbindd_nss_cache_invalidate_file(const char *path)
+{
+	uint32_t valid = 0;
+	int fd;
+
+	fd = open(path, O_WRONLY|O_NOFOLLOW);
+	if (fd == -1) {
+		return;
+	}
+	(void)pwrite(fd, &valid, sizeof(valid),
+		     offsetof(struct winbindd_nss_cache_header, valid));
+	close(fd);
+}
+
+bool winbindd_nss_cache_init(void)
+{
+	struct winbindd_nss_cache *cache = NULL;
+	char *tmp_path = NULL;
+	void *ptr;
+	int num_slots;
+	int fd = -1;
+	int ret;
+
+	if (nss_cache != NULL) {
+		return true;
+	}
+
+	cache = talloc_zero(NULL, struct winbindd_nss_cache);
+	if (cache == NULL) {
+		return false;
+	}
+
+	cache->path = winbindd_nss_cache_path(cache);
+	if (cache->path == NULL) {
+		goto fail;
+	}
+	winbindd_nss_cache_invalidate_file(cache->path);
+
+	num_slots = lp_parm_int(-1, "winbindd", "nss cache size",
+				WINBINDD_NSS_CACHE_DEFAULT_SIZE);
+	if ((num_slots <= 0) || (lp_winbind_cache_time() == 0)) {
+		DEBUG(3, ("winbindd_nss_cache_init: disabled\n"));
+		unlink(cache->path);
+		TALLOC_FREE(cache);
+		return true;
+	}
+
+	tmp_path = talloc_asprintf(cache, "%s.tmp", cache->path);
+	if (tmp_path == NULL) {
+		goto fail;
+	}
+	unlink(tmp_path);
+
+	fd = open(tmp_path, O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW, 0644);
+	if (fd == -1) {
+		DEBUG(1, ("winbindd_nss_cache_init: could not create %s: %s\n",
+			  tmp_path, strerror(errno)));
+		goto fail;
+	}
+
+	cache->size = sizeof(struct winbindd_nss_cache_header) +
+		(size_t)num_slots * WINBINDD_NSS_CACHE_SLOT_SIZE;
+
+	ret = fchmod(fd, 0644);
+	if (ret == 0) {
+		ret = ftruncate(fd, cache->size);
+	}
+	if (ret == -1) {
+		DEBUG(1, ("winbindd_nss_cache_init: could not set up %s: %s\n",
+			  tmp_path, strerror(errno)));
+		goto fail;
+	}
+
+	ptr = mmap(NULL, cache->size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (ptr == MAP_FAILED) {
+		DEBUG(1, ("winbindd_nss_cache_init: mmap failed: %s\n",
+			  strerror(errno)));
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	cache->hdr = (struct winbindd_nss_cache_header *)ptr;
+	cache->slots = (uint8_t *)(cache->hdr + 1);
+
+	cache->hdr->magic = WINBINDD_NSS_CACHE_MAGIC;
+	cache->hdr->version = WINBINDD_NSS_CACHE_VERSION;
+	cache->hdr->num_slots = num_slots;
+	cache->hdr->slot_size = WINBINDD_NSS_CACHE_SLOT_SIZE;
+	cache->hdr->valid = 1;
+
+	ret = rename(tmp_path, cache->path);
+	if (ret == -1) {
+		DEBUG(1, ("winbindd_nss_cache_init: could not rename %s: %s\n",
+			  tmp_path, strerror(errno)));
+		munmap(ptr, cache->size);
+		goto fail;
+	}
+
+	DEBUG(3, ("winbindd_nss_cache_init: %d slots in %s\n",
+		  num_slots, cache->path));
+
+	TALLOC_FREE(tmp_path);
+	nss_cache = cache;
+	return true;
+
+fail:
+	if (fd != -1) {
+		close(fd);
+	}
+	if (tmp_path != NULL) {
+		unlink(tmp_path);
+	}
+	TALLOC_FREE(cache);
+	return false;
+}
+
+void winbindd_nss_cache_shutdown(void)
+{
+	if (nss_cache == NULL) {
+		return;
+	}
+
+	nss_cache->hdr->valid = 0;
+	WINBINDD_NSS_CACHE_BARRIER();
+	unlink(nss_cache->path);
+
+	munmap(nss_cache->hdr, nss_cache->size);
+	TALLOC_FREE(nss_cache);
+}
+
+/*
+ * Children inherit the mapping, only the parent maintains the file
+ */
+
+void winbindd_nss_cache_close_after_fork(void)
+{
+	if (nss_cache == NULL) {
+		return;
+	}
+
+	munmap(nss_cache->hdr, nss_cache->size);
+	TALLOC_FREE(nss_cache);
+}
+
+void winbindd_nss_cache_flush(void)
+{
+	uint32_t i;
+
+	if (nss_cache == NULL) {
+		return;
+	}
+
+	for (i = 0; i < nss_cache->hdr->num_slots; i++) {
+		struct winbindd_nss_cache_slot *slot =
+			(struct winbindd_nss_cache_slot *)(nss_cache->slots +
+			(size_t)i * WINBINDD_NSS_CACHE_SLOT_SIZE);
+
+		if (slot->cmd == 0) {
+			continue;
+		}
+
+		slot->seqnum += 1;
+		WINBINDD_NSS_CACHE_BARRIER();
+		slot->cmd = 0;
+		WINBINDD_NSS_CACHE_BARRIER();
+		slot->seqnum += 1;
+	}
+}
+
+/*
+ * Pick the slot for a key: the one already holding it, else an
+ * unused or expired one, else the one expiring first.
+ */
+
+static struct winbindd_nss_cache_slot *winbindd_nss_cache_slot(
+	int cmd, uint32_t hash, const char *key, int key_len, time_t now)
+{
+	struct winbindd_nss_cache_slot *unused = NULL;
+	struct winbindd_nss_cache_slot *oldest = NULL;
+	uint32_t i;
+
+	for (i = 0; i < WINBINDD_NSS_CACHE_PROBES; i++) {
+		uint32_t idx = (hash + i) % nss_cache->hdr->num_slots;
+		struct winbindd_nss_cache_slot *slot =
+			(struct winbindd_nss_cache_slot *)(nss_cache->slots +
+			(size_t)idx * WINBINDD_NSS_CACHE_SLOT_SIZE);
+
+		if ((slot->cmd == cmd) && (slot->hash == hash) &&
+		    (slot->key_len == key_len) &&
+		    (memcmp(slot->key, key, key_len) == 0)) {
+			return slot;
+		}
+
+		if ((slot->cmd == 0) || (slot->expires <= now)) {
+			if (unused == NULL) {
+				unused = slot;
+			}
+			continue;
+		}
+
+		if ((oldest == NULL) || (slot->expires < oldest->expires)) {
+			oldest = slot;
+		}
+	}
+
+	return (unused != NULL) ? unused : oldest;
+}
+
+static void winbindd_nss_cache_put(int cmd, const char *key, int key_len,
+				   const struct winbindd_response *response,
+				   const void *extra, uint32_t extra_len)
+{
+	struct winbindd_nss_cache_slot *slot;
+	time_t now = time(NULL);
+	uint32_t hash;
+
+	hash = winbindd_nss_cache_hash(cmd, key, key_len);
+
+	slot = winbindd_nss_cache_slot(cmd, hash, key, key_len, now);
+	if (slot == NULL) {
+		return;
+	}
+
+	slot->seqnum += 1;
+	WINBINDD_NSS_CACHE_BARRIER();
+
+	slot->cmd = cmd;
+	slot->expires = now + lp_winbind_cache_time();
+	slot->hash = hash;
+	slot->key_len = key_len;
+	memcpy(slot->key, key, key_len);
+
+	switch (cmd) {
+	case WINBINDD_GETPWNAM:
+	case WINBINDD_GETPWUID:
+		slot->data.pw = response->data.pw;
+		break;
+	case WINBINDD_GETGRNAM:
+	case WINBINDD_GETGRGID:
+		slot->data.gr = response->data.gr;
+		break;
+	case WINBINDD_GETGROUPS:
+		slot->num_entries = response->data.num_entries;
+		break;
+	}
+
+	slot->extra_len = extra_len;
+	if (extra_len != 0) {
+		memcpy(slot + 1, extra, extra_len);
+	}
+
+	WINBINDD_NSS_CACHE_BARRIER();
+	slot->seqnum += 1;
+}
+
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+	struct winbindd_request alias;
+	char key[FSTRING_LEN];
+	int key_len;
+	int alias_cmd;
+	uint32_t extra_len;
+
+	if (nss_cache == NULL) {
+		return;
+	}
+
+	key_len = winbindd_nss_cache_key(request->cmd, request, key);
+	if (key_len == -1) {
+		return;
+	}
+
+	if (response->length < sizeof(struct winbindd_response)) {
+		return;
+	}
+	extra_len = response->length - sizeof(struct winbindd_response);
+	if (extra_len > WINBINDD_NSS_CACHE_MAX_EXTRA) {
+		return;
+	}
+
+	winbindd_nss_cache_put(request->cmd, key, key_len, response,
+			       response->extra_data.data, extra_len);
+
+	/*
+	 * File passwd and group entries under their other key as well
+	 */
+
+	ZERO_STRUCT(alias);
+
+	switch (request->cmd) {
+	case WINBINDD_GETPWNAM:
+		alias_cmd = WINBINDD_GETPWUID;
+		alias.data.uid = response->data.pw.pw_uid;
+		break;
+	case WINBINDD_GETPWUID:
+		alias_cmd = WINBINDD_GETPWNAM;
+		fstrcpy(alias.data.username, response->data.pw.pw_name);
+		break;
+	case WINBINDD_GETGRNAM:
+		alias_cmd = WINBINDD_GETGRGID;
+		alias.data.gid = response->data.gr.gr_gid;
+		break;
+	case WINBINDD_GETGRGID:
+		alias_cmd = WINBINDD_GETGRNAM;
+		fstrcpy(alias.data.groupname, response->data.gr.gr_name);
+		break;
+	default:
+		return;
+	}
+
+	key_len = winbindd_nss_cache_key(alias_cmd, &alias, key);
+	if (key_len == -1) {
+		return;
+	}
+
+	winbindd_nss_cache_put(alias_cmd, key, key_len, response,
+			       response->extra_data.data, extra_len);
+}
+
+#else
+
+bool winbindd_nss_cache_init(void)
+{
+	return true;
+}
+
+void winbindd_nss_cache_shutdown(void)
+{
+}
+
+void winbindd_nss_cache_close_after_fork(void)
+{
+}
+
+void winbindd_nss_cache_flush(void)
+{
+}
+
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+}
+
+#endif /* WINBINDD_NSS_CACHE_BARRIER */
@@ -43,6 +43,8 @@
 #include "librpc/crypto/gse_krb5.h"
 #include "lib/afs/afs_funcs.h"
 #include "libsmb/samlogon_cache.h"
+#include "../lib/crypto/crypto.h"
+#include "../lib/util/memcache.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_WINBIND
@@ -884,6 +886,347 @@ NTSTATUS append_auth_data(TALLOC_CTX *mem_ctx,
 	return NT_STATUS_OK;
 }
 
+/*
+ * Users that authenticate over and over again with the same plaintext
+ * password (web applications, service accounts) cause a SamLogon at
+ * the DC each time. With "winbindd:auth cache time" set, a domain
+ * child remembers successful SamLogons for that many seconds. Entries
+ * hold the info3 and a salted hash of the NT hash. The salt is random
+ * and per process, the cache is never written to disk. A password
+ * change through winbindd marks the user in gencache, so all children
+ * drop older entries.
+ *
+ * Changes made at the DC are not seen until the entry expires: the
+ * old password keeps working, and so does a disabled account. To
+ * narrow this, a hit is only used if the netsamlogon cache still
+ * holds the user, is not newer than the entry and has acceptable
+ * account flags, and the DC's ACCOUNT and PASSWORD errors drop the
+ * entry.
+ */
+
+struct winbindd_pam_auth_cache_entry {
+	time_t fetched;
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	/* followed by the NDR encoded info3 */
+};
+
+static struct memcache *winbindd_pam_auth_cache;
+static uint8_t winbindd_pam_auth_cache_salt[16];
+
+static int winbindd_pam_auth_cache_time(void)
+{
+	return lp_parm_int(-1, "winbindd", "auth cache time", 0);
+}
+
+static char *winbindd_pam_auth_cache_key(TALLOC_CTX *mem_ctx,
+					 const char *name_domain,
+					 const char *name_user)
+{
+	return talloc_asprintf_strupper_m(mem_ctx, "%s\\%s", name_domain,
+					  name_user);
+}
+
+static char *winbindd_pam_auth_cache_changed_key(TALLOC_CTX *mem_ctx,
+						 const char *key)
+{
+	return talloc_asprintf(mem_ctx, "WB_PAM_AUTH_CHANGED/%s", key);
+}
+
+static void winbindd_pam_auth_cache_hash(const char *pass,
+					 uint8_t hash[SHA256_DIGEST_LENGTH])
+{
+	struct HMACSHA256Context ctx;
+	uint8_t nt_hash[NT_HASH_LEN];
+
+	E_md4hash(pass, nt_hash);
+
+	hmac_sha256_init(winbindd_pam_auth_cache_salt,
+			 sizeof(winbindd_pam_auth_cache_salt), &ctx);
+	hmac_sha256_update(nt_hash, sizeof(nt_hash), &ctx);
+	hmac_sha256_final(hash, &ctx);
+
+	ZERO_STRUCT(nt_hash);
+	ZERO_STRUCT(ctx);
+}
+
+static NTSTATUS winbindd_pam_auth_cache_check_account(
+	const struct netr_SamInfo3 *info3)
+{
+	time_t kickoff_time, must_change_time;
+	uint32_t acct_flags = info3->base.acct_flags;
+
+	if (acct_flags & ACB_AUTOLOCK) {
+		return NT_STATUS_ACCOUNT_LOCKED_OUT;
+	}
+	if (acct_flags & ACB_DISABLED) {
+		return NT_STATUS_ACCOUNT_DISABLED;
+	}
+	if (!(acct_flags & ACB_NORMAL)) {
+		return NT_STATUS_LOGON_FAILURE;
+	}
+	if (acct_flags & ACB_PW_EXPIRED) {
+		return NT_STATUS_PASSWORD_EXPIRED;
+	}
+
+	kickoff_time = nt_time_to_unix(info3->base.kickoff_time);
+	if (kickoff_time != 0 && time(NULL) > kickoff_time) {
+		return NT_STATUS_ACCOUNT_EXPIRED;
+	}
+
+	must_change_time = nt_time_to_unix(info3->base.force_password_change);
+	if (!(acct_flags & ACB_PWNOEXP) &&
+	    must_change_time != 0 && must_change_time < time(NULL)) {
+		return NT_STATUS_PASSWORD_MUST_CHANGE;
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * The DC's verdict on the account, not on the password: an entry for
+ * it would answer logons the DC refuses
+ */
+
+static bool winbindd_pam_auth_cache_drop_status(NTSTATUS status)
+{
+	return (NT_STATUS_EQUAL(status, NT_STATUS_ACCOUNT_DISABLED) ||
+		NT_STATUS_EQUAL(status, NT_STATUS_ACCOUNT_EXPIRED) ||
+		NT_STATUS_EQUAL(status, NT_STATUS_ACCOUNT_LOCKED_OUT) ||
+		NT_STATUS_EQUAL(status, NT_STATUS_ACCOUNT_RESTRICTION) ||
+		NT_STATUS_EQUAL(status, NT_STATUS_PASSWORD_EXPIRED) ||
+		NT_STATUS_EQUAL(status, NT_STATUS_PASSWORD_MUST_CHANGE));
+}
+
+static bool winbindd_pam_auth_cache_fetch(TALLOC_CTX *mem_ctx,
+					  const char *name_domain,
+					  const char *name_user,
+					  const char *pass,
+					  struct netr_SamInfo3 **pinfo3)
+{
+	struct winbindd_pam_auth_cache_entry entry;
+	struct netr_SamInfo3 *info3, *samlogon_info3;
+	enum ndr_err_code ndr_err;
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	DATA_BLOB val, blob;
+	char *key, *changed_key, *changed;
+	struct dom_sid user_sid;
+	time_t logon_time;
+	NTSTATUS status;
+	bool match;
+
+	if ((winbindd_pam_auth_cache == NULL) ||
+	    (winbindd_pam_auth_cache_time() <= 0)) {
+		return false;
+	}
+
+	key = winbindd_pam_auth_cache_key(talloc_tos(), name_domain,
+					  name_user);
+	if (key == NULL) {
+		return false;
+	}
+
+	if (!memcache_lookup(winbindd_pam_auth_cache, WB_PAM_AUTH_CACHE,
+			     data_blob_string_const(key), &val) ||
+	    (val.length < sizeof(entry))) {
+		TALLOC_FREE(key);
+		return false;
+	}
+	memcpy(&entry, val.data, sizeof(entry));
+
+	if (entry.fetched + winbindd_pam_auth_cache_time() < time(NULL)) {
+		DBG_DEBUG("Entry for %s expired\n", key);
+		goto drop;
+	}
+
+	changed_key = winbindd_pam_auth_cache_changed_key(talloc_tos(), key);
+	if ((changed_key != NULL) &&
+	    gencache_get(changed_key, talloc_tos(), &changed, NULL)) {
+		bool stale = (entry.fetched <= (time_t)atoll(changed));
+
+		TALLOC_FREE(changed);
+		if (stale) {
+			DBG_DEBUG("Password of %s changed\n", key);
+			TALLOC_FREE(changed_key);
+			goto drop;
+		}
+	}
+	TALLOC_FREE(changed_key);
+
+	winbindd_pam_auth_cache_hash(pass, hash);
+	match = (memcmp(hash, entry.hash, sizeof(hash)) == 0);
+	ZERO_STRUCT(hash);
+
+	if (!match) {
+		/* The DC decides, and we cache its answer if it is good */
+		TALLOC_FREE(key);
+		return false;
+	}
+
+	info3 = talloc_zero(mem_ctx, struct netr_SamInfo3);
+	if (info3 == NULL) {
+		TALLOC_FREE(key);
+		return false;
+	}
+
+	blob = data_blob_const(val.data + sizeof(entry),
+			       val.length - sizeof(entry));
+	ndr_err = ndr_pull_struct_blob(&blob, info3, info3,
+		(ndr_pull_flags_fn_t)ndr_pull_netr_SamInfo3);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(info3);
+		goto drop;
+	}
+
+	/*
+	 * The netsamlogon cache holds the DC's latest word on the
+	 * account. Without it, or if it is newer than our entry, ask
+	 * the DC again.
+	 */
+	sid_compose(&user_sid, info3->base.domain_sid, info3->base.rid);
+
+	if (!netsamlogon_cache_timestamp(&user_sid, &logon_time) ||
+	    (logon_time > entry.fetched)) {
+		DBG_DEBUG("samlogon cache for %s changed\n", key);
+		TALLOC_FREE(info3);
+		goto drop;
+	}
+
+	samlogon_info3 = netsamlogon_cache_get(talloc_tos(), &user_sid);
+	if (samlogon_info3 == NULL) {
+		TALLOC_FREE(info3);
+		goto drop;
+	}
+	status = winbindd_pam_auth_cache_check_account(samlogon_info3);
+	TALLOC_FREE(samlogon_info3);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Account %s not usable: %s\n", key,
+			  nt_errstr(status));
+		TALLOC_FREE(info3);
+		goto drop;
+	}
+
+	DBG_DEBUG("Using cached SamLogon result for %s\n", key);
+
+	TALLOC_FREE(key);
+	*pinfo3 = info3;
+	return true;
+
+drop:
+	memcache_delete(winbindd_pam_auth_cache, WB_PAM_AUTH_CACHE,
+			data_blob_string_const(key));
+	TALLOC_FREE(key);
+	return false;
+}
+
+static void winbindd_pam_auth_cache_store(const char *name_domain,
+					  const char *name_user,
+					  const char *pass,
+					  struct netr_SamInfo3 *info3)
+{
+	struct winbindd_pam_auth_cache_entry entry;
+	enum ndr_err_code ndr_err;
+	DATA_BLOB blob;
+	uint8_t *buf;
+	char *key;
+
+	if (winbindd_pam_auth_cache_time() <= 0) {
+		return;
+	}
+
+	if (winbindd_pam_auth_cache == NULL) {
+		generate_random_buffer(winbindd_pam_auth_cache_salt,
+				       sizeof(winbindd_pam_auth_cache_salt));
+		winbindd_pam_auth_cache = memcache_init(
+			NULL, lp_parm_int(-1, "winbindd", "auth cache size",
+					  256 * 1024));
+		if (winbindd_pam_auth_cache == NULL) {
+			return;
+		}
+	}
+
+	key = winbindd_pam_auth_cache_key(talloc_tos(), name_domain,
+					  name_user);
+	if (key == NULL) {
+		return;
+	}
+
+	ndr_err = ndr_push_struct_blob(&blob, key, info3,
+		(ndr_push_flags_fn_t)ndr_push_netr_SamInfo3);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(key);
+		return;
+	}
+
+	buf = talloc_array(key, uint8_t, sizeof(entry) + blob.length);
+	if (buf == NULL) {
+		TALLOC_FREE(key);
+		return;
+	}
+
+	ZERO_STRUCT(entry);
+	entry.fetched = time(NULL);
+	winbindd_pam_auth_cache_hash(pass, entry.hash);
+
+	memcpy(buf, &entry, sizeof(entry));
+	memcpy(buf + sizeof(entry), blob.data, blob.length);
+	ZERO_STRUCT(entry);
+
+	memcache_add(winbindd_pam_auth_cache, WB_PAM_AUTH_CACHE,
+		     data_blob_string_const(key),
+		     data_blob_const(buf, talloc_get_size(buf)));
+
+	TALLOC_FREE(key);
+}
+
+static void winbindd_pam_auth_cache_delete(const char *name_domain,
+					   const char *name_user)
+{
+	char *key;
+
+	if (winbindd_pam_auth_cache == NULL) {
+		return;
+	}
+
+	key = winbindd_pam_auth_cache_key(talloc_tos(), name_domain,
+					  name_user);
+	if (key == NULL) {
+		return;
+	}
+	memcache_delete(winbindd_pam_auth_cache, WB_PAM_AUTH_CACHE,
+			data_blob_string_const(key));
+	TALLOC_FREE(key);
+}
+
+/*
+ * The password changed, other children may still have the old one
+ */
+
+static void winbindd_pam_auth_cache_password_changed(const char *name_domain,
+						     const char *name_user)
+{
+	int cache_time = winbindd_pam_auth_cache_time();
+	char *key, *changed_key, *now;
+	time_t t = time(NULL);
+
+	if (cache_time <= 0) {
+		return;
+	}
+
+	winbindd_pam_auth_cache_delete(name_domain, name_user);
+
+	key = winbindd_pam_auth_cache_key(talloc_tos(), name_domain,
+					  name_user);
+	if (key == NULL) {
+		return;
+	}
+	changed_key = winbindd_pam_auth_cache_changed_key(key, key);
+	now = talloc_asprintf(key, "%lld", (long long)t);
+	if ((changed_key != NULL) && (now != NULL)) {
+		gencache_set(changed_key, now, t + cache_time);
+	}
+	TALLOC_FREE(key);
+}
+
 static NTSTATUS winbindd_dual_pam_auth_cached(struct winbindd_domain *domain,
 					      struct winbindd_cli_state *state,
 					      struct netr_SamInfo3 **info3)
@@ -1660,6 +2003,8 @@ enum winbindd_result winbindd_dual_pam_auth(struct winbindd_domain *domain,
 	fstring domain_user;
 	struct netr_SamInfo3 *info3 = NULL;
 	NTSTATUS name_map_status = NT_STATUS_UNSUCCESSFUL;
+	bool store_in_auth_cache = false;
+	bool from_auth_cache = false;
 
 	/* Ensure null termination */
 	state->request->data.auth.user[sizeof(state->request->data.auth.user)-1]='\0';
@@ -1763,6 +2108,14 @@ enum winbindd_result winbindd_dual_pam_auth(struct winbindd_domain *domain,
 sam_logon:
 	/* Check for Samlogon authentication */
 	if (domain->online) {
+		if (winbindd_pam_auth_cache_fetch(
+			    state->mem_ctx, name_domain, name_user,
+			    state->request->data.auth.pass, &info3)) {
+			result = NT_STATUS_OK;
+			from_auth_cache = true;
+			goto process_result;
+		}
+
 		result = winbindd_dual_pam_auth_samlogon(
 			state->mem_ctx, domain,
 			state->request->data.auth.user,
@@ -1775,6 +2128,8 @@ sam_logon:
 			/* add the Krb5 err if we have one */
 			if ( NT_STATUS_EQUAL(krb5_result, NT_STATUS_TIME_DIFFERENCE_AT_DC ) ) {
 				info3->base.user_flags |= LOGON_KRB5_FAIL_CLOCK_SKEW;
+			} else {
+				store_in_auth_cache = true;
 			}
 			goto process_result;
 		}
@@ -1782,6 +2137,10 @@ sam_logon:
 		DEBUG(10,("winbindd_dual_pam_auth_samlogon failed: %s\n",
 			  nt_errstr(result)));
 
+		if (winbindd_pam_auth_cache_drop_status(result)) {
+			winbindd_pam_auth_cache_delete(name_domain, name_user);
+		}
+
 		if (NT_STATUS_EQUAL(result, NT_STATUS_NO_LOGON_SERVERS) ||
 		    NT_STATUS_EQUAL(result, NT_STATUS_IO_TIMEOUT) ||
 		    NT_STATUS_EQUAL(result, NT_STATUS_DOMAIN_CONTROLLER_NOT_FOUND))
@@ -1849,15 +2208,23 @@ process_result:
 			}
 		}
 
-		wcache_invalidate_samlogon(find_domain_from_name(name_domain),
-					   &user_sid);
-		netsamlogon_cache_store(name_user, info3);
+		if (!from_auth_cache) {
+			wcache_invalidate_samlogon(
+				find_domain_from_name(name_domain), &user_sid);
+			netsamlogon_cache_store(name_user, info3);
+		}
+
+		if (store_in_auth_cache) {
+			winbindd_pam_auth_cache_store(
+				name_domain, name_user,
+				state->request->data.auth.pass, info3);
+		}
 
 		/* save name_to_sid info as early as possible (only if
 		   this is our primary domain so we don't invalidate
 		   the cache entry by storing the seq_num for the wrong
 		   domain). */
-		if ( domain->primary ) {
+		if (domain->primary && !from_auth_cache) {
 			cache_name2sid(domain, name_domain, name_user,
 				       SID_NAME_USER, &user_sid);
 		}
@@ -1882,7 +2249,7 @@ process_result:
 		}
 
 		if ((state->request->flags & WBFLAG_PAM_CACHED_LOGIN)
-		    && lp_winbind_offline_logon()) {
+		    && lp_winbind_offline_logon() && !from_auth_cache) {
 
 			result = winbindd_store_creds(domain,
 						      state->request->data.auth.user,
@@ -2272,6 +2639,10 @@ process_result:
 		}
 	}
 
+	if (NT_STATUS_IS_OK(result)) {
+		winbindd_pam_auth_cache_password_changed(domain, user);
+	}
+
 	set_auth_errors(state->response, result);
 
 	DEBUG(NT_STATUS_IS_OK(result) ? 5 : 2,
@@ -2450,6 +2821,10 @@ enum winbindd_result winbindd_dual_pam_chng_pswd_auth_crap(struct winbindd_domai
 		cli, state->mem_ctx, user, new_nt_password, old_nt_hash_enc,
 		new_lm_password, old_lm_hash_enc);
 
+	if (NT_STATUS_IS_OK(result)) {
+		winbindd_pam_auth_cache_password_changed(domain, user);
+	}
+
  done:
 
 	if (strequal(contact_domain->name, get_global_sam_name())) {
@@ -184,6 +184,8 @@ bool wcache_tdc_add_domain( struct winbindd_domain *domain );
 struct winbindd_tdc_domain * wcache_tdc_fetch_domain( TALLOC_CTX *ctx, const char *name );
 struct winbindd_tdc_domain* wcache_tdc_fetch_domainbysid(TALLOC_CTX *ctx, const struct dom_sid *sid);
 void wcache_tdc_clear( void );
+bool wcache_fetch_seqnum(const char *domain_name, uint32_t *seqnum,
+			 uint32_t *last_seq_check);
 bool wcache_store_seqnum(const char *domain_name, uint32_t seqnum,
 			 time_t last_seq_check);
 bool wcache_fetch_ndr(TALLOC_CTX *mem_ctx, struct winbindd_domain *domain,
@@ -409,6 +411,15 @@ void ndr_print_winbindd_domain(struct ndr_print *ndr,
 			       const char *name,
 			       const struct winbindd_domain *r);
 
+/* The following definitions come from winbindd/winbindd_nss_cache.c  */
+
+bool winbindd_nss_cache_init(void);
+void winbindd_nss_cache_shutdown(void);
+void winbindd_nss_cache_close_after_fork(void);
+void winbindd_nss_cache_flush(void);
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response);
+
 /* The following definitions come from winbindd/winbindd_pam.c  */
 
 bool check_request_flags(uint32_t flags);
@@ -666,6 +677,7 @@ struct tevent_req *wb_gettoken_send(TALLOC_CTX *mem_ctx,
 				    bool expand_local_aliases);
 NTSTATUS wb_gettoken_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
 			  int *num_sids, struct dom_sid **sids);
+void wb_gettoken_flush_cache(void);
 struct tevent_req *winbindd_getgroups_send(TALLOC_CTX *mem_ctx,
 					   struct tevent_context *ev,
 					   struct winbindd_cli_state *cli,
@@ -923,6 +935,8 @@ struct tevent_req *wb_sids2xids_send(TALLOC_CTX *mem_ctx,
 				     const uint32_t num_sids);
 NTSTATUS wb_sids2xids_recv(struct tevent_req *req,
 			   struct unixid xids[], uint32_t num_xids);
+char *wb_sids2xids_stats_string(TALLOC_CTX *mem_ctx);
+void wb_sids2xids_dump_stats(void);
 struct tevent_req *winbindd_sids_to_xids_send(TALLOC_CTX *mem_ctx,
 					      struct tevent_context *ev,
 					      struct winbindd_cli_state *cli,
@@ -0,0 +1,929 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   DNS server record and forwarder answer caches
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Queries for names in our own zones used to search sam.ldb and unpack
+ * the dnsRecord values every time.  This caches the unpacked records,
+ * and the fact that a name does not exist, per name.
+ *
+ * Records can be changed by other processes (dnsserver RPC, LDAP,
+ * replication). Every write to sam.ldb takes a new sequence number, so
+ * each lookup first compares the highest sequence number with the one
+ * the cache is up to date with. Only when it moved on do we compare the
+ * highest USN of the partition each zone lives in with the one we saw
+ * when we filled the cache, and drop the cached names of the zones
+ * that changed.  Updates we do ourselves only drop the name they
+ * change, zone reloads flush the whole cache.
+ *
+ * Queries use the cached records in place. Each query holds a
+ * dns_cache_ref on the entry, so an entry that is dropped while a
+ * query still uses it is only freed once that query is done.
+ *
+ * Answers from forwarders are kept as the packed response, per
+ * forwarder, name, type and class, for the smallest TTL of the records
+ * in it. Negative answers are kept for the SOA minimum TTL (RFC 2308).
+ */
+
+#include "includes.h"
+#include "lib/util/dlinklist.h"
+#include "librpc/gen_ndr/ndr_dnsp.h"
+#include "librpc/gen_ndr/ndr_dns.h"
+#include <ldb.h>
+#include "dsdb/samdb/samdb.h"
+#include "dsdb/common/util.h"
+#include "param/param.h"
+#include "smbd/service_task.h"
+#include "dns_server/dns_server.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_DNS
+
+#define DNS_CACHE_DEFAULT_SIZE 10000
+#define DNS_CACHE_DEFAULT_FORWARDED_SIZE 10000
+#define DNS_CACHE_DEFAULT_FORWARDED_MAX_TTL 86400
+#define DNS_CACHE_NUM_BUCKETS 4096
+
+struct dns_cache_zone {
+	struct dns_cache_zone *prev, *next;
+	const char *name;
+	struct ldb_dn *nc_root;
+	uint64_t usn;
+	/* false if we can't tell when the partition changes */
+	bool usn_valid;
+};
+
+struct dns_cache_ref;
+
+struct dns_cache_entry {
+	/* LRU list, most recently used first */
+	struct dns_cache_entry *prev, *next;
+	/* hash bucket chain */
+	struct dns_cache_entry *bucket_next;
+	struct dns_server_cache *cache;
+	struct dns_cache_zone *zone;
+	uint32_t hash;
+	char *name;
+	/* WERR_OK, or WERR_DNS_ERROR_NAME_DOES_NOT_EXIST */
+	WERROR werr;
+	struct dnsp_DnssrvRpcRecord *recs;
+	uint16_t rec_count;
+	/* the queries using recs */
+	struct dns_cache_ref *refs;
+	/* no longer in the cache, freed with the last ref */
+	bool removed;
+};
+
+/*
+  a query using the records of an entry, allocated on the memory
+  context of the query
+*/
+struct dns_cache_ref {
+	struct dns_cache_ref *prev, *next;
+	struct dns_cache_entry *e;
+};
+
+struct dns_cache_forwarded {
+	/* LRU list, most recently used first */
+	struct dns_cache_forwarded *prev, *next;
+	/* hash bucket chain */
+	struct dns_cache_forwarded *bucket_next;
+	uint32_t hash;
+	char *name;
+	char *forwarder;
+	enum dns_qtype question_type;
+	enum dns_qclass question_class;
+	time_t stored;
+	time_t expires;
+	bool negative;
+	DATA_BLOB response;
+};
+
+struct dns_server_cache {
+	struct dns_cache_entry *buckets[DNS_CACHE_NUM_BUCKETS];
+	struct dns_cache_entry *lru;
+	size_t num_entries;
+	/* 0 if names in our zones are not cached */
+	size_t max_entries;
+	bool negative;
+	struct dns_cache_zone *zones;
+	/* the sequence number of sam.ldb the zone USNs were checked at */
+	uint64_t seq;
+
+	struct dns_cache_forwarded *fwd_buckets[DNS_CACHE_NUM_BUCKETS];
+	struct dns_cache_forwarded *fwd_lru;
+	size_t fwd_num_entries;
+	/* 0 if forwarded answers are not cached */
+	size_t fwd_max_entries;
+	uint32_t fwd_max_ttl;
+};
+
+/*
+  lower case a dns name into buf, without the trailing dot
+*/
+static bool dns_cache_key(const char *name, char *buf, size_t buflen,
+			  uint32_t *hash)
+{
+	uint32_t h = 0x811c9dc5;
+	size_t len = strlen(name);
+	size_t i;
+
+	if (len > 0 && name[len - 1] == '.') {
+		len -= 1;
+	}
+	if (len == 0 || len >= buflen) {
+		return false;
+	}
+
+	for (i = 0; i < len; i++) {
+		buf[i] = tolower_m((unsigned char)name[i]);
+		h = (h ^ (uint8_t)buf[i]) * 0x01000193;
+	}
+	buf[len] = '\0';
+
+	*hash = h;
+	return true;
+}
+
+static int dns_cache_ref_destructor(struct dns_cache_ref *ref)
+{
+	struct dns_cache_entry *e = ref->e;
+
+	if (e == NULL) {
+		return 0;
+	}
+	DLIST_REMOVE(e->refs, ref);
+	if (e->refs == NULL && e->removed) {
+		TALLOC_FREE(e);
+	}
+	return 0;
+}
+
+static int dns_cache_entry_destructor(struct dns_cache_entry *e)
+{
+	struct dns_cache_ref *ref;
+
+	for (ref = e->refs; ref != NULL; ref = ref->next) {
+		ref->e = NULL;
+	}
+	return 0;
+}
+
+static bool dns_cache_ref_add(TALLOC_CTX *mem_ctx, struct dns_cache_entry *e)
+{
+	struct dns_cache_ref *ref;
+
+	ref = talloc_zero(mem_ctx, struct dns_cache_ref);
+	if (ref == NULL) {
+		return false;
+	}
+	ref->e = e;
+	DLIST_ADD(e->refs, ref);
+	talloc_set_destructor(ref, dns_cache_ref_destructor);
+	return true;
+}
+
+static void dns_cache_entry_remove(struct dns_cache_entry *e)
+{
+	struct dns_server_cache *cache = e->cache;
+	struct dns_cache_entry **p;
+
+	p = &cache->buckets[e->hash % DNS_CACHE_NUM_BUCKETS];
+	while (*p != e) {
+		p = &(*p)->bucket_next;
+	}
+	*p = e->bucket_next;
+
+	DLIST_REMOVE(cache->lru, e);
+	cache->num_entries--;
+
+	/* a running query may still use the records */
+	if (e->refs != NULL) {
+		e->removed = true;
+		return;
+	}
+	TALLOC_FREE(e);
+}
+
+static void dns_cache_flush_zone(struct dns_server_cache *cache,
+				 struct dns_cache_zone *zone)
+{
+	struct dns_cache_entry *e, *next;
+
+	for (e = cache->lru; e != NULL; e = next) {
+		next = e->next;
+		if (zone == NULL || e->zone == zone) {
+			dns_cache_entry_remove(e);
+		}
+	}
+}
+
+static bool dns_cache_load_usn(struct dns_server *dns,
+			       struct dns_cache_zone *zone,
+			       uint64_t *usn)
+{
+	int ret;
+
+	if (zone->nc_root == NULL) {
+		return false;
+	}
+
+	ret = dsdb_load_partition_usn(dns->samdb, zone->nc_root, usn, NULL);
+	if (ret != LDB_SUCCESS) {
+		DEBUG(2, ("dns cache: failed to load the USN of %s: %s\n",
+			  ldb_dn_get_linearized(zone->nc_root),
+			  ldb_strerror(ret)));
+		return false;
+	}
+	return true;
+}
+
+/*
+  flush the names of a zone if its partition has changed since we last
+  looked
+*/
+static void dns_cache_check_zone_usn(struct dns_server *dns,
+				     struct dns_cache_zone *zone)
+{
+	uint64_t usn = 0;
+
+	if (!zone->usn_valid) {
+		return;
+	}
+
+	zone->usn_valid = dns_cache_load_usn(dns, zone, &usn);
+	if (!zone->usn_valid || usn != zone->usn) {
+		DEBUG(10, ("dns cache: zone %s changed, "
+			   "flushing cached names\n", zone->name));
+		dns_cache_flush_zone(dns->cache, zone);
+		zone->usn = usn;
+	}
+}
+
+static bool dns_cache_load_seq(struct dns_server *dns, uint64_t *seq)
+{
+	int ret;
+
+	ret = ldb_sequence_number(dns->samdb, LDB_SEQ_HIGHEST_SEQ, seq);
+	if (ret != LDB_SUCCESS) {
+		DEBUG(2, ("dns cache: failed to load the sequence number: "
+			  "%s\n", ldb_errstring(dns->samdb)));
+		return false;
+	}
+	return true;
+}
+
+/*
+  flush the names of all zones whose partition has changed since we
+  last looked
+*/
+static void dns_cache_check_usns(struct dns_server *dns)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_cache_zone *zone;
+	uint64_t seq;
+
+	if (!dns_cache_load_seq(dns, &seq)) {
+		dns_cache_flush_zone(cache, NULL);
+		cache->seq = 0;
+		return;
+	}
+	if (seq == cache->seq) {
+		return;
+	}
+
+	DEBUG(10, ("dns cache: %zu names, %llu hits, %llu misses\n",
+		   cache->num_entries,
+		   (unsigned long long)dns->cache_stats.records_hits,
+		   (unsigned long long)dns->cache_stats.records_misses));
+
+	for (zone = cache->zones; zone != NULL; zone = zone->next) {
+		dns_cache_check_zone_usn(dns, zone);
+	}
+	cache->seq = seq;
+}
+
+/*
+  set up the cache for the current list of zones, dropping all names
+  cached so far. Called after the zones have been (re)loaded.
+*/
+WERROR dns_cache_reload_zones(struct dns_server *dns)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_server_zone *z;
+	struct dns_cache_zone *zone;
+	int ret;
+
+	if (cache == NULL || cache->max_entries == 0) {
+		return WERR_OK;
+	}
+
+	dns_cache_flush_zone(cache, NULL);
+
+	while ((zone = cache->zones) != NULL) {
+		DLIST_REMOVE(cache->zones, zone);
+		TALLOC_FREE(zone);
+	}
+
+	for (z = dns->zones; z != NULL; z = z->next) {
+		zone = talloc_zero(cache, struct dns_cache_zone);
+		if (zone == NULL) {
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+		zone->name = talloc_strdup(zone, z->name);
+		if (zone->name == NULL) {
+			TALLOC_FREE(zone);
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+
+		ret = dsdb_find_nc_root(dns->samdb, zone, z->dn,
+					&zone->nc_root);
+		if (ret != LDB_SUCCESS) {
+			DEBUG(2, ("dns cache: no partition found for zone "
+				  "%s, not caching it\n", z->name));
+			zone->nc_root = NULL;
+		}
+		zone->usn_valid = dns_cache_load_usn(dns, zone, &zone->usn);
+
+		DLIST_ADD_END(cache->zones, zone);
+	}
+
+	if (!dns_cache_load_seq(dns, &cache->seq)) {
+		cache->seq = 0;
+	}
+
+	return WERR_OK;
+}
+
+WERROR dns_cache_init(struct dns_server *dns)
+{
+	struct loadparm_context *lp_ctx = dns->task->lp_ctx;
+	struct dns_server_cache *cache;
+	int max_entries;
+	int fwd_max_entries;
+
+	max_entries = lpcfg_parm_int(lp_ctx, NULL, "dns server", "cache size",
+				     DNS_CACHE_DEFAULT_SIZE);
+	fwd_max_entries = lpcfg_parm_int(lp_ctx, NULL, "dns server",
+					 "forwarder cache size",
+					 DNS_CACHE_DEFAULT_FORWARDED_SIZE);
+	if (max_entries <= 0 && fwd_max_entries <= 0) {
+		DEBUG(3, ("dns cache: disabled\n"));
+		dns->cache = NULL;
+		return WERR_OK;
+	}
+
+	cache = talloc_zero(dns, struct dns_server_cache);
+	if (cache == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+	cache->max_entries = MAX(max_entries, 0);
+	cache->fwd_max_entries = MAX(fwd_max_entries, 0);
+	cache->fwd_max_ttl = lpcfg_parm_int(lp_ctx, NULL, "dns server",
+					    "forwarder cache max ttl",
+					    DNS_CACHE_DEFAULT_FORWARDED_MAX_TTL);
+	cache->negative = lpcfg_parm_bool(lp_ctx, NULL, "dns server",
+					  "negative cache", true);
+
+	dns->cache = cache;
+	return WERR_OK;
+}
+
+static struct dns_cache_zone *dns_cache_find_zone(struct dns_server_cache *cache,
+						  const char *name)
+{
+	struct dns_cache_zone *zone;
+
+	for (zone = cache->zones; zone != NULL; zone = zone->next) {
+		size_t host_part_len = 0;
+
+		if (dns_name_match(zone->name, name, &host_part_len)) {
+			return zone;
+		}
+	}
+	return NULL;
+}
+
+static struct dns_cache_entry *dns_cache_find(struct dns_server_cache *cache,
+					      const char *key, uint32_t hash)
+{
+	struct dns_cache_entry *e;
+
+	for (e = cache->buckets[hash % DNS_CACHE_NUM_BUCKETS];
+	     e != NULL;
+	     e = e->bucket_next) {
+		if (e->hash == hash && strcmp(e->name, key) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+  the cache key and zone of the name whose records are stored in the
+  dnsNode object dn
+*/
+static struct dns_cache_zone *dns_cache_dn_key(struct dns_server_cache *cache,
+					       struct ldb_dn *dn,
+					       char *key, size_t keylen,
+					       uint32_t *hash)
+{
+	const struct ldb_val *host = ldb_dn_get_rdn_val(dn);
+	const struct ldb_val *zone = ldb_dn_get_component_val(dn, 1);
+	char name[256];
+	int len;
+
+	if (host == NULL || zone == NULL) {
+		return NULL;
+	}
+
+	if (host->length == 1 && host->data[0] == '@') {
+		len = snprintf(name, sizeof(name), "%.*s",
+			       (int)zone->length, (const char *)zone->data);
+	} else {
+		len = snprintf(name, sizeof(name), "%.*s.%.*s",
+			       (int)host->length, (const char *)host->data,
+			       (int)zone->length, (const char *)zone->data);
+	}
+	if (len < 0 || (size_t)len >= sizeof(name)) {
+		return NULL;
+	}
+
+	if (!dns_cache_key(name, key, keylen, hash)) {
+		return NULL;
+	}
+	return dns_cache_find_zone(cache, key);
+}
+
+/*
+  called before we change the records of dn, inside the transaction
+  of the update.
+
+  Nobody else can write to sam.ldb until the transaction ends, so
+  catch up with the changes made by others so far. Our own change then
+  doesn't hide them from dns_cache_records_changed().
+*/
+void dns_cache_records_changing(struct dns_server *dns, struct ldb_dn *dn)
+{
+	struct dns_server_cache *cache = dns->cache;
+
+	if (cache == NULL || cache->max_entries == 0) {
+		return;
+	}
+
+	dns_cache_check_usns(dns);
+}
+
+/*
+  called after we changed the records of dn: only drop that name, and
+  take the USN of the partition and the sequence number of sam.ldb as
+  the ones the cache is up to date with.
+
+  If the transaction is cancelled the USN goes back, and the next
+  check flushes the zone.
+*/
+void dns_cache_records_changed(struct dns_server *dns, struct ldb_dn *dn)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_cache_zone *zone;
+	struct dns_cache_entry *e;
+	char key[256];
+	uint32_t hash;
+
+	if (cache == NULL || cache->max_entries == 0) {
+		return;
+	}
+
+	zone = dns_cache_dn_key(cache, dn, key, sizeof(key), &hash);
+	if (zone == NULL) {
+		dns_cache_flush_zone(cache, NULL);
+		return;
+	}
+
+	e = dns_cache_find(cache, key, hash);
+	if (e != NULL) {
+		dns_cache_entry_remove(e);
+	}
+
+	if (zone->usn_valid) {
+		zone->usn_valid = dns_cache_load_usn(dns, zone, &zone->usn);
+		if (!zone->usn_valid) {
+			dns_cache_flush_zone(cache, zone);
+		}
+	}
+
+	if (!dns_cache_load_seq(dns, &cache->seq)) {
+		dns_cache_flush_zone(cache, NULL);
+		cache->seq = 0;
+	}
+}
+
+static WERROR dns_lookup_records_by_name(struct dns_server *dns,
+					 TALLOC_CTX *mem_ctx,
+					 const char *name,
+					 struct dnsp_DnssrvRpcRecord **records,
+					 uint16_t *rec_count)
+{
+	struct ldb_dn *dn = NULL;
+	WERROR werr;
+
+	werr = dns_name2dn(dns, mem_ctx, name, &dn);
+	if (!W_ERROR_IS_OK(werr)) {
+		return werr;
+	}
+
+	werr = dns_lookup_records(dns, mem_ctx, dn, records, rec_count);
+	TALLOC_FREE(dn);
+	return werr;
+}
+
+/*
+  look up the records of a name in one of our zones, from the cache if
+  possible.
+
+  The records returned are shared with the cache, the caller must not
+  modify them. They stay valid as long as mem_ctx does.
+*/
+WERROR dns_cache_lookup_records(struct dns_server *dns,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				struct dnsp_DnssrvRpcRecord **records,
+				uint16_t *rec_count)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_cache_zone *zone;
+	struct dns_cache_entry *e;
+	char key[256];
+	uint32_t hash;
+	WERROR werr;
+	bool ok;
+
+	*records = NULL;
+	*rec_count = 0;
+
+	if (cache == NULL || cache->max_entries == 0) {
+		return dns_lookup_records_by_name(dns, mem_ctx, name,
+						  records, rec_count);
+	}
+
+	ok = dns_cache_key(name, key, sizeof(key), &hash);
+	if (!ok) {
+		return dns_lookup_records_by_name(dns, mem_ctx, name,
+						  records, rec_count);
+	}
+
+	dns_cache_check_usns(dns);
+
+	e = dns_cache_find(cache, key, hash);
+	if (e != NULL) {
+		if (!dns_cache_ref_add(mem_ctx, e)) {
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+		DLIST_PROMOTE(cache->lru, e);
+		dns->cache_stats.records_hits++;
+
+		*records = e->recs;
+		*rec_count = e->rec_count;
+		return e->werr;
+	}
+
+	dns->cache_stats.records_misses++;
+
+	zone = dns_cache_find_zone(cache, key);
+	if (zone == NULL || !zone->usn_valid) {
+		return dns_lookup_records_by_name(dns, mem_ctx, name,
+						  records, rec_count);
+	}
+
+	e = talloc_zero(cache, struct dns_cache_entry);
+	if (e == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+	talloc_set_destructor(e, dns_cache_entry_destructor);
+
+	werr = dns_lookup_records_by_name(dns, e, name, &e->recs,
+					  &e->rec_count);
+	if (!W_ERROR_IS_OK(werr) &&
+	    !(cache->negative &&
+	      W_ERROR_EQUAL(werr, WERR_DNS_ERROR_NAME_DOES_NOT_EXIST))) {
+		/* don't cache errors talking to the database */
+		TALLOC_FREE(e);
+		return werr;
+	}
+
+	e->cache = cache;
+	e->zone = zone;
+	e->hash = hash;
+	e->werr = werr;
+	e->name = talloc_strdup(e, key);
+	if (e->name == NULL) {
+		TALLOC_FREE(e);
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+
+	if (!dns_cache_ref_add(mem_ctx, e)) {
+		TALLOC_FREE(e);
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+
+	e->bucket_next = cache->buckets[hash % DNS_CACHE_NUM_BUCKETS];
+	cache->buckets[hash % DNS_CACHE_NUM_BUCKETS] = e;
+	DLIST_ADD(cache->lru, e);
+	cache->num_entries++;
+
+	if (cache->num_entries > cache->max_entries) {
+		dns_cache_entry_remove(DLIST_TAIL(cache->lru));
+	}
+
+	*records = e->recs;
+	*rec_count = e->rec_count;
+	return werr;
+}
+
+static void dns_cache_forwarded_remove(struct dns_server_cache *cache,
+				       struct dns_cache_forwarded *f)
+{
+	struct dns_cache_forwarded **p;
+
+	p = &cache->fwd_buckets[f->hash % DNS_CACHE_NUM_BUCKETS];
+	while (*p != f) {
+		p = &(*p)->bucket_next;
+	}
+	*p = f->bucket_next;
+
+	DLIST_REMOVE(cache->fwd_lru, f);
+	cache->fwd_num_entries--;
+	TALLOC_FREE(f);
+}
+
+static struct dns_cache_forwarded *dns_cache_forwarded_find(
+	struct dns_server_cache *cache,
+	const char *forwarder,
+	const struct dns_name_question *question,
+	char *key, size_t keylen,
+	uint32_t *_hash)
+{
+	struct dns_cache_forwarded *f;
+	uint32_t hash;
+	size_t i;
+
+	if (!dns_cache_key(question->name, key, keylen, &hash)) {
+		return NULL;
+	}
+	hash = (hash ^ question->question_type) * 0x01000193;
+	hash = (hash ^ question->question_class) * 0x01000193;
+	for (i = 0; forwarder[i] != '\0'; i++) {
+		hash = (hash ^ (uint8_t)forwarder[i]) * 0x01000193;
+	}
+	*_hash = hash;
+
+	for (f = cache->fwd_buckets[hash % DNS_CACHE_NUM_BUCKETS];
+	     f != NULL;
+	     f = f->bucket_next) {
+		if (f->hash == hash &&
+		    f->question_type == question->question_type &&
+		    f->question_class == question->question_class &&
+		    strcmp(f->name, key) == 0 &&
+		    strcmp(f->forwarder, forwarder) == 0) {
+			return f;
+		}
+	}
+
+	return NULL;
+}
+
+static void dns_cache_age_records(struct dns_res_rec *recs, uint16_t count,
+				  uint32_t age)
+{
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		if (recs[i].rr_type == DNS_QTYPE_OPT) {
+			/* the TTL of an OPT record holds flags */
+			continue;
+		}
+		recs[i].ttl -= MIN(recs[i].ttl, age);
+	}
+}
+
+/*
+  look up the answer of a forwarder in the cache.
+
+  Returns true and fills in packet, allocated on mem_ctx, if there is
+  an answer that has not expired yet. The TTLs in the answer are
+  reduced by the time it spent in the cache.
+*/
+bool dns_cache_lookup_forwarded(struct dns_server *dns,
+				TALLOC_CTX *mem_ctx,
+				const char *forwarder,
+				const struct dns_name_question *question,
+				struct dns_name_packet *packet)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_cache_forwarded *f;
+	enum ndr_err_code ndr_err;
+	char key[256];
+	uint32_t hash;
+	time_t now;
+
+	if (cache == NULL || cache->fwd_max_entries == 0) {
+		return false;
+	}
+
+	f = dns_cache_forwarded_find(cache, forwarder, question,
+				     key, sizeof(key), &hash);
+	now = time(NULL);
+
+	if (f != NULL && f->expires <= now) {
+		dns_cache_forwarded_remove(cache, f);
+		f = NULL;
+	}
+
+	if (f == NULL) {
+		dns->cache_stats.forwarded_misses++;
+		return false;
+	}
+
+	ndr_err = ndr_pull_struct_blob(
+		&f->response, mem_ctx, packet,
+		(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		dns_cache_forwarded_remove(cache, f);
+		dns->cache_stats.forwarded_misses++;
+		return false;
+	}
+
+	dns_cache_age_records(packet->answers, packet->ancount,
+			      now - f->stored);
+	dns_cache_age_records(packet->nsrecs, packet->nscount,
+			      now - f->stored);
+	dns_cache_age_records(packet->additional, packet->arcount,
+			      now - f->stored);
+
+	DLIST_PROMOTE(cache->fwd_lru, f);
+	if (f->negative) {
+		dns->cache_stats.forwarded_negative_hits++;
+	} else {
+		dns->cache_stats.forwarded_hits++;
+	}
+
+	DEBUG(10, ("dns cache: answered %s from the cache of %s\n",
+		   question->name, forwarder));
+
+	return true;
+}
+
+/*
+  how long an answer may be cached, 0 if it must not be
+*/
+static uint32_t dns_cache_forwarded_ttl(struct dns_server_cache *cache,
+					const struct dns_name_packet *packet,
+					bool *negative)
+{
+	uint16_t rcode = packet->operation & DNS_RCODE;
+	uint32_t ttl = UINT32_MAX;
+	uint16_t i;
+
+	if (packet->operation & DNS_FLAG_TRUNCATION) {
+		return 0;
+	}
+
+	if (rcode == DNS_RCODE_OK && packet->ancount > 0) {
+		*negative = false;
+
+		for (i = 0; i < packet->ancount; i++) {
+			ttl = MIN(ttl, packet->answers[i].ttl);
+		}
+		for (i = 0; i < packet->nscount; i++) {
+			ttl = MIN(ttl, packet->nsrecs[i].ttl);
+		}
+		for (i = 0; i < packet->arcount; i++) {
+			if (packet->additional[i].rr_type == DNS_QTYPE_OPT) {
+				continue;
+			}
+			ttl = MIN(ttl, packet->additional[i].ttl);
+		}
+		return MIN(ttl, cache->fwd_max_ttl);
+	}
+
+	if (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NXDOMAIN) {
+		return 0;
+	}
+	if (!cache->negative) {
+		return 0;
+	}
+
+	/*
+	 * NXDOMAIN or NODATA: without an SOA in the authority section
+	 * the answer must not be cached (RFC 2308, section 5)
+	 */
+	*negative = true;
+
+	for (i = 0; i < packet->nscount; i++) {
+		const struct dns_res_rec *rr = &packet->nsrecs[i];
+
+		if (rr->rr_type != DNS_QTYPE_SOA) {
+			continue;
+		}
+		ttl = MIN(rr->ttl, rr->rdata.soa_record.minimum);
+		return MIN(ttl, cache->fwd_max_ttl);
+	}
+
+	return 0;
+}
+
+/*
+  remember the answer of a forwarder, if it can be cached
+*/
+void dns_cache_store_forwarded(struct dns_server *dns,
+			       const char *forwarder,
+			       const struct dns_name_question *question,
+			       const DATA_BLOB *response,
+			       const struct dns_name_packet *packet)
+{
+	struct dns_server_cache *cache = dns->cache;
+	struct dns_cache_forwarded *f;
+	char key[256];
+	uint32_t hash;
+	uint32_t ttl;
+	bool negative = false;
+
+	if (cache == NULL || cache->fwd_max_entries == 0) {
+		return;
+	}
+
+	ttl = dns_cache_forwarded_ttl(cache, packet, &negative);
+	if (ttl == 0) {
+		return;
+	}
+
+	key[0] = '\0';
+	f = dns_cache_forwarded_find(cache, forwarder, question,
+				     key, sizeof(key), &hash);
+	if (f != NULL) {
+		dns_cache_forwarded_remove(cache, f);
+	} else if (key[0] == '\0') {
+		/* no usable key */
+		return;
+	}
+
+	f = talloc_zero(cache, struct dns_cache_forwarded);
+	if (f == NULL) {
+		return;
+	}
+	f->hash = hash;
+	f->question_type = question->question_type;
+	f->question_class = question->question_class;
+	f->stored = time(NULL);
+	f->expires = f->stored + ttl;
+	f->negative = negative;
+	f->name = talloc_strdup(f, key);
+	f->forwarder = talloc_strdup(f, forwarder);
+	f->response = data_blob_talloc(f, response->data, response->length);
+	if (f->name == NULL || f->forwarder == NULL ||
+	    f->response.data == NULL) {
+		TALLOC_FREE(f);
+		return;
+	}
+
+	f->bucket_next = cache->fwd_buckets[hash % DNS_CACHE_NUM_BUCKETS];
+	cache->fwd_buckets[hash % DNS_CACHE_NUM_BUCKETS] = f;
+	DLIST_ADD(cache->fwd_lru, f);
+	cache->fwd_num_entries++;
+
+	if (cache->fwd_num_entries > cache->fwd_max_entries) {
+		dns_cache_forwarded_remove(cache, DLIST_TAIL(cache->fwd_lru));
+	}
+}
+
+/*
+  update the entry counts of dns->cache_stats
+*/
+void dns_cache_update_statistics(struct dns_server *dns)
+{
+	struct dns_server_cache *cache = dns->cache;
+
+	if (cache == NULL) {
+		dns->cache_stats.records_entries = 0;
+		dns->cache_stats.forwarded_entries = 0;
+		return;
+	}
+
+	dns->cache_stats.records_entries = cache->num_entries;
+	dns->cache_stats.forwarded_entries = cache->fwd_num_entries;
+}
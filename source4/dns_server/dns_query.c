@@ -269,102 +269,239 @@ static WERROR add_dns_res_rec(struct dns_res_rec **pdst,
 	return WERR_OK;
 }
 
-struct ask_forwarder_state {
-	struct tevent_context *ev;
+/*
+ * A question sent to a forwarder. The same question asked again while
+ * it is outstanding waits for this answer instead of being sent again.
+ */
+struct dns_forwarder_query {
+	struct dns_forwarder_query *prev, *next;
+	struct dns_server *dns;
+	const char *forwarder;
+	struct dns_name_question question;
 	uint16_t id;
+	struct ask_forwarder_state *waiters;
+};
+
+struct ask_forwarder_state {
+	struct ask_forwarder_state *prev, *next;
+	struct tevent_req *req;
+	struct dns_forwarder_query *query;
 	struct dns_name_packet in_packet;
 };
 
-static void ask_forwarder_done(struct tevent_req *subreq);
+static void dns_forwarder_query_done(struct tevent_req *subreq);
 
-static struct tevent_req *ask_forwarder_send(
-	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
-	struct dns_server *dns,
-	const char *forwarder, struct dns_name_question *question)
+static struct dns_forwarder_query *dns_forwarder_query_find(
+	struct dns_server *dns, const char *forwarder,
+	const struct dns_name_question *question)
+{
+	struct dns_forwarder_query *q;
+
+	for (q = dns->forwarder_queries; q != NULL; q = q->next) {
+		if (q->question.question_type == question->question_type &&
+		    q->question.question_class == question->question_class &&
+		    strcmp(q->forwarder, forwarder) == 0 &&
+		    dns_name_equal(q->question.name, question->name)) {
+			return q;
+		}
+	}
+	return NULL;
+}
+
+static int dns_forwarder_query_destructor(struct dns_forwarder_query *q)
 {
-	struct tevent_req *req, *subreq;
 	struct ask_forwarder_state *state;
+
+	while ((state = q->waiters) != NULL) {
+		DLIST_REMOVE(q->waiters, state);
+		state->query = NULL;
+	}
+	return 0;
+}
+
+static WERROR dns_forwarder_query_start(
+	struct dns_server *dns, struct tevent_context *ev,
+	const char *forwarder, const struct dns_name_question *question,
+	struct dns_forwarder_query **_q)
+{
+	struct dns_forwarder_query *q;
+	struct tevent_req *subreq;
 	struct dns_res_rec *options;
 	struct dns_name_packet out_packet = { 0, };
 	DATA_BLOB out_blob;
 	enum ndr_err_code ndr_err;
 	WERROR werr;
 
-	req = tevent_req_create(mem_ctx, &state, struct ask_forwarder_state);
-	if (req == NULL) {
-		return NULL;
+	q = talloc_zero(dns, struct dns_forwarder_query);
+	if (q == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
 	}
-	state->ev = ev;
-	generate_random_buffer((uint8_t *)&state->id, sizeof(state->id));
-
-	if (!is_ipaddress(forwarder)) {
-		DEBUG(0, ("Invalid 'dns forwarder' setting '%s', needs to be "
-			  "an IP address\n", forwarder));
-		tevent_req_werror(req, DNS_ERR(NAME_ERROR));
-		return tevent_req_post(req, ev);
+	q->dns = dns;
+	q->forwarder = talloc_strdup(q, forwarder);
+	q->question = *question;
+	q->question.name = talloc_strdup(q, question->name);
+	if (q->forwarder == NULL || q->question.name == NULL) {
+		TALLOC_FREE(q);
+		return WERR_NOT_ENOUGH_MEMORY;
 	}
+	generate_random_buffer((uint8_t *)&q->id, sizeof(q->id));
 
-	out_packet.id = state->id;
+	out_packet.id = q->id;
 	out_packet.operation |= DNS_OPCODE_QUERY | DNS_FLAG_RECURSION_DESIRED;
 	out_packet.qdcount = 1;
-	out_packet.questions = question;
+	out_packet.questions = &q->question;
 
-	werr = dns_generate_options(dns, state, &options);
+	werr = dns_generate_options(dns, q, &options);
 	if (!W_ERROR_IS_OK(werr)) {
-		tevent_req_werror(req, werr);
-		return tevent_req_post(req, ev);
+		TALLOC_FREE(q);
+		return werr;
 	}
 
 	out_packet.arcount = 1;
 	out_packet.additional = options;
 
 	ndr_err = ndr_push_struct_blob(
-		&out_blob, state, &out_packet,
+		&out_blob, q, &out_packet,
 		(ndr_push_flags_fn_t)ndr_push_dns_name_packet);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		tevent_req_werror(req, DNS_ERR(SERVER_FAILURE));
-		return tevent_req_post(req, ev);
+		TALLOC_FREE(q);
+		return DNS_ERR(SERVER_FAILURE);
 	}
-	subreq = dns_udp_request_send(state, ev, forwarder, out_blob.data,
+	subreq = dns_udp_request_send(q, ev, forwarder, out_blob.data,
 				      out_blob.length);
-	if (tevent_req_nomem(subreq, req)) {
-		return tevent_req_post(req, ev);
+	if (subreq == NULL) {
+		TALLOC_FREE(q);
+		return WERR_NOT_ENOUGH_MEMORY;
 	}
-	tevent_req_set_callback(subreq, ask_forwarder_done, req);
-	return req;
+	tevent_req_set_callback(subreq, dns_forwarder_query_done, q);
+
+	DLIST_ADD(dns->forwarder_queries, q);
+	talloc_set_destructor(q, dns_forwarder_query_destructor);
+
+	*_q = q;
+	return WERR_OK;
 }
 
-static void ask_forwarder_done(struct tevent_req *subreq)
+static void dns_forwarder_query_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
-	struct ask_forwarder_state *state = tevent_req_data(
-		req, struct ask_forwarder_state);
-	DATA_BLOB in_blob;
+	struct dns_forwarder_query *q = tevent_req_callback_data(
+		subreq, struct dns_forwarder_query);
+	struct ask_forwarder_state *state;
+	struct dns_name_packet in_packet;
+	DATA_BLOB in_blob = data_blob_null;
 	enum ndr_err_code ndr_err;
+	WERROR werr = WERR_OK;
 	int ret;
 
-	ret = dns_udp_request_recv(subreq, state,
+	DLIST_REMOVE(q->dns->forwarder_queries, q);
+
+	ret = dns_udp_request_recv(subreq, q,
 				   &in_blob.data, &in_blob.length);
 	TALLOC_FREE(subreq);
 
 	if (ret != 0) {
-		tevent_req_werror(req, unix_to_werror(ret));
-		return;
+		werr = unix_to_werror(ret);
+		goto done;
 	}
 
 	ndr_err = ndr_pull_struct_blob(
-		&in_blob, state, &state->in_packet,
+		&in_blob, q, &in_packet,
 		(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		tevent_req_werror(req, DNS_ERR(SERVER_FAILURE));
-		return;
+		werr = DNS_ERR(SERVER_FAILURE);
+		goto done;
+	}
+	if (in_packet.id != q->id) {
+		werr = DNS_ERR(NAME_ERROR);
+		goto done;
 	}
-	if (state->in_packet.id != state->id) {
+
+	dns_cache_store_forwarded(q->dns, q->forwarder, &q->question,
+				  &in_blob, &in_packet);
+
+done:
+	/*
+	 * The waiters' callbacks are deferred, so they can't free the
+	 * other waiters while we walk the list.
+	 */
+	while ((state = q->waiters) != NULL) {
+		DLIST_REMOVE(q->waiters, state);
+		state->query = NULL;
+
+		if (tevent_req_werror(state->req, werr)) {
+			continue;
+		}
+
+		ndr_err = ndr_pull_struct_blob(
+			&in_blob, state, &state->in_packet,
+			(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			tevent_req_werror(state->req, DNS_ERR(SERVER_FAILURE));
+			continue;
+		}
+		tevent_req_done(state->req);
+	}
+
+	TALLOC_FREE(q);
+}
+
+static int ask_forwarder_state_destructor(struct ask_forwarder_state *state)
+{
+	if (state->query != NULL) {
+		DLIST_REMOVE(state->query->waiters, state);
+		state->query = NULL;
+	}
+	return 0;
+}
+
+static struct tevent_req *ask_forwarder_send(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct dns_server *dns,
+	const char *forwarder, struct dns_name_question *question)
+{
+	struct tevent_req *req;
+	struct ask_forwarder_state *state;
+	struct dns_forwarder_query *q;
+	WERROR werr;
+
+	req = tevent_req_create(mem_ctx, &state, struct ask_forwarder_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->req = req;
+
+	if (!is_ipaddress(forwarder)) {
+		DEBUG(0, ("Invalid 'dns forwarder' setting '%s', needs to be "
+			  "an IP address\n", forwarder));
 		tevent_req_werror(req, DNS_ERR(NAME_ERROR));
-		return;
+		return tevent_req_post(req, ev);
 	}
-	tevent_req_done(req);
+
+	if (dns_cache_lookup_forwarded(dns, state, forwarder, question,
+				       &state->in_packet)) {
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	q = dns_forwarder_query_find(dns, forwarder, question);
+	if (q != NULL) {
+		DEBUG(10, ("Waiting for the answer to an earlier query "
+			   "for '%s'\n", question->name));
+		dns->cache_stats.forwarded_shared++;
+	} else {
+		werr = dns_forwarder_query_start(dns, ev, forwarder, question,
+						 &q);
+		if (tevent_req_werror(req, werr)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	tevent_req_defer_callback(req, ev);
+	state->query = q;
+	DLIST_ADD_END(q->waiters, state);
+	talloc_set_destructor(state, ask_forwarder_state_destructor);
+
+	return req;
 }
 
 static WERROR ask_forwarder_recv(
@@ -403,19 +540,14 @@ static WERROR add_zone_authority_record(struct dns_server *dns,
 	struct dnsp_DnssrvRpcRecord *recs;
 	struct dns_res_rec *ns = *nsrecs;
 	uint16_t rec_count;
-	struct ldb_dn *dn = NULL;
 	unsigned int ri;
 	WERROR werror;
 
 	zone = dns_get_authoritative_zone(dns, question->name);
 	DEBUG(10, ("Creating zone authority record for '%s'\n", zone));
 
-	werror = dns_name2dn(dns, mem_ctx, zone, &dn);
-	if (!W_ERROR_IS_OK(werror)) {
-		return werror;
-	}
-
-	werror = dns_lookup_records(dns, mem_ctx, dn, &recs, &rec_count);
+	werror = dns_cache_lookup_records(dns, mem_ctx, zone,
+					  &recs, &rec_count);
 	if (!W_ERROR_IS_OK(werror)) {
 		return werror;
 	}
@@ -606,7 +738,6 @@ static struct tevent_req *handle_authoritative_send(
 {
 	struct tevent_req *req, *subreq;
 	struct handle_authoritative_state *state;
-	struct ldb_dn *dn = NULL;
 	WERROR werr;
 
 	req = tevent_req_create(mem_ctx, &state,
@@ -621,14 +752,8 @@ static struct tevent_req *handle_authoritative_send(
 	state->answers = answers;
 	state->nsrecs = nsrecs;
 
-	werr = dns_name2dn(dns, state, question->name, &dn);
-	if (tevent_req_werror(req, werr)) {
-		return tevent_req_post(req, ev);
-	}
-
-	werr = dns_lookup_records(dns, state, dn, &state->recs,
-				  &state->rec_count);
-	TALLOC_FREE(dn);
+	werr = dns_cache_lookup_records(dns, state, question->name,
+					&state->recs, &state->rec_count);
 	if (tevent_req_werror(req, werr)) {
 		return tevent_req_post(req, ev);
 	}
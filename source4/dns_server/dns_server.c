@@ -754,6 +754,8 @@ static NTSTATUS dns_server_reload_zones(struct dns_server *dns)
 	struct dns_server_zone *new_list = NULL;
 	struct dns_server_zone *old_list = NULL;
 	struct dns_server_zone *old_zone;
+	WERROR werr;
+
 	status = dns_common_zones(dns->samdb, dns, &new_list);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
@@ -764,6 +766,11 @@ static NTSTATUS dns_server_reload_zones(struct dns_server *dns)
 		talloc_free(old_zone);
 	}
 
+	werr = dns_cache_reload_zones(dns);
+	if (!W_ERROR_IS_OK(werr)) {
+		return werror_to_ntstatus(werr);
+	}
+
 	return NT_STATUS_OK;
 }
 
@@ -788,10 +795,34 @@ static NTSTATUS dns_reload_zones(struct irpc_message *msg,
 	return NT_STATUS_OK;
 }
 
+/*
+  serve out the cache statistics
+*/
+static NTSTATUS dns_information(struct irpc_message *msg,
+				struct dnssrv_information *r)
+{
+	struct dns_server *dns;
+
+	dns = talloc_get_type(msg->private_data, struct dns_server);
+	if (dns == NULL) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	switch (r->in.level) {
+	case DNSSRV_INFO_CACHE_STATISTICS:
+		dns_cache_update_statistics(dns);
+		r->out.info.cache_stats = &dns->cache_stats;
+		break;
+	}
+
+	return NT_STATUS_OK;
+}
+
 static void dns_task_init(struct task_server *task)
 {
 	struct dns_server *dns;
 	NTSTATUS status;
+	WERROR werr;
 	struct interface *ifaces = NULL;
 	int ret;
 	static const char * const attrs_none[] = { NULL};
@@ -890,6 +921,12 @@ static void dns_task_init(struct task_server *task)
 		return;
 	}
 
+	werr = dns_cache_init(dns);
+	if (!W_ERROR_IS_OK(werr)) {
+		task_server_terminate(task, "dns: failed to set up the caches", true);
+		return;
+	}
+
 	status = dns_server_reload_zones(dns);
 	if (!NT_STATUS_IS_OK(status)) {
 		task_server_terminate(task, "dns: failed to load DNS zones", true);
@@ -915,6 +952,13 @@ static void dns_task_init(struct task_server *task)
 		task_server_terminate(task, "dns: failed to setup reload handler", true);
 		return;
 	}
+
+	status = IRPC_REGISTER(task->msg_ctx, irpc, DNSSRV_INFORMATION,
+			       dns_information, dns);
+	if (!NT_STATUS_IS_OK(status)) {
+		task_server_terminate(task, "dns: failed to setup information handler", true);
+		return;
+	}
 }
 
 NTSTATUS server_service_dns_init(void)
@@ -24,6 +24,7 @@
 
 #include "librpc/gen_ndr/dns.h"
 #include "librpc/gen_ndr/ndr_dnsp.h"
+#include "librpc/gen_ndr/irpc.h"
 #include "dnsserver_common.h"
 
 struct tsocket_address;
@@ -44,10 +45,17 @@ struct dns_server_tkey_store {
 	uint16_t size;
 };
 
+struct dns_server_cache;
+struct dns_forwarder_query;
+
 struct dns_server {
 	struct task_server *task;
 	struct ldb_context *samdb;
 	struct dns_server_zone *zones;
+	struct dns_server_cache *cache;
+	struct dnssrv_cache_statistics cache_stats;
+	/* queries sent to a forwarder that are waiting for an answer */
+	struct dns_forwarder_query *forwarder_queries;
 	struct dns_server_tkey_store *tkeys;
 	struct cli_credentials *server_credentials;
 	uint16_t max_payload;
@@ -99,6 +107,26 @@ WERROR dns_replace_records(struct dns_server *dns,
 			   bool needs_add,
 			   struct dnsp_DnssrvRpcRecord *records,
 			   uint16_t rec_count);
+WERROR dns_cache_init(struct dns_server *dns);
+WERROR dns_cache_reload_zones(struct dns_server *dns);
+void dns_cache_records_changing(struct dns_server *dns, struct ldb_dn *dn);
+void dns_cache_records_changed(struct dns_server *dns, struct ldb_dn *dn);
+WERROR dns_cache_lookup_records(struct dns_server *dns,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				struct dnsp_DnssrvRpcRecord **records,
+				uint16_t *rec_count);
+bool dns_cache_lookup_forwarded(struct dns_server *dns,
+				TALLOC_CTX *mem_ctx,
+				const char *forwarder,
+				const struct dns_name_question *question,
+				struct dns_name_packet *packet);
+void dns_cache_store_forwarded(struct dns_server *dns,
+			       const char *forwarder,
+			       const struct dns_name_question *question,
+			       const DATA_BLOB *response,
+			       const struct dns_name_packet *packet);
+void dns_cache_update_statistics(struct dns_server *dns);
 WERROR dns_name2dn(struct dns_server *dns,
 		   TALLOC_CTX *mem_ctx,
 		   const char *name,
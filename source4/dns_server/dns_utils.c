@@ -126,8 +126,17 @@ WERROR dns_replace_records(struct dns_server *dns,
 {
 	/* TODO: Autogenerate this somehow */
 	uint32_t dwSerial = 110;
-	return dns_common_replace(dns->samdb, mem_ctx, dn,
+	WERROR werr;
+
+	dns_cache_records_changing(dns, dn);
+
+	werr = dns_common_replace(dns->samdb, mem_ctx, dn,
 				  needs_add, dwSerial, records, rec_count);
+
+	/* let the client see its update straight away */
+	dns_cache_records_changed(dns, dn);
+
+	return werr;
 }
 
 bool dns_authoritative_for_zone(struct dns_server *dns,
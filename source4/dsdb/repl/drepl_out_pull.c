@@ -185,35 +185,67 @@ static void dreplsrv_pending_op_callback(struct tevent_req *subreq)
 	if (op->callback) {
 		op->callback(s, werr, op->extended_ret, op->cb_data);
 	}
+	DLIST_REMOVE(s->ops.current, op);
+	s->ops.num_current--;
 	talloc_free(op);
-	s->ops.current = NULL;
 	dreplsrv_run_pending_ops(s);
 }
 
-void dreplsrv_run_pull_ops(struct dreplsrv_service *s)
+/*
+  check if a pending pull operation can be started while the
+  operations in s->ops.current are still running.
+
+  Only one request may be outstanding on a DRSUAPI connection, as the
+  source DSA keeps its GetNCChanges state per bind handle, and only
+  one source may replicate into a partition at a time. Extended
+  operations are always run on their own.
+ */
+static bool dreplsrv_pull_op_can_run(struct dreplsrv_service *s,
+				     struct dreplsrv_out_operation *op)
 {
-	struct dreplsrv_out_operation *op;
-	time_t t;
-	NTTIME now;
-	struct tevent_req *subreq;
-	WERROR werr;
+	struct dreplsrv_out_operation *cur;
 
-	if (s->ops.current) {
-		/* if there's still one running, we're done */
-		return;
+	if (s->ops.current == NULL) {
+		return true;
 	}
 
-	if (!s->ops.pending) {
-		/* if there're no pending operations, we're done */
-		return;
+	if (s->ops.num_current >= s->ops.max_current) {
+		return false;
+	}
+
+	if (op->extended_op != DRSUAPI_EXOP_NONE) {
+		return false;
+	}
+
+	for (cur = s->ops.current; cur; cur = cur->next) {
+		if (cur->extended_op != DRSUAPI_EXOP_NONE) {
+			return false;
+		}
+		if (cur->source_dsa->conn == op->source_dsa->conn) {
+			return false;
+		}
+		if (cur->source_dsa->partition == op->source_dsa->partition) {
+			return false;
+		}
 	}
 
+	return true;
+}
+
+static bool dreplsrv_run_pull_op(struct dreplsrv_service *s,
+				 struct dreplsrv_out_operation *op)
+{
+	time_t t;
+	NTTIME now;
+	struct tevent_req *subreq;
+	WERROR werr;
+
 	t = time(NULL);
 	unix_to_nt_time(&now, t);
 
-	op = s->ops.pending;
-	s->ops.current = op;
 	DLIST_REMOVE(s->ops.pending, op);
+	DLIST_ADD_END(s->ops.current, op);
+	s->ops.num_current++;
 
 	op->source_dsa->repsFrom1->last_attempt = now;
 
@@ -238,7 +270,7 @@ void dreplsrv_run_pull_ops(struct dreplsrv_service *s)
 	}
 
 	tevent_req_set_callback(subreq, dreplsrv_pending_op_callback, op);
-	return;
+	return true;
 
 failed:
 	if (op->extended_op == DRSUAPI_EXOP_NONE) {
@@ -246,11 +278,44 @@ failed:
 				  &op->source_dsa->repsFrom1->source_dsa_obj_guid, werr);
 	}
 	/* unblock queue processing */
-	s->ops.current = NULL;
+	DLIST_REMOVE(s->ops.current, op);
+	s->ops.num_current--;
 	/*
 	 * let the callback do its job just like in any other failure situation
 	 */
 	if (op->callback) {
 		op->callback(s, werr, op->extended_ret, op->cb_data);
 	}
+	return false;
+}
+
+/*
+  start as many pending pull operations as "dreplsrv:max_concurrent_pulls"
+  allows, in the order they were scheduled
+ */
+void dreplsrv_run_pull_ops(struct dreplsrv_service *s)
+{
+	struct dreplsrv_out_operation *op, *next;
+
+	for (op = s->ops.pending;
+	     op != NULL && s->ops.num_current < s->ops.max_current;
+	     op = next) {
+		next = op->next;
+
+		if (!dreplsrv_pull_op_can_run(s, op)) {
+			if (op->extended_op != DRSUAPI_EXOP_NONE) {
+				/* don't let others overtake an extended op */
+				return;
+			}
+			continue;
+		}
+
+		if (!dreplsrv_run_pull_op(s, op)) {
+			/*
+			 * the callback may have changed the queues,
+			 * so stop here and wait for the next run
+			 */
+			return;
+		}
+	}
 }
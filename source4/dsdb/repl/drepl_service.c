@@ -425,6 +425,7 @@ static void dreplsrv_task_init(struct task_server *task)
 	WERROR status;
 	struct dreplsrv_service *service;
 	uint32_t periodic_startup_interval;
+	int max_concurrent_pulls;
 
 	switch (lpcfg_server_role(task->lp_ctx)) {
 	case ROLE_STANDALONE:
@@ -477,6 +478,8 @@ static void dreplsrv_task_init(struct task_server *task)
 
 	periodic_startup_interval	= lpcfg_parm_int(task->lp_ctx, NULL, "dreplsrv", "periodic_startup_interval", 15); /* in seconds */
 	service->periodic.interval	= lpcfg_parm_int(task->lp_ctx, NULL, "dreplsrv", "periodic_interval", 300); /* in seconds */
+	max_concurrent_pulls		= lpcfg_parm_int(task->lp_ctx, NULL, "dreplsrv", "max_concurrent_pulls", 1);
+	service->ops.max_current	= MAX(max_concurrent_pulls, 1);
 
 	status = dreplsrv_periodic_schedule(service, periodic_startup_interval);
 	if (!W_ERROR_IS_OK(status)) {
@@ -232,8 +232,14 @@ struct dreplsrv_service {
 	struct dreplsrv_out_connection *connections;
 
 	struct {	
-		/* the pointer to the current active operation */
+		/*
+		 * the list of currently active pull operations,
+		 * there may be more than one if
+		 * "dreplsrv:max_concurrent_pulls" is larger than 1
+		 */
 		struct dreplsrv_out_operation *current;
+		uint32_t num_current;
+		uint32_t max_current;
 
 		/* the list of pending operations */
 		struct dreplsrv_out_operation *pending;
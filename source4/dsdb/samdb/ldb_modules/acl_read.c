@@ -39,6 +39,19 @@
 #include "dsdb/samdb/ldb_modules/util.h"
 
 
+/*
+ * Number of unpacked security descriptors remembered per search.
+ * Objects created in the same container by the same principal
+ * usually end up with byte-identical descriptors, so a handful of
+ * slots covers most of the entries of a large search.
+ */
+#define ACLREAD_SD_CACHE_SIZE 8
+
+struct aclread_sd_cache_entry {
+	struct ldb_val blob;
+	struct security_descriptor *sd;
+};
+
 struct aclread_context {
 	struct ldb_module *module;
 	struct ldb_request *req;
@@ -50,6 +63,17 @@ struct aclread_context {
 	bool added_objectSid;
 	bool added_objectClass;
 	bool indirsync;
+
+	/* descriptors already unpacked during this search */
+	struct aclread_sd_cache_entry sd_cache[ACLREAD_SD_CACHE_SIZE];
+	unsigned int sd_cache_next;
+	unsigned int sd_cache_hits;
+	unsigned int sd_cache_misses;
+
+	/* result of the last SEC_ADS_LIST check on a parent */
+	struct ldb_dn *last_parent_dn;
+	int last_parent_ret;
+	unsigned int parent_cache_hits;
 };
 
 struct aclread_private {
@@ -64,6 +88,114 @@ static bool aclread_is_inaccessible(struct ldb_message_element *el) {
 	return el->flags & LDB_FLAG_INTERNAL_INACCESSIBLE_ATTRIBUTE;
 }
 
+/*
+ * Get the unpacked nTSecurityDescriptor of a message, reusing the
+ * result for a byte-identical descriptor seen earlier in this search.
+ *
+ * The returned descriptor is owned by the aclread_context and must
+ * not be modified or freed by the caller.
+ */
+static int aclread_get_sd_from_ldb_message(struct aclread_context *ac,
+					   struct ldb_message *msg,
+					   struct security_descriptor **sd)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(ac->module);
+	struct ldb_message_element *sd_element;
+	struct aclread_sd_cache_entry *e;
+	enum ndr_err_code ndr_err;
+	unsigned int i;
+
+	sd_element = ldb_msg_find_element(msg, "nTSecurityDescriptor");
+	if (sd_element == NULL || sd_element->num_values == 0) {
+		return ldb_error(ldb, LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS,
+				 "nTSecurityDescriptor is missing");
+	}
+
+	for (i = 0; i < ACLREAD_SD_CACHE_SIZE; i++) {
+		e = &ac->sd_cache[i];
+		if (e->sd == NULL) {
+			continue;
+		}
+		if (ldb_val_equal_exact(&e->blob, &sd_element->values[0])) {
+			ac->sd_cache_hits++;
+			*sd = e->sd;
+			return LDB_SUCCESS;
+		}
+	}
+
+	ac->sd_cache_misses++;
+
+	e = &ac->sd_cache[ac->sd_cache_next];
+	ac->sd_cache_next = (ac->sd_cache_next + 1) % ACLREAD_SD_CACHE_SIZE;
+
+	TALLOC_FREE(e->sd);
+	TALLOC_FREE(e->blob.data);
+	e->blob.length = 0;
+
+	e->sd = talloc(ac, struct security_descriptor);
+	if (e->sd == NULL) {
+		return ldb_oom(ldb);
+	}
+	ndr_err = ndr_pull_struct_blob(&sd_element->values[0], e->sd, e->sd,
+				       (ndr_pull_flags_fn_t)ndr_pull_security_descriptor);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(e->sd);
+		return ldb_operr(ldb);
+	}
+
+	e->blob = ldb_val_dup(ac, &sd_element->values[0]);
+	if (e->blob.data == NULL) {
+		TALLOC_FREE(e->sd);
+		return ldb_oom(ldb);
+	}
+
+	*sd = e->sd;
+	return LDB_SUCCESS;
+}
+
+/*
+ * Check that the parent of an entry is visible (SEC_ADS_LIST).
+ *
+ * The entries of a one-level or subtree search mostly arrive grouped
+ * by container, so remember the answer for the last parent instead
+ * of searching for its descriptor again for every child.
+ */
+static int aclread_check_parent(struct aclread_context *ac,
+				TALLOC_CTX *mem_ctx,
+				struct ldb_dn *dn,
+				struct ldb_request *req)
+{
+	struct ldb_dn *parent_dn;
+	int ret;
+
+	parent_dn = ldb_dn_get_parent(mem_ctx, dn);
+	if (parent_dn == NULL) {
+		return ldb_oom(ldb_module_get_ctx(ac->module));
+	}
+
+	if (ac->last_parent_dn != NULL &&
+	    ldb_dn_compare(ac->last_parent_dn, parent_dn) == 0) {
+		ac->parent_cache_hits++;
+		return ac->last_parent_ret;
+	}
+
+	ret = dsdb_module_check_access_on_dn(ac->module,
+					     mem_ctx,
+					     parent_dn,
+					     SEC_ADS_LIST,
+					     NULL, req);
+	if (ret != LDB_SUCCESS && ret != LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
+		/* don't remember errors */
+		return ret;
+	}
+
+	TALLOC_FREE(ac->last_parent_dn);
+	ac->last_parent_dn = talloc_steal(ac, parent_dn);
+	ac->last_parent_ret = ret;
+
+	return ret;
+}
+
 static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 {
 	struct ldb_context *ldb;
@@ -91,7 +223,7 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 	switch (ares->type) {
 	case LDB_REPLY_ENTRY:
 		msg = ares->message;
-		ret = dsdb_get_sd_from_ldb_message(ldb, tmp_ctx, msg, &sd);
+		ret = aclread_get_sd_from_ldb_message(ac, msg, &sd);
 		if (ret != LDB_SUCCESS) {
 			ldb_debug_set(ldb, LDB_DEBUG_FATAL,
 				      "acl_read: cannot get descriptor of %s: %s\n",
@@ -123,13 +255,7 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 		if (!ldb_dn_is_null(msg->dn) && !(instanceType & INSTANCE_TYPE_IS_NC_HEAD))
 		{
 			/* the object has a parent, so we have to check for visibility */
-			struct ldb_dn *parent_dn = ldb_dn_get_parent(tmp_ctx, msg->dn);
-
-			ret = dsdb_module_check_access_on_dn(ac->module,
-							     tmp_ctx,
-							     parent_dn,
-							     SEC_ADS_LIST,
-							     NULL, req);
+			ret = aclread_check_parent(ac, tmp_ctx, msg->dn, req);
 			if (ret == LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
 				talloc_free(tmp_ctx);
 				return LDB_SUCCESS;
@@ -301,6 +427,11 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 	case LDB_REPLY_REFERRAL:
 		return ldb_module_send_referral(ac->req, ares->referral);
 	case LDB_REPLY_DONE:
+		ldb_debug(ldb, LDB_DEBUG_TRACE,
+			  "acl_read: descriptor cache %u hits, %u misses, "
+			  "parent check cache %u hits\n",
+			  ac->sd_cache_hits, ac->sd_cache_misses,
+			  ac->parent_cache_hits);
 		return ldb_module_done(ac->req, ares->controls,
 					ares->response, LDB_SUCCESS);
 
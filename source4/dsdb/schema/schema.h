@@ -239,6 +239,18 @@ struct dsdb_schema {
 	uint32_t num_int_id_attr;
 	struct dsdb_attribute **attributes_by_msDS_IntId;
 
+	/*
+	 * open addressing hash tables over the same attributes and
+	 * classes, for the lookups done for every element of every
+	 * message. The sizes are powers of two, 0 if not set up.
+	 */
+	uint32_t attributes_hash_size;
+	struct dsdb_attribute **attributes_hash_by_lDAPDisplayName;
+	struct dsdb_attribute **attributes_hash_by_attributeID_id;
+	uint32_t classes_hash_size;
+	struct dsdb_class **classes_hash_by_lDAPDisplayName;
+	struct dsdb_class **classes_hash_by_governsID_id;
+
 	struct {
 		bool we_are_master;
 		bool update_allowed;
@@ -54,6 +54,193 @@ static int strcasecmp_with_ldb_val(const struct ldb_val *target, const char *str
 	return ret;
 }
 
+/*
+ * Hash a lDAPDisplayName. Only the 0x20 bit is folded, which is
+ * enough to give names that compare equal with strcasecmp() the same
+ * hash value.
+ */
+static uint32_t dsdb_schema_name_hash(const uint8_t *name, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= name[i] | 0x20;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static uint32_t dsdb_schema_id_hash(uint32_t id)
+{
+	id ^= id >> 16;
+	id *= 0x45d9f3bU;
+	id ^= id >> 16;
+	return id;
+}
+
+static bool dsdb_schema_name_match(const char *name,
+				   const uint8_t *key, size_t len)
+{
+	return strncasecmp(name, (const char *)key, len) == 0 &&
+		name[len] == '\0';
+}
+
+static uint32_t dsdb_schema_hash_size(uint32_t num)
+{
+	uint32_t size = 16;
+
+	/* keep the tables at most half full */
+	while (size < num * 2) {
+		size <<= 1;
+	}
+
+	return size;
+}
+
+#define DSDB_SCHEMA_HASH_INSERT(table, size, hash, obj, match) do { \
+	uint32_t _i = (hash) & ((size) - 1); \
+	while ((table)[_i] != NULL) { \
+		if (match) { \
+			break; \
+		} \
+		_i = (_i + 1) & ((size) - 1); \
+	} \
+	if ((table)[_i] == NULL) { \
+		(table)[_i] = (obj); \
+	} \
+} while (0)
+
+void dsdb_schema_hashes_free(struct dsdb_schema *schema)
+{
+	TALLOC_FREE(schema->attributes_hash_by_lDAPDisplayName);
+	TALLOC_FREE(schema->attributes_hash_by_attributeID_id);
+	schema->attributes_hash_size = 0;
+	TALLOC_FREE(schema->classes_hash_by_lDAPDisplayName);
+	TALLOC_FREE(schema->classes_hash_by_governsID_id);
+	schema->classes_hash_size = 0;
+}
+
+/*
+  build the hash tables used by dsdb_attribute_by_lDAPDisplayName(),
+  dsdb_attribute_by_attributeID_id() and the class equivalents.
+
+  If a key appears twice, the first object in the schema list wins.
+ */
+bool dsdb_setup_schema_hashes(struct dsdb_schema *schema)
+{
+	struct dsdb_attribute *a;
+	struct dsdb_class *c;
+	uint32_t size;
+
+	dsdb_schema_hashes_free(schema);
+
+	size = dsdb_schema_hash_size(schema->num_attributes);
+	schema->attributes_hash_by_lDAPDisplayName =
+		talloc_zero_array(schema, struct dsdb_attribute *, size);
+	schema->attributes_hash_by_attributeID_id =
+		talloc_zero_array(schema, struct dsdb_attribute *, size);
+	if (schema->attributes_hash_by_lDAPDisplayName == NULL ||
+	    schema->attributes_hash_by_attributeID_id == NULL) {
+		goto failed;
+	}
+
+	for (a = schema->attributes; a; a = a->next) {
+		struct dsdb_attribute **t;
+
+		if (a->lDAPDisplayName != NULL) {
+			size_t len = strlen(a->lDAPDisplayName);
+			uint32_t h = dsdb_schema_name_hash(
+				(const uint8_t *)a->lDAPDisplayName, len);
+
+			t = schema->attributes_hash_by_lDAPDisplayName;
+			DSDB_SCHEMA_HASH_INSERT(t, size, h, a,
+				strcasecmp(t[_i]->lDAPDisplayName,
+					   a->lDAPDisplayName) == 0);
+		}
+
+		t = schema->attributes_hash_by_attributeID_id;
+		DSDB_SCHEMA_HASH_INSERT(t, size,
+			dsdb_schema_id_hash(a->attributeID_id), a,
+			t[_i]->attributeID_id == a->attributeID_id);
+	}
+	schema->attributes_hash_size = size;
+
+	size = dsdb_schema_hash_size(schema->num_classes);
+	schema->classes_hash_by_lDAPDisplayName =
+		talloc_zero_array(schema, struct dsdb_class *, size);
+	schema->classes_hash_by_governsID_id =
+		talloc_zero_array(schema, struct dsdb_class *, size);
+	if (schema->classes_hash_by_lDAPDisplayName == NULL ||
+	    schema->classes_hash_by_governsID_id == NULL) {
+		goto failed;
+	}
+
+	for (c = schema->classes; c; c = c->next) {
+		struct dsdb_class **t;
+
+		if (c->lDAPDisplayName != NULL) {
+			size_t len = strlen(c->lDAPDisplayName);
+			uint32_t h = dsdb_schema_name_hash(
+				(const uint8_t *)c->lDAPDisplayName, len);
+
+			t = schema->classes_hash_by_lDAPDisplayName;
+			DSDB_SCHEMA_HASH_INSERT(t, size, h, c,
+				strcasecmp(t[_i]->lDAPDisplayName,
+					   c->lDAPDisplayName) == 0);
+		}
+
+		t = schema->classes_hash_by_governsID_id;
+		DSDB_SCHEMA_HASH_INSERT(t, size,
+			dsdb_schema_id_hash(c->governsID_id), c,
+			t[_i]->governsID_id == c->governsID_id);
+	}
+	schema->classes_hash_size = size;
+
+	return true;
+
+failed:
+	dsdb_schema_hashes_free(schema);
+	return false;
+}
+
+static struct dsdb_attribute *dsdb_attribute_hash_by_name(const struct dsdb_schema *schema,
+							  const uint8_t *name,
+							  size_t len)
+{
+	uint32_t mask = schema->attributes_hash_size - 1;
+	uint32_t i = dsdb_schema_name_hash(name, len) & mask;
+	struct dsdb_attribute *a;
+
+	while ((a = schema->attributes_hash_by_lDAPDisplayName[i]) != NULL) {
+		if (dsdb_schema_name_match(a->lDAPDisplayName, name, len)) {
+			return a;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static struct dsdb_class *dsdb_class_hash_by_name(const struct dsdb_schema *schema,
+						  const uint8_t *name,
+						  size_t len)
+{
+	uint32_t mask = schema->classes_hash_size - 1;
+	uint32_t i = dsdb_schema_name_hash(name, len) & mask;
+	struct dsdb_class *c;
+
+	while ((c = schema->classes_hash_by_lDAPDisplayName[i]) != NULL) {
+		if (dsdb_schema_name_match(c->lDAPDisplayName, name, len)) {
+			return c;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
 const struct dsdb_attribute *dsdb_attribute_by_attributeID_id(const struct dsdb_schema *schema,
 							      uint32_t id)
 {
@@ -72,6 +259,19 @@ const struct dsdb_attribute *dsdb_attribute_by_attributeID_id(const struct dsdb_
 		return c;
 	}
 
+	if (schema->attributes_hash_size != 0) {
+		uint32_t mask = schema->attributes_hash_size - 1;
+		uint32_t i = dsdb_schema_id_hash(id) & mask;
+
+		while ((c = schema->attributes_hash_by_attributeID_id[i]) != NULL) {
+			if (c->attributeID_id == id) {
+				return c;
+			}
+			i = (i + 1) & mask;
+		}
+		return NULL;
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_attributeID_id,
 			      schema->num_attributes, attributeID_id, id, uint32_cmp, c);
 	return c;
@@ -96,6 +296,12 @@ const struct dsdb_attribute *dsdb_attribute_by_lDAPDisplayName(const struct dsdb
 
 	if (!name) return NULL;
 
+	if (schema->attributes_hash_size != 0) {
+		return dsdb_attribute_hash_by_name(schema,
+						   (const uint8_t *)name,
+						   strlen(name));
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_lDAPDisplayName,
 			      schema->num_attributes, lDAPDisplayName, name, strcasecmp, c);
 	return c;
@@ -108,6 +314,11 @@ const struct dsdb_attribute *dsdb_attribute_by_lDAPDisplayName_ldb_val(const str
 
 	if (!name) return NULL;
 
+	if (schema->attributes_hash_size != 0) {
+		return dsdb_attribute_hash_by_name(schema, name->data,
+				strnlen((const char *)name->data, name->length));
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->attributes_by_lDAPDisplayName,
 			      schema->num_attributes, lDAPDisplayName, name, strcasecmp_with_ldb_val, a);
 	return a;
@@ -134,6 +345,19 @@ const struct dsdb_class *dsdb_class_by_governsID_id(const struct dsdb_schema *sc
 	 */
 	if (id == 0xFFFFFFFF) return NULL;
 
+	if (schema->classes_hash_size != 0) {
+		uint32_t mask = schema->classes_hash_size - 1;
+		uint32_t i = dsdb_schema_id_hash(id) & mask;
+
+		while ((c = schema->classes_hash_by_governsID_id[i]) != NULL) {
+			if (c->governsID_id == id) {
+				return c;
+			}
+			i = (i + 1) & mask;
+		}
+		return NULL;
+	}
+
 	BINARY_ARRAY_SEARCH_P(schema->classes_by_governsID_id,
 			      schema->num_classes, governsID_id, id, uint32_cmp, c);
 	return c;
@@ -154,6 +378,11 @@ const struct dsdb_class *dsdb_class_by_lDAPDisplayName(const struct dsdb_schema
 {
 	struct dsdb_class *c;
 	if (!name) return NULL;
+	if (schema->classes_hash_size != 0) {
+		return dsdb_class_hash_by_name(schema,
+					       (const uint8_t *)name,
+					       strlen(name));
+	}
 	BINARY_ARRAY_SEARCH_P(schema->classes_by_lDAPDisplayName,
 			      schema->num_classes, lDAPDisplayName, name, strcasecmp, c);
 	return c;
@@ -164,6 +393,10 @@ const struct dsdb_class *dsdb_class_by_lDAPDisplayName_ldb_val(const struct dsdb
 {
 	struct dsdb_class *c;
 	if (!name) return NULL;
+	if (schema->classes_hash_size != 0) {
+		return dsdb_class_hash_by_name(schema, name->data,
+				strnlen((const char *)name->data, name->length));
+	}
 	BINARY_ARRAY_SEARCH_P(schema->classes_by_lDAPDisplayName,
 			      schema->num_classes, lDAPDisplayName, name, strcasecmp_with_ldb_val, c);
 	return c;
@@ -315,6 +315,8 @@ static void dsdb_sorted_accessors_free(struct dsdb_schema *schema)
 	TALLOC_FREE(schema->attributes_by_msDS_IntId);
 	TALLOC_FREE(schema->attributes_by_attributeID_oid);
 	TALLOC_FREE(schema->attributes_by_linkID);
+	/* free the hash tables */
+	dsdb_schema_hashes_free(schema);
 }
 
 /*
@@ -424,6 +426,10 @@ int dsdb_setup_sorted_accessors(struct ldb_context *ldb,
 	TYPESAFE_QSORT(schema->attributes_by_attributeID_oid, schema->num_attributes, dsdb_compare_attribute_by_attributeID_oid);
 	TYPESAFE_QSORT(schema->attributes_by_linkID, schema->num_attributes, dsdb_compare_attribute_by_linkID);
 
+	if (!dsdb_setup_schema_hashes(schema)) {
+		goto failed;
+	}
+
 	dsdb_setup_attribute_shortcuts(ldb, schema);
 
 	ret = schema_fill_constructed(schema);
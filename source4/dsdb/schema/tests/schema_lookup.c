@@ -0,0 +1,255 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Test DSDB schema lookup functions
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include <ldb.h>
+#include "dsdb/samdb/samdb.h"
+#include "param/param.h"
+#include "torture/smbtorture.h"
+#include "torture/local/proto.h"
+#include "param/provision.h"
+#include "lib/util/binsearch.h"
+
+struct torture_dsdb_schema_lookup {
+	struct ldb_context *ldb;
+	struct dsdb_schema *schema;
+};
+
+static int uint32_cmp(uint32_t c1, uint32_t c2)
+{
+	if (c1 == c2) return 0;
+	return c1 > c2 ? 1 : -1;
+}
+
+/*
+ * every attribute and class must be found by name (in any case) and
+ * by id, and the lookups must return the schema object itself
+ */
+static bool torture_dsdb_schema_lookup_all(struct torture_context *tctx,
+					   struct torture_dsdb_schema_lookup *priv)
+{
+	const struct dsdb_schema *schema = priv->schema;
+	const struct dsdb_attribute *a;
+	const struct dsdb_class *c;
+
+	torture_assert(tctx, schema->attributes_hash_size != 0,
+		       "attribute hash tables not set up");
+	torture_assert(tctx, schema->classes_hash_size != 0,
+		       "class hash tables not set up");
+
+	for (a = schema->attributes; a; a = a->next) {
+		char *upper = strupper_talloc(tctx, a->lDAPDisplayName);
+		struct ldb_val val = data_blob_string_const(a->lDAPDisplayName);
+
+		torture_assert(tctx,
+			       dsdb_attribute_by_lDAPDisplayName(schema, a->lDAPDisplayName) == a,
+			       a->lDAPDisplayName);
+		torture_assert(tctx,
+			       dsdb_attribute_by_lDAPDisplayName(schema, upper) == a,
+			       upper);
+		torture_assert(tctx,
+			       dsdb_attribute_by_lDAPDisplayName_ldb_val(schema, &val) == a,
+			       a->lDAPDisplayName);
+		torture_assert(tctx,
+			       dsdb_attribute_by_attributeID_id(schema, a->attributeID_id) == a,
+			       a->lDAPDisplayName);
+		TALLOC_FREE(upper);
+	}
+
+	for (c = schema->classes; c; c = c->next) {
+		char *upper = strupper_talloc(tctx, c->lDAPDisplayName);
+		struct ldb_val val = data_blob_string_const(c->lDAPDisplayName);
+
+		torture_assert(tctx,
+			       dsdb_class_by_lDAPDisplayName(schema, c->lDAPDisplayName) == c,
+			       c->lDAPDisplayName);
+		torture_assert(tctx,
+			       dsdb_class_by_lDAPDisplayName(schema, upper) == c,
+			       upper);
+		torture_assert(tctx,
+			       dsdb_class_by_lDAPDisplayName_ldb_val(schema, &val) == c,
+			       c->lDAPDisplayName);
+		torture_assert(tctx,
+			       dsdb_class_by_governsID_id(schema, c->governsID_id) == c,
+			       c->lDAPDisplayName);
+		TALLOC_FREE(upper);
+	}
+
+	return true;
+}
+
+static bool torture_dsdb_schema_lookup_missing(struct torture_context *tctx,
+					       struct torture_dsdb_schema_lookup *priv)
+{
+	const struct dsdb_schema *schema = priv->schema;
+	struct ldb_val val = data_blob_string_const("cnx");
+
+	torture_assert(tctx,
+		       dsdb_attribute_by_lDAPDisplayName(schema, "noSuchAttribute") == NULL,
+		       "found noSuchAttribute");
+	torture_assert(tctx,
+		       dsdb_attribute_by_lDAPDisplayName(schema, "c") != NULL,
+		       "did not find c");
+	torture_assert(tctx,
+		       dsdb_attribute_by_lDAPDisplayName(schema, "") == NULL,
+		       "found empty name");
+	/* a prefix of the ldb_val must not match the shorter name */
+	val.length = 2;
+	torture_assert(tctx,
+		       dsdb_attribute_by_lDAPDisplayName_ldb_val(schema, &val) != NULL,
+		       "did not find cn from ldb_val");
+	val.length = 3;
+	torture_assert(tctx,
+		       dsdb_attribute_by_lDAPDisplayName_ldb_val(schema, &val) == NULL,
+		       "found cnx from ldb_val");
+	torture_assert(tctx,
+		       dsdb_class_by_lDAPDisplayName(schema, "noSuchClass") == NULL,
+		       "found noSuchClass");
+	torture_assert(tctx,
+		       dsdb_attribute_by_attributeID_id(schema, 0xFFFFFFFF) == NULL,
+		       "found attid 0xFFFFFFFF");
+	torture_assert(tctx,
+		       dsdb_class_by_governsID_id(schema, 0xFFFFFFFF) == NULL,
+		       "found governsID 0xFFFFFFFF");
+
+	return true;
+}
+
+/*
+ * compare the hash lookups with a binary search over the sorted
+ * accessor arrays, the way lookups were done before
+ */
+static bool torture_dsdb_schema_lookup_speed(struct torture_context *tctx,
+					     struct torture_dsdb_schema_lookup *priv)
+{
+	const struct dsdb_schema *schema = priv->schema;
+	const int loops = torture_setting_int(tctx, "schema_lookup_loops", 200);
+	const char **names;
+	uint32_t *ids;
+	uint32_t i, num = schema->num_attributes;
+	struct timeval tv;
+	double t_bsearch, t_hash;
+	int l;
+
+	names = talloc_array(tctx, const char *, num);
+	ids = talloc_array(tctx, uint32_t, num);
+	torture_assert(tctx, names != NULL && ids != NULL, "no memory");
+
+	for (i = 0; i < num; i++) {
+		names[i] = schema->attributes_by_attributeID_id[i]->lDAPDisplayName;
+		ids[i] = schema->attributes_by_attributeID_id[i]->attributeID_id;
+	}
+
+	tv = timeval_current();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < num; i++) {
+			struct dsdb_attribute *a;
+			BINARY_ARRAY_SEARCH_P(schema->attributes_by_lDAPDisplayName,
+					      schema->num_attributes, lDAPDisplayName,
+					      names[i], strcasecmp, a);
+			torture_assert(tctx, a != NULL, names[i]);
+			BINARY_ARRAY_SEARCH_P(schema->attributes_by_attributeID_id,
+					      schema->num_attributes, attributeID_id,
+					      ids[i], uint32_cmp, a);
+			torture_assert(tctx, a != NULL, names[i]);
+		}
+	}
+	t_bsearch = timeval_elapsed(&tv);
+
+	tv = timeval_current();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < num; i++) {
+			torture_assert(tctx,
+				       dsdb_attribute_by_lDAPDisplayName(schema, names[i]) != NULL,
+				       names[i]);
+			torture_assert(tctx,
+				       dsdb_attribute_by_attributeID_id(schema, ids[i]) != NULL,
+				       names[i]);
+		}
+	}
+	t_hash = timeval_elapsed(&tv);
+
+	torture_comment(tctx, "%u attributes, %d loops of name+attid lookups\n",
+			num, loops);
+	torture_comment(tctx, "binary search: %.3f sec (%.1f ns/lookup)\n",
+			t_bsearch, t_bsearch * 1e9 / (2.0 * num * loops));
+	torture_comment(tctx, "hash table:    %.3f sec (%.1f ns/lookup)\n",
+			t_hash, t_hash * 1e9 / (2.0 * num * loops));
+
+	return true;
+}
+
+static bool torture_dsdb_schema_lookup_tcase_setup(struct torture_context *tctx, void **data)
+{
+	struct torture_dsdb_schema_lookup *priv;
+
+	priv = talloc_zero(tctx, struct torture_dsdb_schema_lookup);
+	torture_assert(tctx, priv, "No memory");
+
+	priv->ldb = provision_get_schema(priv, tctx->lp_ctx, NULL, NULL);
+	torture_assert(tctx, priv->ldb, "Failed to load schema from disk");
+
+	priv->schema = dsdb_get_schema(priv->ldb, NULL);
+	torture_assert(tctx, priv->schema, "Failed to fetch schema");
+
+	*data = priv;
+	return true;
+}
+
+static bool torture_dsdb_schema_lookup_tcase_teardown(struct torture_context *tctx, void *data)
+{
+	struct torture_dsdb_schema_lookup *priv;
+
+	priv = talloc_get_type_abort(data, struct torture_dsdb_schema_lookup);
+	talloc_free(priv);
+
+	return true;
+}
+
+/**
+ * DSDB schema lookup test suite creation
+ */
+struct torture_suite *torture_dsdb_schema_lookup(TALLOC_CTX *mem_ctx)
+{
+	typedef bool (*pfn_run)(struct torture_context *, void *);
+
+	struct torture_tcase *tc;
+	struct torture_suite *suite = torture_suite_create(mem_ctx, "dsdb.schema_lookup");
+
+	if (suite == NULL) {
+		return NULL;
+	}
+
+	tc = torture_suite_add_tcase(suite, "tc");
+	if (!tc) {
+		return NULL;
+	}
+
+	torture_tcase_set_fixture(tc,
+				  torture_dsdb_schema_lookup_tcase_setup,
+				  torture_dsdb_schema_lookup_tcase_teardown);
+
+	torture_tcase_add_simple_test(tc, "all", (pfn_run)torture_dsdb_schema_lookup_all);
+	torture_tcase_add_simple_test(tc, "missing", (pfn_run)torture_dsdb_schema_lookup_missing);
+	torture_tcase_add_simple_test(tc, "speed", (pfn_run)torture_dsdb_schema_lookup_speed);
+
+	suite->description = talloc_strdup(suite, "DSDB schema lookup tests");
+
+	return suite;
+}
@@ -35,6 +35,7 @@
 #include "kdc/sdb.h"
 #include "kdc/samba_kdc.h"
 #include "kdc/db-glue.h"
+#include "lib/util/dlinklist.h"
 
 #define SAMBA_KVNO_GET_KRBTGT(kvno) \
 	((uint16_t)(((uint32_t)kvno) >> 16))
@@ -1656,6 +1657,465 @@ static krb5_error_code samba_kdc_lookup_client(krb5_context context,
 	return 0;
 }
 
+/*
+ * Cache of the entries of service principals and of our own krbtgt.
+ *
+ * Building an entry takes one or two searches and unpacking the keys
+ * from supplementalCredentials, for every AS-REQ and TGS-REQ.  Cached
+ * entries are used for at most "kdc:entry cache ttl" seconds.  Before
+ * an entry is used we compare the highest USN of the domain partition
+ * with the one read before the entry was built; if it moved, the
+ * entry is only used if the uSNChanged of its object did not, so
+ * password and key changes are seen within a second.
+ *
+ * Client entries are not cached, they carry lockout and password
+ * expiry state that must be current.  Neither are locked out
+ * entries, and an entry expires no later than its account or
+ * password.
+ */
+
+#define SAMBA_KDC_CACHE_BUCKETS 256
+#define SAMBA_KDC_CACHE_DEFAULT_SIZE 1000
+#define SAMBA_KDC_CACHE_DEFAULT_MAX_MEMORY (8*1024*1024)
+#define SAMBA_KDC_CACHE_DEFAULT_TTL 60
+#define SAMBA_KDC_CACHE_REPORT_INTERVAL 300
+#define SAMBA_KDC_CACHE_NO_USN UINT64_MAX
+
+struct samba_kdc_cache_entry {
+	/* LRU list, most recently used first */
+	struct samba_kdc_cache_entry *prev, *next;
+	struct samba_kdc_cache_entry *bucket_next;
+	uint32_t hash;
+	char *key;
+	struct sdb_entry entry;
+	/* shared with the samba_kdc_entry of every fetch */
+	struct ldb_message *msg;
+	struct ldb_dn *realm_dn;
+	/* partition USN from before the entry was built */
+	uint64_t usn;
+	time_t expires;
+	size_t size;
+};
+
+struct samba_kdc_entry_cache {
+	struct samba_kdc_cache_entry *buckets[SAMBA_KDC_CACHE_BUCKETS];
+	struct samba_kdc_cache_entry *lru;
+	size_t num_entries;
+	size_t max_entries;
+	size_t size;
+	size_t max_size;
+	time_t ttl;
+
+	/* partition USN, read at most once a second */
+	uint64_t usn;
+	time_t usn_time;
+
+	struct samba_kdc_entry_cache_stats stats;
+	time_t last_report;
+};
+
+static void samba_kdc_cache_init(struct samba_kdc_db_context *kdc_db_ctx)
+{
+	struct loadparm_context *lp_ctx = kdc_db_ctx->lp_ctx;
+	struct samba_kdc_entry_cache *cache;
+	int max_entries, max_size, ttl;
+
+	max_entries = lpcfg_parm_int(lp_ctx, NULL, "kdc", "entry cache size",
+				     SAMBA_KDC_CACHE_DEFAULT_SIZE);
+	max_size = lpcfg_parm_bytes(lp_ctx, NULL, "kdc",
+				    "entry cache max memory",
+				    SAMBA_KDC_CACHE_DEFAULT_MAX_MEMORY);
+	ttl = lpcfg_parm_int(lp_ctx, NULL, "kdc", "entry cache ttl",
+			     SAMBA_KDC_CACHE_DEFAULT_TTL);
+
+	if (max_entries <= 0 || max_size <= 0 || ttl <= 0) {
+		DEBUG(3, ("samba_kdc_cache_init: entry cache disabled\n"));
+		return;
+	}
+
+	cache = talloc_zero(kdc_db_ctx, struct samba_kdc_entry_cache);
+	if (cache == NULL) {
+		return;
+	}
+	cache->max_entries = max_entries;
+	cache->max_size = max_size;
+	cache->ttl = ttl;
+	cache->usn = SAMBA_KDC_CACHE_NO_USN;
+	cache->last_report = time(NULL);
+
+	kdc_db_ctx->entry_cache = cache;
+}
+
+static int samba_kdc_cache_entry_destructor(struct samba_kdc_cache_entry *e)
+{
+	unsigned int i;
+
+	for (i = 0; i < e->entry.keys.len; i++) {
+		krb5_free_keyblock_contents(NULL, &e->entry.keys.val[i].key);
+	}
+	free_sdb_entry(&e->entry);
+
+	return 0;
+}
+
+static void samba_kdc_cache_remove(struct samba_kdc_entry_cache *cache,
+				   struct samba_kdc_cache_entry *e)
+{
+	struct samba_kdc_cache_entry **pe;
+
+	pe = &cache->buckets[e->hash % SAMBA_KDC_CACHE_BUCKETS];
+	while (*pe != e) {
+		pe = &(*pe)->bucket_next;
+	}
+	*pe = e->bucket_next;
+
+	DLIST_REMOVE(cache->lru, e);
+	cache->num_entries--;
+	cache->size -= e->size;
+
+	/* fetched entries keep their references to the message */
+	TALLOC_FREE(e);
+}
+
+static struct samba_kdc_cache_entry *samba_kdc_cache_find(
+	struct samba_kdc_entry_cache *cache, const char *key, uint32_t *_hash)
+{
+	struct samba_kdc_cache_entry *e;
+	uint32_t hash = 0x811c9dc5;
+	const char *c;
+
+	for (c = key; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t)*c) * 0x01000193;
+	}
+	*_hash = hash;
+
+	for (e = cache->buckets[hash % SAMBA_KDC_CACHE_BUCKETS];
+	     e != NULL;
+	     e = e->bucket_next) {
+		if (e->hash == hash && strcmp(e->key, key) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static char *samba_kdc_cache_key(TALLOC_CTX *mem_ctx,
+				 krb5_context context,
+				 krb5_const_principal principal,
+				 enum samba_kdc_ent_type ent_type,
+				 unsigned flags,
+				 krb5_kvno kvno)
+{
+	char *name = NULL;
+	char *key;
+	krb5_error_code ret;
+
+	ret = krb5_unparse_name(context, principal, &name);
+	if (ret != 0) {
+		return NULL;
+	}
+
+	key = talloc_asprintf(mem_ctx, "%d:%u:%u:%d:%s",
+			      (int)ent_type, flags, (unsigned)kvno,
+			      (int)smb_krb5_principal_get_type(context,
+							       principal),
+			      name);
+	free(name);
+	return key;
+}
+
+static void samba_kdc_cache_report(struct samba_kdc_entry_cache *cache)
+{
+	const struct samba_kdc_entry_cache_stats *stats = &cache->stats;
+	uint64_t lookups = stats->hits + stats->misses;
+	time_t now = time(NULL);
+
+	if (now - cache->last_report < SAMBA_KDC_CACHE_REPORT_INTERVAL) {
+		return;
+	}
+	cache->last_report = now;
+
+	if (lookups == 0) {
+		return;
+	}
+
+	DEBUG(3, ("samba_kdc entry cache: %zu entries, %zu bytes, "
+		  "%llu hits, %llu misses (%.1f%% hits), %llu expired, "
+		  "%llu changed, %llu evicted\n",
+		  cache->num_entries, cache->size,
+		  (unsigned long long)stats->hits,
+		  (unsigned long long)stats->misses,
+		  100.0 * stats->hits / lookups,
+		  (unsigned long long)stats->expired,
+		  (unsigned long long)stats->changed,
+		  (unsigned long long)stats->evicted));
+}
+
+/*
+ * The highest USN of the domain partition. Reading it costs a search
+ * of its own, so it is only reloaded once a second: a change is then
+ * noticed at most a second late.
+ */
+static uint64_t samba_kdc_cache_partition_usn(struct samba_kdc_db_context *kdc_db_ctx)
+{
+	struct samba_kdc_entry_cache *cache = kdc_db_ctx->entry_cache;
+	time_t now = time(NULL);
+	uint64_t usn = 0;
+	int ret;
+
+	if (cache->usn != SAMBA_KDC_CACHE_NO_USN && cache->usn_time == now) {
+		return cache->usn;
+	}
+
+	ret = dsdb_load_partition_usn(kdc_db_ctx->samdb,
+				      ldb_get_default_basedn(kdc_db_ctx->samdb),
+				      &usn, NULL);
+	if (ret != LDB_SUCCESS) {
+		usn = SAMBA_KDC_CACHE_NO_USN;
+	}
+
+	cache->usn = usn;
+	cache->usn_time = now;
+	return usn;
+}
+
+/*
+ * The time at which a cached entry must be rebuilt. The account and
+ * password expiry times are absolute and checked by the KDC, but a
+ * cached entry must not outlive them either.
+ */
+static time_t samba_kdc_cache_entry_expires(struct samba_kdc_entry_cache *cache,
+					    const struct sdb_entry *entry)
+{
+	time_t now = time(NULL);
+	time_t expires = now + cache->ttl;
+
+	if (entry->valid_end != NULL && *entry->valid_end < expires) {
+		expires = *entry->valid_end;
+	}
+	if (entry->pw_end != NULL && *entry->pw_end < expires) {
+		expires = *entry->pw_end;
+	}
+
+	return expires;
+}
+
+/*
+ * Check that the object of a cached entry did not change since the
+ * entry was built, and move the entry on to the current partition USN
+ */
+static bool samba_kdc_cache_entry_current(struct samba_kdc_db_context *kdc_db_ctx,
+					  struct samba_kdc_cache_entry *e,
+					  uint64_t usn)
+{
+	static const char * const attrs[] = { "uSNChanged", NULL };
+	struct ldb_message *msg = NULL;
+	uint64_t obj_usn;
+	int ret;
+
+	if (usn == SAMBA_KDC_CACHE_NO_USN) {
+		return false;
+	}
+	if (usn == e->usn) {
+		return true;
+	}
+
+	ret = dsdb_search_one(kdc_db_ctx->samdb, kdc_db_ctx, &msg,
+			      e->msg->dn, LDB_SCOPE_BASE, attrs,
+			      DSDB_SEARCH_NO_GLOBAL_CATALOG, NULL);
+	if (ret != LDB_SUCCESS) {
+		return false;
+	}
+	obj_usn = ldb_msg_find_attr_as_uint64(msg, "uSNChanged",
+					      SAMBA_KDC_CACHE_NO_USN);
+	TALLOC_FREE(msg);
+
+	if (obj_usn > e->usn) {
+		return false;
+	}
+
+	e->usn = usn;
+	return true;
+}
+
+/*
+ * Fill entry_ex from the cache. Returns false if there is no usable
+ * entry, *usn is then the partition USN to pass to
+ * samba_kdc_cache_store() once the entry has been built.
+ */
+static bool samba_kdc_cache_fetch(krb5_context context,
+				  struct samba_kdc_db_context *kdc_db_ctx,
+				  const char *key,
+				  struct sdb_entry_ex *entry_ex,
+				  uint64_t *usn)
+{
+	struct samba_kdc_entry_cache *cache = kdc_db_ctx->entry_cache;
+	struct samba_kdc_cache_entry *e;
+	struct samba_kdc_entry *p;
+	uint32_t hash;
+	krb5_error_code ret;
+
+	*usn = SAMBA_KDC_CACHE_NO_USN;
+
+	if (cache == NULL || key == NULL) {
+		return false;
+	}
+
+	samba_kdc_cache_report(cache);
+
+	*usn = samba_kdc_cache_partition_usn(kdc_db_ctx);
+
+	e = samba_kdc_cache_find(cache, key, &hash);
+	if (e == NULL) {
+		cache->stats.misses++;
+		return false;
+	}
+
+	if (e->expires <= time(NULL)) {
+		cache->stats.expired++;
+		cache->stats.misses++;
+		samba_kdc_cache_remove(cache, e);
+		return false;
+	}
+
+	if (!samba_kdc_cache_entry_current(kdc_db_ctx, e, *usn)) {
+		cache->stats.changed++;
+		cache->stats.misses++;
+		samba_kdc_cache_remove(cache, e);
+		return false;
+	}
+
+	p = talloc_zero(kdc_db_ctx, struct samba_kdc_entry);
+	if (p == NULL) {
+		return false;
+	}
+	p->kdc_db_ctx = kdc_db_ctx;
+	p->realm_dn = talloc_reference(p, e->realm_dn);
+	p->msg = talloc_reference(p, e->msg);
+	if (p->realm_dn == NULL || p->msg == NULL) {
+		TALLOC_FREE(p);
+		return false;
+	}
+
+	ZERO_STRUCTP(entry_ex);
+	ret = sdb_entry_copy(context, &e->entry, &entry_ex->entry);
+	if (ret != 0) {
+		TALLOC_FREE(p);
+		return false;
+	}
+
+	talloc_set_destructor(p, samba_kdc_entry_destructor);
+	entry_ex->ctx = p;
+
+	DLIST_PROMOTE(cache->lru, e);
+	cache->stats.hits++;
+
+	return true;
+}
+
+static void samba_kdc_cache_store(krb5_context context,
+				  struct samba_kdc_db_context *kdc_db_ctx,
+				  const char *key,
+				  uint64_t usn,
+				  const struct sdb_entry_ex *entry_ex)
+{
+	struct samba_kdc_entry_cache *cache = kdc_db_ctx->entry_cache;
+	struct samba_kdc_cache_entry *e;
+	struct samba_kdc_entry *p;
+	uint32_t hash;
+	unsigned int i;
+	krb5_error_code ret;
+
+	if (cache == NULL || key == NULL || usn == SAMBA_KDC_CACHE_NO_USN) {
+		return;
+	}
+
+	p = talloc_get_type(entry_ex->ctx, struct samba_kdc_entry);
+	if (p == NULL || p->msg == NULL || p->realm_dn == NULL) {
+		return;
+	}
+
+	/*
+	 * A lockout ends when the lockout duration has passed, without
+	 * the object changing, so locked out entries are not cached.
+	 */
+	if (entry_ex->entry.flags.locked_out) {
+		return;
+	}
+
+	e = samba_kdc_cache_find(cache, key, &hash);
+	if (e != NULL) {
+		samba_kdc_cache_remove(cache, e);
+	}
+
+	e = talloc_zero(cache, struct samba_kdc_cache_entry);
+	if (e == NULL) {
+		return;
+	}
+
+	ret = sdb_entry_copy(context, &entry_ex->entry, &e->entry);
+	if (ret != 0) {
+		TALLOC_FREE(e);
+		return;
+	}
+	talloc_set_destructor(e, samba_kdc_cache_entry_destructor);
+
+	e->hash = hash;
+	e->key = talloc_strdup(e, key);
+	e->msg = talloc_reference(e, p->msg);
+	e->realm_dn = talloc_reference(e, p->realm_dn);
+	if (e->key == NULL || e->msg == NULL || e->realm_dn == NULL) {
+		TALLOC_FREE(e);
+		return;
+	}
+	e->usn = usn;
+	e->expires = samba_kdc_cache_entry_expires(cache, &e->entry);
+	if (e->expires <= time(NULL)) {
+		TALLOC_FREE(e);
+		return;
+	}
+
+	e->size = sizeof(*e) + strlen(key) + talloc_total_size(e->msg);
+	for (i = 0; i < e->entry.keys.len; i++) {
+		const struct sdb_key *k = &e->entry.keys.val[i];
+
+		e->size += sizeof(*k) + KRB5_KEY_LENGTH(&k->key);
+		if (k->salt != NULL) {
+			e->size += sizeof(*k->salt) + k->salt->salt.length;
+		}
+	}
+	if (e->size > cache->max_size) {
+		TALLOC_FREE(e);
+		return;
+	}
+
+	e->bucket_next = cache->buckets[hash % SAMBA_KDC_CACHE_BUCKETS];
+	cache->buckets[hash % SAMBA_KDC_CACHE_BUCKETS] = e;
+	DLIST_ADD(cache->lru, e);
+	cache->num_entries++;
+	cache->size += e->size;
+
+	while (cache->num_entries > cache->max_entries ||
+	       cache->size > cache->max_size) {
+		cache->stats.evicted++;
+		samba_kdc_cache_remove(cache, DLIST_TAIL(cache->lru));
+	}
+}
+
+bool samba_kdc_entry_cache_stats(struct samba_kdc_db_context *kdc_db_ctx,
+				 struct samba_kdc_entry_cache_stats *stats)
+{
+	struct samba_kdc_entry_cache *cache = kdc_db_ctx->entry_cache;
+
+	if (cache == NULL) {
+		return false;
+	}
+
+	*stats = cache->stats;
+	stats->num_entries = cache->num_entries;
+	return true;
+}
+
 static krb5_error_code samba_kdc_fetch_client(krb5_context context,
 					       struct samba_kdc_db_context *kdc_db_ctx,
 					       TALLOC_CTX *mem_ctx,
@@ -1723,6 +2183,8 @@ static krb5_error_code samba_kdc_fetch_krbtgt(krb5_context context,
 
 		int lret;
 		unsigned int krbtgt_number;
+		char *cache_key;
+		uint64_t usn;
 		/* w2k8r2 sometimes gives us a kvno of 255 for inter-domain
 		   trust tickets. We don't yet know what this means, but we do
 		   seem to need to treat it as unspecified */
@@ -1737,6 +2199,14 @@ static krb5_error_code samba_kdc_fetch_krbtgt(krb5_context context,
 			krbtgt_number = kdc_db_ctx->my_krbtgt_number;
 		}
 
+		cache_key = samba_kdc_cache_key(mem_ctx, context, principal,
+						SAMBA_KDC_ENT_TYPE_KRBTGT, flags,
+						(flags & SDB_F_KVNO_SPECIFIED) ? kvno : 0);
+		if (samba_kdc_cache_fetch(context, kdc_db_ctx, cache_key,
+					  entry_ex, &usn)) {
+			return 0;
+		}
+
 		if (krbtgt_number == kdc_db_ctx->my_krbtgt_number) {
 			lret = dsdb_search_one(kdc_db_ctx->samdb, mem_ctx,
 					       &msg, kdc_db_ctx->krbtgt_dn, LDB_SCOPE_BASE,
@@ -1774,8 +2244,12 @@ static krb5_error_code samba_kdc_fetch_krbtgt(krb5_context context,
 					      flags, realm_dn, msg, entry_ex);
 		if (ret != 0) {
 			krb5_warnx(context, "samba_kdc_fetch: self krbtgt message2entry failed");
+			return ret;
 		}
-		return ret;
+
+		samba_kdc_cache_store(context, kdc_db_ctx, cache_key, usn,
+				      entry_ex);
+		return 0;
 
 	} else {
 		enum trust_direction direction = UNKNOWN;
@@ -2008,6 +2482,15 @@ static krb5_error_code samba_kdc_fetch_server(krb5_context context,
 	krb5_error_code ret;
 	struct ldb_dn *realm_dn;
 	struct ldb_message *msg;
+	char *cache_key;
+	uint64_t usn;
+
+	cache_key = samba_kdc_cache_key(mem_ctx, context, principal,
+					SAMBA_KDC_ENT_TYPE_SERVER, flags, 0);
+	if (samba_kdc_cache_fetch(context, kdc_db_ctx, cache_key,
+				  entry_ex, &usn)) {
+		return 0;
+	}
 
 	ret = samba_kdc_lookup_server(context, kdc_db_ctx, mem_ctx, principal,
 				      flags, server_attrs, &realm_dn, &msg);
@@ -2021,9 +2504,12 @@ static krb5_error_code samba_kdc_fetch_server(krb5_context context,
 				      realm_dn, msg, entry_ex);
 	if (ret != 0) {
 		krb5_warnx(context, "samba_kdc_fetch: message2entry failed");
+		return ret;
 	}
 
-	return ret;
+	samba_kdc_cache_store(context, kdc_db_ctx, cache_key, usn, entry_ex);
+
+	return 0;
 }
 
 static krb5_error_code samba_kdc_lookup_realm(krb5_context context,
@@ -2779,6 +3265,9 @@ NTSTATUS samba_kdc_setup_db_ctx(TALLOC_CTX *mem_ctx, struct samba_kdc_base_conte
 		kdc_db_ctx->my_krbtgt_number = 0;
 		talloc_free(msg);
 	}
+
+	samba_kdc_cache_init(kdc_db_ctx);
+
 	*kdc_db_ctx_out = kdc_db_ctx;
 	return NT_STATUS_OK;
 }
@@ -56,5 +56,17 @@ samba_kdc_check_s4u2proxy(krb5_context context,
 			  struct samba_kdc_entry *skdc_entry,
 			  krb5_const_principal target_principal);
 
+struct samba_kdc_entry_cache_stats {
+	size_t num_entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t expired;
+	uint64_t changed;
+	uint64_t evicted;
+};
+
+bool samba_kdc_entry_cache_stats(struct samba_kdc_db_context *kdc_db_ctx,
+				 struct samba_kdc_entry_cache_stats *stats);
+
 NTSTATUS samba_kdc_setup_db_ctx(TALLOC_CTX *mem_ctx, struct samba_kdc_base_context *base_ctx,
 				struct samba_kdc_db_context **kdc_db_ctx_out);
@@ -36,12 +36,14 @@ struct samba_kdc_base_context {
 };
 
 struct samba_kdc_seq;
+struct samba_kdc_entry_cache;
 
 struct samba_kdc_db_context {
 	struct tevent_context *ev_ctx;
 	struct loadparm_context *lp_ctx;
 	struct ldb_context *samdb;
 	struct samba_kdc_seq *seq_ctx;
+	struct samba_kdc_entry_cache *entry_cache;
 	bool rodc;
 	unsigned int my_krbtgt_number;
 	struct ldb_dn *krbtgt_dn;
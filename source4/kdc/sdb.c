@@ -63,6 +63,7 @@ static void free_sdb_key(struct sdb_key *k)
 
 	if (k->salt) {
 		smb_krb5_free_data_contents(NULL, &k->salt->salt);
+		free(k->salt);
 	}
 
 	ZERO_STRUCTP(k);
@@ -89,13 +90,178 @@ void free_sdb_entry(struct sdb_entry *s)
 	if (s->modified_by) {
 		krb5_free_principal(NULL, s->modified_by->principal);
 	}
+	SAFE_FREE(s->modified_by);
 	SAFE_FREE(s->valid_start);
 	SAFE_FREE(s->valid_end);
 	SAFE_FREE(s->pw_end);
+	SAFE_FREE(s->max_life);
+	SAFE_FREE(s->max_renew);
 
 	ZERO_STRUCTP(s);
 }
 
+static int sdb_copy_time(const time_t *s, time_t **d)
+{
+	if (s == NULL) {
+		*d = NULL;
+		return 0;
+	}
+	*d = malloc(sizeof(time_t));
+	if (*d == NULL) {
+		return ENOMEM;
+	}
+	**d = *s;
+	return 0;
+}
+
+static int sdb_copy_uint(const unsigned int *s, unsigned int **d)
+{
+	if (s == NULL) {
+		*d = NULL;
+		return 0;
+	}
+	*d = malloc(sizeof(unsigned int));
+	if (*d == NULL) {
+		return ENOMEM;
+	}
+	**d = *s;
+	return 0;
+}
+
+static int sdb_copy_principal(krb5_context context,
+			      krb5_const_principal s,
+			      krb5_principal *d)
+{
+	if (s == NULL) {
+		*d = NULL;
+		return 0;
+	}
+	return krb5_copy_principal(context, s, d);
+}
+
+static int sdb_copy_key(krb5_context context,
+			const struct sdb_key *s,
+			struct sdb_key *d)
+{
+	int ret;
+
+	ret = sdb_copy_uint(s->mkvno, &d->mkvno);
+	if (ret != 0) {
+		return ret;
+	}
+
+	ret = krb5_copy_keyblock_contents(context, &s->key, &d->key);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (s->salt != NULL) {
+		d->salt = calloc(1, sizeof(struct sdb_salt));
+		if (d->salt == NULL) {
+			return ENOMEM;
+		}
+		d->salt->type = s->salt->type;
+		ret = smb_krb5_copy_data_contents(&d->salt->salt,
+						  s->salt->salt.data,
+						  s->salt->salt.length);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Make a deep copy of an sdb_entry, to be freed with free_sdb_entry()
+ * and krb5_free_keyblock_contents() on the keys, as sdb_free_entry()
+ * does.
+ */
+int sdb_entry_copy(krb5_context context,
+		   const struct sdb_entry *s,
+		   struct sdb_entry *d)
+{
+	unsigned int i;
+	int ret;
+
+	ZERO_STRUCTP(d);
+
+	d->kvno = s->kvno;
+	d->flags = s->flags;
+	d->created_by.time = s->created_by.time;
+
+	ret = sdb_copy_principal(context, s->principal, &d->principal);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	if (s->keys.len > 0) {
+		d->keys.val = calloc(s->keys.len, sizeof(struct sdb_key));
+		if (d->keys.val == NULL) {
+			ret = ENOMEM;
+			goto fail;
+		}
+		d->keys.len = s->keys.len;
+		for (i = 0; i < s->keys.len; i++) {
+			ret = sdb_copy_key(context, &s->keys.val[i],
+					   &d->keys.val[i]);
+			if (ret != 0) {
+				goto fail;
+			}
+		}
+	}
+
+	ret = sdb_copy_principal(context, s->created_by.principal,
+				 &d->created_by.principal);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	if (s->modified_by != NULL) {
+		d->modified_by = calloc(1, sizeof(struct sdb_event));
+		if (d->modified_by == NULL) {
+			ret = ENOMEM;
+			goto fail;
+		}
+		d->modified_by->time = s->modified_by->time;
+		ret = sdb_copy_principal(context, s->modified_by->principal,
+					 &d->modified_by->principal);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
+	ret = sdb_copy_time(s->valid_start, &d->valid_start);
+	if (ret != 0) {
+		goto fail;
+	}
+	ret = sdb_copy_time(s->valid_end, &d->valid_end);
+	if (ret != 0) {
+		goto fail;
+	}
+	ret = sdb_copy_time(s->pw_end, &d->pw_end);
+	if (ret != 0) {
+		goto fail;
+	}
+	ret = sdb_copy_uint(s->max_life, &d->max_life);
+	if (ret != 0) {
+		goto fail;
+	}
+	ret = sdb_copy_uint(s->max_renew, &d->max_renew);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	for (i = 0; i < d->keys.len; i++) {
+		krb5_free_keyblock_contents(NULL, &d->keys.val[i].key);
+	}
+	free_sdb_entry(d);
+	return ret;
+}
+
 struct SDBFlags int2SDBFlags(unsigned n)
 {
 	struct SDBFlags flags;
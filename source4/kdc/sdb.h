@@ -117,6 +117,9 @@ struct sdb_entry_ex {
 
 void sdb_free_entry(struct sdb_entry_ex *e);
 void free_sdb_entry(struct sdb_entry *s);
+int sdb_entry_copy(krb5_context context,
+		   const struct sdb_entry *s,
+		   struct sdb_entry *d);
 struct SDBFlags int2SDBFlags(unsigned n);
 
 #endif /* _KDC_SDB_H_ */
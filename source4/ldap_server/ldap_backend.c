@@ -30,6 +30,7 @@
 #include <ldb_errors.h>
 #include <ldb_module.h>
 #include "ldb_wrap.h"
+#include "libcli/ldap/ldap_proto.h"
 
 static int map_ldb_error(TALLOC_CTX *mem_ctx, int ldb_err,
 	const char *add_err_string, const char **errstring)
@@ -258,6 +259,150 @@ void ldapsrv_queue_reply(struct ldapsrv_call *call, struct ldapsrv_reply *reply)
 	DLIST_ADD_END(call->replies, reply);
 }
 
+/*
+  ASN.1 encode a reply into reply->blob, unless that was already done,
+  and free the decoded form
+*/
+bool ldapsrv_encode_reply(struct ldapsrv_reply *reply)
+{
+	bool ok;
+
+	if (reply->msg == NULL) {
+		return true;
+	}
+
+	ok = ldap_encode(reply->msg, samba_ldap_control_handlers(),
+			 &reply->blob, reply);
+	if (!ok) {
+		return false;
+	}
+
+	TALLOC_FREE(reply->msg);
+	return true;
+}
+
+struct ldapsrv_search_state {
+	struct ldapsrv_call *call;
+	struct ldb_result *res;
+	/* the encoded entries, queued on the call once the search succeeded */
+	struct ldapsrv_reply *replies;
+	size_t replies_size;
+	int extended_type;
+	bool attributesonly;
+};
+
+/*
+  Convert each entry into its LDAP form and encode it as soon as ldb
+  returns it, so that we don't need to keep the whole ldb result and
+  the encoded response in memory at the same time.
+*/
+static int ldapsrv_search_callback(struct ldb_request *req,
+				   struct ldb_reply *ares)
+{
+	struct ldapsrv_search_state *state =
+		talloc_get_type_abort(req->context,
+		struct ldapsrv_search_state);
+	struct ldapsrv_call *call = state->call;
+	struct ldb_result *res = state->res;
+	struct ldb_message *msg;
+	struct ldap_SearchResEntry *ent;
+	struct ldapsrv_reply *ent_r;
+	size_t max_size = call->conn->limits.max_search_response_size;
+	unsigned int j, n;
+
+	if (!ares) {
+		return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+	}
+	if (ares->error != LDB_SUCCESS) {
+		return ldb_request_done(req, ares->error);
+	}
+
+	switch (ares->type) {
+	case LDB_REPLY_ENTRY:
+		ent_r = ldapsrv_init_reply(call, LDAP_TAG_SearchResultEntry);
+		if (ent_r == NULL) {
+			return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+		}
+
+		/* Better to have the whole message kept here,
+		 * than to find someone further up didn't put
+		 * a value in the right spot in the talloc tree */
+		msg = talloc_steal(ent_r, ares->message);
+
+		ent = &ent_r->msg->r.SearchResultEntry;
+		ent->dn = ldb_dn_get_extended_linearized(ent_r, msg->dn,
+							 state->extended_type);
+		ent->num_attributes = 0;
+		ent->attributes = NULL;
+		if (msg->num_elements != 0) {
+			ent->num_attributes = msg->num_elements;
+			ent->attributes = talloc_array(ent_r,
+						       struct ldb_message_element,
+						       ent->num_attributes);
+			if (ent->attributes == NULL) {
+				talloc_free(ent_r);
+				return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+			}
+		}
+		for (j=0; j < ent->num_attributes; j++) {
+			ent->attributes[j].name = msg->elements[j].name;
+			ent->attributes[j].num_values = 0;
+			ent->attributes[j].values = NULL;
+			if (state->attributesonly && (msg->elements[j].num_values == 0)) {
+				continue;
+			}
+			ent->attributes[j].num_values = msg->elements[j].num_values;
+			ent->attributes[j].values = msg->elements[j].values;
+		}
+
+		if (!ldapsrv_encode_reply(ent_r)) {
+			DEBUG(0,("Failed to encode ldap search entry for %s\n",
+				 ldb_dn_get_linearized(msg->dn)));
+			talloc_free(ent_r);
+			return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+		}
+		/* the ldb message is no longer needed */
+		TALLOC_FREE(msg);
+		talloc_free(ares);
+
+		state->replies_size += ent_r->blob.length;
+		DLIST_ADD_END(state->replies, ent_r);
+		res->count++;
+
+		if (max_size != 0 && state->replies_size > max_size) {
+			DEBUG(2,("SearchRequest: response exceeds "
+				 "'ldap server:max search response size' "
+				 "(%zu bytes)\n", max_size));
+			return ldb_request_done(req, LDB_ERR_ADMIN_LIMIT_EXCEEDED);
+		}
+		return LDB_SUCCESS;
+
+	case LDB_REPLY_REFERRAL:
+		if (res->refs) {
+			for (n = 0; res->refs[n]; n++) /*noop*/ ;
+		} else {
+			n = 0;
+		}
+
+		res->refs = talloc_realloc(res, res->refs, char *, n + 2);
+		if (! res->refs) {
+			return ldb_request_done(req, LDB_ERR_OPERATIONS_ERROR);
+		}
+
+		res->refs[n] = talloc_move(res->refs, &ares->referral);
+		res->refs[n + 1] = NULL;
+		break;
+
+	case LDB_REPLY_DONE:
+		res->controls = talloc_move(res, &ares->controls);
+		talloc_free(ares);
+		return ldb_request_done(req, LDB_SUCCESS);
+	}
+
+	talloc_free(ares);
+	return LDB_SUCCESS;
+}
+
 static NTSTATUS ldapsrv_unwilling(struct ldapsrv_call *call, int error)
 {
 	struct ldapsrv_reply *reply;
@@ -501,9 +646,9 @@ static int ldapsrv_rename_with_controls(struct ldapsrv_call *call,
 static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 {
 	struct ldap_SearchRequest *req = &call->request->r.SearchRequest;
-	struct ldap_SearchResEntry *ent;
 	struct ldap_Result *done;
 	struct ldapsrv_reply *ent_r, *done_r;
+	struct ldapsrv_search_state *state = NULL;
 	TALLOC_CTX *local_ctx;
 	struct ldb_context *samdb = talloc_get_type(call->conn->ldb, struct ldb_context);
 	struct ldb_dn *basedn;
@@ -520,8 +665,7 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	int success_limit = 1;
 	int result = -1;
 	int ldb_ret = -1;
-	unsigned int i, j;
-	int extended_type = 1;
+	unsigned int i;
 
 	DEBUG(10, ("SearchRequest"));
 	DEBUGADD(10, (" basedn: %s", req->basedn));
@@ -579,11 +723,18 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	res = talloc_zero(local_ctx, struct ldb_result);
 	NT_STATUS_HAVE_NO_MEMORY(res);
 
+	state = talloc_zero(local_ctx, struct ldapsrv_search_state);
+	NT_STATUS_HAVE_NO_MEMORY(state);
+	state->call = call;
+	state->res = res;
+	state->extended_type = 1;
+	state->attributesonly = req->attributesonly;
+
 	ldb_ret = ldb_build_search_req_ex(&lreq, samdb, local_ctx,
 					  basedn, scope,
 					  req->tree, attrs,
 					  call->request->controls,
-					  res, ldb_search_default_callback,
+					  state, ldapsrv_search_callback,
 					  NULL);
 
 	if (ldb_ret != LDB_SUCCESS) {
@@ -612,9 +763,9 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	if (extended_dn_control) {
 		if (extended_dn_control->data) {
 			extended_dn_decoded = talloc_get_type(extended_dn_control->data, struct ldb_extended_dn_control);
-			extended_type = extended_dn_decoded->type;
+			state->extended_type = extended_dn_decoded->type;
 		} else {
-			extended_type = 0;
+			state->extended_type = 0;
 		}
 	}
 
@@ -660,38 +811,9 @@ static NTSTATUS ldapsrv_SearchRequest(struct ldapsrv_call *call)
 	ldb_ret = ldb_wait(lreq->handle, LDB_WAIT_ALL);
 
 	if (ldb_ret == LDB_SUCCESS) {
-		for (i = 0; i < res->count; i++) {
-			ent_r = ldapsrv_init_reply(call, LDAP_TAG_SearchResultEntry);
-			NT_STATUS_HAVE_NO_MEMORY(ent_r);
-
-			/* Better to have the whole message kept here,
-			 * than to find someone further up didn't put
-			 * a value in the right spot in the talloc tree */
-			talloc_steal(ent_r, res->msgs[i]);
-			
-			ent = &ent_r->msg->r.SearchResultEntry;
-			ent->dn = ldb_dn_get_extended_linearized(ent_r, res->msgs[i]->dn, extended_type);
-			ent->num_attributes = 0;
-			ent->attributes = NULL;
-			if (res->msgs[i]->num_elements == 0) {
-				goto queue_reply;
-			}
-			ent->num_attributes = res->msgs[i]->num_elements;
-			ent->attributes = talloc_array(ent_r, struct ldb_message_element, ent->num_attributes);
-			NT_STATUS_HAVE_NO_MEMORY(ent->attributes);
-			for (j=0; j < ent->num_attributes; j++) {
-				ent->attributes[j].name = res->msgs[i]->elements[j].name;
-				ent->attributes[j].num_values = 0;
-				ent->attributes[j].values = NULL;
-				if (req->attributesonly && (res->msgs[i]->elements[j].num_values == 0)) {
-					continue;
-				}
-				ent->attributes[j].num_values = res->msgs[i]->elements[j].num_values;
-				ent->attributes[j].values = res->msgs[i]->elements[j].values;
-			}
-queue_reply:
-			ldapsrv_queue_reply(call, ent_r);
-		}
+		/* the entries were already encoded by ldapsrv_search_callback() */
+		DLIST_CONCATENATE(call->replies, state->replies);
+		state->replies = NULL;
 
 		if (call->notification.busy) {
 			/* Move/Add it to the end */
@@ -733,6 +855,13 @@ queue_reply:
 	}
 
 reply:
+	/* the entries of a failed search are not sent */
+	while (state != NULL && state->replies != NULL) {
+		ent_r = state->replies;
+		DLIST_REMOVE(state->replies, ent_r);
+		talloc_free(ent_r);
+	}
+
 	DLIST_REMOVE(call->conn->pending_calls, call);
 	call->notification.busy = false;
 
@@ -171,6 +171,9 @@ static int ldapsrv_load_limits(struct ldapsrv_connection *conn)
 	conn->limits.max_page_size = 1000;
 	conn->limits.max_notifications = 5;
 	conn->limits.search_timeout = 120;
+	conn->limits.max_search_response_size =
+		lpcfg_parm_ulonglong(conn->lp_ctx, NULL, "ldap server",
+				     "max search response size", 0);
 
 
 	tmp_ctx = talloc_new(conn);
@@ -576,6 +579,8 @@ static void ldapsrv_call_process_done(struct tevent_req *subreq)
 	struct ldapsrv_connection *conn = call->conn;
 	NTSTATUS status;
 	DATA_BLOB blob = data_blob_null;
+	struct ldapsrv_reply *reply;
+	size_t length = 0;
 
 	conn->active_call = NULL;
 
@@ -586,29 +591,41 @@ static void ldapsrv_call_process_done(struct tevent_req *subreq)
 		return;
 	}
 
-	/* build all the replies into a single blob */
-	while (call->replies) {
-		DATA_BLOB b;
-		bool ret;
-
-		if (!ldap_encode(call->replies->msg, samba_ldap_control_handlers(), &b, call)) {
+	/*
+	 * Encode the replies that are not encoded yet (search
+	 * entries are encoded as they are returned by ldb) and work
+	 * out the total size, so we can build the outgoing blob with
+	 * a single allocation.
+	 */
+	for (reply = call->replies; reply != NULL; reply = reply->next) {
+		if (!ldapsrv_encode_reply(reply)) {
 			DEBUG(0,("Failed to encode ldap reply of type %d\n",
-				 call->replies->msg->type));
+				 reply->msg->type));
 			ldapsrv_terminate_connection(conn, "ldap_encode failed");
 			return;
 		}
+		length += reply->blob.length;
+	}
 
-		ret = data_blob_append(call, &blob, b.data, b.length);
-		data_blob_free(&b);
-
-		talloc_set_name_const(blob.data, "Outgoing, encoded LDAP packet");
-
-		if (!ret) {
-			ldapsrv_terminate_connection(conn, "data_blob_append failed");
+	if (length != 0) {
+		blob = data_blob_talloc(call, NULL, length);
+		if (blob.data == NULL) {
+			ldapsrv_terminate_connection(conn, "data_blob_talloc failed");
 			return;
 		}
+		talloc_set_name_const(blob.data, "Outgoing, encoded LDAP packet");
+		length = 0;
+	}
+
+	/* build all the replies into a single blob */
+	while (call->replies) {
+		reply = call->replies;
+
+		memcpy(blob.data + length, reply->blob.data, reply->blob.length);
+		length += reply->blob.length;
 
-		DLIST_REMOVE(call->replies, call->replies);
+		DLIST_REMOVE(call->replies, reply);
+		TALLOC_FREE(reply);
 	}
 
 	if (blob.length == 0) {
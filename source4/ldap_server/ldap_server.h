@@ -53,6 +53,8 @@ struct ldapsrv_connection {
 		int max_page_size;
 		int max_notifications;
 		int search_timeout;
+		/* maximum encoded size of one search response, 0 = unlimited */
+		size_t max_search_response_size;
 		struct timeval endtime;
 		const char *reason;
 	} limits;
@@ -69,6 +71,8 @@ struct ldapsrv_call {
 	struct ldapsrv_reply {
 		struct ldapsrv_reply *prev, *next;
 		struct ldap_message *msg;
+		/* the ASN.1 encoded reply, once msg has been encoded */
+		DATA_BLOB blob;
 	} *replies;
 	struct iovec out_iov;
 
@@ -348,6 +348,65 @@ void imessaging_dgm_unref_all(void)
 	}
 }
 
+/*
+ * Rebind the messaging contexts of the process we were forked from
+ * (pid) to this process, so a forked worker receives its own messages
+ * rather than those of its parent. The irpc names are registered for
+ * the new server id as well.
+ */
+int imessaging_reinit_all(pid_t pid)
+{
+	struct imessaging_context *msg = NULL;
+	int ret;
+
+	imessaging_dgm_unref_all();
+
+	for (msg = msg_ctxs; msg != NULL; msg = msg->next) {
+		struct server_id server_id = msg->server_id;
+
+		if (server_id.pid != pid) {
+			continue;
+		}
+		server_id.pid = getpid();
+
+		msg->msg_dgm_ref = messaging_dgm_ref(
+			msg, msg->ev, &server_id.unique_id, msg->sock_dir,
+			msg->lock_dir, imessaging_dgm_recv, msg, &ret);
+		if (msg->msg_dgm_ref == NULL) {
+			return ret;
+		}
+
+		msg->server_id = server_id;
+
+		ret = server_id_db_reinit_names(msg->names, server_id);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Stop receiving messages in the messaging contexts of this process
+ * and unpublish their irpc names, for a process that has handed its
+ * work over to forked workers.
+ */
+void imessaging_release_all(void)
+{
+	struct imessaging_context *msg = NULL;
+	pid_t pid = getpid();
+
+	imessaging_dgm_unref_all();
+
+	for (msg = msg_ctxs; msg != NULL; msg = msg->next) {
+		if (msg->server_id.pid != pid) {
+			continue;
+		}
+		server_id_db_prune_all(msg->names);
+	}
+}
+
 /*
   create the listening socket and setup the dispatcher
 */
@@ -209,6 +209,7 @@ static WERROR get_nc_changes_build_object(struct drsuapi_DsReplicaObjectListItem
 	uint32_t rid = 0;
 	enum ndr_err_code ndr_err;
 	uint32_t *attids;
+	const struct dsdb_attribute **attr_sas;
 	const char *rdn;
 	const struct dsdb_attribute *rdn_sa;
 	unsigned int instanceType;
@@ -273,6 +274,16 @@ static WERROR get_nc_changes_build_object(struct drsuapi_DsReplicaObjectListItem
 
 	obj->meta_data_ctr = talloc(obj, struct drsuapi_DsReplicaMetaDataCtr);
 	attids = talloc_array(obj, uint32_t, md.ctr.ctr1.count);
+	/*
+	 * remember the schema attribute found while filtering the
+	 * meta data, so the conversion loop below does not need to
+	 * search the schema a second time for every attribute
+	 */
+	attr_sas = talloc_array(obj, const struct dsdb_attribute *,
+				md.ctr.ctr1.count);
+	if (attids == NULL || attr_sas == NULL) {
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
 
 	obj->object.identifier = get_object_identifier(obj, msg);
 	if (obj->object.identifier == NULL) {
@@ -342,6 +353,7 @@ static WERROR get_nc_changes_build_object(struct drsuapi_DsReplicaObjectListItem
 		obj->meta_data_ctr->meta_data[n].originating_invocation_id = md.ctr.ctr1.array[i].originating_invocation_id;
 		obj->meta_data_ctr->meta_data[n].originating_usn = md.ctr.ctr1.array[i].originating_usn;
 		attids[n] = md.ctr.ctr1.array[i].attid;
+		attr_sas[n] = sa;
 		n++;
 	}
 
@@ -380,13 +392,7 @@ static WERROR get_nc_changes_build_object(struct drsuapi_DsReplicaObjectListItem
 	for (i=0; i<obj->object.attribute_ctr.num_attributes; i++) {
 		struct ldb_message_element *el;
 		WERROR werr;
-		const struct dsdb_attribute *sa;
-
-		sa = dsdb_attribute_by_attributeID_id(schema, attids[i]);
-		if (!sa) {
-			DEBUG(0,("Unable to find attributeID %u in schema\n", attids[i]));
-			return WERR_DS_DRA_INTERNAL_ERROR;
-		}
+		const struct dsdb_attribute *sa = attr_sas[i];
 
 		el = ldb_msg_find_element(msg, sa->lDAPDisplayName);
 		if (el == NULL) {
@@ -721,6 +727,7 @@ struct drsuapi_changed_objects {
 	struct ldb_dn *dn;
 	struct GUID guid;
 	uint64_t usn;
+	bool is_nc_root;
 };
 
 /*
@@ -735,21 +742,19 @@ static int site_res_cmp_anc_order(struct drsuapi_changed_objects *m1,
 
 /*
   sort the objects we send first by uSNChanged
+
+  The NC root always goes first. Whether an object is the NC root is
+  worked out once while collecting the changes, so that the sort does
+  not need to do two DN comparisons for every pair it looks at.
+  uSNChanged is unique per object, so the DN comparison below is only
+  a tie-breaker that should never normally be reached.
  */
 static int site_res_cmp_usn_order(struct drsuapi_changed_objects *m1,
 				  struct drsuapi_changed_objects *m2,
 				  struct drsuapi_getncchanges_state *getnc_state)
 {
-	int ret;
-
-	ret = ldb_dn_compare(getnc_state->ncRoot_dn, m1->dn);
-	if (ret == 0) {
-		return -1;
-	}
-
-	ret = ldb_dn_compare(getnc_state->ncRoot_dn, m2->dn);
-	if (ret == 0) {
-		return 1;
+	if (m1->is_nc_root != m2->is_nc_root) {
+		return m1->is_nc_root ? -1 : 1;
 	}
 
 	if (m1->usn == m2->usn) {
@@ -2023,6 +2028,7 @@ allowed:
 	if (getnc_state->guids == NULL) {
 		const char *extra_filter;
 		struct ldb_result *search_res = NULL;
+		bool found_nc_root = false;
 
 		extra_filter = lpcfg_parm_string(dce_call->conn->dce_ctx->lp_ctx, NULL, "drs", "object filter");
 
@@ -2066,6 +2072,13 @@ allowed:
 			changes[i].dn = search_res->msgs[i]->dn;
 			changes[i].guid = samdb_result_guid(search_res->msgs[i], "objectGUID");
 			changes[i].usn = ldb_msg_find_attr_as_uint64(search_res->msgs[i], "uSNChanged", 0);
+			changes[i].is_nc_root = false;
+
+			if (!found_nc_root &&
+			    ldb_dn_compare(getnc_state->ncRoot_dn, changes[i].dn) == 0) {
+				changes[i].is_nc_root = true;
+				found_nc_root = true;
+			}
 
 			if (changes[i].usn > getnc_state->max_usn) {
 				getnc_state->max_usn = changes[i].usn;
@@ -33,7 +33,9 @@
  * with a comment and maybe update struct process_model_critical_sizes.
  */
 /* version 1 - initial version - metze */
-#define PROCESS_MODEL_VERSION 1
+/* version 2 - add terminate_task, so a model can tell the end of a task
+ *             from the end of a connection */
+#define PROCESS_MODEL_VERSION 2
 
 /* the process model operations structure - contains function pointers to 
    the model-specific implementations of each operation */
@@ -67,6 +69,11 @@ struct model_ops {
 	void (*terminate)(struct tevent_context *, struct loadparm_context *lp_ctx,
 			  const char *reason);
 
+	/* function to terminate a task, terminate is used if this is NULL */
+	void (*terminate_task)(struct tevent_context *,
+			       struct loadparm_context *lp_ctx,
+			       const char *reason);
+
 	/* function to set a title for the connection or task */
 	void (*set_title)(struct tevent_context *, const char *title);
 };
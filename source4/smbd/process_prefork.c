@@ -0,0 +1,560 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   process model: prefork (n client connections per process)
+
+   Copyright (C) Andrew Tridgell 1992-2005
+   Copyright (C) James J Myers 2003 <myersjj@samba.org>
+   Copyright (C) Stefan (metze) Metzmacher 2004
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Each task is started in its own process, as in the standard process
+ * model.  For the services listed in "prefork:services" that process
+ * then becomes a master that forks "prefork:children" workers once the
+ * task has set up its listening sockets.  The workers inherit those
+ * sockets and accept connections on them independently, so the kernel
+ * spreads the load over the workers and no fork() is needed per
+ * connection.
+ *
+ * The master only supervises the workers and starts a new one when a
+ * worker dies.  It never runs the event loop of the task, so it can
+ * always fork a fresh worker from the state the task was in right
+ * after its initialisation.
+ */
+
+#include "includes.h"
+#include "lib/events/events.h"
+#include "../lib/util/dlinklist.h"
+#include "lib/messaging/irpc.h"
+#include "smbd/process_model.h"
+#include "system/filesys.h"
+#include "cluster/cluster.h"
+#include "param/param.h"
+#include "ldb_wrap.h"
+
+/* the default number of worker processes per preforked service */
+#define PREFORK_DEFAULT_CHILDREN 4
+
+/* how long to wait before replacing a worker that has died */
+#define PREFORK_RESTART_DELAY 1
+
+/*
+ * the exit status of a worker whose task was terminated, the master
+ * then takes the task and all the other workers down with it
+ */
+#define PREFORK_EXIT_TASK_TERMINATED 3
+
+struct prefork_master;
+
+struct prefork_child_state {
+	struct prefork_child_state *prev, *next;
+	struct prefork_master *master;
+	pid_t pid;
+	int from_child_fd;
+	struct tevent_fd *from_child_fde;
+};
+
+/*
+  state of a master process, only valid in the master itself
+*/
+struct prefork_master {
+	/* the event context of the task, which the workers run */
+	struct tevent_context *task_ev;
+	/* the event context the master supervises the workers with */
+	struct tevent_context *ev;
+	const char *service_name;
+	pid_t pid;
+	/* the workers watch master_pipe[0] for EOF */
+	int master_pipe[2];
+	struct prefork_child_state *children;
+	unsigned int num_children;
+};
+
+NTSTATUS process_model_prefork_init(void);
+
+/* we hold a pipe open in the parent, and the any child
+   processes wait for EOF on that pipe. This ensures that
+   children die when the parent dies */
+static int child_pipe[2] = { -1, -1 };
+
+/* true in the workers of a preforked service */
+static bool prefork_worker;
+
+/*
+  called when the process model is selected
+*/
+static void prefork_model_init(void)
+{
+	int rc;
+
+	rc = pipe(child_pipe);
+	if (rc < 0) {
+		smb_panic("Failed to initialze pipe!");
+	}
+}
+
+/*
+  handle EOF on the parent-to-all-children pipe, or on the
+  master-to-workers pipe, in the child
+*/
+static void prefork_pipe_handler(struct tevent_context *event_ctx,
+				 struct tevent_fd *fde,
+				 uint16_t flags, void *private_data)
+{
+	DEBUG(10,("Child %d exiting\n", (int)getpid()));
+	exit(0);
+}
+
+/*
+  called when a listening socket becomes readable.
+
+  All the workers of a service share the listening sockets, so the
+  connection is accepted and handled in the calling process.
+*/
+static void prefork_accept_connection(struct tevent_context *ev,
+				      struct loadparm_context *lp_ctx,
+				      struct socket_context *listen_socket,
+				      void (*new_conn)(struct tevent_context *,
+						       struct loadparm_context *,
+						       struct socket_context *,
+						       struct server_id , void *),
+				      void *private_data)
+{
+	NTSTATUS status;
+	struct socket_context *connected_socket;
+	pid_t pid = getpid();
+
+	/* accept an incoming connection. */
+	status = socket_accept(listen_socket, &connected_socket);
+	if (NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES)) {
+		/* another worker got there first */
+		return;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0,("prefork_accept_connection: accept: %s\n",
+			 nt_errstr(status)));
+		/* this looks strange, but is correct. We need to throttle
+		   things until the system clears enough resources to
+		   handle this new socket */
+		sleep(1);
+		return;
+	}
+
+	talloc_steal(private_data, connected_socket);
+
+	/* the combination of pid/fd is unique system-wide */
+	new_conn(ev, lp_ctx, connected_socket,
+		 cluster_id(pid, socket_get_fd(connected_socket)), private_data);
+}
+
+static bool prefork_fork_worker(struct prefork_master *master);
+
+static void prefork_restart_worker(struct tevent_context *ev,
+				   struct tevent_timer *te,
+				   struct timeval current_time,
+				   void *private_data);
+
+/*
+  start a new worker after a while.
+
+  Don't restart a worker straight away, if it died while starting up
+  or the fork failed we would otherwise spin forking new ones.
+*/
+static void prefork_schedule_restart(struct prefork_master *master)
+{
+	struct tevent_timer *te;
+
+	te = tevent_add_timer(master->ev, master,
+			      timeval_current_ofs(PREFORK_RESTART_DELAY, 0),
+			      prefork_restart_worker, master);
+	if (te == NULL) {
+		DEBUG(0, ("Failed to schedule restart of %s worker\n",
+			  master->service_name));
+	}
+}
+
+static void prefork_restart_worker(struct tevent_context *ev,
+				   struct tevent_timer *te,
+				   struct timeval current_time,
+				   void *private_data)
+{
+	struct prefork_master *master =
+		talloc_get_type_abort(private_data, struct prefork_master);
+
+	if (!prefork_fork_worker(master)) {
+		prefork_schedule_restart(master);
+	}
+}
+
+/*
+  handle EOF on a worker pipe in the master, so we know when a worker
+  terminates without using SIGCHLD or waiting on all possible pids.
+*/
+static void prefork_child_pipe_handler(struct tevent_context *ev,
+				       struct tevent_fd *fde,
+				       uint16_t flags,
+				       void *private_data)
+{
+	struct prefork_child_state *state
+		= talloc_get_type_abort(private_data, struct prefork_child_state);
+	struct prefork_master *master = state->master;
+	int status = 0;
+	pid_t pid;
+
+	/* the child has closed the pipe, assume its dead */
+	errno = 0;
+	pid = waitpid(state->pid, &status, 0);
+
+	if (pid != state->pid) {
+		DEBUG(0, ("Error in waitpid() for worker %d (%s) - %s\n",
+			  (int)state->pid, master->service_name,
+			  strerror(errno)));
+	} else if (WIFEXITED(status)) {
+		status = WEXITSTATUS(status);
+		if (status == PREFORK_EXIT_TASK_TERMINATED) {
+			/*
+			 * The task itself has gone down, our exit
+			 * closes master_pipe and ends the other workers
+			 */
+			DEBUG(1, ("Worker %d terminated the %s task\n",
+				  (int)state->pid, master->service_name));
+			exit(0);
+		}
+		DEBUG(1, ("Worker %d (%s) exited with status %d\n",
+			  (int)state->pid, master->service_name, status));
+	} else if (WIFSIGNALED(status)) {
+		status = WTERMSIG(status);
+		DEBUG(0, ("Worker %d (%s) terminated with signal %d\n",
+			  (int)state->pid, master->service_name, status));
+	}
+
+	DLIST_REMOVE(master->children, state);
+	master->num_children--;
+	TALLOC_FREE(state);
+
+	prefork_schedule_restart(master);
+}
+
+/*
+  the main loop of a worker, running the event context of the task
+*/
+_NORETURN_ static void prefork_worker_loop(struct prefork_master *master)
+{
+	struct tevent_context *ev = master->task_ev;
+	struct prefork_child_state *state;
+	int ret;
+
+	prefork_worker = true;
+
+	/* we don't supervise the other workers */
+	for (state = master->children; state != NULL; state = state->next) {
+		close(state->from_child_fd);
+	}
+	close(master->master_pipe[1]);
+
+	/* ldb/tdb need special fork handling */
+	ldb_wrap_fork_hook();
+
+	/*
+	 * Take over the messaging contexts of the task, the master
+	 * has stopped listening on them
+	 */
+	ret = imessaging_reinit_all(master->pid);
+	if (ret != 0) {
+		DEBUG(0, ("Failed to re-initialise messaging in %s worker - "
+			  "%s\n", master->service_name, strerror(ret)));
+		exit(1);
+	}
+	task_server_reinit_all(master->pid);
+
+	tevent_add_fd(ev, ev, master->master_pipe[0], TEVENT_FD_READ,
+		      prefork_pipe_handler, NULL);
+
+	setproctitle("task[%s] pre-forked worker server_id[%d]",
+		     master->service_name, (int)getpid());
+
+	tevent_loop_wait(ev);
+
+	talloc_free(ev);
+	exit(0);
+}
+
+/*
+  fork a new worker of a master, the worker never returns
+*/
+static bool prefork_fork_worker(struct prefork_master *master)
+{
+	struct prefork_child_state *state;
+	int parent_child_pipe[2];
+	pid_t pid;
+	int ret;
+
+	state = talloc_zero(master, struct prefork_child_state);
+	if (state == NULL) {
+		return false;
+	}
+	state->master = master;
+
+	ret = pipe(parent_child_pipe);
+	if (ret == -1) {
+		DEBUG(0, ("Failed to create master-worker pipe for %s\n",
+			  master->service_name));
+		TALLOC_FREE(state);
+		return false;
+	}
+
+	smb_set_close_on_exec(parent_child_pipe[0]);
+	smb_set_close_on_exec(parent_child_pipe[1]);
+
+	pid = fork();
+
+	if (pid == 0) {
+		/* this leaves parent_child_pipe[1] open */
+		close(parent_child_pipe[0]);
+		prefork_worker_loop(master);
+	}
+
+	close(parent_child_pipe[1]);
+
+	if (pid == -1) {
+		DEBUG(0, ("Failed to fork %s worker - %s\n",
+			  master->service_name, strerror(errno)));
+		close(parent_child_pipe[0]);
+		TALLOC_FREE(state);
+		return false;
+	}
+
+	state->pid = pid;
+	state->from_child_fd = parent_child_pipe[0];
+	state->from_child_fde = tevent_add_fd(master->ev, state,
+					      state->from_child_fd,
+					      TEVENT_FD_READ,
+					      prefork_child_pipe_handler,
+					      state);
+	if (state->from_child_fde == NULL) {
+		/* the worker keeps running, we just don't restart it */
+		close(state->from_child_fd);
+		TALLOC_FREE(state);
+		return true;
+	}
+	tevent_fd_set_auto_close(state->from_child_fde);
+
+	DLIST_ADD_END(master->children, state);
+	master->num_children++;
+	return true;
+}
+
+/*
+  turn the task process into a master that hands the task over to a
+  pool of workers, this only returns if the workers could not be set up
+*/
+static void prefork_run_master(struct tevent_context *task_ev,
+			       struct loadparm_context *lp_ctx,
+			       const char *service_name)
+{
+	struct prefork_master *master;
+	int num_children;
+	int num_failed = 0;
+	int i, ret;
+
+	num_children = lpcfg_parm_int(lp_ctx, NULL, "prefork", "children",
+				      PREFORK_DEFAULT_CHILDREN);
+	if (num_children <= 0) {
+		return;
+	}
+
+	master = talloc_zero(NULL, struct prefork_master);
+	if (master == NULL) {
+		return;
+	}
+	master->task_ev = task_ev;
+	master->pid = getpid();
+	master->service_name = talloc_strdup(master, service_name);
+	if (master->service_name == NULL) {
+		TALLOC_FREE(master);
+		return;
+	}
+
+	master->ev = s4_event_context_init(master);
+	if (master->ev == NULL) {
+		TALLOC_FREE(master);
+		return;
+	}
+
+	ret = pipe(master->master_pipe);
+	if (ret == -1) {
+		DEBUG(0, ("Failed to create master pipe for %s\n",
+			  service_name));
+		TALLOC_FREE(master);
+		return;
+	}
+	smb_set_close_on_exec(master->master_pipe[0]);
+	smb_set_close_on_exec(master->master_pipe[1]);
+
+	for (i = 0; i < num_children; i++) {
+		if (!prefork_fork_worker(master)) {
+			num_failed++;
+		}
+	}
+
+	if (num_failed == num_children) {
+		/* the task process carries on serving on its own */
+		DEBUG(0, ("Failed to start any %s worker, not preforking\n",
+			  service_name));
+		close(master->master_pipe[0]);
+		close(master->master_pipe[1]);
+		TALLOC_FREE(master);
+		return;
+	}
+	for (i = 0; i < num_failed; i++) {
+		prefork_schedule_restart(master);
+	}
+
+	DEBUG(2, ("Started %u pre-forked workers for %s\n",
+		  master->num_children, service_name));
+
+	/* from now on the workers handle everything for the task */
+	imessaging_release_all();
+
+	tevent_add_fd(master->ev, master->ev, child_pipe[0], TEVENT_FD_READ,
+		      prefork_pipe_handler, NULL);
+
+	setproctitle("task[%s] pre-fork master server_id[%d]",
+		     service_name, (int)getpid());
+
+	tevent_loop_wait(master->ev);
+
+	exit(0);
+}
+
+/*
+  called to create a new server task
+*/
+static void prefork_new_task(struct tevent_context *ev,
+			     struct loadparm_context *lp_ctx,
+			     const char *service_name,
+			     void (*new_task)(struct tevent_context *, struct loadparm_context *lp_ctx, struct server_id , void *),
+			     void *private_data)
+{
+	const char **prefork_services;
+	pid_t pid;
+
+	pid = fork();
+
+	if (pid != 0) {
+		/* parent or error code ... go back to the event loop */
+		return;
+	}
+
+	pid = getpid();
+
+	/* this will free all the listening sockets and all state that
+	   is not associated with this new connection */
+	if (tevent_re_initialise(ev) != 0) {
+		smb_panic("Failed to re-initialise tevent after fork");
+	}
+
+	/* ldb/tdb need special fork handling */
+	ldb_wrap_fork_hook();
+
+	tevent_add_fd(ev, ev, child_pipe[0], TEVENT_FD_READ,
+		      prefork_pipe_handler, NULL);
+	if (child_pipe[1] != -1) {
+		close(child_pipe[1]);
+		child_pipe[1] = -1;
+	}
+
+	setproctitle("task %s server_id[%d]", service_name, (int)pid);
+
+	/* setup this new task.  Cluster ID is PID based for this process model */
+	new_task(ev, lp_ctx, cluster_id(pid, 0), private_data);
+
+	/*
+	 * Only services which can cope with several processes
+	 * accepting on the same sockets are preforked, everything
+	 * else stays in this single task process.
+	 */
+	prefork_services = lpcfg_parm_string_list(ev, lp_ctx, NULL,
+						  "prefork", "services", NULL);
+	if (prefork_services == NULL) {
+		prefork_services = str_list_make_v3_const(ev, "ldap kdc", NULL);
+	}
+	if (str_list_check_ci(prefork_services, service_name)) {
+		TALLOC_FREE(prefork_services);
+		prefork_run_master(ev, lp_ctx, service_name);
+	}
+	TALLOC_FREE(prefork_services);
+
+	/* we can't return to the top level here, as that event context is gone,
+	   so we now process events in the new event context until there are no
+	   more to process */
+	tevent_loop_wait(ev);
+
+	talloc_free(ev);
+	exit(0);
+}
+
+
+/* called when a connection goes down */
+static void prefork_terminate(struct tevent_context *ev,
+			      struct loadparm_context *lp_ctx,
+			      const char *reason)
+{
+	/*
+	 * Connections are handled inside the task process or its
+	 * workers, so unlike the standard process model we must not
+	 * exit here.
+	 */
+	DEBUG(3,("prefork_terminate: reason[%s]\n",reason));
+}
+
+/* called when a task goes down */
+_NORETURN_ static void prefork_terminate_task(struct tevent_context *ev,
+					      struct loadparm_context *lp_ctx,
+					      const char *reason)
+{
+	DEBUG(2,("prefork_terminate_task: reason[%s]\n",reason));
+
+	talloc_free(ev);
+
+	/* the master takes the whole task down when a worker ends it */
+	exit(prefork_worker ? PREFORK_EXIT_TASK_TERMINATED : 0);
+}
+
+/* called to set a title of a task or connection */
+static void prefork_set_title(struct tevent_context *ev, const char *title)
+{
+}
+
+static const struct model_ops prefork_ops = {
+	.name			= "prefork",
+	.model_init		= prefork_model_init,
+	.accept_connection	= prefork_accept_connection,
+	.new_task		= prefork_new_task,
+	.terminate		= prefork_terminate,
+	.terminate_task		= prefork_terminate_task,
+	.set_title		= prefork_set_title,
+};
+
+/*
+  initialise the prefork process model, registering ourselves with the
+  process model subsystem
+ */
+NTSTATUS process_model_prefork_init(void)
+{
+	return register_process_model(&prefork_ops);
+}
@@ -53,6 +53,14 @@ static void single_accept_connection(struct tevent_context *ev,
 
 	/* accept an incoming connection. */
 	status = socket_accept(listen_socket, &connected_socket);
+	if (NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES)) {
+		/*
+		 * The listening socket is shared with other
+		 * processes (see the prefork process model), and one
+		 * of them accepted the connection first.
+		 */
+		return;
+	}
 	if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(0,("single_accept_connection: accept: %s\n", nt_errstr(status)));
 		/* this looks strange, but is correct. 
@@ -125,6 +133,7 @@ const struct model_ops single_ops = {
 	.new_task               = single_new_task,
 	.accept_connection	= single_accept_connection,
 	.terminate              = single_terminate,
+	.terminate_task         = single_terminate,
 	.set_title		= single_set_title,
 };
 
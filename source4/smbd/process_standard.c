@@ -400,6 +400,7 @@ static const struct model_ops standard_ops = {
 	.accept_connection	= standard_accept_connection,
 	.new_task               = standard_new_task,
 	.terminate              = standard_terminate,
+	.terminate_task         = standard_terminate,
 	.set_title              = standard_set_title,
 };
 
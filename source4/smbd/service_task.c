@@ -24,6 +24,10 @@
 #include "lib/messaging/irpc.h"
 #include "param/param.h"
 #include "librpc/gen_ndr/ndr_irpc_c.h"
+#include "../lib/util/dlinklist.h"
+
+/* the tasks running in this process */
+static struct task_server *task_servers;
 
 /*
   terminate a task service
@@ -50,12 +54,38 @@ void task_server_terminate(struct task_server *task, const char *reason, bool fa
 
 	imessaging_cleanup(task->msg_ctx);
 
-	model_ops->terminate(event_ctx, task->lp_ctx, reason);
+	if (model_ops->terminate_task != NULL) {
+		model_ops->terminate_task(event_ctx, task->lp_ctx, reason);
+	} else {
+		model_ops->terminate(event_ctx, task->lp_ctx, reason);
+	}
 	
 	/* don't free this above, it might contain the 'reason' being printed */
 	talloc_free(task);
 }
 
+static int task_server_destructor(struct task_server *task)
+{
+	DLIST_REMOVE(task_servers, task);
+	return 0;
+}
+
+/*
+  called by a process model in a process forked off a task process,
+  which carries on running the tasks of the process with pid old_pid
+*/
+void task_server_reinit_all(pid_t old_pid)
+{
+	struct task_server *task;
+	pid_t pid = getpid();
+
+	for (task = task_servers; task != NULL; task = task->next) {
+		if (task->server_id.pid == old_pid) {
+			task->server_id.pid = pid;
+		}
+	}
+}
+
 /* used for the callback from the process model code */
 struct task_state {
 	void (*task_init)(struct task_server *);
@@ -74,9 +104,12 @@ static void task_server_callback(struct tevent_context *event_ctx,
 	struct task_state *state = talloc_get_type(private_data, struct task_state);
 	struct task_server *task;
 
-	task = talloc(event_ctx, struct task_server);
+	task = talloc_zero(event_ctx, struct task_server);
 	if (task == NULL) return;
 
+	DLIST_ADD(task_servers, task);
+	talloc_set_destructor(task, task_server_destructor);
+
 	task->event_ctx = event_ctx;
 	task->model_ops = state->model_ops;
 	task->server_id = server_id;
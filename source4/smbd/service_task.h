@@ -25,6 +25,7 @@
 #include "librpc/gen_ndr/server_id.h"
 
 struct task_server {
+	struct task_server *prev, *next;
 	struct tevent_context *event_ctx;
 	const struct model_ops *model_ops;
 	struct imessaging_context *msg_ctx;
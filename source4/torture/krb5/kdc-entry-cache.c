@@ -0,0 +1,328 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Test the KDC entry cache of the samba database backend
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * These tests open the sam.ldb of the DC directly, so they have to
+ * run in a ":local" environment.
+ */
+
+#include "includes.h"
+#include "system/kerberos.h"
+#include "system/time.h"
+#include "torture/smbtorture.h"
+#include "torture/krb5/proto.h"
+#include "auth/kerberos/kerberos.h"
+#include "dsdb/samdb/samdb.h"
+#include "param/param.h"
+#include "kdc/samba_kdc.h"
+#include "kdc/sdb.h"
+#include "kdc/db-glue.h"
+
+#define TEST_ACCOUNT "kdccachetest"
+#define TEST_TTL 3
+
+struct entry_cache_test {
+	struct smb_krb5_context *smb_krb5_context;
+	struct samba_kdc_db_context *db_ctx;
+	struct ldb_dn *dn;
+	krb5_principal principal;
+};
+
+static int entry_cache_test_destructor(struct entry_cache_test *t)
+{
+	if (t->principal != NULL) {
+		krb5_free_principal(t->smb_krb5_context->krb5_context,
+				    t->principal);
+	}
+	return 0;
+}
+
+static bool entry_cache_setup(struct torture_context *tctx, void **data)
+{
+	struct entry_cache_test *t;
+	struct samba_kdc_base_context *base_ctx;
+	struct ldb_message *msg;
+	krb5_error_code k5ret;
+	NTSTATUS status;
+	int ret;
+
+	t = talloc_zero(tctx, struct entry_cache_test);
+	torture_assert(tctx, t != NULL, "talloc failed");
+
+	lpcfg_set_option(tctx->lp_ctx,
+			 "kdc:entry cache ttl=" __STRINGSTRING(TEST_TTL));
+
+	k5ret = smb_krb5_init_context(t, tctx->lp_ctx, &t->smb_krb5_context);
+	torture_assert_int_equal(tctx, k5ret, 0, "smb_krb5_init_context failed");
+
+	base_ctx = talloc_zero(t, struct samba_kdc_base_context);
+	torture_assert(tctx, base_ctx != NULL, "talloc failed");
+	base_ctx->ev_ctx = tctx->ev;
+	base_ctx->lp_ctx = tctx->lp_ctx;
+
+	status = samba_kdc_setup_db_ctx(t, base_ctx, &t->db_ctx);
+	torture_assert_ntstatus_ok(tctx, status, "samba_kdc_setup_db_ctx failed");
+
+	t->dn = ldb_dn_copy(t, ldb_get_default_basedn(t->db_ctx->samdb));
+	torture_assert(tctx, t->dn != NULL, "ldb_dn_copy failed");
+	torture_assert(tctx,
+		       ldb_dn_add_child_fmt(t->dn, "CN=%s,CN=Users",
+					    TEST_ACCOUNT),
+		       "ldb_dn_add_child_fmt failed");
+
+	/* left over from an earlier run */
+	ldb_delete(t->db_ctx->samdb, t->dn);
+
+	msg = ldb_msg_new(t);
+	torture_assert(tctx, msg != NULL, "ldb_msg_new failed");
+	msg->dn = t->dn;
+	ret = ldb_msg_add_string(msg, "objectClass", "user");
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_string");
+	ret = ldb_msg_add_string(msg, "sAMAccountName", TEST_ACCOUNT);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_string");
+	ret = ldb_msg_add_string(msg, "servicePrincipalName",
+				 TEST_ACCOUNT "/test");
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_string");
+
+	ret = ldb_add(t->db_ctx->samdb, msg);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS,
+				 ldb_errstring(t->db_ctx->samdb));
+
+	k5ret = smb_krb5_make_principal(t->smb_krb5_context->krb5_context,
+					&t->principal,
+					lpcfg_realm(tctx->lp_ctx),
+					TEST_ACCOUNT, "test", NULL);
+	torture_assert_int_equal(tctx, k5ret, 0, "smb_krb5_make_principal");
+	talloc_set_destructor(t, entry_cache_test_destructor);
+
+	*data = t;
+	return true;
+}
+
+static bool entry_cache_teardown(struct torture_context *tctx, void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+
+	ldb_delete(t->db_ctx->samdb, t->dn);
+	talloc_free(t);
+	return true;
+}
+
+/* Fetch the test principal as a server and return the cache counters */
+static bool entry_cache_fetch(struct torture_context *tctx,
+			      struct entry_cache_test *t,
+			      struct samba_kdc_entry_cache_stats *stats)
+{
+	struct sdb_entry_ex entry = {
+		.free_entry = NULL,
+	};
+	krb5_error_code k5ret;
+
+	k5ret = samba_kdc_fetch(t->smb_krb5_context->krb5_context,
+				t->db_ctx, t->principal,
+				SDB_F_GET_SERVER, 0, &entry);
+	torture_assert_int_equal(tctx, k5ret, 0, "samba_kdc_fetch failed");
+
+	sdb_free_entry(&entry);
+	TALLOC_FREE(entry.ctx);
+
+	torture_assert(tctx, samba_kdc_entry_cache_stats(t->db_ctx, stats),
+		       "the entry cache is disabled");
+	return true;
+}
+
+static bool entry_cache_modify(struct torture_context *tctx,
+			       struct entry_cache_test *t,
+			       const char *attr, const char *value)
+{
+	struct ldb_message *msg;
+	int ret;
+
+	msg = ldb_msg_new(tctx);
+	torture_assert(tctx, msg != NULL, "ldb_msg_new failed");
+	msg->dn = t->dn;
+
+	ret = ldb_msg_add_empty(msg, attr, LDB_FLAG_MOD_REPLACE, NULL);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_empty");
+	ret = ldb_msg_add_string(msg, attr, value);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_string");
+
+	ret = ldb_modify(t->db_ctx->samdb, msg);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS,
+				 ldb_errstring(t->db_ctx->samdb));
+
+	talloc_free(msg);
+	return true;
+}
+
+static bool test_entry_cache_hit(struct torture_context *tctx, void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+	struct samba_kdc_entry_cache_stats s1, s2;
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s1), "fetch");
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s2), "fetch");
+
+	torture_assert_u64_equal(tctx, s2.hits, s1.hits + 1,
+				 "second fetch not served from the cache");
+	torture_assert_u64_equal(tctx, s2.misses, s1.misses,
+				 "second fetch missed the cache");
+	return true;
+}
+
+static bool test_entry_cache_changed(struct torture_context *tctx,
+				     void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+	struct samba_kdc_entry_cache_stats s1, s2;
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s1), "fetch");
+
+	torture_assert(tctx,
+		       entry_cache_modify(tctx, t, "description", "changed"),
+		       "modify");
+	/* the partition USN is only read once a second */
+	sleep(1);
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s2), "fetch");
+
+	torture_assert_u64_equal(tctx, s2.changed, s1.changed + 1,
+				 "change of the object not noticed");
+	torture_assert_u64_equal(tctx, s2.hits, s1.hits,
+				 "changed entry served from the cache");
+	return true;
+}
+
+static bool test_entry_cache_unrelated_change(struct torture_context *tctx,
+					      void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+	struct samba_kdc_entry_cache_stats s1, s2;
+	struct ldb_message *msg;
+	struct ldb_dn *dn;
+	int ret;
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s1), "fetch");
+
+	/* move the partition USN on with an object of its own */
+	dn = ldb_dn_copy(tctx, ldb_get_default_basedn(t->db_ctx->samdb));
+	torture_assert(tctx, dn != NULL, "ldb_dn_copy failed");
+	torture_assert(tctx,
+		       ldb_dn_add_child_fmt(dn, "CN=%s2,CN=Users",
+					    TEST_ACCOUNT),
+		       "ldb_dn_add_child_fmt failed");
+	ldb_delete(t->db_ctx->samdb, dn);
+
+	msg = ldb_msg_new(tctx);
+	torture_assert(tctx, msg != NULL, "ldb_msg_new failed");
+	msg->dn = dn;
+	ret = ldb_msg_add_string(msg, "objectClass", "user");
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS, "ldb_msg_add_string");
+	ret = ldb_add(t->db_ctx->samdb, msg);
+	torture_assert_int_equal(tctx, ret, LDB_SUCCESS,
+				 ldb_errstring(t->db_ctx->samdb));
+	ldb_delete(t->db_ctx->samdb, dn);
+	sleep(1);
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s2), "fetch");
+
+	torture_assert_u64_equal(tctx, s2.hits, s1.hits + 1,
+				 "unchanged entry not served from the cache");
+	return true;
+}
+
+static bool test_entry_cache_expired(struct torture_context *tctx,
+				     void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+	struct samba_kdc_entry_cache_stats s1, s2;
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s1), "fetch");
+
+	sleep(TEST_TTL + 1);
+
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s2), "fetch");
+
+	torture_assert_u64_equal(tctx, s2.expired, s1.expired + 1,
+				 "entry did not expire");
+	torture_assert_u64_equal(tctx, s2.hits, s1.hits,
+				 "expired entry served from the cache");
+	return true;
+}
+
+static bool test_entry_cache_locked_out(struct torture_context *tctx,
+					void *data)
+{
+	struct entry_cache_test *t =
+		talloc_get_type_abort(data, struct entry_cache_test);
+	struct samba_kdc_entry_cache_stats s1, s2;
+	NTTIME now;
+	char *value;
+
+	unix_to_nt_time(&now, time(NULL));
+	value = talloc_asprintf(tctx, "%llu", (unsigned long long)now);
+	torture_assert(tctx, value != NULL, "talloc_asprintf failed");
+
+	torture_assert(tctx,
+		       entry_cache_modify(tctx, t, "lockoutTime", value),
+		       "modify");
+
+	/*
+	 * The lockout ends without the object changing, the entry must
+	 * be built again every time
+	 */
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s1), "fetch");
+	torture_assert(tctx, entry_cache_fetch(tctx, t, &s2), "fetch");
+
+	torture_assert_u64_equal(tctx, s2.hits, s1.hits,
+				 "locked out entry served from the cache");
+	torture_assert_u64_equal(tctx, s2.misses, s1.misses + 1,
+				 "locked out entry not looked up");
+	return true;
+}
+
+struct torture_suite *torture_krb5_entry_cache(TALLOC_CTX *mem_ctx)
+{
+	struct torture_suite *suite =
+		torture_suite_create(mem_ctx, "entry-cache");
+	struct torture_tcase *tcase;
+
+	suite->description = talloc_strdup(suite, "KDC entry cache tests");
+
+	tcase = torture_suite_add_tcase(suite, "entry-cache");
+	torture_tcase_set_fixture(tcase, entry_cache_setup,
+				  entry_cache_teardown);
+
+	torture_tcase_add_simple_test(tcase, "hit", test_entry_cache_hit);
+	torture_tcase_add_simple_test(tcase, "changed",
+				      test_entry_cache_changed);
+	torture_tcase_add_simple_test(tcase, "unrelated-change",
+				      test_entry_cache_unrelated_change);
+	torture_tcase_add_simple_test(tcase, "expired",
+				      test_entry_cache_expired);
+	torture_tcase_add_simple_test(tcase, "locked-out",
+				      test_entry_cache_locked_out);
+
+	return suite;
+}
@@ -718,6 +718,7 @@ NTSTATUS torture_krb5_init(void)
 
 	torture_suite_add_suite(kdc_suite, torture_krb5_canon(kdc_suite));
 	torture_suite_add_suite(suite, kdc_suite);
+	torture_suite_add_suite(suite, torture_krb5_entry_cache(suite));
 
 	torture_register_suite(suite);
 	return NT_STATUS_OK;
@@ -0,0 +1,179 @@
+/*
+   Unix SMB/CIFS implementation.
+   test suite for compressed NDR subcontexts
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "torture/ndr/ndr.h"
+#include "torture/ndr/proto.h"
+#include "../librpc/ndr/ndr_compression.h"
+
+static const struct {
+	enum ndr_compression_alg alg;
+	const char *name;
+} compression_algs[] = {
+	{ NDR_COMPRESSION_MSZIP, "MSZIP" },
+	{ NDR_COMPRESSION_XPRESS, "XPRESS" },
+	{ NDR_COMPRESSION_XPRESS_HUFF_RAW, "XPRESS_HUFF_RAW" },
+};
+
+/*
+  push a buffer of uint32 values through a compressed subcontext,
+  followed by a trailer in the outer buffer, and pull it back
+ */
+static bool compression_round_trip(struct torture_context *tctx,
+				   enum ndr_compression_alg alg,
+				   const char *name,
+				   uint32_t num_values)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	struct ndr_push *push, *uncomndr;
+	struct ndr_pull *pull, *comndr;
+	ssize_t len = num_values * 4;
+	DATA_BLOB blob;
+	uint32_t i, v;
+
+	torture_comment(tctx, "%s with %u values\n", name, num_values);
+
+	push = ndr_push_init_ctx(mem_ctx);
+	torture_assert(tctx, push != NULL, "ndr_push_init_ctx failed");
+
+	torture_assert_ndr_success(tctx,
+		ndr_push_compression_start(push, &uncomndr, alg, len),
+		"ndr_push_compression_start failed");
+	for (i = 0; i < num_values; i++) {
+		/* something that compresses, but not to nothing */
+		torture_assert_ndr_success(tctx,
+			ndr_push_uint32(uncomndr, NDR_SCALARS, i / 7),
+			"ndr_push_uint32 failed");
+	}
+	torture_assert_ndr_success(tctx,
+		ndr_push_compression_end(push, uncomndr, alg, len),
+		"ndr_push_compression_end failed");
+	blob = ndr_push_blob(push);
+
+	torture_comment(tctx, "%zd bytes compressed to %zu\n",
+			len, blob.length);
+	if (num_values > 1000) {
+		torture_assert(tctx, blob.length < len,
+			       "the data did not compress");
+	}
+
+	pull = ndr_pull_init_blob(&blob, mem_ctx);
+	torture_assert(tctx, pull != NULL, "ndr_pull_init_blob failed");
+
+	torture_assert_ndr_success(tctx,
+		ndr_pull_compression_start(pull, &comndr, alg, len),
+		"ndr_pull_compression_start failed");
+	torture_assert_int_equal(tctx, comndr->data_size, len,
+				 "wrong uncompressed size");
+	for (i = 0; i < num_values; i++) {
+		torture_assert_ndr_success(tctx,
+			ndr_pull_uint32(comndr, NDR_SCALARS, &v),
+			"ndr_pull_uint32 failed");
+		torture_assert_int_equal(tctx, v, i / 7, "wrong value");
+	}
+	torture_assert_ndr_success(tctx,
+		ndr_pull_compression_end(pull, comndr, alg, len),
+		"ndr_pull_compression_end failed");
+	torture_assert_int_equal(tctx, pull->offset, blob.length,
+				 "compressed data not consumed");
+
+	talloc_free(mem_ctx);
+	return true;
+}
+
+static bool test_ndr_compression_round_trip(struct torture_context *tctx)
+{
+	const uint32_t num_values[] = { 1, 100, 0x4000, 0x4001, 50000 };
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(compression_algs); i++) {
+		for (j = 0; j < ARRAY_SIZE(num_values); j++) {
+			if (!compression_round_trip(tctx,
+						    compression_algs[i].alg,
+						    compression_algs[i].name,
+						    num_values[j])) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+  XPRESS_HUFF_RAW has no framing, so the size must come from the caller
+ */
+static bool test_ndr_compression_huff_raw_size(struct torture_context *tctx)
+{
+	const uint8_t data[16] = { 0 };
+	DATA_BLOB blob;
+	struct ndr_push *push, *uncomndr;
+	struct ndr_pull *pull, *comndr;
+
+	push = ndr_push_init_ctx(tctx);
+	torture_assert(tctx, push != NULL, "ndr_push_init_ctx failed");
+	torture_assert_ndr_success(tctx,
+		ndr_push_compression_start(push, &uncomndr,
+					   NDR_COMPRESSION_XPRESS_HUFF_RAW,
+					   sizeof(data)),
+		"ndr_push_compression_start failed");
+	torture_assert_ndr_success(tctx,
+		ndr_push_bytes(uncomndr, data, sizeof(data)),
+		"ndr_push_bytes failed");
+	torture_assert_ndr_success(tctx,
+		ndr_push_compression_end(push, uncomndr,
+					 NDR_COMPRESSION_XPRESS_HUFF_RAW,
+					 sizeof(data)),
+		"ndr_push_compression_end failed");
+	blob = ndr_push_blob(push);
+
+	pull = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, pull != NULL, "ndr_pull_init_blob failed");
+	torture_assert_ndr_err_equal(tctx,
+		ndr_pull_compression_start(pull, &comndr,
+					   NDR_COMPRESSION_XPRESS_HUFF_RAW, -1),
+		NDR_ERR_COMPRESSION,
+		"unknown size accepted");
+
+	/* a cut stream must not decode */
+	blob.length -= blob.length / 2;
+	pull = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, pull != NULL, "ndr_pull_init_blob failed");
+	torture_assert_ndr_err_equal(tctx,
+		ndr_pull_compression_start(pull, &comndr,
+					   NDR_COMPRESSION_XPRESS_HUFF_RAW,
+					   sizeof(data)),
+		NDR_ERR_COMPRESSION,
+		"truncated stream accepted");
+
+	return true;
+}
+
+struct torture_suite *ndr_compression_suite(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "compression");
+
+	suite->description = talloc_strdup(suite, "NDR - compressed subcontext tests");
+
+	torture_suite_add_simple_test(suite, "round_trip",
+				      test_ndr_compression_round_trip);
+	torture_suite_add_simple_test(suite, "huff_raw_size",
+				      test_ndr_compression_huff_raw_size);
+
+	return suite;
+}
@@ -0,0 +1,201 @@
+/*
+   Unix SMB/CIFS implementation.
+   test suite for the ndr_pull machinery
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "torture/ndr/ndr.h"
+#include "torture/ndr/proto.h"
+#include "librpc/gen_ndr/ndr_lsa.h"
+
+static bool in_blob(const DATA_BLOB *blob, const void *p)
+{
+	const uint8_t *u = (const uint8_t *)p;
+
+	return u >= blob->data && u < blob->data + blob->length;
+}
+
+static bool pull_set_secret(struct torture_context *tctx,
+			    TALLOC_CTX *mem_ctx,
+			    const DATA_BLOB *blob,
+			    bool no_copy,
+			    struct lsa_SetSecret *r)
+{
+	struct ndr_pull *ndr;
+
+	ndr = ndr_pull_init_blob(blob, mem_ctx);
+	torture_assert(tctx, ndr != NULL, "ndr_pull_init_blob failed");
+	ndr->flags |= LIBNDR_FLAG_REF_ALLOC;
+	ndr_pull_set_no_copy(ndr, no_copy);
+
+	ZERO_STRUCTP(r);
+	torture_assert_ndr_success(tctx,
+		ndr_pull_lsa_SetSecret(ndr, NDR_IN, r),
+		"ndr_pull_lsa_SetSecret failed");
+	torture_assert_int_equal(tctx, ndr->offset, blob->length,
+				 "not all bytes consumed");
+	TALLOC_FREE(ndr);
+
+	return true;
+}
+
+static bool test_ndr_pull_no_copy_array(struct torture_context *tctx)
+{
+	struct policy_handle handle = { .handle_type = 0 };
+	struct lsa_DATA_BUF buf;
+	struct lsa_SetSecret r = {
+		.in.sec_handle = &handle,
+		.in.new_val = &buf,
+		.in.old_val = NULL,
+	};
+	TALLOC_CTX *copy_ctx, *ref_ctx;
+	struct ndr_push *push;
+	DATA_BLOB blob;
+	size_t copy_blocks, ref_blocks;
+	uint32_t i;
+
+	buf.size = buf.length = 4096;
+	buf.data = talloc_array(tctx, uint8_t, buf.size);
+	torture_assert(tctx, buf.data != NULL, "talloc failed");
+	for (i=0; i<buf.size; i++) {
+		buf.data[i] = i % 251;
+	}
+
+	push = ndr_push_init_ctx(tctx);
+	torture_assert(tctx, push != NULL, "ndr_push_init_ctx failed");
+	torture_assert_ndr_success(tctx,
+		ndr_push_lsa_SetSecret(push, NDR_IN, &r),
+		"ndr_push_lsa_SetSecret failed");
+	blob = ndr_push_blob(push);
+
+	copy_ctx = talloc_new(tctx);
+	if (!pull_set_secret(tctx, copy_ctx, &blob, false, &r)) {
+		return false;
+	}
+	torture_assert(tctx, !in_blob(&blob, r.in.new_val->data),
+		       "data references the input without no_copy");
+	torture_assert_mem_equal(tctx, r.in.new_val->data, buf.data,
+				 buf.size, "wrong data");
+	copy_blocks = talloc_total_blocks(copy_ctx);
+
+	ref_ctx = talloc_new(tctx);
+	if (!pull_set_secret(tctx, ref_ctx, &blob, true, &r)) {
+		return false;
+	}
+	torture_assert(tctx, in_blob(&blob, r.in.new_val->data),
+		       "data copied in no_copy mode");
+	torture_assert_mem_equal(tctx, r.in.new_val->data, buf.data,
+				 buf.size, "wrong data");
+	ref_blocks = talloc_total_blocks(ref_ctx);
+
+	torture_comment(tctx, "talloc blocks: copied %zu, no_copy %zu\n",
+			copy_blocks, ref_blocks);
+	torture_assert(tctx, ref_blocks < copy_blocks,
+		       "no_copy did not save allocations");
+
+	TALLOC_FREE(copy_ctx);
+	TALLOC_FREE(ref_ctx);
+	return true;
+}
+
+static bool test_ndr_pull_no_copy_string(struct torture_context *tctx)
+{
+	const uint8_t ascii[] = "plain ascii";
+	const uint8_t utf8[] = "caf\xc3\xa9";
+	DATA_BLOB blob;
+	struct ndr_pull *ndr;
+	const char *s;
+
+	blob = data_blob_const(ascii, sizeof(ascii));
+	ndr = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, ndr != NULL, "ndr_pull_init_blob failed");
+	ndr_pull_set_no_copy(ndr, true);
+	ndr->flags |= LIBNDR_FLAG_STR_UTF8|LIBNDR_FLAG_STR_NULLTERM;
+	torture_assert_ndr_success(tctx,
+		ndr_pull_string(ndr, NDR_SCALARS, &s),
+		"ndr_pull_string failed");
+	torture_assert(tctx, in_blob(&blob, s), "ascii string copied");
+	torture_assert_str_equal(tctx, s, "plain ascii", "wrong string");
+	TALLOC_FREE(ndr);
+
+	/* non-ASCII might change in the conversion to the unix charset */
+	blob = data_blob_const(utf8, sizeof(utf8));
+	ndr = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, ndr != NULL, "ndr_pull_init_blob failed");
+	ndr_pull_set_no_copy(ndr, true);
+	ndr->flags |= LIBNDR_FLAG_STR_UTF8|LIBNDR_FLAG_STR_NULLTERM;
+	torture_assert_ndr_success(tctx,
+		ndr_pull_string(ndr, NDR_SCALARS, &s),
+		"ndr_pull_string failed");
+	torture_assert(tctx, !in_blob(&blob, s), "utf8 string referenced");
+	torture_assert_str_equal(tctx, s, "caf\xc3\xa9", "wrong string");
+	TALLOC_FREE(ndr);
+
+	blob = data_blob_const(ascii, sizeof(ascii));
+	ndr = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, ndr != NULL, "ndr_pull_init_blob failed");
+	ndr_pull_set_no_copy(ndr, true);
+	torture_assert_ndr_success(tctx,
+		ndr_pull_charset(ndr, NDR_SCALARS, &s, sizeof(ascii), 1,
+				 CH_UTF8),
+		"ndr_pull_charset failed");
+	torture_assert(tctx, in_blob(&blob, s), "ascii charset copied");
+	torture_assert_str_equal(tctx, s, "plain ascii", "wrong string");
+	TALLOC_FREE(ndr);
+
+	return true;
+}
+
+static bool test_ndr_pull_no_copy_blob(struct torture_context *tctx)
+{
+	const uint8_t data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	DATA_BLOB blob = data_blob_const(data, sizeof(data));
+	DATA_BLOB out;
+	struct ndr_pull *ndr;
+
+	ndr = ndr_pull_init_blob(&blob, tctx);
+	torture_assert(tctx, ndr != NULL, "ndr_pull_init_blob failed");
+	ndr_pull_set_no_copy(ndr, true);
+	ndr->flags |= LIBNDR_FLAG_REMAINING;
+	torture_assert_ndr_success(tctx,
+		ndr_pull_DATA_BLOB(ndr, NDR_SCALARS, &out),
+		"ndr_pull_DATA_BLOB failed");
+	torture_assert(tctx, out.data == blob.data, "blob copied");
+	torture_assert_data_blob_equal(tctx, out, blob, "wrong blob");
+
+	torture_assert(tctx,
+		!NDR_ERR_CODE_IS_SUCCESS(ndr_pull_append(ndr, &blob)),
+		"ndr_pull_append() allowed in no_copy mode");
+	TALLOC_FREE(ndr);
+
+	return true;
+}
+
+struct torture_suite *ndr_pull_suite(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "pull");
+
+	suite->description = talloc_strdup(suite, "NDR - no_copy pull tests");
+
+	torture_suite_add_simple_test(suite, "no_copy_array",
+				      test_ndr_pull_no_copy_array);
+	torture_suite_add_simple_test(suite, "no_copy_string",
+				      test_ndr_pull_no_copy_string);
+	torture_suite_add_simple_test(suite, "no_copy_blob",
+				      test_ndr_pull_no_copy_blob);
+
+	return suite;
+}
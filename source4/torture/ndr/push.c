@@ -0,0 +1,310 @@
+/*
+   Unix SMB/CIFS implementation.
+   test suite for the ndr_push machinery
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "torture/ndr/ndr.h"
+#include "torture/ndr/proto.h"
+#include "librpc/gen_ndr/ndr_lsa.h"
+#include "libcli/security/dom_sid.h"
+
+static DATA_BLOB iov_to_blob(TALLOC_CTX *mem_ctx,
+			     const struct iovec *iov, int num_iov)
+{
+	DATA_BLOB blob = data_blob_null;
+	int i;
+
+	for (i=0; i<num_iov; i++) {
+		if (!data_blob_append(mem_ctx, &blob, iov[i].iov_base,
+				      iov[i].iov_len)) {
+			return data_blob_null;
+		}
+	}
+	return blob;
+}
+
+/*
+ * Push the request of an lsa_SetSecret call, its new_val is a large
+ * uint8 array
+ */
+static bool push_data_buf(struct torture_context *tctx,
+			  struct lsa_DATA_BUF *buf,
+			  uint32_t threshold,
+			  struct ndr_push **pndr)
+{
+	struct policy_handle handle = { .handle_type = 0 };
+	struct lsa_SetSecret r = {
+		.in.sec_handle = &handle,
+		.in.new_val = buf,
+		.in.old_val = NULL,
+	};
+	struct ndr_push *ndr;
+
+	ndr = ndr_push_init_ctx(tctx);
+	torture_assert(tctx, ndr != NULL, "ndr_push_init_ctx failed");
+
+	ndr_push_set_iov_threshold(ndr, threshold);
+
+	torture_assert_ndr_success(tctx,
+		ndr_push_lsa_SetSecret(ndr, NDR_IN, &r),
+		"ndr_push_lsa_SetSecret failed");
+
+	*pndr = ndr;
+	return true;
+}
+
+static bool test_ndr_push_iov(struct torture_context *tctx)
+{
+	struct lsa_DATA_BUF buf;
+	struct ndr_push *ndr_copy, *ndr_iov;
+	struct iovec *iov;
+	int num_iov;
+	DATA_BLOB expected, blob;
+	uint32_t i;
+
+	buf.size = buf.length = 1024*1024;
+	buf.data = talloc_array(tctx, uint8_t, buf.size);
+	torture_assert(tctx, buf.data != NULL, "talloc failed");
+	for (i=0; i<buf.size; i++) {
+		buf.data[i] = i % 251;
+	}
+
+	if (!push_data_buf(tctx, &buf, 0, &ndr_copy)) {
+		return false;
+	}
+	expected = ndr_push_blob(ndr_copy);
+
+	if (!push_data_buf(tctx, &buf, 4096, &ndr_iov)) {
+		return false;
+	}
+	torture_assert_int_equal(tctx, ndr_iov->num_iov_refs, 1,
+				 "data not referenced");
+	torture_assert_int_equal(tctx, ndr_iov->offset, expected.length,
+				 "wrong offset");
+
+	torture_assert_ndr_success(tctx,
+		ndr_push_iov(ndr_iov, tctx, &iov, &num_iov),
+		"ndr_push_iov failed");
+
+	/* header, the referenced data and the old_val pointer */
+	torture_assert_int_equal(tctx, num_iov, 3, "wrong number of iovecs");
+	torture_assert(tctx, iov[1].iov_base == buf.data,
+		       "data not referenced in place");
+
+	blob = iov_to_blob(tctx, iov, num_iov);
+	torture_assert_data_blob_equal(tctx, blob, expected,
+				       "iovecs differ from copied push");
+
+	/* ndr_push_blob() fills in the reserved space */
+	blob = ndr_push_blob(ndr_iov);
+	torture_assert_data_blob_equal(tctx, blob, expected,
+				       "blob differs from copied push");
+	torture_assert_int_equal(tctx, ndr_iov->num_iov_refs, 0,
+				 "references left after ndr_push_blob");
+
+	/* below the threshold everything is copied */
+	if (!push_data_buf(tctx, &buf, buf.size + 1, &ndr_iov)) {
+		return false;
+	}
+	torture_assert_int_equal(tctx, ndr_iov->num_iov_refs, 0,
+				 "data referenced below the threshold");
+
+	torture_assert_ndr_success(tctx,
+		ndr_push_iov(ndr_iov, tctx, &iov, &num_iov),
+		"ndr_push_iov failed");
+	torture_assert_int_equal(tctx, num_iov, 1, "wrong number of iovecs");
+	blob = iov_to_blob(tctx, iov, num_iov);
+	torture_assert_data_blob_equal(tctx, blob, expected,
+				       "iovecs differ from copied push");
+
+	return true;
+}
+
+/*
+ * Many referenced arrays, as in a GetNCChanges reply with many
+ * attribute values
+ */
+static bool test_ndr_push_iov_many(struct torture_context *tctx)
+{
+	const uint32_t num_arrays = 1000;
+	struct ndr_push *ndr_copy, *ndr_iov;
+	uint8_t data[64];
+	struct iovec *iov;
+	int num_iov;
+	DATA_BLOB expected, blob;
+	uint32_t i;
+
+	for (i=0; i<sizeof(data); i++) {
+		data[i] = i;
+	}
+
+	ndr_copy = ndr_push_init_ctx(tctx);
+	ndr_iov = ndr_push_init_ctx(tctx);
+	torture_assert(tctx, ndr_copy != NULL && ndr_iov != NULL,
+		       "ndr_push_init_ctx failed");
+	ndr_push_set_iov_threshold(ndr_iov, 16);
+
+	for (i=0; i<num_arrays; i++) {
+		torture_assert_ndr_success(tctx,
+			ndr_push_array_uint8(ndr_copy, NDR_SCALARS,
+					     data + i % 32, 32),
+			"ndr_push_array_uint8 failed");
+		torture_assert_ndr_success(tctx,
+			ndr_push_array_uint8(ndr_iov, NDR_SCALARS,
+					     data + i % 32, 32),
+			"ndr_push_array_uint8 failed");
+	}
+	expected = ndr_push_blob(ndr_copy);
+
+	torture_assert_int_equal(tctx, ndr_iov->num_iov_refs, num_arrays,
+				 "arrays not referenced");
+	/* 16 doubled until it holds them all */
+	torture_assert_int_equal(tctx, ndr_iov->alloc_iov_refs, 1024,
+				 "references not grown geometrically");
+
+	torture_assert_ndr_success(tctx,
+		ndr_push_iov(ndr_iov, tctx, &iov, &num_iov),
+		"ndr_push_iov failed");
+	torture_assert_int_equal(tctx, num_iov, num_arrays,
+				 "wrong number of iovecs");
+
+	blob = iov_to_blob(tctx, iov, num_iov);
+	torture_assert_data_blob_equal(tctx, blob, expected,
+				       "iovecs differ from copied push");
+
+	blob = ndr_push_blob(ndr_iov);
+	torture_assert_data_blob_equal(tctx, blob, expected,
+				       "blob differs from copied push");
+	torture_assert_int_equal(tctx, ndr_iov->alloc_iov_refs, 0,
+				 "references left after ndr_push_blob");
+
+	return true;
+}
+
+/*
+ * Push cost against size: an lsa_SidArray is pushed as many small
+ * elements, which exercises the growth of the marshalling buffer, a
+ * large lsa_SetSecret request shows the gain of the iov mode.
+ */
+static bool test_ndr_push_speed(struct torture_context *tctx)
+{
+	uint32_t num_sids[] = { 1000, 10000, 100000, 200000 };
+	uint32_t buf_sizes[] = { 1024*1024, 16*1024*1024 };
+	struct dom_sid domain_sid;
+	size_t i;
+
+	torture_assert(tctx,
+		       dom_sid_parse("S-1-5-21-1111111111-2222222222-3333333333",
+				     &domain_sid),
+		       "dom_sid_parse failed");
+
+	for (i=0; i<ARRAY_SIZE(num_sids); i++) {
+		TALLOC_CTX *frame = talloc_stackframe();
+		struct lsa_SidArray sids;
+		struct ndr_push *ndr;
+		struct timeval tv;
+		double elapsed;
+		uint32_t j;
+
+		sids.num_sids = num_sids[i];
+		sids.sids = talloc_array(frame, struct lsa_SidPtr,
+					 sids.num_sids);
+		torture_assert(tctx, sids.sids != NULL, "talloc failed");
+
+		for (j=0; j<sids.num_sids; j++) {
+			sids.sids[j].sid = dom_sid_add_rid(sids.sids,
+							   &domain_sid,
+							   1000 + j);
+			torture_assert(tctx, sids.sids[j].sid != NULL,
+				       "talloc failed");
+		}
+
+		tv = timeval_current();
+
+		ndr = ndr_push_init_ctx(frame);
+		torture_assert(tctx, ndr != NULL, "ndr_push_init_ctx failed");
+		torture_assert_ndr_success(tctx,
+			ndr_push_lsa_SidArray(ndr, NDR_SCALARS|NDR_BUFFERS,
+					      &sids),
+			"ndr_push_lsa_SidArray failed");
+
+		elapsed = timeval_elapsed(&tv);
+
+		torture_comment(tctx, "lsa_SidArray %7u sids: %9u bytes in "
+				"%.4f s, %.1f ns/byte, buffer %u bytes\n",
+				sids.num_sids, ndr->offset, elapsed,
+				elapsed * 1e9 / ndr->offset,
+				ndr->alloc_size);
+
+		TALLOC_FREE(frame);
+	}
+
+	for (i=0; i<ARRAY_SIZE(buf_sizes); i++) {
+		TALLOC_CTX *frame = talloc_stackframe();
+		struct lsa_DATA_BUF buf;
+		struct ndr_push *ndr;
+		struct timeval tv;
+		double copy_time, iov_time;
+		struct iovec *iov;
+		int num_iov;
+
+		buf.size = buf.length = buf_sizes[i];
+		buf.data = talloc_zero_array(frame, uint8_t, buf.size);
+		torture_assert(tctx, buf.data != NULL, "talloc failed");
+
+		tv = timeval_current();
+		if (!push_data_buf(tctx, &buf, 0, &ndr)) {
+			return false;
+		}
+		ndr_push_blob(ndr);
+		copy_time = timeval_elapsed(&tv);
+		TALLOC_FREE(ndr);
+
+		tv = timeval_current();
+		if (!push_data_buf(tctx, &buf, 4096, &ndr)) {
+			return false;
+		}
+		torture_assert_ndr_success(tctx,
+			ndr_push_iov(ndr, frame, &iov, &num_iov),
+			"ndr_push_iov failed");
+		iov_time = timeval_elapsed(&tv);
+		TALLOC_FREE(ndr);
+
+		torture_comment(tctx, "lsa_SetSecret %9u bytes: copied %.4f s, "
+				"referenced %.4f s\n",
+				buf.size, copy_time, iov_time);
+
+		TALLOC_FREE(frame);
+	}
+
+	return true;
+}
+
+struct torture_suite *ndr_push_suite(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "push");
+
+	suite->description = talloc_strdup(suite, "NDR - marshalling buffer and iov push tests");
+
+	torture_suite_add_simple_test(suite, "iov", test_ndr_push_iov);
+	torture_suite_add_simple_test(suite, "iov_many",
+				      test_ndr_push_iov_many);
+	torture_suite_add_simple_test(suite, "speed", test_ndr_push_speed);
+
+	return suite;
+}
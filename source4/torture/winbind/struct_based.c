@@ -21,6 +21,9 @@
 #include "includes.h"
 #include "torture/torture.h"
 #include "nsswitch/winbind_client.h"
+#include "nsswitch/winbind_nss_cache.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
 #include "libcli/security/security.h"
 #include "librpc/gen_ndr/netlogon.h"
 #include "param/param.h"
@@ -1074,6 +1077,280 @@ static bool torture_winbind_struct_lookup_name_sid(struct torture_context *tortu
 	return true;
 }
 
+#ifdef WINBINDD_NSS_CACHE_BARRIER
+
+/*
+ * The passwd and group cache winbindd publishes for the nss modules.
+ * Requests without a winbindd_context are answered from it, requests
+ * through a context of their own always go to winbindd.
+ */
+
+struct nss_cache_file {
+	struct winbindd_nss_cache_header *hdr;
+	size_t size;
+};
+
+static int nss_cache_file_destructor(struct nss_cache_file *f)
+{
+	munmap(f->hdr, f->size);
+	return 0;
+}
+
+static struct nss_cache_file *nss_cache_file_map(struct torture_context *torture)
+{
+	const char *dir = getenv("SELFTEST_WINBINDD_SOCKET_DIR");
+	struct nss_cache_file *f;
+	struct stat st;
+	char *path;
+	void *ptr;
+	int fd;
+	int ret;
+
+	if (dir == NULL) {
+		dir = lpcfg_winbindd_socket_directory(torture->lp_ctx);
+	}
+	path = talloc_asprintf(torture, "%s/%s", dir, WINBINDD_NSS_CACHE_NAME);
+	if (path == NULL) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDWR);
+	TALLOC_FREE(path);
+	if (fd == -1) {
+		return NULL;
+	}
+	ret = fstat(fd, &st);
+	if ((ret == -1) ||
+	    (st.st_size < sizeof(struct winbindd_nss_cache_header))) {
+		close(fd);
+		return NULL;
+	}
+	ptr = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	f = talloc_zero(torture, struct nss_cache_file);
+	if (f == NULL) {
+		munmap(ptr, st.st_size);
+		return NULL;
+	}
+	f->hdr = (struct winbindd_nss_cache_header *)ptr;
+	f->size = st.st_size;
+	talloc_set_destructor(f, nss_cache_file_destructor);
+
+	return f;
+}
+
+static struct winbindd_nss_cache_slot *nss_cache_file_slot(
+	struct nss_cache_file *f, int cmd,
+	const struct winbindd_request *req)
+{
+	uint8_t *slots = (uint8_t *)(f->hdr + 1);
+	char key[FSTRING_LEN];
+	uint32_t hash;
+	int key_len;
+	uint32_t i;
+
+	key_len = winbindd_nss_cache_key(cmd, req, key);
+	if (key_len == -1) {
+		return NULL;
+	}
+	hash = winbindd_nss_cache_hash(cmd, key, key_len);
+
+	for (i = 0; i < WINBINDD_NSS_CACHE_PROBES; i++) {
+		uint32_t idx = (hash + i) % f->hdr->num_slots;
+		struct winbindd_nss_cache_slot *slot =
+			(struct winbindd_nss_cache_slot *)(slots +
+			(size_t)idx * WINBINDD_NSS_CACHE_SLOT_SIZE);
+
+		if ((slot->cmd == cmd) && (slot->hash == hash) &&
+		    (slot->key_len == key_len) &&
+		    (memcmp(slot->key, key, key_len) == 0)) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+/* Change a cached passwd entry the way winbindd writes a slot */
+static void nss_cache_slot_set_gecos(struct winbindd_nss_cache_slot *slot,
+				     const char *gecos)
+{
+	slot->seqnum += 1;
+	WINBINDD_NSS_CACHE_BARRIER();
+	fstrcpy(slot->data.pw.pw_gecos, gecos);
+	WINBINDD_NSS_CACHE_BARRIER();
+	slot->seqnum += 1;
+}
+
+static bool nss_cache_getpwnam(struct torture_context *torture,
+			       struct winbindd_context *ctx,
+			       const char *name,
+			       struct winbindd_pw *pw)
+{
+	struct winbindd_request req;
+	struct winbindd_response rep;
+	NSS_STATUS status;
+
+	ZERO_STRUCT(req);
+	ZERO_STRUCT(rep);
+	fstrcpy(req.data.username, name);
+
+	status = winbindd_request_response(ctx, WINBINDD_GETPWNAM, &req, &rep);
+	torture_assert_int_equal(torture, status, NSS_STATUS_SUCCESS,
+				 talloc_asprintf(torture, "getpwnam(%s)", name));
+	*pw = rep.data.pw;
+	winbindd_free_response(&rep);
+	return true;
+}
+
+static bool torture_winbind_struct_nss_cache(struct torture_context *torture)
+{
+	struct winbindd_context *ctx;
+	struct winbindd_request req;
+	struct winbindd_response sock_rep, cache_rep;
+	struct winbindd_pw sock_pw, pw;
+	struct winbindd_nss_cache_slot *slot;
+	struct nss_cache_file *f;
+	char **users = NULL;
+	char **groups = NULL;
+	unsigned int num_groups;
+	const char *gecos = "nss cache test";
+	NSS_STATUS status;
+	bool ok = true;
+
+	ZERO_STRUCT(sock_rep);
+	ZERO_STRUCT(cache_rep);
+
+	f = nss_cache_file_map(torture);
+	if (f == NULL) {
+		torture_skip(torture, "winbindd does not publish an nss cache");
+	}
+
+	torture_assert(torture, get_user_list(torture, &users),
+		       "failed to get user list");
+	torture_assert(torture, users != NULL && users[0] != NULL,
+		       "no users");
+
+	ctx = winbindd_ctx_create();
+	torture_assert(torture, ctx != NULL, "winbindd_ctx_create failed");
+
+	/* the answer over the socket is published in the cache */
+	ok = nss_cache_getpwnam(torture, ctx, users[0], &sock_pw);
+	torture_assert_goto(torture, ok, ok, done, "getpwnam over the socket");
+
+	ZERO_STRUCT(req);
+	fstrcpy(req.data.username, users[0]);
+	slot = nss_cache_file_slot(f, WINBINDD_GETPWNAM, &req);
+	torture_assert_goto(torture, slot != NULL, ok, done,
+			    "getpwnam answer not in the cache");
+
+	ok = nss_cache_getpwnam(torture, NULL, users[0], &pw);
+	torture_assert_goto(torture, ok, ok, done, "getpwnam from the cache");
+	torture_assert_str_equal_goto(torture, pw.pw_name, sock_pw.pw_name,
+				      ok, done, "pw_name");
+	torture_assert_int_equal_goto(torture, pw.pw_uid, sock_pw.pw_uid,
+				      ok, done, "pw_uid");
+	torture_assert_int_equal_goto(torture, pw.pw_gid, sock_pw.pw_gid,
+				      ok, done, "pw_gid");
+	torture_assert_str_equal_goto(torture, pw.pw_gecos, sock_pw.pw_gecos,
+				      ok, done, "pw_gecos");
+	torture_assert_str_equal_goto(torture, pw.pw_dir, sock_pw.pw_dir,
+				      ok, done, "pw_dir");
+	torture_assert_str_equal_goto(torture, pw.pw_shell, sock_pw.pw_shell,
+				      ok, done, "pw_shell");
+
+	/* make sure that answer really came from the cache */
+	nss_cache_slot_set_gecos(slot, gecos);
+	ok = nss_cache_getpwnam(torture, NULL, users[0], &pw);
+	torture_assert_goto(torture, ok, ok, done, "getpwnam from the cache");
+	torture_assert_str_equal_goto(torture, pw.pw_gecos, gecos,
+				      ok, done, "not answered from the cache");
+
+	/*
+	 * A slot winbindd is writing must not be used. Finish the write
+	 * afterwards, winbindd storing the answer again keeps the
+	 * sequence number odd.
+	 */
+	slot->seqnum += 1;
+	WINBINDD_NSS_CACHE_BARRIER();
+	ok = nss_cache_getpwnam(torture, NULL, users[0], &pw);
+	WINBINDD_NSS_CACHE_BARRIER();
+	slot->seqnum += 1;
+	torture_assert_goto(torture, ok, ok, done, "getpwnam");
+	torture_assert_str_equal_goto(torture, pw.pw_gecos, sock_pw.pw_gecos,
+				      ok, done, "torn slot used");
+
+	/* neither may a file winbindd does not maintain anymore */
+	slot = nss_cache_file_slot(f, WINBINDD_GETPWNAM, &req);
+	torture_assert_goto(torture, slot != NULL, ok, done,
+			    "getpwnam answer not in the cache");
+	nss_cache_slot_set_gecos(slot, gecos);
+	f->hdr->valid = 0;
+	WINBINDD_NSS_CACHE_BARRIER();
+	ok = nss_cache_getpwnam(torture, NULL, users[0], &pw);
+	f->hdr->valid = 1;
+	torture_assert_goto(torture, ok, ok, done, "getpwnam");
+	torture_assert_str_equal_goto(torture, pw.pw_gecos, sock_pw.pw_gecos,
+				      ok, done, "old cache file used");
+
+	/* group entries carry their members in the extra data */
+	torture_assert_goto(torture,
+			    get_group_list(torture, &num_groups, &groups),
+			    ok, done, "failed to get group list");
+	if (num_groups == 0) {
+		goto done;
+	}
+
+	ZERO_STRUCT(req);
+	fstrcpy(req.data.groupname, groups[0]);
+
+	status = winbindd_request_response(ctx, WINBINDD_GETGRNAM, &req,
+					   &sock_rep);
+	torture_assert_int_equal_goto(torture, status, NSS_STATUS_SUCCESS,
+				      ok, done, "getgrnam over the socket");
+	torture_assert_goto(torture,
+			    nss_cache_file_slot(f, WINBINDD_GETGRNAM, &req)
+			    != NULL,
+			    ok, done, "getgrnam answer not in the cache");
+
+	status = winbindd_request_response(NULL, WINBINDD_GETGRNAM, &req,
+					   &cache_rep);
+	torture_assert_int_equal_goto(torture, status, NSS_STATUS_SUCCESS,
+				      ok, done, "getgrnam from the cache");
+	torture_assert_str_equal_goto(torture, cache_rep.data.gr.gr_name,
+				      sock_rep.data.gr.gr_name,
+				      ok, done, "gr_name");
+	torture_assert_int_equal_goto(torture, cache_rep.data.gr.gr_gid,
+				      sock_rep.data.gr.gr_gid,
+				      ok, done, "gr_gid");
+	torture_assert_int_equal_goto(torture, cache_rep.data.gr.num_gr_mem,
+				      sock_rep.data.gr.num_gr_mem,
+				      ok, done, "num_gr_mem");
+	torture_assert_int_equal_goto(torture, cache_rep.length,
+				      sock_rep.length, ok, done, "length");
+	if (sock_rep.length > sizeof(struct winbindd_response)) {
+		torture_assert_goto(torture,
+			memcmp(cache_rep.extra_data.data,
+			       sock_rep.extra_data.data,
+			       sock_rep.length -
+			       sizeof(struct winbindd_response)) == 0,
+			ok, done, "group members differ");
+	}
+
+done:
+	winbindd_free_response(&sock_rep);
+	winbindd_free_response(&cache_rep);
+	winbindd_ctx_free(ctx);
+	talloc_free(users);
+	talloc_free(groups);
+	return ok;
+}
+
+#endif /* WINBINDD_NSS_CACHE_BARRIER */
+
 struct torture_suite *torture_winbind_struct_init(void)
 {
 	struct torture_suite *suite = torture_suite_create(talloc_autofree_context(), "struct");
@@ -1096,6 +1373,9 @@ struct torture_suite *torture_winbind_struct_init(void)
 	torture_suite_add_simple_test(suite, "getpwent", torture_winbind_struct_getpwent);
 	torture_suite_add_simple_test(suite, "endpwent", torture_winbind_struct_endpwent);
 	torture_suite_add_simple_test(suite, "lookup_name_sid", torture_winbind_struct_lookup_name_sid);
+#ifdef WINBINDD_NSS_CACHE_BARRIER
+	torture_suite_add_simple_test(suite, "nss_cache", torture_winbind_struct_nss_cache);
+#endif
 
 	suite->description = talloc_strdup(suite, "WINBIND - struct based protocol tests");
 